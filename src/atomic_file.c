@@ -0,0 +1,41 @@
+#include "atomic_file.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int atomic_file_create(const char *path, char **temporary_path) {
+    size_t length = strlen(path);
+    *temporary_path = (char *) malloc(length + sizeof(".XXXXXX"));
+    if (*temporary_path == NULL) {
+        return -1;
+    }
+    memcpy(*temporary_path, path, length);
+    memcpy(*temporary_path + length, ".XXXXXX", sizeof(".XXXXXX"));
+
+    int fd = mkstemp(*temporary_path);
+    if (fd < 0) {
+        free(*temporary_path);
+        *temporary_path = NULL;
+        return -1;
+    }
+    // mkstemp only lets the owner read the file.
+    fchmod(fd, 0644);
+    return fd;
+}
+
+bool atomic_file_finish(char *temporary_path, const char *path, bool ok) {
+    if (!ok || rename(temporary_path, path) != 0) {
+        atomic_file_discard(temporary_path);
+        return false;
+    }
+    free(temporary_path);
+    return true;
+}
+
+void atomic_file_discard(char *temporary_path) {
+    unlink(temporary_path);
+    free(temporary_path);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Files replaced in one step: they are written under a temporary name next
+// to their destination, so the rename stays on one file system, and moved
+// over it only once complete. Readers never see a partially written file.
+
+// Creates the temporary file for path, readable by everyone, and returns its
+// descriptor. Sets temporary_path, to be passed on to atomic_file_finish or
+// atomic_file_discard. Returns -1, with temporary_path NULL, on failure.
+int  atomic_file_create(const char *path, char **temporary_path);
+// Moves the temporary file over path if ok, and discards it otherwise or if
+// it cannot be moved. The descriptor should be closed or synced first.
+// Returns whether path was replaced.
+bool atomic_file_finish(char *temporary_path, const char *path, bool ok);
+// Removes the temporary file and frees its path.
+void atomic_file_discard(char *temporary_path);
@@ -0,0 +1,268 @@
+#include "convert.h"
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#define USE_RINTERNALS
+#include <R.h>
+#include <Rinternals.h>
+
+#include "header.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+bool __storage_compatible(uint32_t storage, int type) {
+    switch (type) {
+    case INTSXP:
+        return storage == UFO_BIN_INT32
+            || storage == UFO_BIN_INT8  || storage == UFO_BIN_UINT8
+            || storage == UFO_BIN_INT16 || storage == UFO_BIN_UINT16;
+    case REALSXP:
+        return storage == UFO_BIN_FLOAT64
+            || storage == UFO_BIN_FLOAT32 || storage == UFO_BIN_UINT32;
+    case LGLSXP:
+        return storage == UFO_BIN_LOGICAL32 || storage == UFO_BIN_UINT8;
+    case CPLXSXP:
+        return storage == UFO_BIN_COMPLEX128;
+    case RAWSXP:
+        return storage == UFO_BIN_RAW8;
+    default:
+        return false;
+    }
+}
+
+bool __storage_is_native(uint32_t storage, int type) {
+    return storage == ufo_bin_dtype_from_sexptype(type);
+}
+
+// Element accessors go through memcpy, since in-place widening reads and
+// writes the same bytes through differently typed pointers.
+#define __ACCESSORS(type)                                                      \
+    static inline type __load_##type(const unsigned char *data, size_t i) {    \
+        type value;                                                            \
+        memcpy(&value, data + i * sizeof(type), sizeof(type));                 \
+        return value;                                                          \
+    }                                                                          \
+    static inline void __store_##type(unsigned char *data, size_t i, type value) { \
+        memcpy(data + i * sizeof(type), &value, sizeof(type));                 \
+    }
+
+__ACCESSORS(float)
+__ACCESSORS(double)
+__ACCESSORS(int8_t)
+__ACCESSORS(uint8_t)
+__ACCESSORS(int16_t)
+__ACCESSORS(uint16_t)
+__ACCESSORS(int32_t)
+__ACCESSORS(uint32_t)
+
+static inline double __float32_to_double(float value) {
+    if (isnan(value)) {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return bits == UFO_FLOAT32_NA_BITS ? NA_REAL : R_NaN;
+    }
+    return (double) value;
+}
+
+static void __widen_float32(const unsigned char *source, size_t count, unsigned char *target) {
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 4 <= count; i += 4) {
+        __m128 values = _mm_loadu_ps((const float *) (source + i * sizeof(float)));
+        if (_mm_movemask_ps(_mm_cmpunord_ps(values, values)) != 0) {
+            // NaNs need their payload checked for NA, do this block slowly.
+            for (size_t j = i; j < i + 4; j++) {
+                __store_double(target, j, __float32_to_double(__load_float(source, j)));
+            }
+            continue;
+        }
+        __m128d low = _mm_cvtps_pd(values);
+        __m128d high = _mm_cvtps_pd(_mm_movehl_ps(values, values));
+        _mm_storeu_pd((double *) (target + i * sizeof(double)), low);
+        _mm_storeu_pd((double *) (target + (i + 2) * sizeof(double)), high);
+    }
+#endif
+    for (; i < count; i++) {
+        __store_double(target, i, __float32_to_double(__load_float(source, i)));
+    }
+}
+
+static void __widen_uint32(const unsigned char *source, size_t count, unsigned char *target) {
+    for (size_t i = 0; i < count; i++) {
+        __store_double(target, i, (double) __load_uint32_t(source, i));
+    }
+}
+
+#ifdef __SSE2__
+// Replace lanes equal to na_in with NA_INTEGER.
+static inline __m128i __replace_na(__m128i values, __m128i na_in, __m128i na_out) {
+    __m128i mask = _mm_cmpeq_epi32(values, na_in);
+    return _mm_or_si128(_mm_and_si128(mask, na_out), _mm_andnot_si128(mask, values));
+}
+#endif
+
+static void __widen_int16(const unsigned char *source, size_t count, unsigned char *target, bool is_signed) {
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i na_in = _mm_set1_epi32(INT16_MIN);
+    const __m128i na_out = _mm_set1_epi32(NA_INTEGER);
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= count; i += 8) {
+        __m128i values = _mm_loadu_si128((const __m128i *) (source + i * sizeof(int16_t)));
+        __m128i low, high;
+        if (is_signed) {
+            low = _mm_srai_epi32(_mm_unpacklo_epi16(values, values), 16);
+            high = _mm_srai_epi32(_mm_unpackhi_epi16(values, values), 16);
+            low = __replace_na(low, na_in, na_out);
+            high = __replace_na(high, na_in, na_out);
+        } else {
+            low = _mm_unpacklo_epi16(values, zero);
+            high = _mm_unpackhi_epi16(values, zero);
+        }
+        _mm_storeu_si128((__m128i *) (target + i * sizeof(int32_t)), low);
+        _mm_storeu_si128((__m128i *) (target + (i + 4) * sizeof(int32_t)), high);
+    }
+#endif
+    for (; i < count; i++) {
+        if (is_signed) {
+            int16_t value = __load_int16_t(source, i);
+            __store_int32_t(target, i, value == INT16_MIN ? NA_INTEGER : value);
+        } else {
+            __store_int32_t(target, i, __load_uint16_t(source, i));
+        }
+    }
+}
+
+// Signed bytes map INT8_MIN to NA. Unsigned bytes have no NA, unless they
+// back a logical vector, in which case UFO_UINT8_LOGICAL_NA is NA.
+static void __widen_int8(const unsigned char *source, size_t count, unsigned char *target, bool is_signed, bool is_logical) {
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i na_in = _mm_set1_epi32(is_signed ? INT8_MIN : UFO_UINT8_LOGICAL_NA);
+    const __m128i na_out = _mm_set1_epi32(NA_INTEGER);
+    const __m128i zero = _mm_setzero_si128();
+    bool has_na = is_signed || is_logical;
+    for (; i + 16 <= count; i += 16) {
+        __m128i values = _mm_loadu_si128((const __m128i *) (source + i));
+        __m128i words[2], quads[4];
+        if (is_signed) {
+            words[0] = _mm_srai_epi16(_mm_unpacklo_epi8(values, values), 8);
+            words[1] = _mm_srai_epi16(_mm_unpackhi_epi8(values, values), 8);
+            for (int w = 0; w < 2; w++) {
+                quads[2 * w]     = _mm_srai_epi32(_mm_unpacklo_epi16(words[w], words[w]), 16);
+                quads[2 * w + 1] = _mm_srai_epi32(_mm_unpackhi_epi16(words[w], words[w]), 16);
+            }
+        } else {
+            words[0] = _mm_unpacklo_epi8(values, zero);
+            words[1] = _mm_unpackhi_epi8(values, zero);
+            for (int w = 0; w < 2; w++) {
+                quads[2 * w]     = _mm_unpacklo_epi16(words[w], zero);
+                quads[2 * w + 1] = _mm_unpackhi_epi16(words[w], zero);
+            }
+        }
+        for (int q = 0; q < 4; q++) {
+            __m128i result = has_na ? __replace_na(quads[q], na_in, na_out) : quads[q];
+            _mm_storeu_si128((__m128i *) (target + (i + 4 * q) * sizeof(int32_t)), result);
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        if (is_signed) {
+            int8_t value = __load_int8_t(source, i);
+            __store_int32_t(target, i, value == INT8_MIN ? NA_INTEGER : value);
+        } else {
+            uint8_t value = __load_uint8_t(source, i);
+            __store_int32_t(target, i, (is_logical && value == UFO_UINT8_LOGICAL_NA) ? NA_INTEGER : value);
+        }
+    }
+}
+
+void __widen(uint32_t storage, int type, const unsigned char *source, size_t count, unsigned char *target) {
+    switch (storage) {
+    case UFO_BIN_FLOAT32: __widen_float32(source, count, target);                           return;
+    case UFO_BIN_UINT32:  __widen_uint32(source, count, target);                            return;
+    case UFO_BIN_INT16:   __widen_int16(source, count, target, true);                       return;
+    case UFO_BIN_UINT16:  __widen_int16(source, count, target, false);                      return;
+    case UFO_BIN_INT8:    __widen_int8(source, count, target, true, false);                 return;
+    case UFO_BIN_UINT8:   __widen_int8(source, count, target, false, type == LGLSXP);       return;
+    default:
+        // Native storage, nothing to widen.
+        memmove(target, source, count * ufo_bin_dtype_size(storage));
+        return;
+    }
+}
+
+int64_t __narrow(uint32_t storage, int type, const unsigned char *source, size_t count, unsigned char *target) {
+    switch (storage) {
+    case UFO_BIN_FLOAT32: {
+        const double *values = (const double *) source;
+        for (size_t i = 0; i < count; i++) {
+            float value;
+            if (ISNA(values[i])) {
+                uint32_t bits = UFO_FLOAT32_NA_BITS;
+                memcpy(&value, &bits, sizeof(value));
+            } else if (isfinite(values[i]) && fabs(values[i]) > FLT_MAX) {
+                return i;
+            } else {
+                value = (float) values[i];
+            }
+            ((float *) target)[i] = value;
+        }
+        return -1;
+    }
+    case UFO_BIN_UINT32: {
+        const double *values = (const double *) source;
+        for (size_t i = 0; i < count; i++) {
+            if (!(values[i] >= 0 && values[i] <= UINT32_MAX) || values[i] != floor(values[i])) {
+                return i;
+            }
+            ((uint32_t *) target)[i] = (uint32_t) values[i];
+        }
+        return -1;
+    }
+    case UFO_BIN_INT16:
+    case UFO_BIN_INT8: {
+        // The smallest value of the signed type is reserved for NA.
+        const int *values = (const int *) source;
+        int limit = storage == UFO_BIN_INT16 ? INT16_MAX : INT8_MAX;
+        for (size_t i = 0; i < count; i++) {
+            int value = values[i];
+            if (value != NA_INTEGER && (value < -limit || value > limit)) {
+                return i;
+            }
+            if (storage == UFO_BIN_INT16) {
+                ((int16_t *) target)[i] = value == NA_INTEGER ? INT16_MIN : value;
+            } else {
+                ((int8_t *) target)[i] = value == NA_INTEGER ? INT8_MIN : value;
+            }
+        }
+        return -1;
+    }
+    case UFO_BIN_UINT16:
+    case UFO_BIN_UINT8: {
+        const int *values = (const int *) source;
+        int limit = storage == UFO_BIN_UINT16 ? UINT16_MAX : UINT8_MAX;
+        for (size_t i = 0; i < count; i++) {
+            int value = values[i];
+            if (type == LGLSXP) {
+                value = (value == NA_LOGICAL) ? UFO_UINT8_LOGICAL_NA : (value != 0);
+            } else if (value == NA_INTEGER || value < 0 || value > limit) {
+                return i;
+            }
+            if (storage == UFO_BIN_UINT16) {
+                ((uint16_t *) target)[i] = value;
+            } else {
+                ((uint8_t *) target)[i] = value;
+            }
+        }
+        return -1;
+    }
+    default:
+        memcpy(target, source, count * ufo_bin_dtype_size(storage));
+        return -1;
+    }
+}
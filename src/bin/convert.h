@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Conversions between the element type stored in a file (a ufo_bin_dtype_t)
+// and the type of the R vector it backs (a SEXPTYPE). Narrow storage types
+// map their NA sentinels to R's NA and back:
+//
+//   int8, int16  -> integer  (INT8_MIN, INT16_MIN are NA)
+//   uint8        -> integer  (no NA)
+//   uint8        -> logical  (0 is FALSE, 1 is TRUE, 255 is NA)
+//   uint16       -> integer  (no NA)
+//   uint32       -> double   (no NA)
+//   float32      -> double   (NaN with UFO_FLOAT32_NA_BITS is NA)
+
+#define UFO_FLOAT32_NA_BITS 0x7FA207A2u
+#define UFO_UINT8_LOGICAL_NA 255
+
+// Whether a vector of the given type can be backed by the given storage.
+bool __storage_compatible(uint32_t storage, int type);
+
+// Whether reading the storage needs a conversion at all.
+bool __storage_is_native(uint32_t storage, int type);
+
+/**
+ * Widen count elements from storage to the type of the vector.
+ *
+ * The source may alias the target, as long as it sits at the tail of the
+ * target's count * element_size bytes: every block of elements is loaded
+ * before its widened values are stored, and those never reach past the
+ * source elements that are yet to be converted. This lets populate read the
+ * narrow data straight into the target area and widen it in place.
+ */
+void __widen(uint32_t storage, int type, const unsigned char *source, size_t count, unsigned char *target);
+
+/**
+ * Narrow count elements of a vector of the given type into storage. Source
+ * and target must not overlap.
+ *
+ * @return -1 if all elements were converted, otherwise the index of the
+ *         first element that cannot be represented in storage.
+ */
+int64_t __narrow(uint32_t storage, int type, const unsigned char *source, size_t count, unsigned char *target);
@@ -0,0 +1,369 @@
+#include "header.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define USE_RINTERNALS
+#include <R.h>
+#include <Rinternals.h>
+
+#include "io.h"
+#include "convert.h"
+
+const char *ufo_bin_status_message(ufo_bin_status_t status) {
+    switch (status) {
+    case UFO_BIN_OK:             return "ok";
+    case UFO_BIN_NO_HEADER:      return "file has no header";
+    case UFO_BIN_IO_ERROR:       return "could not read or write header";
+    case UFO_BIN_BAD_VERSION:    return "unsupported header version";
+    case UFO_BIN_BAD_ENDIANNESS: return "file was written with a different byte order";
+    case UFO_BIN_CORRUPT:        return "header is corrupt";
+    case UFO_BIN_OUT_OF_MEMORY:  return "cannot allocate memory for header";
+    default:                     return "unknown error";
+    }
+}
+
+uint32_t ufo_bin_dtype_from_sexptype(int sexptype) {
+    switch (sexptype) {
+    case INTSXP:  return UFO_BIN_INT32;
+    case REALSXP: return UFO_BIN_FLOAT64;
+    case CPLXSXP: return UFO_BIN_COMPLEX128;
+    case LGLSXP:  return UFO_BIN_LOGICAL32;
+    case RAWSXP:  return UFO_BIN_RAW8;
+    default:      return 0;
+    }
+}
+
+int ufo_bin_sexptype_from_dtype(uint32_t dtype) {
+    switch (dtype) {
+    case UFO_BIN_INT32:      return INTSXP;
+    case UFO_BIN_FLOAT64:    return REALSXP;
+    case UFO_BIN_COMPLEX128: return CPLXSXP;
+    case UFO_BIN_LOGICAL32:  return LGLSXP;
+    case UFO_BIN_RAW8:       return RAWSXP;
+    case UFO_BIN_INT8:       return INTSXP;
+    case UFO_BIN_UINT8:      return INTSXP;
+    case UFO_BIN_INT16:      return INTSXP;
+    case UFO_BIN_UINT16:     return INTSXP;
+    case UFO_BIN_UINT32:     return REALSXP;
+    case UFO_BIN_FLOAT32:    return REALSXP;
+    default:                 return 0;
+    }
+}
+
+size_t ufo_bin_dtype_size(uint32_t dtype) {
+    switch (dtype) {
+    case UFO_BIN_INT32:      return sizeof(int32_t);
+    case UFO_BIN_FLOAT64:    return sizeof(double);
+    case UFO_BIN_COMPLEX128: return 2 * sizeof(double);
+    case UFO_BIN_LOGICAL32:  return sizeof(int32_t);
+    case UFO_BIN_RAW8:       return sizeof(uint8_t);
+    case UFO_BIN_INT8:       return sizeof(int8_t);
+    case UFO_BIN_UINT8:      return sizeof(uint8_t);
+    case UFO_BIN_INT16:      return sizeof(int16_t);
+    case UFO_BIN_UINT16:     return sizeof(uint16_t);
+    case UFO_BIN_UINT32:     return sizeof(uint32_t);
+    case UFO_BIN_FLOAT32:    return sizeof(float);
+    default:                 return 0;
+    }
+}
+
+static const struct { uint32_t dtype; const char *name; } __dtype_names[] = {
+    { UFO_BIN_INT32,      "int32"      },
+    { UFO_BIN_FLOAT64,    "float64"    },
+    { UFO_BIN_COMPLEX128, "complex128" },
+    { UFO_BIN_LOGICAL32,  "logical32"  },
+    { UFO_BIN_RAW8,       "raw8"       },
+    { UFO_BIN_INT8,       "int8"       },
+    { UFO_BIN_UINT8,      "uint8"      },
+    { UFO_BIN_INT16,      "int16"      },
+    { UFO_BIN_UINT16,     "uint16"     },
+    { UFO_BIN_UINT32,     "uint32"     },
+    { UFO_BIN_FLOAT32,    "float32"    },
+};
+
+uint32_t ufo_bin_dtype_from_name(const char *name) {
+    for (size_t i = 0; i < sizeof(__dtype_names) / sizeof(__dtype_names[0]); i++) {
+        if (0 == strcmp(__dtype_names[i].name, name)) {
+            return __dtype_names[i].dtype;
+        }
+    }
+    return 0;
+}
+
+const char *ufo_bin_dtype_name(uint32_t dtype) {
+    for (size_t i = 0; i < sizeof(__dtype_names) / sizeof(__dtype_names[0]); i++) {
+        if (__dtype_names[i].dtype == dtype) {
+            return __dtype_names[i].name;
+        }
+    }
+    return NULL;
+}
+
+static bool __dtype_has_stats(uint32_t dtype) {
+    return dtype != UFO_BIN_COMPLEX128 && ufo_bin_dtype_size(dtype) != 0;
+}
+
+static bool __dtype_na_sentinel(uint32_t dtype, uint64_t *sentinel) {
+    switch (dtype) {
+    case UFO_BIN_INT32:
+    case UFO_BIN_LOGICAL32: {
+        uint32_t bits;
+        int32_t na = NA_INTEGER;
+        memcpy(&bits, &na, sizeof(bits));
+        *sentinel = bits;
+        return true;
+    }
+    case UFO_BIN_FLOAT64:
+    case UFO_BIN_COMPLEX128: {
+        double na = NA_REAL;
+        memcpy(sentinel, &na, sizeof(*sentinel));
+        return true;
+    }
+    case UFO_BIN_INT8:
+        *sentinel = (uint8_t) INT8_MIN;
+        return true;
+    case UFO_BIN_INT16:
+        *sentinel = (uint16_t) INT16_MIN;
+        return true;
+    case UFO_BIN_FLOAT32:
+        *sentinel = UFO_FLOAT32_NA_BITS;
+        return true;
+    default:
+        return false;
+    }
+}
+
+size_t ufo_bin_metadata_size(uint32_t dimensions_length, uint64_t chunk_count) {
+    return sizeof(ufo_bin_header_t)
+         + dimensions_length * sizeof(int64_t)
+         + chunk_count * 2 * sizeof(double);
+}
+
+static uint64_t __align_up(uint64_t value, uint64_t alignment) {
+    return ((value + alignment - 1) / alignment) * alignment;
+}
+
+ufo_bin_status_t ufo_bin_metadata_init(ufo_bin_metadata_t *metadata, uint32_t dtype,
+                                       int type, uint64_t element_count,
+                                       const int64_t *dimensions, uint32_t dimensions_length,
+                                       uint64_t chunk_length) {
+
+    memset(metadata, 0, sizeof(ufo_bin_metadata_t));
+    ufo_bin_header_t *header = &metadata->header;
+
+    memcpy(header->magic, UFO_BIN_MAGIC, UFO_BIN_MAGIC_LENGTH);
+    header->version = UFO_BIN_VERSION;
+    header->dtype = dtype;
+    header->endianness = UFO_BIN_ENDIANNESS;
+    header->element_size = ufo_bin_dtype_size(dtype);
+    header->element_count = element_count;
+    header->dimensions_length = dimensions_length;
+
+    if (type == LGLSXP && dtype == UFO_BIN_UINT8) {
+        header->flags |= UFO_BIN_LOGICAL | UFO_BIN_HAS_NA;
+        header->na_sentinel = UFO_UINT8_LOGICAL_NA;
+    } else if (__dtype_na_sentinel(dtype, &header->na_sentinel)) {
+        header->flags |= UFO_BIN_HAS_NA;
+    }
+
+    if (chunk_length > 0 && __dtype_has_stats(dtype)) {
+        header->flags |= UFO_BIN_HAS_STATS;
+        header->chunk_length = chunk_length;
+        header->chunk_count = (element_count + chunk_length - 1) / chunk_length;
+    }
+
+    metadata->dimensions = (int64_t *) malloc(sizeof(int64_t) * (dimensions_length ? dimensions_length : 1));
+    if (metadata->dimensions == NULL) {
+        return UFO_BIN_OUT_OF_MEMORY;
+    }
+    memcpy(metadata->dimensions, dimensions, sizeof(int64_t) * dimensions_length);
+
+    if (header->chunk_count > 0) {
+        metadata->chunk_min = (double *) malloc(sizeof(double) * header->chunk_count);
+        metadata->chunk_max = (double *) malloc(sizeof(double) * header->chunk_count);
+        if (metadata->chunk_min == NULL || metadata->chunk_max == NULL) {
+            ufo_bin_metadata_free(metadata);
+            return UFO_BIN_OUT_OF_MEMORY;
+        }
+        for (uint64_t i = 0; i < header->chunk_count; i++) {
+            metadata->chunk_min[i] = NAN;
+            metadata->chunk_max[i] = NAN;
+        }
+    }
+
+    header->data_offset = __align_up(ufo_bin_metadata_size(dimensions_length, header->chunk_count),
+                                     UFO_BIN_ALIGNMENT);
+    return UFO_BIN_OK;
+}
+
+ufo_bin_status_t ufo_bin_metadata_set_tiles(ufo_bin_metadata_t *metadata, uint64_t tile_rows, uint64_t tile_cols) {
+    ufo_bin_header_t *header = &metadata->header;
+    if (header->dimensions_length != 2 || tile_rows == 0 || tile_cols == 0 || header->chunk_count != 0) {
+        return UFO_BIN_CORRUPT;
+    }
+    header->flags |= UFO_BIN_TILED;
+    header->tile_rows = tile_rows;
+    header->tile_cols = tile_cols;
+    return UFO_BIN_OK;
+}
+
+uint64_t ufo_bin_payload_size(const ufo_bin_metadata_t *metadata) {
+    const ufo_bin_header_t *header = &metadata->header;
+    if (!(header->flags & UFO_BIN_TILED)) {
+        return header->element_count * header->element_size;
+    }
+    // Tiles on the bottom and right edges are padded to full size.
+    uint64_t tiles_down = (metadata->dimensions[0] + header->tile_rows - 1) / header->tile_rows;
+    uint64_t tiles_across = (metadata->dimensions[1] + header->tile_cols - 1) / header->tile_cols;
+    return tiles_down * tiles_across * header->tile_rows * header->tile_cols * header->element_size;
+}
+
+#define __RANGE(element_type, is_na) {                     \
+        const element_type *v = (const element_type *) values; \
+        for (uint64_t i = 0; i < count; i++) {                 \
+            if (is_na) continue;                               \
+            if (v[i] < lo) lo = v[i];                          \
+            if (v[i] > hi) hi = v[i];                          \
+        }                                                      \
+        break;                                                 \
+    }
+
+// Min and max ignore NAs. A chunk with only NAs keeps NaN for both.
+static void __chunk_stats(uint32_t dtype, bool logical, const void *values, uint64_t count, double *min, double *max) {
+    double lo = INFINITY, hi = -INFINITY;
+    switch (dtype) {
+    case UFO_BIN_INT32:
+    case UFO_BIN_LOGICAL32: __RANGE(int32_t,  v[i] == NA_INTEGER)
+    case UFO_BIN_FLOAT64:   __RANGE(double,   isnan(v[i]))
+    case UFO_BIN_RAW8:      __RANGE(uint8_t,  false)
+    case UFO_BIN_INT8:      __RANGE(int8_t,   v[i] == INT8_MIN)
+    case UFO_BIN_UINT8:     __RANGE(uint8_t,  logical && v[i] == UFO_UINT8_LOGICAL_NA)
+    case UFO_BIN_INT16:     __RANGE(int16_t,  v[i] == INT16_MIN)
+    case UFO_BIN_UINT16:    __RANGE(uint16_t, false)
+    case UFO_BIN_UINT32:    __RANGE(uint32_t, false)
+    case UFO_BIN_FLOAT32:   __RANGE(float,    isnan(v[i]))
+    }
+    *min = (lo > hi) ? NAN : lo;
+    *max = (lo > hi) ? NAN : hi;
+}
+
+#undef __RANGE
+
+void ufo_bin_update_stats(ufo_bin_metadata_t *metadata, uint64_t start, uint64_t count, const void *values) {
+    const ufo_bin_header_t *header = &metadata->header;
+    if (!(header->flags & UFO_BIN_HAS_STATS)) {
+        return;
+    }
+
+    const unsigned char *bytes = (const unsigned char *) values;
+    for (uint64_t offset = 0; offset < count; offset += header->chunk_length) {
+        uint64_t chunk = (start + offset) / header->chunk_length;
+        uint64_t length = count - offset < header->chunk_length ? count - offset : header->chunk_length;
+        __chunk_stats(header->dtype, (header->flags & UFO_BIN_LOGICAL) != 0, bytes + offset * header->element_size, length,
+                      &metadata->chunk_min[chunk], &metadata->chunk_max[chunk]);
+    }
+}
+
+ufo_bin_status_t ufo_bin_write_metadata(int fd, const ufo_bin_metadata_t *metadata) {
+    const ufo_bin_header_t *header = &metadata->header;
+
+    // The padding is written out as well, so the payload starts at
+    // data_offset even if the file is written sequentially afterwards.
+    unsigned char *buffer = (unsigned char *) calloc(header->data_offset, 1);
+    if (buffer == NULL) {
+        return UFO_BIN_OUT_OF_MEMORY;
+    }
+
+    size_t cursor = 0;
+    memcpy(buffer + cursor, header, sizeof(ufo_bin_header_t));
+    cursor += sizeof(ufo_bin_header_t);
+    memcpy(buffer + cursor, metadata->dimensions, header->dimensions_length * sizeof(int64_t));
+    cursor += header->dimensions_length * sizeof(int64_t);
+    if (header->chunk_count > 0) {
+        memcpy(buffer + cursor, metadata->chunk_min, header->chunk_count * sizeof(double));
+        cursor += header->chunk_count * sizeof(double);
+        memcpy(buffer + cursor, metadata->chunk_max, header->chunk_count * sizeof(double));
+    }
+
+    ssize_t written = __pwrite_fully(fd, buffer, header->data_offset, 0);
+    free(buffer);
+
+    if (written < 0 || (size_t) written < header->data_offset) {
+        return UFO_BIN_IO_ERROR;
+    }
+    return UFO_BIN_OK;
+}
+
+ufo_bin_status_t ufo_bin_read_metadata(int fd, ufo_bin_metadata_t *metadata) {
+    memset(metadata, 0, sizeof(ufo_bin_metadata_t));
+    ufo_bin_header_t *header = &metadata->header;
+
+    ssize_t read = __pread_fully(fd, (unsigned char *) header, sizeof(ufo_bin_header_t), 0);
+    if (read < 0) {
+        return UFO_BIN_IO_ERROR;
+    }
+    if ((size_t) read < UFO_BIN_MAGIC_LENGTH || 0 != memcmp(header->magic, UFO_BIN_MAGIC, UFO_BIN_MAGIC_LENGTH)) {
+        return UFO_BIN_NO_HEADER;
+    }
+    if ((size_t) read < sizeof(ufo_bin_header_t)) {
+        return UFO_BIN_CORRUPT;
+    }
+    if (header->endianness != UFO_BIN_ENDIANNESS) {
+        return UFO_BIN_BAD_ENDIANNESS;
+    }
+    if (header->version != UFO_BIN_VERSION) {
+        return UFO_BIN_BAD_VERSION;
+    }
+
+    size_t metadata_size = ufo_bin_metadata_size(header->dimensions_length, header->chunk_count);
+    if (header->element_size == 0
+        || header->element_size != ufo_bin_dtype_size(header->dtype)
+        || header->data_offset % UFO_BIN_ALIGNMENT != 0
+        || header->data_offset < metadata_size
+        || ((header->flags & UFO_BIN_HAS_STATS) && header->chunk_length == 0)
+        || ((header->flags & UFO_BIN_TILED) && (header->dimensions_length != 2 || header->tile_rows == 0
+                                                || header->tile_cols == 0 || header->chunk_count != 0))) {
+        return UFO_BIN_CORRUPT;
+    }
+
+    metadata->dimensions = (int64_t *) malloc(sizeof(int64_t) * (header->dimensions_length ? header->dimensions_length : 1));
+    if (metadata->dimensions == NULL) {
+        return UFO_BIN_OUT_OF_MEMORY;
+    }
+
+    size_t cursor = sizeof(ufo_bin_header_t);
+    size_t dimensions_bytes = header->dimensions_length * sizeof(int64_t);
+    if (__pread_fully(fd, (unsigned char *) metadata->dimensions, dimensions_bytes, cursor) != (ssize_t) dimensions_bytes) {
+        ufo_bin_metadata_free(metadata);
+        return UFO_BIN_CORRUPT;
+    }
+    cursor += dimensions_bytes;
+
+    if (header->chunk_count > 0) {
+        size_t stats_bytes = header->chunk_count * sizeof(double);
+        metadata->chunk_min = (double *) malloc(stats_bytes);
+        metadata->chunk_max = (double *) malloc(stats_bytes);
+        if (metadata->chunk_min == NULL || metadata->chunk_max == NULL) {
+            ufo_bin_metadata_free(metadata);
+            return UFO_BIN_OUT_OF_MEMORY;
+        }
+        if (__pread_fully(fd, (unsigned char *) metadata->chunk_min, stats_bytes, cursor) != (ssize_t) stats_bytes
+            || __pread_fully(fd, (unsigned char *) metadata->chunk_max, stats_bytes, cursor + stats_bytes) != (ssize_t) stats_bytes) {
+            ufo_bin_metadata_free(metadata);
+            return UFO_BIN_CORRUPT;
+        }
+    }
+
+    return UFO_BIN_OK;
+}
+
+void ufo_bin_metadata_free(ufo_bin_metadata_t *metadata) {
+    free(metadata->dimensions);
+    free(metadata->chunk_min);
+    free(metadata->chunk_max);
+    metadata->dimensions = NULL;
+    metadata->chunk_min = NULL;
+    metadata->chunk_max = NULL;
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Self-describing binary vector files:
+//
+//   [ufo_bin_header_t][dimensions: int64 x dimensions_length]
+//   [chunk statistics: (double min, double max) x chunk_count]
+//   [padding up to data_offset][payload]
+//
+// The data offset is aligned to UFO_BIN_ALIGNMENT, so the payload can be
+// mapped directly. All header fields are in the byte order of the writer;
+// the endianness field tells whether that matches the reader's.
+
+#define UFO_BIN_MAGIC          "\x89UFOBIN\n"
+#define UFO_BIN_MAGIC_LENGTH   8
+#define UFO_BIN_VERSION        1
+#define UFO_BIN_ENDIANNESS     0x01020304u
+#define UFO_BIN_ALIGNMENT      4096
+
+// Element types of the payload, independent of R's SEXPTYPE numbering. The
+// narrow types are widened to R types when read, see convert.h.
+typedef enum {
+    UFO_BIN_INT32      = 1,
+    UFO_BIN_FLOAT64    = 2,
+    UFO_BIN_COMPLEX128 = 3,
+    UFO_BIN_LOGICAL32  = 4,
+    UFO_BIN_RAW8       = 5,
+    UFO_BIN_INT8       = 6,
+    UFO_BIN_UINT8      = 7,
+    UFO_BIN_INT16      = 8,
+    UFO_BIN_UINT16     = 9,
+    UFO_BIN_UINT32     = 10,
+    UFO_BIN_FLOAT32    = 11,
+} ufo_bin_dtype_t;
+
+typedef enum {
+    UFO_BIN_HAS_NA    = 1 << 0, // na_sentinel holds the bit pattern of NA
+    UFO_BIN_HAS_STATS = 1 << 1, // per-chunk min/max follow the dimensions
+    UFO_BIN_LOGICAL   = 1 << 2, // narrow payload holds a logical vector
+    UFO_BIN_TILED     = 1 << 3, // matrix payload is stored in tiles, see tiles.h
+} ufo_bin_flags_t;
+
+typedef struct {
+    char     magic[UFO_BIN_MAGIC_LENGTH];
+    uint32_t version;
+    uint32_t dtype;             /* ufo_bin_dtype_t */
+    uint32_t endianness;        /* UFO_BIN_ENDIANNESS as seen by the writer */
+    uint32_t flags;             /* ufo_bin_flags_t */
+    uint32_t element_size;      /* in bytes */
+    uint32_t dimensions_length;
+    uint64_t element_count;
+    uint64_t data_offset;       /* in bytes, multiple of UFO_BIN_ALIGNMENT */
+    uint64_t chunk_length;      /* elements per statistics chunk */
+    uint64_t chunk_count;
+    uint64_t na_sentinel;
+    uint64_t tile_rows;         /* only with UFO_BIN_TILED, zero otherwise */
+    uint64_t tile_cols;         /* only with UFO_BIN_TILED, zero otherwise */
+    uint64_t reserved[2];       /* zero, for future extensions */
+} ufo_bin_header_t;
+
+typedef struct {
+    ufo_bin_header_t header;
+    int64_t         *dimensions; /* dimensions_length entries */
+    double          *chunk_min;  /* chunk_count entries, NULL without stats */
+    double          *chunk_max;  /* chunk_count entries, NULL without stats */
+} ufo_bin_metadata_t;
+
+typedef enum {
+    UFO_BIN_OK = 0,
+    UFO_BIN_NO_HEADER,          // file does not start with the magic
+    UFO_BIN_IO_ERROR,
+    UFO_BIN_BAD_VERSION,
+    UFO_BIN_BAD_ENDIANNESS,
+    UFO_BIN_CORRUPT,
+    UFO_BIN_OUT_OF_MEMORY,
+} ufo_bin_status_t;
+
+const char *ufo_bin_status_message(ufo_bin_status_t status);
+
+// Conversions between R vector types and payload element types. Return 0 if
+// there is no counterpart. Narrow types map to the R type they widen to by
+// default.
+uint32_t ufo_bin_dtype_from_sexptype(int sexptype);
+int ufo_bin_sexptype_from_dtype(uint32_t dtype);
+size_t ufo_bin_dtype_size(uint32_t dtype);
+
+// Storage type names as used in the R interface ("int8", "float32", ...).
+// Return 0 or NULL if the name or type is not known.
+uint32_t ufo_bin_dtype_from_name(const char *name);
+const char *ufo_bin_dtype_name(uint32_t dtype);
+
+// Number of header bytes before padding, for a header with the given
+// dimensions and chunk count.
+size_t ufo_bin_metadata_size(uint32_t dimensions_length, uint64_t chunk_count);
+
+/**
+ * Prepare metadata for a payload of element_count elements of the given
+ * storage type, holding an R vector of the given type.
+ * If chunk_length is not zero and the type supports it, space is reserved for
+ * per-chunk statistics, which are then filled in by ufo_bin_update_stats.
+ */
+ufo_bin_status_t ufo_bin_metadata_init(ufo_bin_metadata_t *metadata, uint32_t dtype,
+                                       int type, uint64_t element_count,
+                                       const int64_t *dimensions, uint32_t dimensions_length,
+                                       uint64_t chunk_length);
+
+/**
+ * Mark a two-dimensional payload as stored in tiles of the given size.
+ * Tiled payloads carry no chunk statistics.
+ */
+ufo_bin_status_t ufo_bin_metadata_set_tiles(ufo_bin_metadata_t *metadata, uint64_t tile_rows, uint64_t tile_cols);
+
+// Number of payload bytes following the data offset.
+uint64_t ufo_bin_payload_size(const ufo_bin_metadata_t *metadata);
+
+/**
+ * Compute statistics of the elements [start, start + count) of the payload,
+ * which are passed in as values. The range must start at a chunk boundary.
+ */
+void ufo_bin_update_stats(ufo_bin_metadata_t *metadata, uint64_t start, uint64_t count, const void *values);
+
+/**
+ * Write the metadata to the start of the file, padded up to the data offset.
+ */
+ufo_bin_status_t ufo_bin_write_metadata(int fd, const ufo_bin_metadata_t *metadata);
+
+/**
+ * Read the metadata from the start of a file. Returns UFO_BIN_NO_HEADER for
+ * plain binary files, which are then read as headerless payloads.
+ */
+ufo_bin_status_t ufo_bin_read_metadata(int fd, ufo_bin_metadata_t *metadata);
+
+void ufo_bin_metadata_free(ufo_bin_metadata_t *metadata);
@@ -6,12 +6,127 @@
 
 #include "../ufo_metadata.h"
 #include "../debug.h"
-
+#include "../atomic_file.h"
+#include "prefetch.h"
+#include "header.h"
+#include "convert.h"
+#include "writeback.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 
+ssize_t __pread_fully(int fd, unsigned char *target, size_t size, off_t offset) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t result = pread(fd, target + done, size - done, offset + done);
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (result == 0) {
+            break; // EOF
+        }
+        done += result;
+    }
+    return done;
+}
+
+ssize_t __pwrite_fully(int fd, const unsigned char *contents, size_t size, off_t offset) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t result = pwrite(fd, contents + done, size - done, offset + done);
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        done += result;
+    }
+    return done;
+}
+
+int32_t __read_range_from_file(void* user_data, uintptr_t start, uintptr_t end, unsigned char* target) {
+
+    ufo_file_source_data_t* cfg = (ufo_file_source_data_t*) user_data;
+
+    size_t payload_size = cfg->file_size - cfg->data_offset;
+
+    size_t start_reading_from = cfg->storage_size * start;
+    if (start_reading_from > payload_size) {
+        return 42;
+    }
+
+    size_t end_reading_at = cfg->storage_size * end;
+    if (end_reading_at > payload_size || end_reading_at < start_reading_from) {
+        return 43;
+    }
+
+    size_t bytes_to_read = end_reading_at - start_reading_from;
+    bool native = cfg->storage_size == cfg->element_size;
+
+    if (cfg->io_mode == UFO_IO_MMAP) {
+        if (native) {
+            memcpy(target, cfg->mapping + start_reading_from, bytes_to_read);
+        } else {
+            __widen(cfg->storage, cfg->vector_type, cfg->mapping + start_reading_from, end - start, target);
+        }
+        return 0;
+    }
+
+    // Narrow elements are read into the tail of the target and widened in
+    // place towards its start.
+    unsigned char *buffer = target + (end - start) * cfg->element_size - bytes_to_read;
+
+    // Positional read: does not touch a shared file cursor, so concurrent
+    // populates of the same vector do not interfere with each other.
+    ssize_t read_status = __pread_fully(cfg->file_descriptor, buffer, bytes_to_read, cfg->data_offset + start_reading_from);
+    if (read_status < 0 || (size_t) read_status < bytes_to_read) {
+        return 44;
+    }
+
+    if (!native) {
+        __widen(cfg->storage, cfg->vector_type, buffer, end - start, target);
+    }
+
+    return 0;
+}
+
+int32_t __read_range_through_queue(void* user_data, uintptr_t start, uintptr_t end, unsigned char* target) {
+    ufo_file_source_data_t* cfg = (ufo_file_source_data_t*) user_data;
+    if (cfg->writeback_queue == NULL) {
+        return __read_range_from_file(user_data, start, end, target);
+    }
+    return writeback_queue_read(cfg->writeback_queue, &__read_range_from_file, user_data, start, end, target);
+}
+
+// With a mapping there is nothing to read ahead into, so ask the kernel to
+// start paging in the ranges that follow a sequential populate instead.
+static void __advise_read_ahead(ufo_file_source_data_t* cfg, uintptr_t start, uintptr_t end) {
+    // Populates run concurrently, so the expected start is swapped atomically.
+    bool sequential = (start == atomic_exchange(&cfg->expected_start, end));
+    if (!sequential || cfg->mapping == NULL || end <= start) {
+        return;
+    }
+
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    size_t from = (cfg->storage_size * end) & ~(page_size - 1);
+    size_t to = cfg->storage_size * (end + (end - start) * cfg->prefetch_depth);
+    if (to > cfg->mapping_size) {
+        to = cfg->mapping_size;
+    }
+    if (from < to) {
+        madvise(cfg->mapping + from, to - from, MADV_WILLNEED);
+    }
+}
+
 int32_t __load_from_file(void* user_data, uintptr_t start, uintptr_t end, unsigned char* target) {
 
     ufo_file_source_data_t* cfg = (ufo_file_source_data_t*) user_data;
@@ -25,48 +140,101 @@ int32_t __load_from_file(void* user_data, uintptr_t start, uintptr_t end, unsign
         REprintf("    vector type: %d\n", cfg->vector_type);
         REprintf("    vector size: %li\n", cfg->vector_size);
         REprintf("   element size: %li\n", cfg->element_size);
+        REprintf("        io mode: %s\n", cfg->io_mode == UFO_IO_MMAP ? "mmap" : "read");
+        REprintf("        storage: %s\n", ufo_bin_dtype_name(cfg->storage));
+        REprintf(" prefetch depth: %li\n", cfg->prefetch_depth);
+    }
+
+    int32_t result;
+    if (cfg->prefetcher != NULL && prefetcher_take(cfg->prefetcher, start, end, target)) {
+        result = 0;
+    } else {
+        result = __read_range_through_queue(user_data, start, end, target);
+    }
+
+    switch (result) {
+    case 42: REprintf("Start index out of bounds of the file.\n"); return result;
+    case 43: REprintf("End index out of bounds of the file.\n"); return result;
+    case 44: REprintf("Read failed.\n"); return result;
     }
 
-    int initial_seek_status = fseek(cfg->file_handle, 0L, SEEK_END);
-    if (initial_seek_status < 0) {
-        // Could not seek in from file.
-        REprintf("Could not seek to the end of file.\n");
-        return 1;
+    if (cfg->prefetcher != NULL) {
+        prefetcher_advance(cfg->prefetcher, start, end);
+    } else if (cfg->prefetch_depth > 0) {
+        __advise_read_ahead(cfg, start, end);
     }
 
-    long file_size_in_bytes = ftell(cfg->file_handle);
+    return 0;
+}
+
+int32_t __write_range_to_file(void* user_data, uintptr_t start, uintptr_t end, const unsigned char* contents) {
 
-    long start_reading_from = cfg->element_size * start;
-    if (start_reading_from > file_size_in_bytes) {
-        // Start index out of bounds of the file.
-        REprintf("Start index out of bounds of the file.\n");
+    ufo_file_source_data_t* cfg = (ufo_file_source_data_t*) user_data;
+
+    if (cfg->write_file_descriptor < 0) {
+        return -1;
+    }
+
+    size_t payload_size = cfg->file_size - cfg->data_offset;
+
+    size_t start_writing_from = cfg->storage_size * start;
+    if (start_writing_from > payload_size) {
         return 42;
     }
 
-    long end_reading_at = cfg->element_size * end;
-    if (end_reading_at > file_size_in_bytes) {
-        // End index out of bounds of the file.
-        REprintf("End index out of bounds of the file.\n");
+    size_t end_writing_at = cfg->storage_size * end;
+    if (end_writing_at > payload_size || end_writing_at < start_writing_from) {
         return 43;
     }
 
-    int rewind_seek_status = fseek(cfg->file_handle, start_reading_from, SEEK_SET);
-    if (rewind_seek_status < 0) {
-        // Could not seek in the file to position at start index.
-        REprintf("Could not seek in the file to position at start index.\n");
-        return 2;
+    // The per-chunk statistics in the header no longer describe the payload
+    // once it is modified, so mark them as absent before the first write.
+    if (cfg->header_flags & UFO_BIN_HAS_STATS) {
+        uint32_t flags = cfg->header_flags & ~UFO_BIN_HAS_STATS;
+        if (__pwrite_fully(cfg->write_file_descriptor, (const unsigned char *) &flags, sizeof(flags),
+                           offsetof(ufo_bin_header_t, flags)) != sizeof(flags)) {
+            return 665;
+        }
+        cfg->header_flags = flags;
     }
 
-    size_t read_status = fread(target, cfg->element_size, end - start, cfg->file_handle);
-    if (read_status < end - start || read_status == 0) {
-        // Read failed.
-        REprintf("Read failed. Read %li out of %li elements.\n", read_status, end - start);
-        return 44;
+    size_t bytes_to_write = end_writing_at - start_writing_from;
+
+    unsigned char *narrowed = NULL;
+    if (cfg->storage_size != cfg->element_size) {
+        narrowed = (unsigned char *) malloc(bytes_to_write);
+        if (narrowed == NULL) {
+            return 666;
+        }
+        if (__narrow(cfg->storage, cfg->vector_type, contents, end - start, narrowed) >= 0) {
+            free(narrowed);
+            return 667;
+        }
+        contents = narrowed;
+    }
+
+    ssize_t write_status = __pwrite_fully(cfg->write_file_descriptor, contents, bytes_to_write, cfg->data_offset + start_writing_from);
+    free(narrowed);
+    if (write_status < 0 || (size_t) write_status < bytes_to_write) {
+        return 666;
     }
 
     return 0;
 }
 
+const char *__write_error_message(int32_t code) {
+    switch (code) {
+    case 0:   return "ok";
+    case -1:  return "file was not opened for writing";
+    case 42:  return "start index out of bounds of the file";
+    case 43:  return "end index out of bounds of the file";
+    case 665: return "cannot invalidate statistics in the header";
+    case 666: return "write failed";
+    case 667: return "value does not fit into the storage type";
+    default:  return "unknown error";
+    }
+}
+
 int32_t __write_to_file(void* user_data, uintptr_t start, uintptr_t end, const unsigned char* contents) {
 
     ufo_file_source_data_t* cfg = (ufo_file_source_data_t*) user_data;
@@ -82,114 +250,202 @@ int32_t __write_to_file(void* user_data, uintptr_t start, uintptr_t end, const u
         REprintf("   element size: %li\n", cfg->element_size);
     }
 
-    // TODO redo as mmap
-    // size_t size = cfg->element_size * cfg->vector_size;
-    // int fd = open(cfg->path, O_RDWR);
-    // unsigned char* file = (unsigned char *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    // memcpy(file + (start * cfg->element_size), contents, (end - start) * cfg->element_size);
-    // close(fd);
-    // munmap(file, size);
-
-    // return 0;
-
-    // Open for writing, do not reuse the file handle
-    FILE* file = fopen(cfg->path, "r+b");
-    if (!file) {        
-        REprintf("Error opening file '%s' for writing.", cfg->path); // FIXME change to UFO_LOG and UFO_REPORT
-        return -1;
+    int32_t result = __write_range_to_file(user_data, start, end, contents);
+    if (result != 0) {
+        REprintf("Error writing elements %li-%li to file '%s': %s.\n",
+                 start, end, cfg->path, __write_error_message(result)); // FIXME change to UFO_LOG and UFO_REPORT
     }
+    return result;
+}
 
-    int initial_seek_status = fseek(file, 0L, SEEK_END);
-    if (initial_seek_status < 0) {
-        // Could not seek in from file.
-        REprintf("Could not seek to the end of file.\n");
-        return 1;
+static size_t __gcd(size_t a, size_t b) {
+    while (b != 0) {
+        size_t t = a % b;
+        a = b;
+        b = t;
     }
+    return a;
+}
 
-    long file_size_in_bytes = ftell(file);
-
-    long start_writing_from = cfg->element_size * start;
-    if (start_writing_from > file_size_in_bytes) {
-        // Start index out of bounds of the file.
-        REprintf("Start index %li out of bounds of the file %li.\n", start_writing_from, file_size_in_bytes);
-        return 42;
+// Elements per window: about UFO_STORE_WINDOW_BYTES unless asked otherwise,
+// rounded up so that every window starts on a chunk boundary for the
+// statistics and at a page boundary in the file.
+static size_t __store_window_length(size_t window, size_t chunk_length, size_t storage_size) {
+    if (window == 0) {
+        window = UFO_STORE_WINDOW_BYTES / storage_size;
     }
-
-    long end_writing_at = cfg->element_size * end;
-    if (end_writing_at > file_size_in_bytes) {
-        // End index out of bounds of the file.
-        REprintf("End index %li out of bounds of the file %li.\n", end_writing_at, file_size_in_bytes);
-        return 43;
+    size_t granule = UFO_BIN_ALIGNMENT / __gcd(UFO_BIN_ALIGNMENT, storage_size);
+    if (chunk_length > 0) {
+        granule = granule / __gcd(granule, chunk_length) * chunk_length;
     }
+    return (window + granule - 1) / granule * granule;
+}
 
-    int rewind_seek_status = fseek(file, start_writing_from, SEEK_SET);
-    if (rewind_seek_status < 0) {
-        // Could not seek in the file to position at start index.
-        REprintf("Could not seek in the file to position at start index.\n");
-        return 2;
+typedef struct {
+    const char         *path;
+    char               *temporary_path;
+    int                 fd;
+    unsigned char      *buffer;
+    ufo_bin_metadata_t  metadata;
+    bool                has_metadata;
+} __store_t;
+
+// Releases everything held while storing, including the path. A failed
+// store discards the partly written temporary file.
+static void __store_cleanup(__store_t *store, bool failed) {
+    if (store->fd >= 0) {
+        close(store->fd);
     }
-
-    size_t write_status = fwrite(contents, cfg->element_size, end - start, file);
-    if (write_status < end - start || write_status == 0) {
-        fclose(file);
-        REprintf("Error writing to file '%s'. Written: %i out of %li",
-                 cfg->path, write_status, end - start);
-        return 666;
+    if (failed && store->temporary_path != NULL) {
+        atomic_file_discard(store->temporary_path);
+    } else {
+        free(store->temporary_path);
     }
+    free(store->buffer);
+    if (store->has_metadata) {
+        ufo_bin_metadata_free(&store->metadata);
+    }
+    free((char *) store->path);
+}
 
-    fclose(file);
-    return 0;
+static void __store_fail(__store_t *store, const char *format, ...) {
+    char message[1024];
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(message, sizeof(message), format, arguments);
+    va_end(arguments);
+
+    __store_cleanup(store, true);
+    Rf_error("%s", message);
 }
 
-void __write_bytes_to_disk(const char *path, size_t size, const char *bytes) {
-    //fprintf(stderr, "__write_bytes_to_disk(%s,%li,...)\n", path, size);
+void __store_bytes_or_die(const char *path, uint32_t storage, int type, size_t element_count,
+                          bool header, const int64_t *dimensions, uint32_t dimensions_length,
+                          size_t chunk_length, size_t window, bool atomic,
+                          const unsigned char *bytes) {
+    __store_t store;
+    memset(&store, 0, sizeof(store));
+    store.path = path;
+    store.fd = -1;
+    size_t storage_size = ufo_bin_dtype_size(storage);
+    size_t element_size = ufo_bin_dtype_size(ufo_bin_dtype_from_sexptype(type));
+    size_t data_offset = 0;
+
+    if (header) {
+        ufo_bin_status_t status = ufo_bin_metadata_init(&store.metadata, storage, type, element_count,
+                                                        dimensions, dimensions_length, chunk_length);
+        store.has_metadata = true;
+        if (status != UFO_BIN_OK) {
+            __store_fail(&store, "Error preparing header for file '%s': %s.", path, ufo_bin_status_message(status));
+        }
+        data_offset = store.metadata.header.data_offset;
+        chunk_length = store.metadata.header.chunk_length;
+    } else {
+        chunk_length = 0;
+    }
 
-    FILE* file = fopen(path, "wb");
+    if (atomic) {
+        store.fd = atomic_file_create(path, &store.temporary_path);
+    } else {
+        store.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if (store.fd < 0) {
+        __store_fail(&store, "Error opening file '%s'.", path);
+    }
 
-    if (!file) {
-        fclose(file);
-        Rf_error("Error opening file '%s'.", path);
+    bool native = __storage_is_native(storage, type);
+    window = __store_window_length(window, chunk_length, storage_size);
+    if (!native) {
+        store.buffer = (unsigned char *) malloc(window * storage_size);
+        if (store.buffer == NULL) {
+            __store_fail(&store, "Cannot allocate a buffer of %li elements to write file '%s'.", window, path);
+        }
     }
 
-    size_t write_status = fwrite(bytes, sizeof(const char), size, file);
-    if (write_status < size || write_status == 0) {
-        fclose(file);
-        Rf_error("Error writing to file '%s'. Written: %i out of %li",
-                 path, write_status, size);
+    // Touch the vector one window at a time, so a UFO only has to have one
+    // window in memory at a time rather than all of it.
+    for (size_t start = 0; start < element_count; start += window) {
+        size_t count = element_count - start < window ? element_count - start : window;
+        const unsigned char *values = bytes + start * element_size;
+
+        const unsigned char *contents = values;
+        if (!native) {
+            int64_t failed = __narrow(storage, type, values, count, store.buffer);
+            if (failed >= 0) {
+                __store_fail(&store, "Value at index %li does not fit into %s storage.\n",
+                             start + failed + 1, ufo_bin_dtype_name(storage));
+            }
+            contents = store.buffer;
+        }
+
+        // The statistics are read in the storage type.
+        if (store.has_metadata) {
+            ufo_bin_update_stats(&store.metadata, start, count, contents);
+        }
+
+        size_t size = count * storage_size;
+        ssize_t write_status = __pwrite_fully(store.fd, contents, size, data_offset + start * storage_size);
+        if (write_status < 0 || (size_t) write_status < size) {
+            __store_fail(&store, "Error writing to file '%s'. Written: %li out of %li",
+                         path, write_status, size);
+        }
     }
 
-    fclose(file);
+    // The statistics are only known now, so the header goes in last.
+    if (store.has_metadata) {
+        ufo_bin_status_t status = ufo_bin_write_metadata(store.fd, &store.metadata);
+        if (status != UFO_BIN_OK) {
+            __store_fail(&store, "Error writing header to file '%s': %s.", path, ufo_bin_status_message(status));
+        }
+    }
+
+    if (atomic) {
+        // The temporary path is released either way.
+        bool replaced = atomic_file_finish(store.temporary_path, path, fdatasync(store.fd) == 0);
+        store.temporary_path = NULL;
+        if (!replaced) {
+            __store_fail(&store, "Error replacing file '%s'.", path);
+        }
+    }
+    __store_cleanup(&store, false);
 }
 
-long __get_vector_length_from_file_or_die(const char * path, size_t element_size) {
+size_t __get_file_size_or_die(int fd) {
+    struct stat file_info;
+    if (fstat(fd, &file_info) < 0) {
+        Rf_error("Could not stat file.\n");
+    }
+    return file_info.st_size;
+}
 
-    // FIXME concurrency
-    FILE* file = fopen(path, "rb");
-    if (file == NULL) {
+int __open_file_or_die(char const *path, int flags) {
+    int fd = open(path, flags);
+    if (fd < 0) {
         Rf_error("Could not open file.\n");
     }
+    return fd;
+}
 
-    int seek_status = fseek(file, 0L, SEEK_END);
-    if (seek_status < 0) {
-        // Could not seek in from file.
-        fclose(file);
-        Rf_error("Could not seek to the end of file.\n");
+unsigned char *__map_file(int fd, size_t offset, size_t size, int advice) {
+    if (size == 0) {
+        // Cannot map an empty file, but there is also nothing to read.
+        return NULL;
     }
 
-    long file_size_in_bytes = ftell(file);
-    fclose(file);
+    unsigned char *mapping = (unsigned char *) mmap(NULL, size, PROT_READ, MAP_SHARED, fd, offset);
+    if (mapping == MAP_FAILED) {
+        return MAP_FAILED;
+    }
 
-    if (file_size_in_bytes % element_size != 0) {
-        Rf_error("File size not divisible by element size.\n");
+    if (madvise(mapping, size, advice) < 0) {
+        UFO_WARN("Could not apply advice %i to file mapping.\n", advice);
     }
 
-    return file_size_in_bytes / element_size;
+    return mapping;
 }
 
-FILE *__open_file_or_die(char const *path) {
-    FILE * file = fopen(path, "rb");
-    if (!file) {
-        Rf_error("Could not open file.\n");
+void __unmap_file(unsigned char *mapping, size_t size) {
+    if (mapping != NULL) {
+        munmap(mapping, size);
     }
-    return file;
 }
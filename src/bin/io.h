@@ -2,6 +2,11 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+// Bytes written per window when storing a vector, unless asked otherwise.
+#define UFO_STORE_WINDOW_BYTES (16 * 1024 * 1024)
 
 /**
  * Load a range of values from a binary file.
@@ -14,17 +19,81 @@
  * @param start First index of the range.
  * @param end Last index within the range.
  * @param target The area of memory where the data from the file will be loaded.
- * @return 0 on success, 42 if seek failed to find the required index in the
- *         file, 44 if reading failed.
+ * @return 0 on success, 42 or 43 if the range is out of bounds of the file,
+ *         44 if reading failed.
+ *
+ * The range is read with a single positional read (pread), so concurrent
+ * populates of the same vector are safe. If the source was created with
+ * UFO_IO_MMAP, the range is copied directly out of the file mapping instead.
+ * If the source has a prefetcher, the range is taken from it when it was
+ * already read ahead, and sequential populates schedule further read-ahead.
  */
 int32_t __load_from_file(
     void* user_data,
     uintptr_t start, uintptr_t end,
     unsigned char* target);
+// Same as __load_from_file, but without prefetching or any logging, so it is
+// safe to call from the prefetcher's worker threads.
+int32_t __read_range_from_file(
+    void* user_data,
+    uintptr_t start, uintptr_t end,
+    unsigned char* target);
+// Same as __read_range_from_file, but ranges that are still waiting in the
+// source's writeback queue are taken from the queue.
+int32_t __read_range_through_queue(
+    void* user_data,
+    uintptr_t start, uintptr_t end,
+    unsigned char* target);
 int32_t __write_to_file(
     void* user_data, 
     uintptr_t start, uintptr_t end, 
     const unsigned char* contents);
-void __write_bytes_to_disk(const char *path, size_t size, const char *bytes);
-long __get_vector_length_from_file_or_die(const char * path, size_t element_size);
-FILE *__open_file_or_die(char const *path);
\ No newline at end of file
+// Same as __write_to_file, but without any logging, so it is safe to call
+// from the writeback thread. __write_error_message describes the result.
+int32_t __write_range_to_file(
+    void* user_data,
+    uintptr_t start, uintptr_t end,
+    const unsigned char* contents);
+const char *__write_error_message(int32_t code);
+
+/**
+ * Write a vector to a file, optionally prefixed by a header (see header.h)
+ * that records its element type, dimensions, NA sentinel, and, if
+ * chunk_length is not zero, the minimum and maximum of every chunk of
+ * chunk_length elements.
+ *
+ * The bytes hold element_count elements of an R vector of the given type.
+ * They are narrowed to the storage type and written out window by window,
+ * window elements at a time (0 picks the default), so that a UFO vector
+ * does not have to be in memory all at once.
+ *
+ * If atomic, the file is written under a temporary name and renamed over
+ * path when complete, so readers see either the old or the new file.
+ *
+ * Takes over the path, which is freed before returning or raising an error.
+ */
+void __store_bytes_or_die(const char *path, uint32_t storage, int type, size_t element_count,
+                          bool header, const int64_t *dimensions, uint32_t dimensions_length,
+                          size_t chunk_length, size_t window, bool atomic,
+                          const unsigned char *bytes);
+size_t __get_file_size_or_die(int fd);
+int __open_file_or_die(char const *path, int flags);
+
+// Read or write exactly size bytes at offset, retrying on short transfers.
+// Return the number of bytes transferred or -1 on error.
+ssize_t __pread_fully(int fd, unsigned char *target, size_t size, off_t offset);
+ssize_t __pwrite_fully(int fd, const unsigned char *contents, size_t size, off_t offset);
+
+/**
+ * Map a file into memory as read-only and pass the provided advice
+ * (MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED) to the kernel.
+ *
+ * @param fd An open file descriptor of the file.
+ * @param offset Where the mapping starts in the file, must be page-aligned.
+ * @param size The size of the mapped area in bytes.
+ * @param advice One of the madvise advice values.
+ * @return Pointer to the mapping, NULL if the file is empty, or MAP_FAILED
+ *         if it cannot be mapped.
+ */
+unsigned char *__map_file(int fd, size_t offset, size_t size, int advice);
+void __unmap_file(unsigned char *mapping, size_t size);
\ No newline at end of file
@@ -0,0 +1,280 @@
+#include "prefetch.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../debug.h"
+
+// No point in more readers than that, the device queue is full by then.
+#define MAX_PREFETCH_WORKERS 16
+
+static prefetch_slot_t *find_slot(prefetcher_t *prefetcher, uintptr_t start, uintptr_t end) {
+    for (size_t i = 0; i < prefetcher->depth; i++) {
+        prefetch_slot_t *slot = &prefetcher->slots[i];
+        if (slot->state == PREFETCH_EMPTY || slot->state == PREFETCH_TAKEN) {
+            continue;
+        }
+        if (slot->start <= start && end <= slot->end) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+static prefetch_slot_t *find_slot_starting_at(prefetcher_t *prefetcher, uintptr_t start) {
+    for (size_t i = 0; i < prefetcher->depth; i++) {
+        prefetch_slot_t *slot = &prefetcher->slots[i];
+        if (slot->state != PREFETCH_EMPTY && slot->start == start) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+static prefetch_slot_t *find_queued_slot(prefetcher_t *prefetcher) {
+    prefetch_slot_t *first = NULL;
+    for (size_t i = 0; i < prefetcher->depth; i++) {
+        prefetch_slot_t *slot = &prefetcher->slots[i];
+        if (slot->state == PREFETCH_QUEUED && (first == NULL || slot->start < first->start)) {
+            first = slot;
+        }
+    }
+    return first;
+}
+
+static prefetch_slot_t *find_empty_slot(prefetcher_t *prefetcher) {
+    for (size_t i = 0; i < prefetcher->depth; i++) {
+        if (prefetcher->slots[i].state == PREFETCH_EMPTY) {
+            return &prefetcher->slots[i];
+        }
+    }
+    return NULL;
+}
+
+// Forget ranges that the populates have moved past (or all of them, if the
+// access pattern stopped being sequential), so their slots can be reused.
+static void drop_stale_slots(prefetcher_t *prefetcher, uintptr_t start, bool all) {
+    for (size_t i = 0; i < prefetcher->depth; i++) {
+        prefetch_slot_t *slot = &prefetcher->slots[i];
+        bool droppable = slot->state == PREFETCH_QUEUED
+                      || slot->state == PREFETCH_READY
+                      || slot->state == PREFETCH_FAILED;
+        if (droppable && (all || slot->end <= start)) {
+            slot->state = PREFETCH_EMPTY;
+        }
+    }
+}
+
+static void *prefetcher_worker(void *argument) {
+    prefetcher_t *prefetcher = (prefetcher_t *) argument;
+
+    pthread_mutex_lock(&prefetcher->lock);
+    while (true) {
+        prefetch_slot_t *slot = NULL;
+        while (!prefetcher->shutdown && (slot = find_queued_slot(prefetcher)) == NULL) {
+            pthread_cond_wait(&prefetcher->queued, &prefetcher->lock);
+        }
+        if (prefetcher->shutdown) {
+            break;
+        }
+
+        slot->state = PREFETCH_LOADING;
+        pthread_mutex_unlock(&prefetcher->lock);
+
+        int32_t result = prefetcher->read(prefetcher->read_data, slot->start, slot->end, slot->buffer);
+
+        pthread_mutex_lock(&prefetcher->lock);
+        if (slot->stale) {
+            slot->state = PREFETCH_EMPTY;
+        } else {
+            slot->state = (result == 0) ? PREFETCH_READY : PREFETCH_FAILED;
+        }
+        pthread_cond_broadcast(&prefetcher->loaded);
+    }
+    pthread_mutex_unlock(&prefetcher->lock);
+    return NULL;
+}
+
+prefetcher_t *prefetcher_new(prefetch_read_t read, void *read_data, size_t element_size, size_t vector_size, size_t depth) {
+    prefetcher_t *prefetcher = (prefetcher_t *) malloc(sizeof(prefetcher_t));
+    if (prefetcher == NULL) {
+        UFO_REPORT("Cannot allocate prefetcher.\n");
+        return NULL;
+    }
+
+    prefetcher->read = read;
+    prefetcher->read_data = read_data;
+    prefetcher->element_size = element_size;
+    prefetcher->vector_size = vector_size;
+    prefetcher->depth = depth;
+    prefetcher->expected_start = 0;
+    prefetcher->shutdown = false;
+
+    prefetcher->slots = (prefetch_slot_t *) calloc(depth, sizeof(prefetch_slot_t));
+    if (prefetcher->slots == NULL) {
+        UFO_REPORT("Cannot allocate prefetcher slots.\n");
+        free(prefetcher);
+        return NULL;
+    }
+
+    pthread_mutex_init(&prefetcher->lock, NULL);
+    pthread_cond_init(&prefetcher->queued, NULL);
+    pthread_cond_init(&prefetcher->loaded, NULL);
+
+    size_t workers_count = depth < MAX_PREFETCH_WORKERS ? depth : MAX_PREFETCH_WORKERS;
+    prefetcher->workers = (pthread_t *) malloc(sizeof(pthread_t) * workers_count);
+    prefetcher->workers_count = 0;
+    for (size_t i = 0; i < workers_count; i++) {
+        if (0 != pthread_create(&prefetcher->workers[i], NULL, prefetcher_worker, prefetcher)) {
+            UFO_WARN("Cannot start prefetcher thread, running with %li threads.\n", i);
+            break;
+        }
+        prefetcher->workers_count++;
+    }
+
+    if (prefetcher->workers_count == 0) {
+        prefetcher_free(prefetcher);
+        return NULL;
+    }
+
+    return prefetcher;
+}
+
+void prefetcher_free(prefetcher_t *prefetcher) {
+    pthread_mutex_lock(&prefetcher->lock);
+    prefetcher->shutdown = true;
+    pthread_cond_broadcast(&prefetcher->queued);
+    pthread_mutex_unlock(&prefetcher->lock);
+
+    for (size_t i = 0; i < prefetcher->workers_count; i++) {
+        pthread_join(prefetcher->workers[i], NULL);
+    }
+
+    for (size_t i = 0; i < prefetcher->depth; i++) {
+        free(prefetcher->slots[i].buffer);
+    }
+
+    pthread_cond_destroy(&prefetcher->loaded);
+    pthread_cond_destroy(&prefetcher->queued);
+    pthread_mutex_destroy(&prefetcher->lock);
+    free(prefetcher->workers);
+    free(prefetcher->slots);
+    free(prefetcher);
+}
+
+bool prefetcher_take(prefetcher_t *prefetcher, uintptr_t start, uintptr_t end, unsigned char *target) {
+    pthread_mutex_lock(&prefetcher->lock);
+
+    prefetch_slot_t *slot = find_slot(prefetcher, start, end);
+    if (slot == NULL) {
+        pthread_mutex_unlock(&prefetcher->lock);
+        return false;
+    }
+
+    // Nobody picked it up yet, it's faster to read it ourselves.
+    if (slot->state == PREFETCH_QUEUED) {
+        slot->state = PREFETCH_EMPTY;
+        pthread_mutex_unlock(&prefetcher->lock);
+        return false;
+    }
+
+    while (slot->state == PREFETCH_LOADING && slot->start <= start && end <= slot->end) {
+        pthread_cond_wait(&prefetcher->loaded, &prefetcher->lock);
+    }
+
+    // While we waited, the slot may have been dropped and reused for another
+    // range, which is not ours to touch.
+    if (slot->start > start || end > slot->end) {
+        pthread_mutex_unlock(&prefetcher->lock);
+        return false;
+    }
+
+    if (slot->state != PREFETCH_READY) {
+        if (slot->state == PREFETCH_FAILED) {
+            slot->state = PREFETCH_EMPTY;
+        }
+        pthread_mutex_unlock(&prefetcher->lock);
+        return false;
+    }
+
+    // Copy outside of the lock, so the workers can carry on in the meantime.
+    slot->state = PREFETCH_TAKEN;
+    pthread_mutex_unlock(&prefetcher->lock);
+
+    memcpy(target,
+           slot->buffer + (start - slot->start) * prefetcher->element_size,
+           (end - start) * prefetcher->element_size);
+
+    pthread_mutex_lock(&prefetcher->lock);
+    slot->state = PREFETCH_EMPTY;
+    pthread_mutex_unlock(&prefetcher->lock);
+    return true;
+}
+
+void prefetcher_advance(prefetcher_t *prefetcher, uintptr_t start, uintptr_t end) {
+    pthread_mutex_lock(&prefetcher->lock);
+
+    bool sequential = (start == prefetcher->expected_start);
+    prefetcher->expected_start = end;
+
+    drop_stale_slots(prefetcher, start, !sequential);
+    if (!sequential || end <= start) {
+        pthread_mutex_unlock(&prefetcher->lock);
+        return;
+    }
+
+    size_t length = end - start;
+    for (size_t i = 0; i < prefetcher->depth; i++) {
+        uintptr_t next_start = end + i * length;
+        if (next_start >= prefetcher->vector_size) {
+            break;
+        }
+        uintptr_t next_end = next_start + length;
+        if (next_end > prefetcher->vector_size) {
+            next_end = prefetcher->vector_size;
+        }
+
+        if (find_slot_starting_at(prefetcher, next_start) != NULL) {
+            continue; // Already in flight.
+        }
+
+        prefetch_slot_t *slot = find_empty_slot(prefetcher);
+        if (slot == NULL) {
+            break; // All slots are busy.
+        }
+
+        size_t bytes = (next_end - next_start) * prefetcher->element_size;
+        if (slot->capacity < bytes) {
+            unsigned char *buffer = (unsigned char *) realloc(slot->buffer, bytes);
+            if (buffer == NULL) {
+                break;
+            }
+            slot->buffer = buffer;
+            slot->capacity = bytes;
+        }
+
+        slot->start = next_start;
+        slot->end = next_end;
+        slot->stale = false;
+        slot->state = PREFETCH_QUEUED;
+    }
+
+    pthread_cond_broadcast(&prefetcher->queued);
+    pthread_mutex_unlock(&prefetcher->lock);
+}
+
+void prefetcher_invalidate(prefetcher_t *prefetcher, uintptr_t start, uintptr_t end) {
+    pthread_mutex_lock(&prefetcher->lock);
+    for (size_t i = 0; i < prefetcher->depth; i++) {
+        prefetch_slot_t *slot = &prefetcher->slots[i];
+        if (slot->state == PREFETCH_EMPTY || slot->end <= start || slot->start >= end) {
+            continue;
+        }
+        if (slot->state == PREFETCH_LOADING) {
+            slot->stale = true;
+        } else if (slot->state != PREFETCH_TAKEN) {
+            slot->state = PREFETCH_EMPTY;
+        }
+    }
+    pthread_mutex_unlock(&prefetcher->lock);
+}
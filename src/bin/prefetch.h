@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+// Reads the range of elements [start, end) into target, returns 0 on success.
+// Called from worker threads, so it must not call into R.
+typedef int32_t (*prefetch_read_t)(void *data, uintptr_t start, uintptr_t end, unsigned char *target);
+
+typedef enum {
+    PREFETCH_EMPTY,   // slot is free
+    PREFETCH_QUEUED,  // range is waiting for a worker
+    PREFETCH_LOADING, // a worker is reading the range
+    PREFETCH_READY,   // range is loaded and waiting to be taken
+    PREFETCH_TAKEN,   // a populate is copying the range out of the slot
+    PREFETCH_FAILED,  // worker could not read the range
+} prefetch_slot_state_t;
+
+typedef struct {
+    prefetch_slot_state_t state;
+    uintptr_t             start;
+    uintptr_t             end;
+    unsigned char        *buffer;
+    size_t                capacity; /* in bytes */
+    bool                  stale;    /* invalidated while loading, dropped when done */
+} prefetch_slot_t;
+
+// Read-ahead engine: when populates come in sequentially, keeps the next
+// `depth` ranges of the same length in flight on a pool of worker threads.
+typedef struct {
+    prefetch_read_t       read;
+    void                 *read_data;
+    size_t                element_size;
+    size_t                vector_size;
+    size_t                depth;
+    prefetch_slot_t      *slots;
+    pthread_t            *workers;
+    size_t                workers_count;
+    pthread_mutex_t       lock;
+    pthread_cond_t        queued;
+    pthread_cond_t        loaded;
+    uintptr_t             expected_start; // where the next sequential populate starts
+    bool                  shutdown;
+} prefetcher_t;
+
+prefetcher_t *prefetcher_new(prefetch_read_t read, void *read_data, size_t element_size, size_t vector_size, size_t depth);
+void prefetcher_free(prefetcher_t *prefetcher);
+
+/**
+ * Copy the range [start, end) into target if it was prefetched. Waits if the
+ * range is currently being loaded by a worker.
+ *
+ * @return true if target was populated, false if the caller has to read the
+ *         range itself.
+ */
+bool prefetcher_take(prefetcher_t *prefetcher, uintptr_t start, uintptr_t end, unsigned char *target);
+
+/**
+ * Record that the range [start, end) was populated. If populates follow each
+ * other sequentially, queue up the following ranges for the workers.
+ */
+void prefetcher_advance(prefetcher_t *prefetcher, uintptr_t start, uintptr_t end);
+
+/**
+ * Forget everything read ahead that overlaps [start, end), because the
+ * range was modified in the meantime.
+ */
+void prefetcher_invalidate(prefetcher_t *prefetcher, uintptr_t start, uintptr_t end);
@@ -0,0 +1,361 @@
+#include "tiles.h"
+
+#define USE_RINTERNALS
+#include <R.h>
+#include <Rinternals.h>
+
+#include "../ufo_metadata.h"
+#include "../debug.h"
+#include "io.h"
+#include "header.h"
+#include "convert.h"
+#include "../atomic_file.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+tile_cache_t *tile_cache_new(size_t slot_count, size_t tile_bytes) {
+    tile_cache_t *cache = (tile_cache_t *) calloc(1, sizeof(tile_cache_t));
+    if (cache == NULL) {
+        return NULL;
+    }
+    cache->slots = (tile_slot_t *) calloc(slot_count, sizeof(tile_slot_t));
+    if (cache->slots == NULL) {
+        free(cache);
+        return NULL;
+    }
+    cache->slot_count = slot_count;
+    pthread_mutex_init(&cache->lock, NULL);
+    pthread_cond_init(&cache->loaded, NULL);
+    for (size_t i = 0; i < slot_count; i++) {
+        cache->slots[i].values = (unsigned char *) malloc(tile_bytes);
+        if (cache->slots[i].values == NULL) {
+            tile_cache_free(cache);
+            return NULL;
+        }
+    }
+    return cache;
+}
+
+void tile_cache_free(tile_cache_t *cache) {
+    for (size_t i = 0; i < cache->slot_count; i++) {
+        free(cache->slots[i].values);
+    }
+    free(cache->slots);
+    pthread_cond_destroy(&cache->loaded);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+static tile_slot_t *__find_tile(tile_cache_t *cache, uint64_t tile) {
+    for (size_t i = 0; i < cache->slot_count; i++) {
+        if (cache->slots[i].valid && cache->slots[i].tile == tile) {
+            cache->slots[i].last_used = ++cache->clock;
+            return &cache->slots[i];
+        }
+    }
+    return NULL;
+}
+
+static tile_slot_t *__find_loading_tile(tile_cache_t *cache, uint64_t tile) {
+    for (size_t i = 0; i < cache->slot_count; i++) {
+        if (cache->slots[i].loading && cache->slots[i].tile == tile) {
+            return &cache->slots[i];
+        }
+    }
+    return NULL;
+}
+
+// The least recently used slot that is not being loaded, or NULL.
+static tile_slot_t *__find_victim(tile_cache_t *cache) {
+    tile_slot_t *victim = NULL;
+    for (size_t i = 0; i < cache->slot_count; i++) {
+        tile_slot_t *slot = &cache->slots[i];
+        if (!slot->loading && (victim == NULL || slot->last_used < victim->last_used)) {
+            victim = slot;
+        }
+    }
+    return victim;
+}
+
+// Returns the slot holding the tile, reading it if necessary, or NULL if the
+// tile cannot be read. Must be called with the cache locked, but unlocks it
+// while reading, so that populates do not wait for each other's reads.
+static tile_slot_t *__load_tile(ufo_tiled_source_data_t *data, uint64_t tile) {
+    tile_cache_t *cache = data->cache;
+    while (true) {
+        tile_slot_t *slot = __find_tile(cache, tile);
+        if (slot != NULL) {
+            return slot;
+        }
+
+        // Someone else is reading the tile, or every slot is being read into.
+        if (__find_loading_tile(cache, tile) != NULL || (slot = __find_victim(cache)) == NULL) {
+            pthread_cond_wait(&cache->loaded, &cache->lock);
+            continue;
+        }
+
+        slot->tile = tile;
+        slot->valid = false;
+        slot->loading = true;
+        slot->stale = false;
+        pthread_mutex_unlock(&cache->lock);
+
+        // Read the narrow elements into the tail of the slot and widen them
+        // in place, see __read_range_from_file.
+        size_t tile_elements = data->tile_rows * data->tile_cols;
+        size_t bytes = tile_elements * data->storage_size;
+        unsigned char *raw = slot->values + tile_elements * data->element_size - bytes;
+        off_t offset = data->data_offset + tile * bytes;
+        bool read = __pread_fully(data->file_descriptor, raw, bytes, offset) == (ssize_t) bytes;
+        if (read) {
+            __widen(data->storage, data->vector_type, raw, tile_elements, slot->values);
+        }
+
+        pthread_mutex_lock(&cache->lock);
+        slot->loading = false;
+        slot->valid = read && !slot->stale;
+        slot->last_used = ++cache->clock;
+        pthread_cond_broadcast(&cache->loaded);
+        if (!read) {
+            return NULL;
+        }
+        if (slot->valid) {
+            return slot;
+        }
+        // Written back to while it was read, so what was read may be outdated.
+    }
+}
+
+typedef struct {
+    size_t   length;         /* elements, all within one column of one tile */
+    uint64_t tile;           /* index of the tile in the file */
+    size_t   offset_in_tile; /* elements from the start of the tile */
+} tile_piece_t;
+
+// The longest run of elements starting at position and ending before end
+// that lies within one column of one tile.
+static tile_piece_t __next_piece(const ufo_tiled_source_data_t *data, uintptr_t position, uintptr_t end) {
+    size_t column = position / data->rows;
+    size_t row = position % data->rows;
+    size_t row_in_tile = row % data->tile_rows;
+
+    tile_piece_t piece;
+    piece.length = data->tile_rows - row_in_tile;
+    if (piece.length > data->rows - row) piece.length = data->rows - row;
+    if (piece.length > end - position) piece.length = end - position;
+    piece.tile = (uint64_t) (column / data->tile_cols) * data->tiles_down + row / data->tile_rows;
+    piece.offset_in_tile = (column % data->tile_cols) * data->tile_rows + row_in_tile;
+    return piece;
+}
+
+int32_t __load_from_tiles(void* user_data, uintptr_t start, uintptr_t end, unsigned char* target) {
+    ufo_tiled_source_data_t *data = (ufo_tiled_source_data_t *) user_data;
+
+    if (__get_debug_mode()) {
+        REprintf("__load_from_tiles\n");
+        REprintf("    start index: %li\n", start);
+        REprintf("      end index: %li\n", end);
+        REprintf("      tile size: %lix%li\n", data->tile_rows, data->tile_cols);
+        REprintf("    source file: %s\n", data->path);
+    }
+
+    if (end > data->vector_size) {
+        return 42;
+    }
+
+    size_t element_size = data->element_size;
+    pthread_mutex_lock(&data->cache->lock);
+    for (uintptr_t position = start; position < end;) {
+        tile_piece_t piece = __next_piece(data, position, end);
+        tile_slot_t *slot = __load_tile(data, piece.tile);
+        if (slot == NULL) {
+            pthread_mutex_unlock(&data->cache->lock);
+            REprintf("Error reading tile %li from file '%s'.\n", piece.tile, data->path);
+            return 43;
+        }
+        memcpy(target + (position - start) * element_size,
+               slot->values + piece.offset_in_tile * element_size,
+               piece.length * element_size);
+        position += piece.length;
+    }
+    pthread_mutex_unlock(&data->cache->lock);
+    return 0;
+}
+
+int32_t __write_to_tiles(void* user_data, uintptr_t start, uintptr_t end, const unsigned char* contents) {
+    ufo_tiled_source_data_t *data = (ufo_tiled_source_data_t *) user_data;
+
+    if (__get_debug_mode()) {
+        REprintf("__write_to_tiles\n");
+        REprintf("    start index: %li\n", start);
+        REprintf("      end index: %li\n", end);
+        REprintf("    target file: %s\n", data->path);
+    }
+
+    if (data->write_file_descriptor < 0) {
+        return -1;
+    }
+    if (end > data->vector_size) {
+        return 42;
+    }
+
+    size_t element_size = data->element_size;
+    size_t storage_size = data->storage_size;
+    size_t tile_bytes = data->tile_rows * data->tile_cols * storage_size;
+    unsigned char *narrowed = (unsigned char *) malloc(data->tile_rows * storage_size);
+    if (narrowed == NULL) {
+        return 666;
+    }
+
+    int32_t result = 0;
+    pthread_mutex_lock(&data->cache->lock);
+    for (uintptr_t position = start; position < end;) {
+        tile_piece_t piece = __next_piece(data, position, end);
+        const unsigned char *values = contents + (position - start) * element_size;
+        int64_t failed = __narrow(data->storage, data->vector_type, values, piece.length, narrowed);
+        if (failed >= 0) {
+            REprintf("Value at index %li does not fit into %s storage.\n",
+                     position + failed + 1, ufo_bin_dtype_name(data->storage));
+            result = 667;
+            break;
+        }
+
+        size_t bytes = piece.length * storage_size;
+        off_t offset = data->data_offset + piece.tile * tile_bytes + piece.offset_in_tile * storage_size;
+        if (__pwrite_fully(data->write_file_descriptor, narrowed, bytes, offset) != (ssize_t) bytes) {
+            REprintf("Error writing tile %li to file '%s'.\n", piece.tile, data->path);
+            result = 666;
+            break;
+        }
+
+        // Keep a cached copy of the tile in line with the file. One being read
+        // right now may have missed the write.
+        tile_slot_t *slot = __find_tile(data->cache, piece.tile);
+        if (slot != NULL) {
+            memcpy(slot->values + piece.offset_in_tile * element_size, values, piece.length * element_size);
+        } else if ((slot = __find_loading_tile(data->cache, piece.tile)) != NULL) {
+            slot->stale = true;
+        }
+        position += piece.length;
+    }
+    pthread_mutex_unlock(&data->cache->lock);
+
+    free(narrowed);
+    return result;
+}
+
+typedef struct {
+    const char         *path;
+    char               *temporary_path;
+    int                 fd;
+    unsigned char      *buffer;
+    ufo_bin_metadata_t  metadata;
+    bool                has_metadata;
+} __tiles_store_t;
+
+// Releases everything held while storing, including the path, discarding
+// the partly written file, and raises the error.
+static void __tiles_store_fail(__tiles_store_t *store, const char *format, ...) {
+    char message[1024];
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(message, sizeof(message), format, arguments);
+    va_end(arguments);
+
+    if (store->fd >= 0) {
+        close(store->fd);
+    }
+    if (store->temporary_path != NULL) {
+        atomic_file_discard(store->temporary_path);
+    }
+    free(store->buffer);
+    if (store->has_metadata) {
+        ufo_bin_metadata_free(&store->metadata);
+    }
+    free((char *) store->path);
+    Rf_error("%s", message);
+}
+
+void __store_tiles_or_die(const char *path, uint32_t storage, int type, size_t rows, size_t cols,
+                          size_t tile_rows, size_t tile_cols, const unsigned char *bytes) {
+    __tiles_store_t store;
+    memset(&store, 0, sizeof(store));
+    store.path = path;
+    store.fd = -1;
+
+    int64_t dimensions[2] = { rows, cols };
+    ufo_bin_status_t status = ufo_bin_metadata_init(&store.metadata, storage, type, rows * cols, dimensions, 2, 0);
+    store.has_metadata = true;
+    if (status == UFO_BIN_OK) {
+        status = ufo_bin_metadata_set_tiles(&store.metadata, tile_rows, tile_cols);
+    }
+    if (status != UFO_BIN_OK) {
+        __tiles_store_fail(&store, "Error preparing header for file '%s': %s.", path, ufo_bin_status_message(status));
+    }
+
+    size_t element_size = ufo_bin_dtype_size(ufo_bin_dtype_from_sexptype(type));
+    size_t storage_size = ufo_bin_dtype_size(storage);
+    size_t data_offset = store.metadata.header.data_offset;
+    size_t tiles_down = (rows + tile_rows - 1) / tile_rows;
+    size_t tile_bytes = tile_rows * tile_cols * storage_size;
+
+    // One column of tiles at a time.
+    store.buffer = (unsigned char *) malloc(tiles_down * tile_bytes);
+    if (store.buffer == NULL) {
+        __tiles_store_fail(&store, "Cannot allocate a buffer of %li tiles to write file '%s'.", tiles_down, path);
+    }
+
+    store.fd = atomic_file_create(path, &store.temporary_path);
+    if (store.fd < 0) {
+        __tiles_store_fail(&store, "Error opening file '%s'.", path);
+    }
+
+    status = ufo_bin_write_metadata(store.fd, &store.metadata);
+    if (status != UFO_BIN_OK) {
+        __tiles_store_fail(&store, "Error writing header to file '%s': %s.", path, ufo_bin_status_message(status));
+    }
+
+    for (size_t first_column = 0; first_column < cols; first_column += tile_cols) {
+        // Padding is left zeroed.
+        memset(store.buffer, 0, tiles_down * tile_bytes);
+        for (size_t column = first_column; column < cols && column < first_column + tile_cols; column++) {
+            for (size_t tile_row = 0; tile_row < tiles_down; tile_row++) {
+                size_t first_row = tile_row * tile_rows;
+                size_t count = rows - first_row < tile_rows ? rows - first_row : tile_rows;
+                const unsigned char *values = bytes + (column * rows + first_row) * element_size;
+                unsigned char *tile = store.buffer + tile_row * tile_bytes;
+                int64_t failed = __narrow(storage, type, values, count,
+                                          tile + (column - first_column) * tile_rows * storage_size);
+                if (failed >= 0) {
+                    __tiles_store_fail(&store, "Value at index %li does not fit into %s storage.\n",
+                                       column * rows + first_row + failed + 1, ufo_bin_dtype_name(storage));
+                }
+            }
+        }
+
+        size_t size = tiles_down * tile_bytes;
+        off_t offset = data_offset + (first_column / tile_cols) * size;
+        ssize_t write_status = __pwrite_fully(store.fd, store.buffer, size, offset);
+        if (write_status < 0 || (size_t) write_status < size) {
+            __tiles_store_fail(&store, "Error writing to file '%s'. Written: %li out of %li",
+                               path, write_status, size);
+        }
+    }
+
+    // The temporary path is released either way.
+    bool replaced = atomic_file_finish(store.temporary_path, path, fdatasync(store.fd) == 0);
+    store.temporary_path = NULL;
+    if (!replaced) {
+        __tiles_store_fail(&store, "Error replacing file '%s'.", path);
+    }
+
+    close(store.fd);
+    free(store.buffer);
+    ufo_bin_metadata_free(&store.metadata);
+    free((char *) path);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+// Tiled matrix files:
+//
+//   [header with UFO_BIN_TILED, see header.h][padding up to data_offset]
+//   [tile (0,0)][tile (1,0)]...[tile (0,1)][tile (1,1)]...
+//
+// The matrix is cut into tiles of tile_rows x tile_cols elements. Tiles are
+// stored column of tiles after column of tiles, and the elements in each
+// tile are column-major. Tiles on the bottom and right edges are padded to
+// full size. A sub-block of the matrix then lives in a few tiles instead of
+// being spread over a part of every column it touches.
+
+// Default tile size, 64 x 64 doubles is 32KB.
+#define UFO_TILE_DEFAULT_ROWS 64
+#define UFO_TILE_DEFAULT_COLS 64
+
+// Upper bound on the memory used to keep loaded tiles around.
+#define UFO_TILE_CACHE_BYTES (64 * 1024 * 1024)
+
+typedef struct {
+    uint64_t        tile;      /* index of the tile in the file */
+    uint64_t        last_used;
+    bool            valid;
+    bool            loading;   /* being read without the lock held, wait for it */
+    bool            stale;     /* written to while loading, read again when done */
+    unsigned char  *values;    /* widened to the vector's element type */
+} tile_slot_t;
+
+// Recently used tiles, so that populating neighbouring columns does not read
+// the same tiles from the file again. Tiles are read with the lock released.
+typedef struct {
+    tile_slot_t    *slots;
+    size_t          slot_count;
+    uint64_t        clock;
+    pthread_mutex_t lock;
+    pthread_cond_t  loaded;
+} tile_cache_t;
+
+tile_cache_t *tile_cache_new(size_t slot_count, size_t tile_bytes);
+void tile_cache_free(tile_cache_t *cache);
+
+/**
+ * Populate function for tiled matrices: assembles the column-major range
+ * of elements [start, end) out of the tiles that hold it.
+ */
+int32_t __load_from_tiles(void* user_data, uintptr_t start, uintptr_t end, unsigned char* target);
+
+/**
+ * Write the column-major range of elements [start, end) back into the tiles
+ * that hold it.
+ */
+int32_t __write_to_tiles(void* user_data, uintptr_t start, uintptr_t end, const unsigned char* contents);
+
+/**
+ * Write a rows x cols column-major matrix to a tiled file. The bytes hold an
+ * R vector of the given type and are narrowed to the storage type. The
+ * matrix is read one column of tiles at a time, so a UFO matrix does not
+ * have to be in memory all at once. The file is replaced only once it is
+ * completely written. Takes over the path.
+ */
+void __store_tiles_or_die(const char *path, uint32_t storage, int type, size_t rows, size_t cols,
+                          size_t tile_rows, size_t tile_cols, const unsigned char *bytes);
@@ -0,0 +1,272 @@
+#include "writeback.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../debug.h"
+
+static void free_ranges(writeback_range_t *range) {
+    while (range != NULL) {
+        writeback_range_t *next = range->next;
+        free(range->contents);
+        free(range);
+        range = next;
+    }
+}
+
+// Copy the parts of the ranges that fall within [start, end) into target.
+static void overlay_ranges(const writeback_queue_t *queue, const writeback_range_t *range,
+                           uintptr_t start, uintptr_t end, unsigned char *target) {
+    for (; range != NULL; range = range->next) {
+        if (range->end <= start || range->start >= end) {
+            continue;
+        }
+        uintptr_t from = range->start > start ? range->start : start;
+        uintptr_t to = range->end < end ? range->end : end;
+        memcpy(target + (from - start) * queue->element_size,
+               range->contents + (from - range->start) * queue->element_size,
+               (to - from) * queue->element_size);
+    }
+}
+
+// Whether any of the ranges overlaps [start, end).
+static bool overlaps_ranges(const writeback_range_t *range, uintptr_t start, uintptr_t end) {
+    for (; range != NULL; range = range->next) {
+        if (range->start < end && start < range->end) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void *writeback_worker(void *argument) {
+    writeback_queue_t *queue = (writeback_queue_t *) argument;
+
+    pthread_mutex_lock(&queue->lock);
+    while (true) {
+        while (!queue->shutdown && queue->pending == NULL) {
+            pthread_cond_wait(&queue->work, &queue->lock);
+        }
+        if (queue->shutdown && queue->pending == NULL) {
+            break;
+        }
+
+        // Give neighbouring ranges a moment to arrive, so they can be merged
+        // into one write, unless someone is waiting for the queue to drain.
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += WRITEBACK_LINGER_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (!queue->flush_requested && !queue->shutdown && queue->pending_bytes < queue->budget) {
+            if (ETIMEDOUT == pthread_cond_timedwait(&queue->work, &queue->lock, &deadline)) {
+                break;
+            }
+        }
+
+        queue->writing = queue->pending;
+        queue->pending = NULL;
+        queue->pending_bytes = 0;
+        queue->flush_requested = false;
+        pthread_mutex_unlock(&queue->lock);
+
+        // Ranges are sorted, so the file is written front to back.
+        int32_t failure = 0;
+        for (writeback_range_t *range = queue->writing; range != NULL; range = range->next) {
+            int32_t result = queue->write(queue->write_data, range->start, range->end, range->contents);
+            if (result != 0 && failure == 0) {
+                failure = result;
+            }
+        }
+
+        pthread_mutex_lock(&queue->lock);
+        free_ranges(queue->writing);
+        queue->writing = NULL;
+        queue->batches_written++;
+        if (failure != 0 && queue->failure == 0) {
+            queue->failure = failure;
+        }
+        pthread_cond_broadcast(&queue->done);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return NULL;
+}
+
+writeback_queue_t *writeback_queue_new(writeback_write_t write, void *write_data, size_t element_size, size_t budget) {
+    writeback_queue_t *queue = (writeback_queue_t *) calloc(1, sizeof(writeback_queue_t));
+    if (queue == NULL) {
+        UFO_REPORT("Cannot allocate writeback queue.\n");
+        return NULL;
+    }
+
+    queue->write = write;
+    queue->write_data = write_data;
+    queue->element_size = element_size;
+    queue->budget = budget;
+
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->work, NULL);
+    pthread_cond_init(&queue->done, NULL);
+
+    if (0 != pthread_create(&queue->thread, NULL, writeback_worker, queue)) {
+        UFO_REPORT("Cannot start writeback thread.\n");
+        pthread_cond_destroy(&queue->done);
+        pthread_cond_destroy(&queue->work);
+        pthread_mutex_destroy(&queue->lock);
+        free(queue);
+        return NULL;
+    }
+
+    return queue;
+}
+
+int32_t writeback_queue_free(writeback_queue_t *queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->shutdown = true;
+    pthread_cond_broadcast(&queue->work);
+    pthread_mutex_unlock(&queue->lock);
+
+    // The worker drains everything that is pending before it exits.
+    pthread_join(queue->thread, NULL);
+
+    int32_t failure = queue->failure;
+    pthread_cond_destroy(&queue->done);
+    pthread_cond_destroy(&queue->work);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue);
+    return failure;
+}
+
+void writeback_queue_push(writeback_queue_t *queue, uintptr_t start, uintptr_t end, const unsigned char *contents) {
+    if (end <= start) {
+        return;
+    }
+
+    size_t element_size = queue->element_size;
+    size_t bytes = (end - start) * element_size;
+
+    pthread_mutex_lock(&queue->lock);
+
+    // Back-pressure: let the worker catch up before queueing more.
+    while (queue->pending != NULL && queue->pending_bytes + bytes > queue->budget) {
+        queue->flush_requested = true;
+        pthread_cond_signal(&queue->work);
+        pthread_cond_wait(&queue->done, &queue->lock);
+    }
+
+    // Skip the ranges that end before this one starts, then take all the
+    // ranges that overlap or touch it.
+    writeback_range_t **link = &queue->pending;
+    while (*link != NULL && (*link)->end < start) {
+        link = &(*link)->next;
+    }
+
+    writeback_range_t *first = *link;
+    if (first != NULL && first->start <= start && end <= first->end) {
+        // Fully inside a queued range: just update its contents.
+        memcpy(first->contents + (start - first->start) * element_size, contents, bytes);
+        pthread_mutex_unlock(&queue->lock);
+        return;
+    }
+
+    uintptr_t merged_start = start;
+    uintptr_t merged_end = end;
+    writeback_range_t *after = first;
+    while (after != NULL && after->start <= end) {
+        if (after->start < merged_start) merged_start = after->start;
+        if (after->end > merged_end) merged_end = after->end;
+        after = after->next;
+    }
+
+    writeback_range_t *merged = (writeback_range_t *) malloc(sizeof(writeback_range_t));
+    unsigned char *merged_contents = (unsigned char *) malloc((merged_end - merged_start) * element_size);
+    if (merged == NULL || merged_contents == NULL) {
+        // Cannot queue it, so write it out right away instead. Older queued
+        // contents of the range must reach the file first, or the worker
+        // would later write them over the new ones. The lock is held while
+        // writing, so that nothing newer overtakes this write either.
+        free(merged);
+        free(merged_contents);
+        while (overlaps_ranges(queue->pending, start, end) || overlaps_ranges(queue->writing, start, end)) {
+            queue->flush_requested = true;
+            pthread_cond_signal(&queue->work);
+            pthread_cond_wait(&queue->done, &queue->lock);
+        }
+        int32_t result = queue->write(queue->write_data, start, end, contents);
+        if (result != 0 && queue->failure == 0) {
+            queue->failure = result;
+        }
+        pthread_mutex_unlock(&queue->lock);
+        return;
+    }
+
+    // Older contents first, the new ones on top.
+    for (writeback_range_t *range = first; range != after; range = range->next) {
+        memcpy(merged_contents + (range->start - merged_start) * element_size,
+               range->contents, (range->end - range->start) * element_size);
+        queue->pending_bytes -= (range->end - range->start) * element_size;
+    }
+    memcpy(merged_contents + (start - merged_start) * element_size, contents, bytes);
+
+    // Unlink the merged ranges.
+    writeback_range_t *range = first;
+    while (range != after) {
+        writeback_range_t *next = range->next;
+        free(range->contents);
+        free(range);
+        range = next;
+    }
+
+    merged->start = merged_start;
+    merged->end = merged_end;
+    merged->contents = merged_contents;
+    merged->next = after;
+    *link = merged;
+    queue->pending_bytes += (merged_end - merged_start) * element_size;
+
+    pthread_cond_signal(&queue->work);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+int32_t writeback_queue_flush(writeback_queue_t *queue) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->pending != NULL || queue->writing != NULL) {
+        queue->flush_requested = true;
+        pthread_cond_signal(&queue->work);
+        pthread_cond_wait(&queue->done, &queue->lock);
+    }
+    int32_t failure = queue->failure;
+    queue->failure = 0;
+    pthread_mutex_unlock(&queue->lock);
+    return failure;
+}
+
+int32_t writeback_queue_read(writeback_queue_t *queue, writeback_read_t read, void *read_data,
+                             uintptr_t start, uintptr_t end, unsigned char *target) {
+    while (true) {
+        pthread_mutex_lock(&queue->lock);
+        uint64_t batches_written = queue->batches_written;
+        pthread_mutex_unlock(&queue->lock);
+
+        int32_t result = read(read_data, start, end, target);
+        if (result != 0) {
+            return result;
+        }
+
+        // If a batch reached the file while we were reading, we may have
+        // read a mix of old and new data and no longer have the new data
+        // in the queue to patch it up with, so read again.
+        pthread_mutex_lock(&queue->lock);
+        if (batches_written == queue->batches_written) {
+            overlay_ranges(queue, queue->writing, start, end, target);
+            overlay_ranges(queue, queue->pending, start, end, target);
+            pthread_mutex_unlock(&queue->lock);
+            return 0;
+        }
+        pthread_mutex_unlock(&queue->lock);
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+// Pending bytes at which writers wait for the background thread to catch up.
+#define WRITEBACK_DEFAULT_BUDGET (64 * 1024 * 1024)
+
+// How long the background thread waits for adjacent ranges to arrive before
+// it starts writing.
+#define WRITEBACK_LINGER_MS 10
+
+// Writes the range of elements [start, end) to the file, returns 0 on
+// success. Called from the background thread, so it must not call into R.
+typedef int32_t (*writeback_write_t)(void *data, uintptr_t start, uintptr_t end, const unsigned char *contents);
+
+// Reads the range of elements [start, end) from the file, see prefetch.h.
+typedef int32_t (*writeback_read_t)(void *data, uintptr_t start, uintptr_t end, unsigned char *target);
+
+typedef struct writeback_range {
+    uintptr_t               start;
+    uintptr_t               end;
+    unsigned char          *contents;
+    struct writeback_range *next;
+} writeback_range_t;
+
+// Collects dirty ranges, merges the ones that overlap or touch, and writes
+// them out on a background thread.
+typedef struct {
+    writeback_write_t  write;
+    void              *write_data;
+    size_t             element_size;
+    size_t             budget;          /* in bytes */
+
+    writeback_range_t *pending;         // sorted by start, disjoint, not touching
+    size_t             pending_bytes;
+    writeback_range_t *writing;         // taken by the background thread
+    uint64_t           batches_written; // bumped whenever a batch reaches the file
+    int32_t            failure;         // first failure since the last flush
+
+    bool               flush_requested;
+    bool               shutdown;
+    pthread_mutex_t    lock;
+    pthread_cond_t     work;
+    pthread_cond_t     done;
+    pthread_t          thread;
+} writeback_queue_t;
+
+writeback_queue_t *writeback_queue_new(writeback_write_t write, void *write_data, size_t element_size, size_t budget);
+
+// Flush the queue, stop the background thread, and free the queue.
+// Returns the first write error, or 0.
+int32_t writeback_queue_free(writeback_queue_t *queue);
+
+/**
+ * Queue a copy of the elements [start, end). Ranges overlapping or adjacent
+ * to already queued ones are merged with them, the newer contents win.
+ * Blocks while the queue is over its byte budget.
+ */
+void writeback_queue_push(writeback_queue_t *queue, uintptr_t start, uintptr_t end, const unsigned char *contents);
+
+/**
+ * Wait until everything queued so far has been written out.
+ *
+ * @return the first write error since the last flush, or 0.
+ */
+int32_t writeback_queue_flush(writeback_queue_t *queue);
+
+/**
+ * Read the elements [start, end) with the provided reader, and then replace
+ * the parts that are still waiting in the queue with their queued contents,
+ * so a populate never sees data older than what was written back.
+ */
+int32_t writeback_queue_read(writeback_queue_t *queue, writeback_read_t read, void *read_data,
+                             uintptr_t start, uintptr_t end, unsigned char *target);
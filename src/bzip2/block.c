@@ -85,13 +85,16 @@ Block *Block_from(Blocks *boundaries, size_t index) {
 
     // Alloc the buffre for the chunk
     unsigned char *buffer = (unsigned char *) calloc(buffer_size_in_bytes, sizeof(unsigned char));
-    memset(buffer, 0, buffer_size_in_bytes);
+    if (buffer == NULL) {
+        UFO_REPORT("cannot allocate %li bytes for block %li\n", buffer_size_in_bytes, index);
+        return NULL;
+    }
 
     // Open file for reading the remainder
     FileBitStream *input_stream = FileBitStream_new(boundaries->path);
     if (input_stream == NULL) {
         UFO_REPORT("cannot open bit stream for %s\n", boundaries->path);
-        // TODO free what needs freeing
+        free(buffer);
         return NULL;
     }
 
@@ -102,7 +105,7 @@ Block *Block_from(Blocks *boundaries, size_t index) {
         if (byte < 0) {
             UFO_REPORT("cannot read byte from bit stream\n");
             FileBitStream_free(input_stream);
-            // TODO free what needs freeing
+            free(buffer);
             return NULL;
         }
         buffer[read_bytes] = byte;
@@ -113,6 +116,8 @@ Block *Block_from(Blocks *boundaries, size_t index) {
     int seek_result = FileBitStream_seek_bit(input_stream, block_start_offset_in_bits);
     if (seek_result < 0) {
         UFO_REPORT("cannot seek to %lib offset\n", block_start_offset_in_bits);
+        FileBitStream_free(input_stream);
+        free(buffer);
         return NULL;
     }
 
@@ -122,7 +127,7 @@ Block *Block_from(Blocks *boundaries, size_t index) {
     if (block_crc < 0) {
         UFO_REPORT("Cannot read uint32 from bit stream.\n");
         FileBitStream_free(input_stream);
-        // TODO free what needs freeing
+        free(buffer);
         return NULL;
     }
 
@@ -147,7 +152,7 @@ Block *Block_from(Blocks *boundaries, size_t index) {
         if (byte < 0) {
             UFO_REPORT("Cannot read byte from bit stream.\n");
             FileBitStream_free(input_stream);
-            // TODO free what needs freeing
+            free(buffer);
             return NULL;
         }
         buffer[read_bytes] = byte;
@@ -164,6 +169,9 @@ Block *Block_from(Blocks *boundaries, size_t index) {
         int bit = FileBitStream_read_bit(input_stream);
         if (bit < 0) {
             UFO_REPORT("cannot read bit from bit stream.\n");
+            BitBuffer_free(bit_buffer);
+            FileBitStream_free(input_stream);
+            free(buffer);
             return NULL;
         }
 
@@ -171,6 +179,9 @@ Block *Block_from(Blocks *boundaries, size_t index) {
         int result = BitBuffer_append_bit(bit_buffer, (unsigned char) bit);
         if (result < 0) {
             UFO_REPORT("Cannot write bit to bit buffer.\n");
+            BitBuffer_free(bit_buffer);
+            FileBitStream_free(input_stream);
+            free(buffer);
             return NULL;
         }
     }
@@ -183,6 +194,9 @@ Block *Block_from(Blocks *boundaries, size_t index) {
         int result = BitBuffer_append_byte(bit_buffer, footer_magic[footer_magic_byte]);
         if (result < 0) {
             UFO_REPORT("cannot write magic footer byte to bit buffer\n");
+            BitBuffer_free(bit_buffer);
+            FileBitStream_free(input_stream);
+            free(buffer);
             return NULL;
         }
     }
@@ -192,6 +206,9 @@ Block *Block_from(Blocks *boundaries, size_t index) {
     int result = BitBuffer_append_uint32(bit_buffer, block_crc);
     if (result < 0) {
         UFO_REPORT("cannot write CRC byte to bit buffer\n");
+        BitBuffer_free(bit_buffer);
+        FileBitStream_free(input_stream);
+        free(buffer);
         return NULL;
     }  
 
@@ -206,9 +223,11 @@ Block *Block_from(Blocks *boundaries, size_t index) {
     block->buffer = buffer;
     block->size = read_bytes;
     block->max_size = buffer_size_in_bytes;
+    block->crc = block_crc;
 
     // Free what needs freeing
     BitBuffer_free(bit_buffer);
+    FileBitStream_free(input_stream);
 
     // Do not release buffer, because that's what we return. Make sure to free
     // it afterwards though.
@@ -216,6 +235,139 @@ Block *Block_from(Blocks *boundaries, size_t index) {
     return block;
 }
 
+// Appends bits to a byte buffer, most significant bit first.
+typedef struct {
+    unsigned char *data;
+    uint64_t       bits;
+} BitWriter;
+
+static void BitWriter_append_bits(BitWriter *writer, uint64_t value, int count) {
+    for (int i = count - 1; i >= 0; i--) {
+        if ((value >> i) & 1) {
+            writer->data[writer->bits / 8] |= 0x80 >> (writer->bits % 8);
+        }
+        writer->bits++;
+    }
+}
+
+// Copies the bits [from, from + count) of source to the writer, which must be
+// at a byte boundary.
+static void BitWriter_copy_bits(BitWriter *writer, const unsigned char *source, uint64_t from, uint64_t count) {
+    unsigned char *target = writer->data + writer->bits / 8;
+    const unsigned char *first = source + from / 8;
+    int shift = from % 8;
+    uint64_t whole_bytes = count / 8;
+    if (shift == 0) {
+        memcpy(target, first, whole_bytes);
+    } else {
+        for (uint64_t i = 0; i < whole_bytes; i++) {
+            target[i] = (unsigned char) ((first[i] << shift) | (first[i + 1] >> (8 - shift)));
+        }
+    }
+    writer->bits += whole_bytes * 8;
+
+    uint64_t rest = from + whole_bytes * 8;
+    for (uint64_t bit = rest; bit < from + count; bit++) {
+        BitWriter_append_bits(writer, (source[bit / 8] >> (7 - bit % 8)) & 1, 1);
+    }
+}
+
+Block *Block_from_memory(const unsigned char *data, size_t size, uint64_t header_end_offset_in_bits,
+                         uint64_t block_start_offset_in_bits, uint64_t block_end_offset_in_bits) {
+
+    // Same layout as in Block_from: the stream header and the first block
+    // magic, the block itself, and a stream footer carrying the block CRC.
+    const uint64_t payload_size_in_bits = block_end_offset_in_bits - block_start_offset_in_bits + 1;
+    if (header_end_offset_in_bits % 8 != 0
+        || block_end_offset_in_bits < block_start_offset_in_bits
+        || payload_size_in_bits < 32
+        || block_end_offset_in_bits >= (uint64_t) size * 8) {
+        return NULL;
+    }
+
+    uint64_t buffer_size_in_bits = header_end_offset_in_bits + payload_size_in_bits + 80;
+    uint64_t buffer_size_in_bytes = (buffer_size_in_bits + 7) / 8;
+
+    unsigned char *buffer = (unsigned char *) calloc(buffer_size_in_bytes, sizeof(unsigned char));
+    Block *block = (Block *) malloc(sizeof(Block));
+    if (buffer == NULL || block == NULL) {
+        free(buffer);
+        free(block);
+        return NULL;
+    }
+
+    uint32_t block_crc = 0;
+    for (uint64_t bit = block_start_offset_in_bits; bit < block_start_offset_in_bits + 32; bit++) {
+        block_crc = (block_crc << 1) | ((data[bit / 8] >> (7 - bit % 8)) & 1);
+    }
+
+    BitWriter writer = { buffer, 0 };
+    memcpy(buffer, data, header_end_offset_in_bits / 8);
+    writer.bits = header_end_offset_in_bits;
+    BitWriter_copy_bits(&writer, data, block_start_offset_in_bits, payload_size_in_bits);
+    for (int i = 0; i < footer_magic_size; i++) {
+        BitWriter_append_bits(&writer, footer_magic[i], 8);
+    }
+    BitWriter_append_bits(&writer, block_crc, 32);
+
+    block->buffer = buffer;
+    block->size = buffer_size_in_bytes;
+    block->max_size = buffer_size_in_bytes;
+    block->crc = block_crc;
+    return block;
+}
+
+int64_t Block_decompressed_size(Block *block) {
+    bz_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (BZ2_bzDecompressInit(&stream, /*verbosity*/ 0, /*small*/ 0) != BZ_OK) {
+        return -1;
+    }
+
+    // The output is thrown away, so a small buffer is reused.
+    char output_buffer[64 * 1024];
+    stream.avail_in = block->size;
+    stream.next_in = (char *) block->buffer;
+
+    int64_t decompressed_size = 0;
+    while (true) {
+        stream.avail_out = sizeof(output_buffer);
+        stream.next_out = output_buffer;
+        int result = BZ2_bzDecompress(&stream);
+        decompressed_size += sizeof(output_buffer) - stream.avail_out;
+
+        if (result == BZ_STREAM_END) {
+            break;
+        }
+        if (result != BZ_OK || (stream.avail_in == 0 && stream.avail_out > 0)) {
+            BZ2_bzDecompressEnd(&stream);
+            return -1;
+        }
+    }
+
+    BZ2_bzDecompressEnd(&stream);
+    return decompressed_size;
+}
+
+int64_t Block_decompress_into(Block *block, size_t output_buffer_size, char *output_buffer) {
+    bz_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (BZ2_bzDecompressInit(&stream, /*verbosity*/ 0, /*small*/ 0) != BZ_OK) {
+        return -1;
+    }
+
+    stream.avail_in = block->size;
+    stream.next_in = (char *) block->buffer;
+    stream.avail_out = output_buffer_size;
+    stream.next_out = output_buffer;
+
+    // The whole block has to fit into the output buffer.
+    int result = BZ2_bzDecompress(&stream);
+    int64_t decompressed_size = output_buffer_size - stream.avail_out;
+    BZ2_bzDecompressEnd(&stream);
+    return result == BZ_STREAM_END ? decompressed_size : -1;
+}
+
 int Block_decompress(Block *block, size_t output_buffer_size, char *output_buffer) {
 
     // Hand-crank the BZip2 decompressor
@@ -225,9 +377,6 @@ int Block_decompress(Block *block, size_t output_buffer_size, char *output_buffe
         return -1;
     }         
 
-    // Set array contents to zero, just in case.
-    memset(output_buffer, 0x7c, output_buffer_size);
-
     // Tell BZip2 where to write decompressed data.
 	stream->avail_out = output_buffer_size;
 	stream->next_out = output_buffer;
@@ -248,6 +397,7 @@ int Block_decompress(Block *block, size_t output_buffer_size, char *output_buffe
     if (result != BZ_OK && result != BZ_STREAM_END) { 
         UFO_REPORT("Cannot process stream, error no.: %i.\n", result);
         BZ2_bzDecompressEnd(stream);
+        free(stream);
         return -3;
     };
 
@@ -255,24 +405,29 @@ int Block_decompress(Block *block, size_t output_buffer_size, char *output_buffe
         && stream->avail_in == 0 
         && stream->avail_out > 0) {
         BZ2_bzDecompressEnd(stream);
+        free(stream);
         UFO_REPORT("Cannot process stream, unexpected end of file.\n");        
         return -4; 
     };
 
     if (result == BZ_STREAM_END) {        
         UFO_LOG("Finshed processing stream.\n");  
-        BZ2_bzDecompressEnd(stream); 
-        return output_buffer_size - stream->avail_out;
+        int decompressed_size = output_buffer_size - stream->avail_out;
+        BZ2_bzDecompressEnd(stream);
+        free(stream);
+        return decompressed_size;
     };
 
     if (stream->avail_out == 0) {   
         UFO_LOG("Stream ended: no data read.\n");  
         BZ2_bzDecompressEnd(stream);
+        free(stream);
         return output_buffer_size; 
     };
 
     // Supposedly unreachable.
     UFO_REPORT("Unreachable isn't.\n");  
     BZ2_bzDecompressEnd(stream);
+    free(stream);
     return 0;
 }
\ No newline at end of file
@@ -10,8 +10,22 @@ typedef struct {
     unsigned char   *buffer;
     size_t  size;
     size_t  max_size;
+    uint32_t crc;
 } Block;
 
 Block *Block_from(Blocks *boundaries, size_t index);
+
+// Same as Block_from, but takes the block out of an archive in memory, and
+// does not log, so it can be called from worker threads. Returns NULL if the
+// offsets are out of bounds or memory runs out.
+Block *Block_from_memory(const unsigned char *data, size_t size, uint64_t header_end_offset_in_bits,
+                         uint64_t block_start_offset_in_bits, uint64_t block_end_offset_in_bits);
+
+// Decompresses the block only to count its bytes, or returns -1 on error.
+// Does not log.
+int64_t Block_decompressed_size(Block *block);
 void Block_free(Block *block);
-int Block_decompress(Block *block, size_t output_buffer_size, char *output_buffer);
\ No newline at end of file
+int Block_decompress(Block *block, size_t output_buffer_size, char *output_buffer);
+
+// Same as Block_decompress, but returns -1 on any error and does not log.
+int64_t Block_decompress_into(Block *block, size_t output_buffer_size, char *output_buffer);
\ No newline at end of file
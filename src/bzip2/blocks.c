@@ -2,289 +2,295 @@
 #include "block.h"
 #include "bitstream.h"
 #include "shift.h"
+#include "index.h"
+#include "marks.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "../safety_first.h"
 #include "../debug.h"
 
-Blocks *Blocks_parse(const char *input_file_path) {
-
-    // Open file for reading.
-    FileBitStream *input_stream = FileBitStream_new(input_file_path);
-    if (input_stream == NULL) {
-        UFO_LOG("Cannot open file %s.\n", input_file_path);  
+Blocks *Blocks_empty(const char *path, size_t capacity) {
+    Blocks *blocks = (Blocks *) calloc(1, sizeof(Blocks));
+    if (NULL == blocks) {
         return NULL;
     }
+    blocks->path = strdup(path);
+    if (blocks->path == NULL || 0 != Blocks_reserve(blocks, capacity)) {
+        Blocks_free(blocks);
+        return NULL;
+    }
+    return blocks;
+}
 
-    size_t blocks = 0;
-    uint64_t start_offset[MAX_BLOCKS];
-    uint64_t end_offset[MAX_BLOCKS];
+static int Blocks_grow_array(void **array, size_t element_size, size_t capacity) {
+    void *grown = realloc(*array, element_size * capacity);
+    if (grown == NULL) {
+        return -1;
+    }
+    *array = grown;
+    return 0;
+}
 
-    // Initialize the counters.
-    Blocks *boundaries = (Blocks *) malloc(sizeof(Blocks));    
+int Blocks_reserve(Blocks *blocks, size_t capacity) {
+    if (capacity <= blocks->capacity) {
+        return 0;
+    }
+    // Arrays that were grown before a failure stay grown, which is harmless.
+    if (0 != Blocks_grow_array((void **) &blocks->start_offset, sizeof(uint64_t), capacity)
+        || 0 != Blocks_grow_array((void **) &blocks->end_offset, sizeof(uint64_t), capacity)
+        || 0 != Blocks_grow_array((void **) &blocks->decompressed_start_offset, sizeof(uint64_t), capacity)
+        || 0 != Blocks_grow_array((void **) &blocks->decompressed_end_offset, sizeof(uint64_t), capacity)
+        || 0 != Blocks_grow_array((void **) &blocks->crc, sizeof(uint32_t), capacity)) {
+        return -1;
+    }
+    blocks->capacity = capacity;
+    return 0;
+}
+
+int Blocks_append(Blocks *blocks, uint64_t start_offset, uint64_t end_offset) {
+    if (blocks->blocks == blocks->capacity
+        && 0 != Blocks_reserve(blocks, blocks->capacity ? 2 * blocks->capacity : 16)) {
+        return -1;
+    }
+    size_t block = blocks->blocks++;
+    blocks->start_offset[block] = start_offset;
+    blocks->end_offset[block] = end_offset;
+    blocks->decompressed_start_offset[block] = 0;
+    blocks->decompressed_end_offset[block] = 0;
+    blocks->crc[block] = 0;
+    return 0;
+}
+
+// Turns the positions of magic numbers into block boundaries. A block runs
+// from just past its header magic to just before the next magic number.
+static Blocks *Blocks_from_marks(const char *input_file_path, const MarkList *marks, size_t size) {
+    // There are at most as many blocks as there are marks.
+    Blocks *boundaries = Blocks_empty(input_file_path, marks->count);
     if (NULL == boundaries) {
         UFO_REPORT("Cannot allocate a struct for recording block boundaries.\n");  
         return NULL;
     }
 
-    boundaries->path = strdup(input_file_path);
-    boundaries->blocks = 0;
-    boundaries->bad_blocks = 0;
-
-    // Shifting buffer consisting of two parts: senior (most significant) and
-    // junior (least significant).
-    //ShiftRegister shift_register = {0, 0};
-    
-    while (true) {
-        int bit = FileBitStream_read_bit(input_stream);
-
-        // In case of errors or encountering end of file. We recover, although
-        // we probably shouldn't. I don't want to mess with the function too
-        // much.
-        if (bit < 0) {
-            // If we're inside a block (not at the beginning or within an end
-            // marker) we UFO_REPORT an error and stop processing the block.
-            if (input_stream->read_bits >= start_offset[blocks] && 
-               (input_stream->read_bits - start_offset[blocks]) >= 40) {
-                end_offset[blocks] = input_stream->read_bits - 1;
-                if (blocks > 0) {
-                    UFO_LOG("Block %li runs from %li to %li (incomplete)\n",
-                            blocks, 
-                            start_offset[blocks], 
-                            end_offset[blocks]);
+    for (size_t i = 0; i < marks->count; i++) {
+        if (marks->marks[i].end_of_stream) {
+            continue;
+        }
 
-                    boundaries->bad_blocks++;
-                }               
-            } else {
-                // Otherwise, I guess this is just EOF?
-                blocks--;
+        uint64_t start_offset = marks->marks[i].bit_offset + 48;
+        if (i + 1 == marks->count) {
+            // No end-of-stream marker after the last block, unless what is
+            // left is just the stream CRC and padding.
+            if ((uint64_t) size * 8 - start_offset >= 40) {
+                UFO_LOG("Block %li starting at %li is incomplete\n", boundaries->blocks + 1, start_offset);
+                boundaries->bad_blocks++;
             }
-
-            // Proceed to next block.
             break;
         }
+        uint64_t end_offset = marks->marks[i + 1].bit_offset - 1;
 
-        // Detect block header or block end mark
-        if (ShiftRegister_equal_with_senior_mask(&input_stream->shift_register, &block_header_template, 0x0000ffff)
-            || ShiftRegister_equal_with_senior_mask(&input_stream->shift_register, &block_endmark_template, 0x0000ffff)) {
-
-            // If we found a bounary, the end of the preceding block is 49 bytes
-            // ago (or zero if it's the first block)
-            end_offset[blocks] = 
-                (input_stream->read_bits > 49) ? input_stream->read_bits - 49 : 0;
-
-            // We finished reading a whole block
-            if (blocks > 0 
-                && (end_offset[blocks] 
-                - start_offset[blocks]) >= 130) {
-
-                UFO_LOG("Block %li runs from %li to %li\n",
-                    boundaries->blocks + 1, 
-                    start_offset[blocks], 
-                    end_offset[blocks]);
-
-                // Store the offsets
-                boundaries->start_offset[boundaries->blocks] = 
-                    start_offset[blocks];
-                boundaries->end_offset[boundaries->blocks] = 
-                    end_offset[blocks];
+        if (end_offset - start_offset < 130) {
+            continue;
+        }
 
-                // Increment number of complete blocks so far
-                boundaries->blocks++;
+        Blocks_append(boundaries, start_offset, end_offset);
+    }
 
-                //start_offset[blocks] = input_stream->read_bits;
-            }
+    UFO_LOG("Found %li blocks in %s\n", boundaries->blocks, input_file_path);
+    return boundaries;
+}
 
-            // Too many blocks
-            if (blocks >= MAX_BLOCKS) {
-                UFO_REPORT("analyzer can handle up to %i blocks, "
-                                "but more blocks were found in file %s\n",
-                                MAX_BLOCKS, input_stream->path);
-                free(boundaries);
-                return NULL;
-            }
+const unsigned char *Blocks_map(const char *input_file_path, size_t *size) {
+    int fd = open(input_file_path, O_RDONLY);
+    if (fd < 0) {
+        UFO_LOG("Cannot open file %s.\n", input_file_path);  
+        return NULL;
+    }
+    struct stat file_info;
+    if (fstat(fd, &file_info) < 0 || file_info.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    void *data = mmap(NULL, file_info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        UFO_LOG("Cannot map file %s.\n", input_file_path);  
+        return NULL;
+    }
+    // Every byte is going to be looked at once.
+    madvise(data, file_info.st_size, MADV_WILLNEED);
+    *size = file_info.st_size;
+    return (const unsigned char *) data;
+}
 
-            // Increment number of blocks encountered so far and record the
-            // start offset of next encountered block
-            blocks++;
-            start_offset[blocks] = input_stream->read_bits;
-        }
+static Blocks *Blocks_parse_memory(const char *input_file_path, const unsigned char *data, size_t size) {
+    MarkList *marks = Marks_find(data, size, Marks_thread_count());
+    if (marks == NULL) {
+        UFO_REPORT("Cannot allocate memory to scan file %s.\n", input_file_path);  
+        return NULL;
     }
+    Blocks *boundaries = Blocks_from_marks(input_file_path, marks, size);
+    MarkList_free(marks);
+    return boundaries;
+}
 
-    // Clean up and exit
-    FileBitStream_free(input_stream);        
+Blocks *Blocks_parse(const char *input_file_path) {
+    size_t size;
+    const unsigned char *data = Blocks_map(input_file_path, &size);
+    if (data == NULL) {
+        return NULL;
+    }
+    Blocks *boundaries = Blocks_parse_memory(input_file_path, data, size);
+    munmap((void *) data, size);
     return boundaries;
 }
 
 void Blocks_free(Blocks *blocks) {
     free((void *) blocks->path); // because allocated by strdup
+    free(blocks->start_offset);
+    free(blocks->end_offset);
+    free(blocks->decompressed_start_offset);
+    free(blocks->decompressed_end_offset);
+    free(blocks->crc);
     free(blocks);
 }
 
-Blocks *Blocks_new(const char *filename, size_t buffer_size) {
-    // Parse the file.
-    Blocks *blocks = Blocks_parse(filename);
-
-    // Create the structures for outputting the decompressed data into
-    // (temporarily).
-    blocks->buffer_size = buffer_size;
-    size_t output_buffer_size = 1024 * 1024 * 1024; // 1MB
-    char *output_buffer = (char *) calloc(output_buffer_size, sizeof(char));
-    
-    // Unfortunatelly, we need to scan the entire file to figure out where the blocks go when decompressed.
-    size_t end_of_last_decompressed_block = 0;
-    for (size_t i = 0; i < blocks->blocks; i++) {
-
-        // Extract a single compressed block.
-        Block *block = Block_from(blocks, i);        
-        int output_buffer_occupancy = Block_decompress(block, output_buffer_size, output_buffer);
-        UFO_LOG("Finished decompressing block %li, found %i elements\n", i, output_buffer_occupancy);   
-
-        // Cleanup: we don't actually need the block for anything, except size.
-        Block_free(block);
+typedef struct {
+    const Blocks        *blocks;
+    const unsigned char *data;
+    size_t               size;
+    int64_t             *decompressed_sizes;  // -1 for blocks that failed
+    size_t               next_block;
+    pthread_mutex_t      lock;
+} SizingTask;
+
+// Worker that decompresses blocks one after another until none are left,
+// to learn their sizes. Must not call into R.
+static void *Blocks_measure(void *argument) {
+    SizingTask *task = (SizingTask *) argument;
+    const Blocks *blocks = task->blocks;
 
-        if (output_buffer_occupancy < 0) {
-            UFO_REPORT("Failed to decompress block %li, stopping\n", i);
-            break;
+    while (true) {
+        pthread_mutex_lock(&task->lock);
+        size_t index = task->next_block++;
+        pthread_mutex_unlock(&task->lock);
+        if (index >= blocks->blocks) {
+            return NULL;
         }
 
-        // Calculate start and end of this block when it is decompressed.
-        // TODO we could defer some of this.
-        blocks->decompressed_start_offset[i] = end_of_last_decompressed_block + (0 == i ? 0 : 1);        
-        blocks->decompressed_end_offset[i] = blocks->decompressed_start_offset[i] + output_buffer_occupancy;
-        end_of_last_decompressed_block = blocks->decompressed_end_offset[i];        
+        Block *block = Block_from_memory(task->data, task->size, blocks->start_offset[0],
+                                         blocks->start_offset[index], blocks->end_offset[index]);
+        if (block == NULL) {
+            task->decompressed_sizes[index] = -1;
+            continue;
+        }
+        task->decompressed_sizes[index] = Block_decompressed_size(block);
+        ((Blocks *) blocks)->crc[index] = block->crc;
+        free(block->buffer);
+        free(block);
     }
-
-    // Cleanup
-    free(output_buffer);
-
-    // Add one, because end is inclusive.
-    blocks->decompressed_size = end_of_last_decompressed_block + 1;
-    return blocks;
 }
 
-int32_t Blocks_read(Blocks *blocks, uintptr_t start /*byte index*/, uintptr_t end /*byte index*/, unsigned char* target) {
+Blocks *Blocks_new(const char *filename) {
+    // Skip the scan if the file was already indexed.
+    Blocks *blocks = Blocks_load_index(filename);
+    if (blocks != NULL) {
+        return blocks;
+    }
+
+    size_t size;
+    const unsigned char *data = Blocks_map(filename, &size);
+    if (data == NULL) {
+        return NULL;
+    }
 
-    for (size_t block = 0; block < blocks->blocks; block ++) {
-        UFO_LOG("UFO checking block lengths: block %li : decompressed %li-%li [%li]\n", block,
-            blocks->decompressed_start_offset[block], blocks->decompressed_end_offset[block], 
-            blocks->decompressed_end_offset[block] - blocks->decompressed_start_offset[block] + 1);
+    // Parse the file.
+    blocks = Blocks_parse_memory(filename, data, size);
+    if (blocks == NULL) {
+        munmap((void *) data, size);
+        return NULL;
     }
 
-    size_t block_index = 0;
-    bool found_start = false;
+    // Unfortunatelly, we need to decompress the entire file to figure out
+    // where the blocks go when decompressed. Blocks are independent, so
+    // they are decompressed in parallel.
+    SizingTask task;
+    task.blocks = blocks;
+    task.data = data;
+    task.size = size;
+    task.next_block = 0;
+    task.decompressed_sizes = (int64_t *) calloc(blocks->blocks ? blocks->blocks : 1, sizeof(int64_t));
+    if (task.decompressed_sizes == NULL) {
+        UFO_REPORT("Cannot allocate memory to index file %s.\n", filename);
+        munmap((void *) data, size);
+        Blocks_free(blocks);
+        return NULL;
+    }
+    pthread_mutex_init(&task.lock, NULL);
 
-    // Ignore blocks that do not are not a part of the current segment.
-    for (; block_index < blocks->blocks; block_index++) {
-        if (start >= blocks->decompressed_start_offset[block_index] && start <= blocks->decompressed_end_offset[block_index]) { 
-            found_start = true;
-            UFO_LOG("UFO will start at block %li: start=%li <= decompressed_offset=%li\n", 
-                block_index, start, blocks->decompressed_start_offset[block_index]);
+    size_t threads = Marks_thread_count();
+    if (threads > blocks->blocks) {
+        threads = blocks->blocks;
+    }
+    pthread_t workers[MARKS_MAX_THREADS];
+    size_t started = 0;
+    for (; started + 1 < threads; started++) {
+        if (0 != pthread_create(&workers[started], NULL, Blocks_measure, &task)) {
             break;
         }
-       UFO_LOG("UFO skips block %li: start=%li <= decompressed_offset=%li \n", 
-            block_index, start, blocks->decompressed_start_offset[block_index]);
     }
-
-    // The start index is not within any of the blocks?
-    if (!found_start) {
-        UFO_LOG("Start index %li is not within any of the BZip2 blocks.\n", start); 
-        return 1;
+    Blocks_measure(&task);
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
     }
+    pthread_mutex_destroy(&task.lock);
+    munmap((void *) data, size);
 
-    // At this point block index is the index of the block containing the start.
-    // We calculate the bytes_to_skip: the offset of the start of the UFO segment with
-    // respect to the first value in the Bzip2 block.
-    size_t bytes_to_skip = start - (blocks->decompressed_start_offset[block_index]);
-    UFO_LOG("UFO will skip %lu bytes of block %lu\n", bytes_to_skip, block_index);
-
-    // The index in the target buffer.
-    // size_t target_index = 0;
-
-    // Temp buffers, because I don't know how to do it without it.
-    size_t decompressed_buffer_size = blocks->buffer_size; // 1MB
-    char *decompressed_buffer = (char *) calloc(decompressed_buffer_size, sizeof(char));
-    // memset(decompressed_buffer, 0x5c, decompressed_buffer_size); // FIXME remove
-
-    // Check if we filled all the requested bytes from all the necessary BZip blocks.
-    bool found_end = false;
-
-    // The offset in target at which to paste the next decompressed BZip block.
-    size_t offset_in_target = 0;
-
-    // The number of bytes we still have to generate.
-    size_t left_to_fill_in_target = end - start;
-
-    // Decompress blocks, until required number of decompressed blocks produce
-    // the prerequisite number of bytes of data.
-    for (; block_index < blocks->blocks; block_index++) {
-
-        UFO_LOG("UFO loads and decompresses block %li.\n", block_index);
+    size_t decompressed_so_far = 0;
+    for (size_t i = 0; i < blocks->blocks; i++) {
+        int64_t decompressed_size = task.decompressed_sizes[i];
+        UFO_LOG("Finished decompressing block %li, found %li elements\n", i, decompressed_size);   
 
-        // Retrive and decompress the block.
-        Block *block = Block_from(blocks, block_index);
-        int decompressed_buffer_occupancy = Block_decompress(block, decompressed_buffer_size, decompressed_buffer);
-        if (decompressed_buffer_occupancy <= 0) {
-            UFO_REPORT("UFO failed to decompress BZip.\n");
-            return -1;
-        } else {
-            UFO_LOG("UFO retrieved %i elements by decompressing block %li.\n", 
-                decompressed_buffer_occupancy, block_index);
+        if (decompressed_size <= 0) {
+            UFO_REPORT("Failed to decompress block %li, stopping\n", i);
+            blocks->bad_blocks++;
+            break;
         }
-        size_t elements_to_copy = decompressed_buffer_occupancy - bytes_to_skip;
-        UFO_LOG("UFO can retrieve %lu = %i - %li elements from BZip block "
-            "and needs to grab %lu elements to fill the target location.\n", 
-            elements_to_copy, decompressed_buffer_occupancy, bytes_to_skip, left_to_fill_in_target);
-        if (elements_to_copy > left_to_fill_in_target) {            
-            elements_to_copy = left_to_fill_in_target;
-        }        
-        UFO_LOG("UFO will grab %lu elements from BZip decompressed block to fill the target location.\n", 
-            elements_to_copy);
-        make_sure(decompressed_buffer_occupancy >= bytes_to_skip, "More bytes to skip, than bytes in buffer");
-
-        UFO_LOG("UFO copies %lu elements from decompressed block %lu to target area %p = %p + %lu\n", 
-            elements_to_copy, block_index, decompressed_buffer + bytes_to_skip, 
-            decompressed_buffer, bytes_to_skip);
-
-        // Copy the contents of the block to the target area. I can't do this
-        // without this intermediate buffer, because the first block might need
-        // to discard some number of bytes from the front. 
-        // 
-        // Also the last one has to disregards some number of bytes from the
-        // back, but the block won't produce anything unless it's given room to
-        // write out the whole block. <-- TODO: this needs verification        
-        memcpy(/* destination */ target + offset_in_target, 
-               /* source      */ decompressed_buffer + bytes_to_skip, 
-               /* elements    */ elements_to_copy); // TODO remove elements to make sure we don't load more than `end`
 
-        // Start filling the target in the next iteration from the palce we
-        // finished here.
-        offset_in_target += elements_to_copy;
-
-        // We copied these many elements already.
-        left_to_fill_in_target -= elements_to_copy;     
+        // Calculate start and end of this block when it is decompressed. The
+        // end is inclusive.
+        blocks->decompressed_start_offset[i] = decompressed_so_far;
+        blocks->decompressed_end_offset[i] = decompressed_so_far + decompressed_size - 1;
+        decompressed_so_far += decompressed_size;
+    }
+    free(task.decompressed_sizes);
 
-        // Only the first block has bytes_to_skip != 0.
-        bytes_to_skip = 0;   
+    blocks->decompressed_size = decompressed_so_far;
 
-        // Cleanup.
-        Block_free(block);        
+    // Remember the table for next time, unless the archive is damaged.
+    if (blocks->bad_blocks == 0) {
+        Blocks_store_index(blocks);
+    }
+    return blocks;
+}
 
-        if ((end - 1) >= blocks->decompressed_start_offset[block_index] 
-            && (end - 1) <= blocks->decompressed_end_offset[block_index]) { 
-            found_end = true;
-            break;
+size_t Blocks_find(const Blocks *blocks, uintptr_t offset) {
+    // Find the last block that starts at or before the offset.
+    size_t low = 0, high = blocks->blocks;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (blocks->decompressed_start_offset[middle] <= offset) {
+            low = middle + 1;
+        } else {
+            high = middle;
         }
     }
-
-    // Cleanup
-    free(decompressed_buffer);
-
-    // TODO check if found end
-    if (!found_end) {
-        UFO_REPORT("did not find a block containing the end of "
-                "the segment range [%li-%li].\n", start, end);
-        return 1;
+    if (low == 0 || offset > blocks->decompressed_end_offset[low - 1]) {
+        return blocks->blocks;
     }
-
-    return 0;
-}
\ No newline at end of file
+    return low - 1;
+}
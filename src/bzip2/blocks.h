@@ -4,27 +4,39 @@
 #include <stdbool.h>
 #include <stddef.h>
 
-// This is the maximum number of blocks that we expect in a file. We cannot
-// process more than this number. 50K blocks represents 40GB+ of uncompressed
-// data. 
-#define MAX_BLOCKS 50000 // TODO: grow the vector instead? or parameterize
-
 // A structure representing blocks in a BZIP2 file. Records offset of beginning
-// and end of each block.
+// and end of each block. The arrays hold capacity entries, the first blocks
+// of which are used. Ends are inclusive.
 typedef struct {
     const char *path;
     size_t blocks;
-    uint64_t start_offset[MAX_BLOCKS];
-    uint64_t end_offset[MAX_BLOCKS];
-    uint64_t decompressed_start_offset[MAX_BLOCKS];    
-    uint64_t decompressed_end_offset[MAX_BLOCKS];   
+    size_t capacity;
+    uint64_t *start_offset;
+    uint64_t *end_offset;
+    uint64_t *decompressed_start_offset;    
+    uint64_t *decompressed_end_offset;   
+    uint32_t *crc;
     size_t bad_blocks;
     size_t decompressed_size;
-    size_t buffer_size;
 } Blocks;
 
+// An empty table with room for capacity blocks, or NULL.
+Blocks *Blocks_empty(const char *path, size_t capacity);
+
+// Makes room for at least capacity blocks. Returns 0 on success.
+int Blocks_reserve(Blocks *blocks, size_t capacity);
+
+// Adds a block with the given compressed offsets. Returns 0 on success.
+int Blocks_append(Blocks *blocks, uint64_t start_offset, uint64_t end_offset);
+
 Blocks *Blocks_parse(const char *input_file_path);
-Blocks *Blocks_new(const char *filename, size_t buffer_size);
+Blocks *Blocks_new(const char *filename);
 void Blocks_free(Blocks *blocks);
-int32_t Blocks_read(Blocks *blocks, uintptr_t start /*byte index*/, uintptr_t end /*byte index*/, unsigned char* target);
+
+// Maps the whole file into memory read-only, or returns NULL.
+const unsigned char *Blocks_map(const char *input_file_path, size_t *size);
+
+// Index of the block holding the byte at the given decompressed offset, or
+// the number of blocks if no block holds it. Binary search.
+size_t Blocks_find(const Blocks *blocks, uintptr_t offset);
 
@@ -0,0 +1,322 @@
+#include "cache.h"
+#include "block.h"
+#include "marks.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+static void *BlockCache_worker(void *argument);
+
+BlockCache *BlockCache_new(Blocks *blocks, size_t max_bytes, size_t readahead) {
+    BlockCache *cache = (BlockCache *) calloc(1, sizeof(BlockCache));
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    cache->archive = Blocks_map(blocks->path, &cache->archive_size);
+    if (cache->archive == NULL) {
+        free(cache);
+        return NULL;
+    }
+    // Blocks are read wherever the vector is accessed.
+    madvise((void *) cache->archive, cache->archive_size, MADV_RANDOM);
+
+    cache->blocks = blocks;
+    cache->max_bytes = max_bytes;
+    pthread_mutex_init(&cache->lock, NULL);
+    pthread_cond_init(&cache->loaded, NULL);
+    pthread_cond_init(&cache->queued, NULL);
+
+    // Leave room for the block being read and the one before it, so that
+    // blocks decompressed ahead do not push out the ones still in use.
+    size_t largest_block = 1;
+    for (size_t i = 0; i < blocks->blocks; i++) {
+        size_t size = blocks->decompressed_end_offset[i] - blocks->decompressed_start_offset[i] + 1;
+        if (size > largest_block) {
+            largest_block = size;
+        }
+    }
+    size_t room = max_bytes / largest_block;
+    if (readahead + 2 > room) {
+        readahead = room > 2 ? room - 2 : 0;
+    }
+
+    // Read-ahead is best effort: without memory or threads for it, blocks
+    // are just decompressed when they are read.
+    size_t workers_count = readahead < Marks_thread_count() ? readahead : Marks_thread_count();
+    if (workers_count > 0) {
+        cache->queue = (size_t *) malloc(readahead * sizeof(size_t));
+        cache->workers = (pthread_t *) malloc(workers_count * sizeof(pthread_t));
+    }
+    if (cache->queue != NULL && cache->workers != NULL) {
+        cache->readahead = readahead;
+        for (; cache->workers_count < workers_count; cache->workers_count++) {
+            if (0 != pthread_create(&cache->workers[cache->workers_count], NULL, BlockCache_worker, cache)) {
+                break;
+            }
+        }
+    }
+    if (cache->workers_count == 0) {
+        cache->readahead = 0;
+    }
+    return cache;
+}
+
+void BlockCache_free(BlockCache *cache) {
+    pthread_mutex_lock(&cache->lock);
+    cache->shutdown = true;
+    pthread_cond_broadcast(&cache->queued);
+    pthread_mutex_unlock(&cache->lock);
+    for (size_t i = 0; i < cache->workers_count; i++) {
+        pthread_join(cache->workers[i], NULL);
+    }
+    free(cache->workers);
+    free(cache->queue);
+
+    for (size_t i = 0; i < cache->entry_count; i++) {
+        free(cache->entries[i]->buffer);
+        free(cache->entries[i]);
+    }
+    free(cache->entries);
+    munmap((void *) cache->archive, cache->archive_size);
+    pthread_cond_destroy(&cache->queued);
+    pthread_cond_destroy(&cache->loaded);
+    pthread_mutex_destroy(&cache->lock);
+    Blocks_free(cache->blocks);
+    free(cache);
+}
+
+static BlockCacheEntry *BlockCache_find(BlockCache *cache, size_t block) {
+    for (size_t i = 0; i < cache->entry_count; i++) {
+        BlockCacheEntry *entry = cache->entries[i];
+        if (entry->state != BlockCacheEntry_EMPTY && entry->block == block) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static BlockCacheEntry *BlockCache_least_recently_used(BlockCache *cache) {
+    BlockCacheEntry *victim = NULL;
+    for (size_t i = 0; i < cache->entry_count; i++) {
+        BlockCacheEntry *entry = cache->entries[i];
+        if (entry->state == BlockCacheEntry_READY && entry->pins == 0
+            && (victim == NULL || entry->last_used < victim->last_used)) {
+            victim = entry;
+        }
+    }
+    return victim;
+}
+
+// Returns an empty entry with a buffer of at least the needed capacity,
+// evicting blocks to make room, or NULL if memory runs out. Must be called
+// with the cache locked. Blocks that are in use are never evicted, so the
+// cache can go over its limit while they are, unless it is only filling
+// speculatively.
+static BlockCacheEntry *BlockCache_claim(BlockCache *cache, size_t needed, bool speculative) {
+    while (cache->bytes + needed > cache->max_bytes) {
+        BlockCacheEntry *victim = BlockCache_least_recently_used(cache);
+        if (victim == NULL) {
+            if (speculative) {
+                return NULL;
+            }
+            break;
+        }
+        victim->state = BlockCacheEntry_EMPTY;
+        if (victim->capacity >= needed) {
+            return victim;
+        }
+        free(victim->buffer);
+        cache->bytes -= victim->capacity;
+        victim->buffer = NULL;
+        victim->capacity = 0;
+    }
+
+    BlockCacheEntry *entry = NULL;
+    for (size_t i = 0; i < cache->entry_count; i++) {
+        if (cache->entries[i]->state == BlockCacheEntry_EMPTY) {
+            entry = cache->entries[i];
+            break;
+        }
+    }
+
+    if (entry == NULL) {
+        BlockCacheEntry **entries = (BlockCacheEntry **)
+            realloc(cache->entries, (cache->entry_count + 1) * sizeof(BlockCacheEntry *));
+        if (entries == NULL) {
+            return NULL;
+        }
+        cache->entries = entries;
+        entry = (BlockCacheEntry *) calloc(1, sizeof(BlockCacheEntry));
+        if (entry == NULL) {
+            return NULL;
+        }
+        cache->entries[cache->entry_count++] = entry;
+    }
+
+    if (entry->capacity < needed) {
+        char *buffer = (char *) malloc(needed);
+        if (buffer == NULL) {
+            return NULL;
+        }
+        free(entry->buffer);
+        cache->bytes -= entry->capacity;
+        entry->buffer = buffer;
+        entry->capacity = needed;
+        cache->bytes += needed;
+    }
+    return entry;
+}
+
+// Decompresses the block into a fresh entry. Must be called with the cache
+// locked, but unlocks it while decompressing, so other blocks can be read in
+// the meantime. Returns the entry, pinned once if requested, or NULL if the
+// block cannot be decompressed, or if it is speculative and does not fit.
+static BlockCacheEntry *BlockCache_load(BlockCache *cache, size_t block, bool speculative) {
+    Blocks *blocks = cache->blocks;
+    size_t expected_size = blocks->decompressed_end_offset[block] - blocks->decompressed_start_offset[block] + 1;
+    BlockCacheEntry *entry = BlockCache_claim(cache, expected_size, speculative);
+    if (entry == NULL) {
+        return NULL;
+    }
+    entry->state = BlockCacheEntry_LOADING;
+    entry->block = block;
+    entry->pins = speculative ? 0 : 1;
+    pthread_mutex_unlock(&cache->lock);
+
+    int64_t size = -1;
+    Block *compressed = Block_from_memory(cache->archive, cache->archive_size, blocks->start_offset[0],
+                                          blocks->start_offset[block], blocks->end_offset[block]);
+    if (compressed != NULL) {
+        // A different CRC means the archive changed since it was indexed.
+        if (compressed->crc == blocks->crc[block]) {
+            size = Block_decompress_into(compressed, entry->capacity, entry->buffer);
+        }
+        free(compressed->buffer);
+        free(compressed);
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    if (size < 0 || (size_t) size != expected_size) {
+        entry->state = BlockCacheEntry_EMPTY;
+        entry->pins = 0;
+        entry = NULL;
+    } else {
+        entry->state = BlockCacheEntry_READY;
+        entry->size = size;
+        entry->last_used = ++cache->clock;
+    }
+    pthread_cond_broadcast(&cache->loaded);
+    return entry;
+}
+
+// Returns the pinned entry holding the decompressed block, decompressing it
+// if necessary, or NULL if the block cannot be decompressed.
+static BlockCacheEntry *BlockCache_acquire(BlockCache *cache, size_t block) {
+    pthread_mutex_lock(&cache->lock);
+
+    BlockCacheEntry *entry;
+    while ((entry = BlockCache_find(cache, block)) != NULL && entry->state == BlockCacheEntry_LOADING) {
+        pthread_cond_wait(&cache->loaded, &cache->lock);
+    }
+    if (entry != NULL) {
+        entry->pins++;
+        entry->last_used = ++cache->clock;
+        cache->hits++;
+    } else {
+        cache->misses++;
+        entry = BlockCache_load(cache, block, false);
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+    return entry;
+}
+
+static void BlockCache_release(BlockCache *cache, BlockCacheEntry *entry) {
+    pthread_mutex_lock(&cache->lock);
+    entry->pins--;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// Replaces the queue with the blocks following the given one that are not
+// in the cache yet. Blocks queued for an earlier read and not started by now
+// are no longer needed.
+static void BlockCache_read_ahead(BlockCache *cache, size_t block) {
+    if (cache->readahead == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    cache->queue_length = 0;
+    for (size_t next = block + 1; next <= block + cache->readahead && next < cache->blocks->blocks; next++) {
+        if (BlockCache_find(cache, next) == NULL) {
+            cache->queue[cache->queue_length++] = next;
+        }
+    }
+    if (cache->queue_length > 0) {
+        pthread_cond_broadcast(&cache->queued);
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+static void *BlockCache_worker(void *argument) {
+    BlockCache *cache = (BlockCache *) argument;
+
+    pthread_mutex_lock(&cache->lock);
+    while (true) {
+        while (!cache->shutdown && cache->queue_length == 0) {
+            pthread_cond_wait(&cache->queued, &cache->lock);
+        }
+        if (cache->shutdown) {
+            break;
+        }
+
+        size_t block = cache->queue[0];
+        cache->queue_length--;
+        memmove(cache->queue, cache->queue + 1, cache->queue_length * sizeof(size_t));
+
+        // Someone else may have started on it in the meantime.
+        if (BlockCache_find(cache, block) == NULL && BlockCache_load(cache, block, true) != NULL) {
+            cache->prefetched++;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return NULL;
+}
+
+int32_t BlockCache_read(BlockCache *cache, uintptr_t start, uintptr_t end, unsigned char *target) {
+    Blocks *blocks = cache->blocks;
+    if (start > end || end > blocks->decompressed_size) {
+        return 1;
+    }
+
+    // Get the workers going before decompressing anything here.
+    size_t first_block = Blocks_find(blocks, start);
+    if (start < end && first_block < blocks->blocks) {
+        BlockCache_read_ahead(cache, first_block);
+    }
+
+    for (uintptr_t position = start; position < end;) {
+        size_t block = Blocks_find(blocks, position);
+        if (block >= blocks->blocks) {
+            return 1;
+        }
+
+        BlockCacheEntry *entry = BlockCache_acquire(cache, block);
+        if (entry == NULL) {
+            return -1;
+        }
+
+        size_t bytes_to_skip = position - blocks->decompressed_start_offset[block];
+        size_t length = entry->size - bytes_to_skip;
+        if (length > end - position) {
+            length = end - position;
+        }
+        memcpy(target + (position - start), entry->buffer + bytes_to_skip, length);
+        BlockCache_release(cache, entry);
+
+        position += length;
+    }
+    return 0;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "blocks.h"
+
+// Default upper bound on the memory held by decompressed blocks of one
+// vector. Blocks are up to 900kB each.
+#define BLOCK_CACHE_DEFAULT_BYTES (64 * 1024 * 1024)
+
+typedef enum {
+    BlockCacheEntry_EMPTY,
+    BlockCacheEntry_LOADING,  // being decompressed, wait for it
+    BlockCacheEntry_READY,
+} BlockCacheEntryState;
+
+typedef struct {
+    BlockCacheEntryState state;
+    size_t    block;      // index in the block table
+    char     *buffer;
+    size_t    capacity;   // bytes allocated for buffer
+    size_t    size;       // bytes decompressed into buffer
+    uint64_t  last_used;
+    size_t    pins;       // readers copying out of buffer
+} BlockCacheEntry;
+
+// Decompressed blocks of one archive, evicted least recently used first once
+// they take up more than max_bytes. Blocks are decompressed straight out of
+// a mapping of the archive.
+//
+// When a read lands in block k, blocks k+1..k+readahead are queued and
+// decompressed by a pool of worker threads, so that a scan finds them ready.
+typedef struct {
+    Blocks              *blocks;
+    const unsigned char *archive;
+    size_t               archive_size;
+
+    BlockCacheEntry    **entries;
+    size_t               entry_count;
+    size_t               bytes;      // sum of the capacities of all buffers
+    size_t               max_bytes;
+    uint64_t             clock;
+
+    uint64_t             hits;
+    uint64_t             misses;
+    uint64_t             prefetched;
+
+    size_t               readahead;
+    size_t              *queue;      // blocks waiting for a worker, nearest first
+    size_t               queue_length;
+    pthread_t           *workers;
+    size_t               workers_count;
+    bool                 shutdown;
+
+    pthread_mutex_t      lock;
+    pthread_cond_t       loaded;
+    pthread_cond_t       queued;
+} BlockCache;
+
+// Takes ownership of the blocks. Starts up to readahead worker threads, but
+// no more than there are cores. Returns NULL if the archive cannot be mapped.
+BlockCache *BlockCache_new(Blocks *blocks, size_t max_bytes, size_t readahead);
+void BlockCache_free(BlockCache *cache);
+
+/**
+ * Copy the decompressed bytes [start, end) into target, decompressing only
+ * the blocks that are not in the cache. Does not call into R.
+ *
+ * @return 0 on success.
+ */
+int32_t BlockCache_read(BlockCache *cache, uintptr_t start, uintptr_t end, unsigned char *target);
@@ -0,0 +1,165 @@
+#include "index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../debug.h"
+#include "../atomic_file.h"
+
+char *Blocks_index_path(const char *archive_path) {
+    size_t length = strlen(archive_path);
+    char *index_path = (char *) malloc(length + sizeof(BLOCKS_INDEX_SUFFIX));
+    if (index_path == NULL) {
+        return NULL;
+    }
+    memcpy(index_path, archive_path, length);
+    memcpy(index_path + length, BLOCKS_INDEX_SUFFIX, sizeof(BLOCKS_INDEX_SUFFIX));
+    return index_path;
+}
+
+static bool Blocks_index_matches(const BlocksIndexHeader *header, const struct stat *archive) {
+    return 0 == memcmp(header->magic, BLOCKS_INDEX_MAGIC, sizeof(header->magic))
+        && header->version == BLOCKS_INDEX_VERSION
+        && header->archive_size == (uint64_t) archive->st_size
+        && header->archive_mtime_sec == (int64_t) archive->st_mtim.tv_sec
+        && header->archive_mtime_nsec == (int64_t) archive->st_mtim.tv_nsec
+        // Every block takes up well over 130 bits.
+        && header->blocks <= header->archive_size * 8 / 130;
+}
+
+// Offsets must grow from block to block and stay within the archive.
+static bool Blocks_index_consistent(const Blocks *blocks, uint64_t archive_size) {
+    for (size_t i = 0; i < blocks->blocks; i++) {
+        if (blocks->start_offset[i] > blocks->end_offset[i]
+            || blocks->end_offset[i] > archive_size * 8
+            || blocks->decompressed_start_offset[i] > blocks->decompressed_end_offset[i]) {
+            return false;
+        }
+        if (i > 0 && (blocks->start_offset[i] <= blocks->end_offset[i - 1]
+                      || blocks->decompressed_start_offset[i] < blocks->decompressed_end_offset[i - 1])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Blocks *Blocks_load_index(const char *archive_path) {
+    struct stat archive;
+    if (stat(archive_path, &archive) != 0) {
+        return NULL;
+    }
+
+    char *index_path = Blocks_index_path(archive_path);
+    if (index_path == NULL) {
+        return NULL;
+    }
+    FILE *index = fopen(index_path, "rb");
+    if (index == NULL) {
+        free(index_path);
+        return NULL;
+    }
+
+    BlocksIndexHeader header;
+    if (fread(&header, sizeof(header), 1, index) != 1 || !Blocks_index_matches(&header, &archive)) {
+        UFO_LOG("Index %s is out of date, ignoring it.\n", index_path);
+        fclose(index);
+        free(index_path);
+        return NULL;
+    }
+
+    Blocks *blocks = Blocks_empty(archive_path, header.blocks);
+    if (blocks == NULL) {
+        fclose(index);
+        free(index_path);
+        return NULL;
+    }
+    blocks->blocks = header.blocks;
+    blocks->decompressed_size = header.decompressed_size;
+
+    for (size_t i = 0; i < blocks->blocks; i++) {
+        BlocksIndexEntry entry;
+        if (fread(&entry, sizeof(entry), 1, index) != 1) {
+            UFO_LOG("Index %s is truncated, ignoring it.\n", index_path);
+            Blocks_free(blocks);
+            fclose(index);
+            free(index_path);
+            return NULL;
+        }
+        blocks->start_offset[i] = entry.start_offset;
+        blocks->end_offset[i] = entry.end_offset;
+        blocks->decompressed_start_offset[i] = entry.decompressed_start_offset;
+        blocks->decompressed_end_offset[i] = entry.decompressed_end_offset;
+        blocks->crc[i] = entry.crc;
+    }
+    fclose(index);
+
+    if (!Blocks_index_consistent(blocks, header.archive_size)) {
+        UFO_LOG("Index %s is corrupted, ignoring it.\n", index_path);
+        Blocks_free(blocks);
+        free(index_path);
+        return NULL;
+    }
+
+    UFO_LOG("Loaded %li blocks from index %s.\n", blocks->blocks, index_path);
+    free(index_path);
+    return blocks;
+}
+
+int Blocks_store_index(const Blocks *blocks) {
+    struct stat archive;
+    if (stat(blocks->path, &archive) != 0) {
+        return -1;
+    }
+
+    BlocksIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BLOCKS_INDEX_MAGIC, sizeof(header.magic));
+    header.version = BLOCKS_INDEX_VERSION;
+    header.archive_size = archive.st_size;
+    header.archive_mtime_sec = archive.st_mtim.tv_sec;
+    header.archive_mtime_nsec = archive.st_mtim.tv_nsec;
+    header.blocks = blocks->blocks;
+    header.decompressed_size = blocks->decompressed_size;
+
+    char *index_path = Blocks_index_path(blocks->path);
+    if (index_path == NULL) {
+        return -1;
+    }
+
+    // Concurrent readers never see a partially written index.
+    char *temporary_path;
+    int fd = atomic_file_create(index_path, &temporary_path);
+    FILE *index = fd < 0 ? NULL : fdopen(fd, "wb");
+    if (index == NULL) {
+        UFO_LOG("Cannot create index %s, the archive will be scanned again next time.\n", index_path);
+        if (fd >= 0) {
+            close(fd);
+            atomic_file_discard(temporary_path);
+        }
+        free(index_path);
+        return -1;
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, index) == 1;
+    for (size_t i = 0; ok && i < blocks->blocks; i++) {
+        BlocksIndexEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.start_offset = blocks->start_offset[i];
+        entry.end_offset = blocks->end_offset[i];
+        entry.decompressed_start_offset = blocks->decompressed_start_offset[i];
+        entry.decompressed_end_offset = blocks->decompressed_end_offset[i];
+        entry.crc = blocks->crc[i];
+        ok = fwrite(&entry, sizeof(entry), 1, index) == 1;
+    }
+    ok = (fclose(index) == 0) && ok;
+    if (!atomic_file_finish(temporary_path, index_path, ok)) {
+        UFO_LOG("Cannot write index %s, the archive will be scanned again next time.\n", index_path);
+        ok = false;
+    }
+
+    free(index_path);
+    return ok ? 0 : -1;
+}
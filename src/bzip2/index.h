@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "blocks.h"
+
+// Block tables are saved next to the archive, so that the archive only has
+// to be scanned and decompressed once. The index records the size and
+// modification time of the archive it was built from and is ignored once
+// they no longer match.
+#define BLOCKS_INDEX_SUFFIX  ".ufoidx"
+#define BLOCKS_INDEX_MAGIC   "UFOBZIDX"
+#define BLOCKS_INDEX_VERSION 2
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t archive_size;
+    int64_t  archive_mtime_sec;
+    int64_t  archive_mtime_nsec;
+    uint64_t blocks;
+    uint64_t decompressed_size;
+} BlocksIndexHeader;
+
+typedef struct {
+    uint64_t start_offset;
+    uint64_t end_offset;
+    uint64_t decompressed_start_offset;
+    uint64_t decompressed_end_offset;
+    uint32_t crc;
+    uint32_t reserved;
+} BlocksIndexEntry;
+
+// Returns a newly allocated path of the index of the given archive.
+char *Blocks_index_path(const char *archive_path);
+
+// Returns the block table of the archive if an up to date index exists,
+// NULL otherwise.
+Blocks *Blocks_load_index(const char *archive_path);
+
+// Saves the block table next to the archive. Returns 0 on success. Failing to
+// save is not an error, the archive is just scanned again next time.
+int Blocks_store_index(const Blocks *blocks);
@@ -0,0 +1,242 @@
+#include "lines.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../debug.h"
+#include "../atomic_file.h"
+
+// The text is read through the cache in pieces of this size while counting.
+#define LINES_SCAN_BYTES (4 * 1024 * 1024)
+
+static char *Lines_index_path(const char *archive_path) {
+    size_t length = strlen(archive_path);
+    char *index_path = (char *) malloc(length + sizeof(LINES_INDEX_SUFFIX));
+    if (index_path == NULL) {
+        return NULL;
+    }
+    memcpy(index_path, archive_path, length);
+    memcpy(index_path + length, LINES_INDEX_SUFFIX, sizeof(LINES_INDEX_SUFFIX));
+    return index_path;
+}
+
+static Lines *Lines_empty(const char *path, size_t sample, size_t samples) {
+    Lines *lines = (Lines *) calloc(1, sizeof(Lines));
+    if (lines == NULL) {
+        return NULL;
+    }
+    lines->path = strdup(path);
+    lines->offsets = (uint64_t *) malloc((samples ? samples : 1) * sizeof(uint64_t));
+    if (lines->path == NULL || lines->offsets == NULL) {
+        Lines_free(lines);
+        return NULL;
+    }
+    lines->sample = sample;
+    lines->samples = samples;
+    return lines;
+}
+
+void Lines_free(Lines *lines) {
+    free(lines->offsets);
+    free((void *) lines->path);
+    free(lines);
+}
+
+static bool Lines_index_matches(const LinesIndexHeader *header, const struct stat *archive,
+                                size_t sample, size_t decompressed_size) {
+    return 0 == memcmp(header->magic, LINES_INDEX_MAGIC, sizeof(header->magic))
+        && header->version == LINES_INDEX_VERSION
+        && header->archive_size == (uint64_t) archive->st_size
+        && header->archive_mtime_sec == (int64_t) archive->st_mtim.tv_sec
+        && header->archive_mtime_nsec == (int64_t) archive->st_mtim.tv_nsec
+        && header->decompressed_size == decompressed_size
+        && header->sample == sample
+        && header->lines <= decompressed_size
+        && header->samples == (header->lines + sample - 1) / sample;
+}
+
+static Lines *Lines_load_index(const char *archive_path, size_t sample, size_t decompressed_size) {
+    struct stat archive;
+    if (stat(archive_path, &archive) != 0) {
+        return NULL;
+    }
+
+    char *index_path = Lines_index_path(archive_path);
+    if (index_path == NULL) {
+        return NULL;
+    }
+    FILE *index = fopen(index_path, "rb");
+    if (index == NULL) {
+        free(index_path);
+        return NULL;
+    }
+
+    LinesIndexHeader header;
+    if (fread(&header, sizeof(header), 1, index) != 1
+        || !Lines_index_matches(&header, &archive, sample, decompressed_size)) {
+        UFO_LOG("Line index %s is out of date, ignoring it.\n", index_path);
+        fclose(index);
+        free(index_path);
+        return NULL;
+    }
+
+    Lines *lines = Lines_empty(archive_path, sample, header.samples);
+    if (lines == NULL) {
+        fclose(index);
+        free(index_path);
+        return NULL;
+    }
+    lines->lines = header.lines;
+    lines->decompressed_size = header.decompressed_size;
+
+    bool consistent = fread(lines->offsets, sizeof(uint64_t), lines->samples, index) == lines->samples;
+    for (size_t i = 0; consistent && i < lines->samples; i++) {
+        consistent = lines->offsets[i] < decompressed_size
+                  && (i == 0 ? lines->offsets[i] == 0 : lines->offsets[i] > lines->offsets[i - 1]);
+    }
+    fclose(index);
+
+    if (!consistent) {
+        UFO_LOG("Line index %s is truncated or corrupted, ignoring it.\n", index_path);
+        Lines_free(lines);
+        free(index_path);
+        return NULL;
+    }
+
+    UFO_LOG("Loaded %li lines from index %s.\n", lines->lines, index_path);
+    free(index_path);
+    return lines;
+}
+
+static int Lines_store_index(const Lines *lines) {
+    struct stat archive;
+    if (stat(lines->path, &archive) != 0) {
+        return -1;
+    }
+
+    LinesIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LINES_INDEX_MAGIC, sizeof(header.magic));
+    header.version = LINES_INDEX_VERSION;
+    header.archive_size = archive.st_size;
+    header.archive_mtime_sec = archive.st_mtim.tv_sec;
+    header.archive_mtime_nsec = archive.st_mtim.tv_nsec;
+    header.decompressed_size = lines->decompressed_size;
+    header.sample = lines->sample;
+    header.lines = lines->lines;
+    header.samples = lines->samples;
+
+    char *index_path = Lines_index_path(lines->path);
+    if (index_path == NULL) {
+        return -1;
+    }
+
+    // Replaced in one step, as with the block table.
+    char *temporary_path;
+    int fd = atomic_file_create(index_path, &temporary_path);
+    FILE *index = fd < 0 ? NULL : fdopen(fd, "wb");
+    if (index == NULL) {
+        UFO_LOG("Cannot create line index %s, the text will be scanned again next time.\n", index_path);
+        if (fd >= 0) {
+            close(fd);
+            atomic_file_discard(temporary_path);
+        }
+        free(index_path);
+        return -1;
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, index) == 1
+           && fwrite(lines->offsets, sizeof(uint64_t), lines->samples, index) == lines->samples;
+    ok = (fclose(index) == 0) && ok;
+    if (!atomic_file_finish(temporary_path, index_path, ok)) {
+        UFO_LOG("Cannot write line index %s, the text will be scanned again next time.\n", index_path);
+        ok = false;
+    }
+
+    free(index_path);
+    return ok ? 0 : -1;
+}
+
+// Reads the whole text once, recording where every sample-th line starts.
+static Lines *Lines_scan(BlockCache *cache, size_t sample) {
+    size_t size = cache->blocks->decompressed_size;
+    Lines *lines = Lines_empty(cache->blocks->path, sample, 0);
+    char *buffer = (char *) malloc(LINES_SCAN_BYTES);
+    if (lines == NULL || buffer == NULL) {
+        if (lines != NULL) Lines_free(lines);
+        free(buffer);
+        return NULL;
+    }
+    lines->decompressed_size = size;
+
+    // A line starts at the beginning and after every newline but the last.
+    size_t capacity = 1;
+    size_t newlines = 0;
+    char last = '\n';
+    if (size > 0) {
+        lines->offsets[lines->samples++] = 0;
+    }
+    for (size_t position = 0; position < size;) {
+        size_t length = size - position < LINES_SCAN_BYTES ? size - position : LINES_SCAN_BYTES;
+        if (BlockCache_read(cache, position, position + length, (unsigned char *) buffer) != 0) {
+            free(buffer);
+            Lines_free(lines);
+            return NULL;
+        }
+
+        for (const char *cursor = buffer; cursor < buffer + length;) {
+            const char *newline = (const char *) memchr(cursor, '\n', buffer + length - cursor);
+            if (newline == NULL) {
+                break;
+            }
+            newlines++;
+            uint64_t next_line = position + (newline - buffer) + 1;
+            if (newlines % sample == 0 && next_line < size) {
+                if (lines->samples == capacity) {
+                    uint64_t *offsets = (uint64_t *) realloc(lines->offsets, 2 * capacity * sizeof(uint64_t));
+                    if (offsets == NULL) {
+                        free(buffer);
+                        Lines_free(lines);
+                        return NULL;
+                    }
+                    lines->offsets = offsets;
+                    capacity *= 2;
+                }
+                lines->offsets[lines->samples++] = next_line;
+            }
+            cursor = newline + 1;
+        }
+
+        last = buffer[length - 1];
+        position += length;
+    }
+    free(buffer);
+
+    // The last line does not need to end with a newline.
+    lines->lines = newlines + (last != '\n' ? 1 : 0);
+    return lines;
+}
+
+Lines *Lines_new(BlockCache *cache, size_t sample) {
+    Lines *lines = Lines_load_index(cache->blocks->path, sample, cache->blocks->decompressed_size);
+    if (lines != NULL) {
+        return lines;
+    }
+
+    lines = Lines_scan(cache, sample);
+    if (lines == NULL) {
+        return NULL;
+    }
+    UFO_LOG("Found %li lines in %s.\n", lines->lines, lines->path);
+    Lines_store_index(lines);
+    return lines;
+}
+
+void Lines_range(const Lines *lines, size_t first, size_t last, uint64_t *start, uint64_t *end) {
+    *start = lines->offsets[first / lines->sample];
+    size_t after = (last + lines->sample - 1) / lines->sample;
+    *end = after < lines->samples ? lines->offsets[after] : lines->decompressed_size;
+}
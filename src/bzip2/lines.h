@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "cache.h"
+
+// Lines of the decompressed text of an archive. The decompressed offset of
+// every sample-th line is recorded, so a line is found by starting at the
+// closest recorded line before it and skipping the lines in between.
+//
+// Like the block table, the line table is saved next to the archive and
+// ignored once the archive changes or a different sample is asked for.
+#define LINES_INDEX_SUFFIX  ".ufolines"
+#define LINES_INDEX_MAGIC   "UFOLNIDX"
+#define LINES_INDEX_VERSION 1
+#define LINES_DEFAULT_SAMPLE 1024
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t archive_size;
+    int64_t  archive_mtime_sec;
+    int64_t  archive_mtime_nsec;
+    uint64_t decompressed_size;
+    uint64_t sample;
+    uint64_t lines;
+    uint64_t samples;
+} LinesIndexHeader;
+
+typedef struct {
+    const char *path;
+    size_t      sample;
+    size_t      lines;
+    size_t      samples;
+    uint64_t   *offsets;           // offsets[i] is where line i * sample starts
+    size_t      decompressed_size;
+} Lines;
+
+// Loads the line table of the archive, or builds it by reading the whole
+// decompressed text through the cache and saves it. Returns NULL if the
+// archive cannot be read.
+Lines *Lines_new(BlockCache *cache, size_t sample);
+void Lines_free(Lines *lines);
+
+// The decompressed bytes [*start, *end) hold the lines [first, last), along
+// with at most sample - 1 lines before and after them.
+void Lines_range(const Lines *lines, size_t first, size_t last, uint64_t *start, uint64_t *end);
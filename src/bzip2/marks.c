@@ -0,0 +1,184 @@
+#include "marks.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define MAGIC_MASK 0xffffffffffffULL
+
+// For every byte value, the bit alignments (as a bitmask) at which a magic
+// number starting in the preceding byte would have that value as its second
+// byte. The second byte lies within the magic number at every alignment, so
+// most bytes can be ruled out by one lookup.
+typedef struct {
+    uint8_t block[256];
+    uint8_t endmark[256];
+} MagicTable;
+
+static void MagicTable_init(MagicTable *table) {
+    memset(table, 0, sizeof(MagicTable));
+    for (int shift = 0; shift < 8; shift++) {
+        table->block[((BLOCK_MAGIC << (16 - shift)) >> 48) & 0xff] |= 1 << shift;
+        table->endmark[((ENDMARK_MAGIC << (16 - shift)) >> 48) & 0xff] |= 1 << shift;
+    }
+}
+
+// Big-endian 64-bit window starting at byte position, zero past the end.
+static inline uint64_t window_at(const unsigned char *data, size_t size, size_t position) {
+    uint64_t window = 0;
+    for (size_t i = 0; i < 8; i++) {
+        window = (window << 8) | (position + i < size ? data[position + i] : 0);
+    }
+    return window;
+}
+
+static bool MarkList_append(MarkList *list, uint64_t bit_offset, bool end_of_stream) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity == 0 ? 64 : list->capacity * 2;
+        Mark *marks = (Mark *) realloc(list->marks, capacity * sizeof(Mark));
+        if (marks == NULL) {
+            return false;
+        }
+        list->marks = marks;
+        list->capacity = capacity;
+    }
+    list->marks[list->count].bit_offset = bit_offset;
+    list->marks[list->count].end_of_stream = end_of_stream;
+    list->count++;
+    return true;
+}
+
+typedef struct {
+    const MagicTable    *table;
+    const unsigned char *data;
+    size_t               size;
+    size_t               from;  // first byte in which a magic number may start
+    size_t               to;    // first byte in which it may not
+    MarkList             marks;
+    bool                 failed;
+} ScanTask;
+
+static void *Marks_scan(void *argument) {
+    ScanTask *task = (ScanTask *) argument;
+    const unsigned char *data = task->data;
+    size_t size = task->size;
+
+    for (size_t position = task->from; position < task->to; position++) {
+        if (position + 1 >= size) {
+            break;
+        }
+        unsigned char second = data[position + 1];
+        uint8_t candidates = task->table->block[second] | task->table->endmark[second];
+        if (candidates == 0) {
+            continue;
+        }
+
+        uint64_t window = window_at(data, size, position);
+        for (int shift = 0; shift < 8; shift++) {
+            if (!(candidates & (1 << shift))) {
+                continue;
+            }
+            uint64_t bit_offset = (uint64_t) position * 8 + shift;
+            if (bit_offset + 48 > (uint64_t) size * 8) {
+                continue;
+            }
+            uint64_t value = (window >> (16 - shift)) & MAGIC_MASK;
+            if (value == BLOCK_MAGIC || value == ENDMARK_MAGIC) {
+                if (!MarkList_append(&task->marks, bit_offset, value == ENDMARK_MAGIC)) {
+                    task->failed = true;
+                    return NULL;
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+size_t Marks_thread_count() {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1) {
+        return 1;
+    }
+    return cores > MARKS_MAX_THREADS ? MARKS_MAX_THREADS : (size_t) cores;
+}
+
+MarkList *Marks_find(const unsigned char *data, size_t size, size_t threads) {
+    MagicTable table;
+    MagicTable_init(&table);
+
+    // Small archives are not worth the threads.
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (size / threads < (1 << 20)) {
+        threads = size / (1 << 20) + 1;
+    }
+
+    ScanTask *tasks = (ScanTask *) calloc(threads, sizeof(ScanTask));
+    pthread_t *workers = (pthread_t *) calloc(threads, sizeof(pthread_t));
+    bool *started = (bool *) calloc(threads, sizeof(bool));
+    MarkList *result = (MarkList *) calloc(1, sizeof(MarkList));
+    if (tasks == NULL || workers == NULL || started == NULL || result == NULL) {
+        free(tasks);
+        free(workers);
+        free(started);
+        free(result);
+        return NULL;
+    }
+
+    // Each task owns the magic numbers that start within its range of bytes,
+    // and may look up to 7 bytes past its end to see them whole.
+    size_t range = size / threads + 1;
+    for (size_t i = 0; i < threads; i++) {
+        tasks[i].table = &table;
+        tasks[i].data = data;
+        tasks[i].size = size;
+        tasks[i].from = i * range < size ? i * range : size;
+        tasks[i].to = (i + 1) * range < size ? (i + 1) * range : size;
+        // Run the last range on this thread, and any that could not be started.
+        started[i] = i + 1 < threads && 0 == pthread_create(&workers[i], NULL, Marks_scan, &tasks[i]);
+    }
+    for (size_t i = 0; i < threads; i++) {
+        if (!started[i]) {
+            Marks_scan(&tasks[i]);
+        }
+    }
+
+    bool failed = false;
+    for (size_t i = 0; i < threads; i++) {
+        if (started[i]) {
+            pthread_join(workers[i], NULL);
+        }
+        failed = failed || tasks[i].failed;
+    }
+
+    // Ranges are in order, so concatenating them keeps the marks sorted.
+    for (size_t i = 0; i < threads && !failed; i++) {
+        for (size_t j = 0; j < tasks[i].marks.count; j++) {
+            if (!MarkList_append(result, tasks[i].marks.marks[j].bit_offset,
+                                 tasks[i].marks.marks[j].end_of_stream)) {
+                failed = true;
+                break;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < threads; i++) {
+        free(tasks[i].marks.marks);
+    }
+    free(tasks);
+    free(workers);
+    free(started);
+
+    if (failed) {
+        MarkList_free(result);
+        return NULL;
+    }
+    return result;
+}
+
+void MarkList_free(MarkList *list) {
+    free(list->marks);
+    free(list);
+}
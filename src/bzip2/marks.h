@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// The 48-bit magic numbers that start each block and end each stream. They
+// are not byte-aligned, so they can start at any bit of a byte.
+#define BLOCK_MAGIC   0x314159265359ULL
+#define ENDMARK_MAGIC 0x177245385090ULL
+
+// Upper bound on the number of threads used to scan and index an archive.
+#define MARKS_MAX_THREADS 32
+
+typedef struct {
+    uint64_t bit_offset;    // of the first bit of the magic number
+    bool     end_of_stream; // end-of-stream marker rather than block header
+} Mark;
+
+typedef struct {
+    Mark   *marks;          // sorted by offset
+    size_t  count;
+    size_t  capacity;
+} MarkList;
+
+// Number of threads to use for work on an archive, based on available cores.
+size_t Marks_thread_count();
+
+/**
+ * Find all block headers and end-of-stream markers in the data, at any bit
+ * alignment. The data is split into ranges that are scanned by separate
+ * threads. Returns NULL if memory runs out.
+ */
+MarkList *Marks_find(const unsigned char *data, size_t size, size_t threads);
+void MarkList_free(MarkList *list);
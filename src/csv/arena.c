@@ -0,0 +1,52 @@
+#include "arena.h"
+
+// Allocations are aligned to pointers, which is enough for tokens. The
+// header of a block is three words long, so its data is aligned too.
+#define ARENA_ALIGNMENT sizeof(void *)
+
+arena_t *arena_new(size_t block_size) {
+    arena_t *arena = (arena_t *) malloc(sizeof(arena_t));
+    if (arena == NULL) {
+        return NULL;
+    }
+    arena->blocks = NULL;
+    arena->block_size = block_size;
+    arena->bytes = 0;
+    return arena;
+}
+
+void *arena_allocate(arena_t *arena, size_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+
+    arena_block_t *block = arena->blocks;
+    if (block == NULL || block->size - block->used < size) {
+        size_t block_size = size > arena->block_size ? size : arena->block_size;
+        block = (arena_block_t *) malloc(sizeof(arena_block_t) + block_size);
+        if (block == NULL) {
+            return NULL;
+        }
+        block->size = block_size;
+        block->used = 0;
+        block->next = arena->blocks;
+        arena->blocks = block;
+        arena->bytes += sizeof(arena_block_t) + block_size;
+    }
+
+    void *allocation = block->data + block->used;
+    block->used += size;
+    return allocation;
+}
+
+void arena_free(arena_t *arena) {
+    arena_block_t *block = arena->blocks;
+    while (block != NULL) {
+        arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    free(arena);
+}
+
+size_t arena_size(arena_t *arena) {
+    return arena->bytes;
+}
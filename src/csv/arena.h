@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdlib.h>
+
+// A bump allocator: memory is carved out of large blocks one allocation
+// after another and given back all at once. Tokens read while populating a
+// chunk of a column live in one, so that a chunk costs a handful of mallocs
+// instead of two per cell.
+
+#define ARENA_DEFAULT_BLOCK_SIZE (256 * 1024)
+
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t              size;
+    size_t              used;
+    char                data[];
+} arena_block_t;
+
+typedef struct {
+    arena_block_t *blocks;          // the one being filled first
+    size_t         block_size;
+    size_t         bytes;           // taken up by all blocks
+} arena_t;
+
+arena_t *arena_new      (size_t block_size);
+void    *arena_allocate (arena_t *, size_t size);
+void     arena_free     (arena_t *);
+size_t   arena_size     (arena_t *);
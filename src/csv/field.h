@@ -0,0 +1,196 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <errno.h>
+
+#include "token.h"
+
+// Converting fields straight from the tokenizer's buffer into the values of
+// typed columns, without making tokens out of them first. Plain decimal
+// numbers, which is what most cells are, are parsed here. Anything else (NA,
+// blanks, hexadecimals, infinities, very long mantissas, surrounding
+// whitespace) goes through the same library functions as the token_to_*
+// functions. Fields are NUL-terminated at field[size].
+
+static inline bool field_is_blank(const char *field, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        if (!isspace((unsigned char) field[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static inline bool field_is_na(const char *field, size_t size) {
+    return size == 2 && field[0] == 'N' && field[1] == 'A';
+}
+
+static inline int field_to_integer_slow(const char *field, size_t size) {
+    if (field_is_blank(field, size) || field_is_na(field, size)) {
+        return NA_INTEGER;
+    }
+
+    errno = 0;
+    char *trailing;
+    long result = strtol(field, &trailing, 10);
+
+    if (trailing == field)                            { return NA_INTEGER; }
+    if (!field_is_blank(trailing, field + size - trailing)) { return NA_INTEGER; }
+    if (errno == ERANGE)                              { return NA_INTEGER; }
+    if (result > INT_MAX || result <= INT_MIN)        { return NA_INTEGER; }
+
+    return (int) result;
+}
+
+static inline int field_to_integer(const char *field, size_t size) {
+    const char *c = field;
+    const char *end = field + size;
+
+    bool negative = false;
+    if (c < end && (*c == '-' || *c == '+')) {
+        negative = *c == '-';
+        c++;
+    }
+
+    // At most 10 digits fit in an int, so the sum cannot overflow 64 bits.
+    const char *digits = c;
+    int64_t value = 0;
+    while (c < end && c - digits < 10 && (unsigned) (*c - '0') < 10) {
+        value = value * 10 + (*c - '0');
+        c++;
+    }
+
+    if (c != end || c == digits) {
+        return field_to_integer_slow(field, size);
+    }
+
+    value = negative ? -value : value;
+    if (value > INT_MAX || value <= INT_MIN) {          // INT_MIN is NA_INTEGER
+        return NA_INTEGER;
+    }
+    return (int) value;
+}
+
+static inline double field_to_numeric_slow(const char *field, size_t size) {
+    if (field_is_blank(field, size)) {
+        return NA_REAL;
+    }
+
+    char *trailing;
+#ifdef USE_R_STUFF
+    double result = R_strtod(field, &trailing);
+#else
+    errno = 0;
+    double result = strtod(field, &trailing);
+    if (errno == ERANGE)                              { return NA_REAL; }
+#endif
+
+    if (trailing == field)                            { return NA_REAL; }
+    if (!field_is_blank(trailing, field + size - trailing)) { return NA_REAL; }
+
+    return result;
+}
+
+// Powers of ten that are exact doubles.
+static const double field_powers_of_ten[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10,
+    1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+// Numbers of the form [+-]digits[.digits][(e|E)[+-]digits]. If the digits
+// make an integer that is exact as a double, and the power of ten is exact
+// too, one multiplication or division rounds correctly (Clinger's fast
+// path). Other numbers are left to the library.
+static inline double field_to_numeric(const char *field, size_t size) {
+    const char *c = field;
+    const char *end = field + size;
+
+    bool negative = false;
+    if (c < end && (*c == '-' || *c == '+')) {
+        negative = *c == '-';
+        c++;
+    }
+
+    uint64_t mantissa = 0;
+    int significant_digits = 0;
+    int exponent = 0;
+    const char *start_of_digits = c;
+
+    for (; c < end && (unsigned) (*c - '0') < 10; c++) {
+        if (mantissa != 0 || *c != '0') {
+            significant_digits++;
+        }
+        mantissa = mantissa * 10 + (*c - '0');
+    }
+
+    if (c < end && *c == '.') {
+        c++;
+        for (; c < end && (unsigned) (*c - '0') < 10; c++) {
+            if (mantissa != 0 || *c != '0') {
+                significant_digits++;
+            }
+            mantissa = mantissa * 10 + (*c - '0');
+            exponent--;
+        }
+    }
+
+    // Just a sign or a dot, or too many digits for the mantissa to be exact.
+    if (c == start_of_digits || (c == start_of_digits + 1 && *start_of_digits == '.') || significant_digits > 19) {
+        return field_to_numeric_slow(field, size);
+    }
+
+    if (c < end && (*c == 'e' || *c == 'E')) {
+        c++;
+        bool negative_exponent = false;
+        if (c < end && (*c == '-' || *c == '+')) {
+            negative_exponent = *c == '-';
+            c++;
+        }
+        const char *start_of_exponent = c;
+        int explicit_exponent = 0;
+        for (; c < end && (unsigned) (*c - '0') < 10 && c - start_of_exponent < 5; c++) {
+            explicit_exponent = explicit_exponent * 10 + (*c - '0');
+        }
+        if (c == start_of_exponent) {
+            return field_to_numeric_slow(field, size);
+        }
+        exponent += negative_exponent ? -explicit_exponent : explicit_exponent;
+    }
+
+    if (c != end) {
+        return field_to_numeric_slow(field, size);
+    }
+
+    if (mantissa == 0) {
+        return negative ? -0.0 : 0.0;
+    }
+
+    if (mantissa > (UINT64_C(1) << 53) || exponent < -22 || exponent > 22) {
+        return field_to_numeric_slow(field, size);
+    }
+
+    double value = (double) mantissa;
+    value = exponent < 0 ? value / field_powers_of_ten[-exponent] : value * field_powers_of_ten[exponent];
+    return negative ? -value : value;
+}
+
+static inline trinary_t field_to_logical(const char *field, size_t size) {
+    switch (size) {
+        case 1:
+            if (field[0] == 'T') { return TRUE;  }
+            if (field[0] == 'F') { return FALSE; }
+            break;
+        case 4:
+            if (0 == memcmp(field, "TRUE", 4) || 0 == memcmp(field, "True", 4) || 0 == memcmp(field, "true", 4))     { return TRUE;  }
+            break;
+        case 5:
+            if (0 == memcmp(field, "FALSE", 5) || 0 == memcmp(field, "False", 5) || 0 == memcmp(field, "false", 5))  { return FALSE; }
+            break;
+    }
+    return NA_LOGICAL;
+}
@@ -0,0 +1,346 @@
+#include "index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../atomic_file.h"
+
+char *csv_index_path(const char *path) {
+    size_t length = strlen(path);
+    char *index_path = (char *) malloc(length + sizeof(CSV_INDEX_SUFFIX));
+    if (index_path == NULL) {
+        return NULL;
+    }
+    memcpy(index_path, path, length);
+    memcpy(index_path + length, CSV_INDEX_SUFFIX, sizeof(CSV_INDEX_SUFFIX));
+    return index_path;
+}
+
+// FNV-1a of the first and the last page of the file.
+static bool csv_index_hash(const char *path, uint64_t size, uint64_t *hash) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+
+    char page[CSV_INDEX_PAGE_SIZE];
+    long positions[2] = {0, size > CSV_INDEX_PAGE_SIZE ? (long) (size - CSV_INDEX_PAGE_SIZE) : 0};
+
+    *hash = UINT64_C(14695981039346656037);
+    for (int i = 0; i < 2; i++) {
+        if (0 != fseek(file, positions[i], SEEK_SET)) {
+            fclose(file);
+            return false;
+        }
+        size_t length = fread(page, sizeof(char), CSV_INDEX_PAGE_SIZE, file);
+        for (size_t j = 0; j < length; j++) {
+            *hash ^= (unsigned char) page[j];
+            *hash *= UINT64_C(1099511628211);
+        }
+    }
+
+    fclose(file);
+    return true;
+}
+
+// FNV-1a of the strings read as NA, each followed by a NUL.
+static uint64_t csv_index_na_strings_hash(tokenizer_t *tokenizer) {
+    if (tokenizer->na_strings == NULL) {
+        return 0;
+    }
+
+    uint64_t hash = UINT64_C(14695981039346656037);
+    for (size_t i = 0; i < tokenizer->na_strings->size; i++) {
+        const char *string = tokenizer->na_strings->strings[i];
+        for (size_t j = 0; j <= tokenizer->na_strings->lengths[i]; j++) {
+            hash ^= (unsigned char) string[j];
+            hash *= UINT64_C(1099511628211);
+        }
+    }
+    return hash;
+}
+
+static void csv_index_header_init(csv_index_header_t *header, tokenizer_t *tokenizer, const struct stat *file, uint64_t hash, bool has_header, size_t skip) {
+    memset(header, 0, sizeof(csv_index_header_t));
+    memcpy(header->magic, CSV_INDEX_MAGIC, sizeof(header->magic));
+    header->version = CSV_INDEX_VERSION;
+    header->file_size = file->st_size;
+    header->file_mtime_sec = file->st_mtim.tv_sec;
+    header->file_mtime_nsec = file->st_mtim.tv_nsec;
+    header->file_hash = hash;
+    header->header = has_header;
+    header->row_delimiter = tokenizer->row_delimiter;
+    header->column_delimiter = tokenizer->column_delimiter;
+    header->escape = tokenizer->escape;
+    header->quote = tokenizer->quote;
+    header->use_double_quote_escape = tokenizer->use_double_quote_escape;
+    header->use_escape_character = tokenizer->use_escape_character;
+    header->comment = tokenizer->comment;
+    header->skip = skip;
+    header->na_strings_hash = csv_index_na_strings_hash(tokenizer);
+}
+
+// Whether the index describes the file as it is now, read the way it is
+// about to be read.
+static bool csv_index_matches(const csv_index_header_t *found, const csv_index_header_t *expected, long interval, size_t max_levels) {
+    return 0 == memcmp(found->magic, CSV_INDEX_MAGIC, sizeof(found->magic))
+        && found->version == CSV_INDEX_VERSION
+        && found->file_size == expected->file_size
+        && found->file_mtime_sec == expected->file_mtime_sec
+        && found->file_mtime_nsec == expected->file_mtime_nsec
+        && found->file_hash == expected->file_hash
+        && found->header == expected->header
+        && found->row_delimiter == expected->row_delimiter
+        && found->column_delimiter == expected->column_delimiter
+        && found->escape == expected->escape
+        && found->quote == expected->quote
+        && found->use_double_quote_escape == expected->use_double_quote_escape
+        && found->use_escape_character == expected->use_escape_character
+        && found->comment == expected->comment
+        && found->skip == expected->skip
+        && found->na_strings_hash == expected->na_strings_hash
+        && found->max_interval == interval
+        && found->interval > 0 && found->interval <= (interval > 0 ? interval : 1)
+        && found->max_levels >= max_levels
+        // Every row takes up at least a byte.
+        && found->rows <= found->file_size
+        && found->columns <= found->file_size + 1
+        && found->offsets <= found->rows / found->interval + 1;
+}
+
+static char *csv_index_read_string(FILE *index, uint64_t limit) {
+    uint32_t length;
+    if (fread(&length, sizeof(length), 1, index) != 1 || length > limit) {
+        return NULL;
+    }
+    char *string = (char *) malloc(length + 1);
+    if (string == NULL) {
+        return NULL;
+    }
+    if (length > 0 && fread(string, sizeof(char), length, index) != length) {
+        free(string);
+        return NULL;
+    }
+    string[length] = '\0';
+    return string;
+}
+
+static bool csv_index_write_string(FILE *index, const char *string) {
+    uint32_t length = strlen(string);
+    return fwrite(&length, sizeof(length), 1, index) == 1
+        && (length == 0 || fwrite(string, sizeof(char), length, index) == length);
+}
+
+// Only the types a scan can give a column.
+static bool csv_index_known_type(uint32_t type) {
+    switch (type) {
+        case TOKEN_EMPTY:
+        case TOKEN_NA:
+        case TOKEN_BOOLEAN:
+        case TOKEN_INTEGER:
+        case TOKEN_DOUBLE:
+        case TOKEN_STRING:
+        case TOKEN_INTERNED_STRING:
+        case TOKEN_FREE_STRING:
+        case TOKEN_FACTOR:          return true;
+        default:                    return false;
+    }
+}
+
+scan_results_t *csv_index_load(tokenizer_t *tokenizer, const char *path, long record_row_offsets_at_interval, bool header, size_t skip, size_t max_levels) {
+    struct stat file;
+    uint64_t hash;
+    if (stat(path, &file) != 0 || !csv_index_hash(path, file.st_size, &hash)) {
+        return NULL;
+    }
+
+    csv_index_header_t expected;
+    csv_index_header_init(&expected, tokenizer, &file, hash, header, skip);
+
+    char *index_path = csv_index_path(path);
+    if (index_path == NULL) {
+        return NULL;
+    }
+    FILE *index = fopen(index_path, "rb");
+    free(index_path);
+    if (index == NULL) {
+        return NULL;
+    }
+
+    csv_index_header_t found;
+    if (fread(&found, sizeof(found), 1, index) != 1
+        || !csv_index_matches(&found, &expected, record_row_offsets_at_interval, max_levels)) {
+        fclose(index);
+        return NULL;
+    }
+
+    offset_record_t *row_offsets = offset_record_new(found.interval, found.offsets > 0 ? found.offsets : 1);
+    if (row_offsets == NULL || row_offsets->offsets == NULL) {
+        fclose(index);
+        return NULL;
+    }
+    for (size_t i = 0; i < found.offsets; i++) {
+        int64_t offset;
+        if (fread(&offset, sizeof(offset), 1, index) != 1 || offset < 0 || (uint64_t) offset > found.file_size) {
+            offset_record_free(row_offsets);
+            fclose(index);
+            return NULL;
+        }
+        offset_record_add(row_offsets, offset);
+    }
+
+    if (found.rows > 0) {
+        row_offsets->deltas = (uint16_t *) malloc(sizeof(uint16_t) * found.rows);
+        if (row_offsets->deltas == NULL
+            || fread(row_offsets->deltas, sizeof(uint16_t), found.rows, index) != found.rows) {
+            offset_record_free(row_offsets);
+            fclose(index);
+            return NULL;
+        }
+        row_offsets->rows = found.rows;
+        row_offsets->allocated_rows = found.rows;
+
+        // The last row has to start within the file.
+        long last_offset;
+        size_t last_row;
+        if (row_offsets->size <= (found.rows - 1) / row_offsets->interval) {
+            offset_record_free(row_offsets);
+            fclose(index);
+            return NULL;
+        }
+        offset_record_get_value_closest_to_this_key(row_offsets, found.rows - 1, &last_offset, &last_row);
+        if (last_offset < 0 || (uint64_t) last_offset > found.file_size) {
+            offset_record_free(row_offsets);
+            fclose(index);
+            return NULL;
+        }
+    }
+
+    scan_results_t *results = scan_results_new(found.rows, found.columns, row_offsets);
+    if (results == NULL) {
+        offset_record_free(row_offsets);
+        fclose(index);
+        return NULL;
+    }
+    for (size_t column = 0; column < found.columns; column++) {
+        uint32_t type;
+        if (fread(&type, sizeof(type), 1, index) != 1 || !csv_index_known_type(type)) {
+            goto bad;
+        }
+        results->column_types[column] = (token_type_t) type;
+
+        int64_t offset;
+        if (fread(&offset, sizeof(offset), 1, index) != 1 || offset < CSV_COLUMN_OFFSET_VARIES
+            || (offset != CSV_COLUMN_OFFSET_VARIES && (uint64_t) offset > found.file_size)) {
+            goto bad;
+        }
+        results->column_offsets[column] = offset;
+
+        results->column_names[column] = csv_index_read_string(index, found.file_size);
+        if (results->column_names[column] == NULL) {
+            goto bad;
+        }
+
+        int64_t levels;
+        if (fread(&levels, sizeof(levels), 1, index) != 1 || levels > (int64_t) found.max_levels) {
+            goto bad;
+        }
+        if (levels < 0) {
+            continue;
+        }
+
+        string_set_t *set = string_set_new(levels);
+        if (set == NULL) {
+            goto bad;
+        }
+        results->column_levels[column] = set;
+        for (int64_t i = 0; i < levels; i++) {
+            char *level = csv_index_read_string(index, found.file_size);
+            bool added = level != NULL && string_set_add(set, level);
+            free(level);
+            if (!added) {
+                goto bad;
+            }
+        }
+
+        // Levels were collected with a higher limit than this one.
+        if (string_set_size(set) > max_levels) {
+            string_set_free(set);
+            results->column_levels[column] = NULL;
+        }
+    }
+
+    fclose(index);
+    return results;
+
+    bad:
+    fclose(index);
+    scan_results_free(results);
+    return NULL;
+}
+
+int csv_index_store(tokenizer_t *tokenizer, const char *path, long record_row_offsets_at_interval, bool header, size_t skip, size_t max_levels, scan_results_t *results) {
+    struct stat file;
+    uint64_t hash;
+    if (stat(path, &file) != 0 || !csv_index_hash(path, file.st_size, &hash)) {
+        return -1;
+    }
+
+    csv_index_header_t index_header;
+    csv_index_header_init(&index_header, tokenizer, &file, hash, header, skip);
+    index_header.rows = results->rows;
+    index_header.columns = results->columns;
+    index_header.max_interval = record_row_offsets_at_interval;
+    index_header.interval = results->row_offsets->interval;
+    index_header.offsets = results->row_offsets->size;
+    index_header.max_levels = max_levels;
+
+    char *index_path = csv_index_path(path);
+    if (index_path == NULL) {
+        return -1;
+    }
+
+    // Concurrent readers never see a partially written index.
+    char *temporary_path;
+    int fd = atomic_file_create(index_path, &temporary_path);
+    FILE *index = fd < 0 ? NULL : fdopen(fd, "wb");
+    if (index == NULL) {
+        if (fd >= 0) {
+            close(fd);
+            atomic_file_discard(temporary_path);
+        }
+        free(index_path);
+        return -1;
+    }
+
+    bool ok = fwrite(&index_header, sizeof(index_header), 1, index) == 1;
+    for (size_t i = 0; ok && i < results->row_offsets->size; i++) {
+        int64_t offset = results->row_offsets->offsets[i];
+        ok = fwrite(&offset, sizeof(offset), 1, index) == 1;
+    }
+    if (ok && results->row_offsets->rows > 0) {
+        ok = results->row_offsets->rows == results->rows
+          && fwrite(results->row_offsets->deltas, sizeof(uint16_t), results->rows, index) == results->rows;
+    }
+    for (size_t column = 0; ok && column < results->columns; column++) {
+        uint32_t type = results->column_types[column];
+        string_set_t *set = results->column_levels[column];
+        int64_t offset = results->column_offsets[column];
+        int64_t levels = set == NULL ? -1 : (int64_t) string_set_size(set);
+        ok = fwrite(&type, sizeof(type), 1, index) == 1
+          && fwrite(&offset, sizeof(offset), 1, index) == 1
+          && csv_index_write_string(index, results->column_names[column])
+          && fwrite(&levels, sizeof(levels), 1, index) == 1;
+        for (int64_t i = 0; ok && i < levels; i++) {
+            ok = csv_index_write_string(index, set->strings[i]);
+        }
+    }
+    ok = (fclose(index) == 0) && ok;
+    ok = atomic_file_finish(temporary_path, index_path, ok);
+
+    free(index_path);
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "reader.h"
+#include "tokenizer.h"
+
+// Scan results are saved next to the CSV file, so that reopening it does not
+// scan it again. The index records the size and modification time of the
+// file and a hash of its first and last pages, and is ignored once they no
+// longer match. It also records how the file was tokenized, since a file
+// read differently scans differently.
+#define CSV_INDEX_SUFFIX    ".ufoidx"
+#define CSV_INDEX_MAGIC     "UFOCSIDX"
+#define CSV_INDEX_VERSION   4
+#define CSV_INDEX_PAGE_SIZE 4096
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t file_size;
+    int64_t  file_mtime_sec;
+    int64_t  file_mtime_nsec;
+    uint64_t file_hash;         // of the first and last pages
+    uint64_t rows;
+    uint64_t columns;
+    int64_t  max_interval;      // the interval asked for
+    int64_t  interval;          // rows between recorded offsets
+    uint64_t offsets;
+    uint64_t max_levels;        // levels were collected up to this many
+    uint64_t skip;              // lines skipped before the header
+    uint64_t na_strings_hash;   // of the strings read as NA, 0 for just "NA"
+    uint8_t  header;
+    char     row_delimiter;
+    char     column_delimiter;
+    char     escape;
+    char     quote;
+    uint8_t  use_double_quote_escape;
+    uint8_t  use_escape_character;
+    char     comment;
+} csv_index_header_t;
+
+// After the header: the row offsets as int64_t, the offset of every row from
+// the row offset before it as uint16_t, then for every column its
+// type as uint32_t, where it starts within every row as int64_t, the length
+// of its name as uint32_t and the name, and the
+// number of its levels as int64_t, -1 if it has none, followed by the length
+// of each level as uint32_t and the level.
+
+// Returns a newly allocated path of the index of the given file.
+char *csv_index_path(const char *path);
+
+// Returns the scan results of the file if an up to date index of it exists,
+// NULL otherwise. String columns get levels if they have at most max_levels
+// distinct values.
+scan_results_t *csv_index_load(tokenizer_t *, const char *path, long record_row_offsets_at_interval, bool header, size_t skip, size_t max_levels);
+
+// Saves scan results, including levels collected up to max_levels, next to
+// the file. Returns 0 on success. Failing to save is not an error, the file
+// is just scanned again next time.
+int csv_index_store(tokenizer_t *, const char *path, long record_row_offsets_at_interval, bool header, size_t skip, size_t max_levels, scan_results_t *);
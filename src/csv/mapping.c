@@ -0,0 +1,57 @@
+#include "mapping.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+csv_mapping_t *csv_mapping_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat file_info;
+    if (fstat(fd, &file_info) < 0 || file_info.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    void *data = mmap(NULL, file_info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    csv_mapping_t *mapping = (csv_mapping_t *) malloc(sizeof(csv_mapping_t));
+    if (mapping == NULL) {
+        munmap(data, file_info.st_size);
+        return NULL;
+    }
+
+    // Chunks are populated in whatever order the program touches them, so
+    // reading ahead of a fault is left to csv_mapping_will_need.
+    madvise(data, file_info.st_size, MADV_RANDOM);
+
+    mapping->data = (const char *) data;
+    mapping->size = file_info.st_size;
+    return mapping;
+}
+
+void csv_mapping_close(csv_mapping_t *mapping) {
+    munmap((void *) mapping->data, mapping->size);
+    free(mapping);
+}
+
+void csv_mapping_will_need(const csv_mapping_t *mapping, size_t from, size_t to) {
+    if (to > mapping->size) {
+        to = mapping->size;
+    }
+    if (from >= to) {
+        return;
+    }
+    uintptr_t page_size = (uintptr_t) sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t) (mapping->data + from)) & ~(page_size - 1);
+    uintptr_t end = (uintptr_t) (mapping->data + to);
+    madvise((void *) start, end - start, MADV_WILLNEED);
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stddef.h>
+
+// A CSV file mapped into memory once and read by the vectors of all of its
+// columns. Tokenizers walk the mapped bytes directly instead of reading the
+// file through a buffer of their own, and the kernel is told which rows are
+// about to be read so it can fault them in ahead of the tokenizer.
+typedef struct {
+    const char *data;
+    size_t      size;
+} csv_mapping_t;
+
+// Maps the file read-only. Returns NULL if it cannot be mapped, which is also
+// the case for empty files, and the file is then read with stdio instead.
+csv_mapping_t *csv_mapping_open     (const char *path);
+void           csv_mapping_close    (csv_mapping_t *);
+
+// Asks for bytes from to to, exclusive, to be read in ahead of use.
+void           csv_mapping_will_need(const csv_mapping_t *, size_t from, size_t to);
@@ -1,10 +1,17 @@
 #include "reader.h"
 
 #include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "token.h"
 #include "tokenizer.h"
 #include "string_vector.h"
+#include "structural.h"
+#include "field.h"
 
 typedef union {
     struct {
@@ -95,6 +102,10 @@ offset_record_t *offset_record_new(long interval, size_t initial_size) {
     if (record->offsets == NULL) {
         perror("Error: cannot allocate memory to create offset record");
     }
+
+    record->deltas = NULL;
+    record->rows = 0;
+    record->allocated_rows = 0;
     return record;
 }
 
@@ -115,6 +126,29 @@ int offset_record_add(offset_record_t *record, long offset) {
     return 0;
 }
 
+int offset_record_add_row(offset_record_t *record, long offset) {
+    if (record->rows >= record->allocated_rows) {
+        size_t allocated = record->allocated_rows < 64 ? 64 : record->allocated_rows + (record->allocated_rows >> 1);
+        uint16_t *deltas = (uint16_t *) realloc(record->deltas, sizeof(uint16_t) * allocated);
+        if (deltas == NULL) {
+            perror("Error: cannot allocate memory to expand offset record");
+            return -1;
+        }
+        record->deltas = deltas;
+        record->allocated_rows = allocated;
+    }
+
+    if (offset_record_is_interesting(record, record->rows)) {
+        if (0 != offset_record_add(record, offset)) {
+            return -1;
+        }
+    }
+
+    long delta = offset - record->offsets[record->size - 1];
+    record->deltas[record->rows++] = delta < CSV_ROW_OFFSET_FAR ? (uint16_t) delta : CSV_ROW_OFFSET_FAR;
+    return 0;
+}
+
 size_t offset_record_human_readable_key(offset_record_t *record, size_t i) {
     return (i * (record->interval)) + 1;
 }
@@ -127,46 +161,657 @@ void offset_record_get_value_closest_to_this_key(offset_record_t *record, size_t
     size_t target_index = target / record->interval; // floor
 
     assert(record->size > target_index);
-    *offset = record->offsets[target_index];
-    *key_at_offset = offset_record_key_at(record, target_index);
+    size_t first_key = offset_record_key_at(record, target_index);
+
+    // Deltas only grow within an interval, so the rows too far out to be
+    // recorded are all at its end.
+    size_t key = target < record->rows ? target : first_key;
+    while (key > first_key && record->deltas[key] == CSV_ROW_OFFSET_FAR) {
+        key--;
+    }
+
+    *offset = record->offsets[target_index] + (key > first_key ? record->deltas[key] : 0);
+    *key_at_offset = key;
 
     //printf("target: %li -> target_index: %li (key: %li) -> %li\n", target, target_index, *key_at_offset, *offset);
 }
 
 void offset_record_free(offset_record_t *record) {
+    free(record->deltas);
     free(record->offsets);
     free(record);
 }
 
+tokenizer_state_t *ufo_csv_open_rows(const char *path, const csv_mapping_t *mapping, scan_results_t *scan_results, size_t first_row, size_t last_row, size_t initial_buffer_size, size_t *row_at_offset) {
+    long offset = 0;
+    offset_record_get_value_closest_to_this_key(scan_results->row_offsets, first_row, &offset, row_at_offset);
+
+    if (mapping == NULL) {
+        return tokenizer_state_init(path, offset, initial_buffer_size, CSV_READ_BUFFER_SIZE);
+    }
+
+    // The rows end before the next recorded offset, if there is one.
+    offset_record_t *row_offsets = scan_results->row_offsets;
+    size_t next_index = last_row / row_offsets->interval + 1;
+    size_t end = next_index < row_offsets->size ? (size_t) row_offsets->offsets[next_index] : mapping->size;
+    csv_mapping_will_need(mapping, offset, end);
+
+    return tokenizer_state_init_mapped(mapping->data, mapping->size, offset, initial_buffer_size);
+}
+
 scan_results_t *scan_results_new(size_t rows, size_t columns, offset_record_t *row_offset_record) {
     scan_results_t *results = (scan_results_t *) malloc(sizeof(scan_results_t));
+    if (results == NULL) {
+        return NULL;
+    }
     results->rows = rows;
     results->columns = columns;
-    results->column_types = (token_type_t *) malloc(sizeof(token_type_t) * columns); // FIXME check
-    results->column_names = (char **) malloc(sizeof(char *) * columns); // FIXME check
+    results->column_types = (token_type_t *) malloc(sizeof(token_type_t) * columns);
+    results->column_names = (char **) calloc(columns, sizeof(char *));
     results->row_offsets = row_offset_record;
+    results->column_levels = (string_set_t **) calloc(columns, sizeof(string_set_t *));
+    results->column_offsets = (long *) malloc(sizeof(long) * columns);
+    if (columns > 0 && (results->column_types == NULL || results->column_names == NULL
+                        || results->column_levels == NULL || results->column_offsets == NULL)) {
+        free(results->column_types);
+        free(results->column_names);
+        free(results->column_levels);
+        free(results->column_offsets);
+        free(results);
+        return NULL;
+    }
+    for (size_t i = 0; i < columns; i++) {
+        results->column_offsets[i] = CSV_COLUMN_OFFSET_VARIES;
+    }
     return results;
 }
 
 void scan_results_free(scan_results_t *results) {
     offset_record_free(results->row_offsets);
+    for (size_t i = 0; i < results->columns; i++) {
+        if (results->column_levels[i] != NULL) {
+            string_set_free(results->column_levels[i]);
+        }
+    }
+    free(results->column_levels);
+    for (size_t i = 0; i < results->columns; i++) {
+        free(results->column_names[i]);
+    }
+    free(results->column_names);
+    free(results->column_offsets);
     free(results->column_types);
     free(results);
 }
 
-scan_results_t *ufo_csv_perform_initial_scan(tokenizer_t *tokenizer, const char* path, long record_row_offsets_at_interval, bool header, size_t initial_buffer_size) {
+// Lengths of consecutive rows, two bytes each. Rows too long for that are
+// recorded as CSV_ROW_OFFSET_FAR and their lengths kept on the side.
+typedef struct {
+    uint16_t *lengths;
+    size_t    size;
+    size_t    allocated;
+    long     *long_lengths;
+    size_t    long_size;
+    size_t    long_allocated;
+} row_lengths_t;
+
+static bool row_lengths_add(row_lengths_t *row_lengths, long length) {
+    if (row_lengths->size >= row_lengths->allocated) {
+        size_t allocated = row_lengths->allocated < 1024 ? 1024 : row_lengths->allocated + (row_lengths->allocated >> 1);
+        uint16_t *lengths = (uint16_t *) realloc(row_lengths->lengths, sizeof(uint16_t) * allocated);
+        if (lengths == NULL) {
+            return false;
+        }
+        row_lengths->lengths = lengths;
+        row_lengths->allocated = allocated;
+    }
+    if (length < CSV_ROW_OFFSET_FAR) {
+        row_lengths->lengths[row_lengths->size++] = (uint16_t) length;
+        return true;
+    }
+
+    if (row_lengths->long_size >= row_lengths->long_allocated) {
+        size_t allocated = row_lengths->long_allocated < 16 ? 16 : row_lengths->long_allocated * 2;
+        long *long_lengths = (long *) realloc(row_lengths->long_lengths, sizeof(long) * allocated);
+        if (long_lengths == NULL) {
+            return false;
+        }
+        row_lengths->long_lengths = long_lengths;
+        row_lengths->long_allocated = allocated;
+    }
+    row_lengths->lengths[row_lengths->size++] = CSV_ROW_OFFSET_FAR;
+    row_lengths->long_lengths[row_lengths->long_size++] = length;
+    return true;
+}
+
+static void row_lengths_free(row_lengths_t *row_lengths) {
+    free(row_lengths->lengths);
+    free(row_lengths->long_lengths);
+}
+
+// Where each column starts within the rows seen so far, or
+// CSV_COLUMN_OFFSET_VARIES for columns that did not always start at the same
+// byte or that some of the rows lack.
+typedef struct {
+    long  *offsets;
+    size_t size;
+    size_t allocated;
+    bool   has_rows;
+} column_offsets_t;
+
+static bool column_offsets_append(column_offsets_t *column_offsets, long offset) {
+    if (column_offsets->size >= column_offsets->allocated) {
+        size_t allocated = column_offsets->allocated < 32 ? 32 : column_offsets->allocated * 2;
+        long *offsets = (long *) realloc(column_offsets->offsets, sizeof(long) * allocated);
+        if (offsets == NULL) {
+            return false;
+        }
+        column_offsets->offsets = offsets;
+        column_offsets->allocated = allocated;
+    }
+    column_offsets->offsets[column_offsets->size++] = offset;
+    return true;
+}
+
+// Columns are set in order, and the row ended once they all are.
+static bool column_offsets_set(column_offsets_t *column_offsets, size_t column, long offset) {
+    if (column >= column_offsets->size) {
+        return column_offsets_append(column_offsets, column_offsets->has_rows ? CSV_COLUMN_OFFSET_VARIES : offset);
+    }
+    if (column_offsets->offsets[column] != offset) {
+        column_offsets->offsets[column] = CSV_COLUMN_OFFSET_VARIES;
+    }
+    return true;
+}
+
+static void column_offsets_end_row(column_offsets_t *column_offsets, size_t columns) {
+    for (size_t column = columns; column < column_offsets->size; column++) {
+        column_offsets->offsets[column] = CSV_COLUMN_OFFSET_VARIES;
+    }
+    column_offsets->has_rows = true;
+}
+
+static bool column_offsets_merge(column_offsets_t *into, column_offsets_t *from) {
+    if (!from->has_rows) {
+        return true;
+    }
+    for (size_t column = 0; column < from->size || column < into->size; column++) {
+        bool in_both = column < from->size && column < into->size;
+        long offset = in_both || !into->has_rows ? from->offsets[column] : CSV_COLUMN_OFFSET_VARIES;
+        if (column >= into->size) {
+            if (!column_offsets_append(into, offset)) {
+                return false;
+            }
+        } else if (!in_both || into->offsets[column] != offset) {
+            into->offsets[column] = CSV_COLUMN_OFFSET_VARIES;
+        }
+    }
+    into->has_rows = true;
+    return true;
+}
+
+// Tokenizes the rows that start in [from, to), deducing column types and
+// recording how long every row is and where its columns start. The first row starts at from and is the
+// first_row-th row of the file.
+typedef struct {
+    tokenizer_t         *tokenizer;
+    const char          *path;
+    long                 from;
+    long                 to;
+    long                 size;          // of the file
+    size_t               first_row;
+
+    long                 end;           // where the first row at or past to starts
+    size_t               rows;
+    token_type_vector_t *column_types;
+    row_lengths_t        row_lengths;
+    column_offsets_t     column_offsets;
+    bool                 failed;
+} scan_task_t;
+
+static void *scan_rows(void *argument) {
+    scan_task_t *task = (scan_task_t *) argument;
+
+    tokenizer_state_t *state = tokenizer_state_init(task->path, task->from, CSV_SCAN_READ_BUFFER_SIZE, CSV_SCAN_READ_BUFFER_SIZE);
+    if (state == NULL || 0 != tokenizer_start(task->tokenizer, state)) {
+        task->failed = true;
+        return NULL;
+    }
+
+    long row_start = task->from;
+    size_t column = 0;
+
+    while (row_start < task->to && row_start < task->size) {
+        bool column_type_is_string = token_type_vector_is_string(task->column_types, column);
+        long column_offset = state->current_offset - row_start;
+
+        tokenizer_token_t *token = NULL;
+        tokenizer_result_t result = tokenizer_next(task->tokenizer, state, &token, column_type_is_string);
+
+        if (TOKENIZER_ERROR == result || TOKENIZER_PARSE_ERROR == result) {
+            if (token != NULL) {
+                token_free(token);
+            }
+            task->failed = true;
+            break;
+        }
+
+        // Comment lines at the end of the file are no row.
+        if (TOKENIZER_END_OF_FILE == result && column == 0 && state->row_start) {
+            if (token != NULL) {
+                token_free(token);
+            }
+            row_start = task->size;
+            break;
+        }
+
+        if (!column_type_is_string) {
+            token_type_t token_type = tokenizer_is_na(task->tokenizer, token->string, strlen(token->string))
+                                    ? TOKEN_NA : deduce_token_type(token);
+            token_free(token);
+            if (0 != token_type_vector_add_type(task->column_types, column, token_type)) {
+                task->failed = true;
+                break;
+            }
+        }
+
+        if (!column_offsets_set(&task->column_offsets, column, column_offset)) {
+            task->failed = true;
+            break;
+        }
+
+        switch (result) {
+            case TOKENIZER_OK:
+                column++;
+                break;
+
+            case TOKENIZER_END_OF_ROW:
+                column_offsets_end_row(&task->column_offsets, column + 1);
+                column = 0;
+                task->rows++;
+                task->failed = !row_lengths_add(&task->row_lengths, state->current_offset - row_start);
+                row_start = state->current_offset;
+                break;
+
+            case TOKENIZER_END_OF_FILE:
+                column_offsets_end_row(&task->column_offsets, column + 1);
+                column = 0;
+                task->rows++;
+                task->failed = !row_lengths_add(&task->row_lengths, task->size - row_start);
+                row_start = task->size;
+                break;
+
+            default:;
+        }
+        if (task->failed) {
+            break;
+        }
+    }
+
+    task->end = row_start;
+    tokenizer_state_close(state);
+    return NULL;
+}
+
+// Where rows start in a range of bytes, found without tokenizing. Whether a
+// row delimiter ends a row depends on whether it is inside quotes or a
+// comment line, which depends on what came before the range. So every case
+// is counted, indexed by the state at the start of the range, and the right
+// one is picked once all ranges know the state they end in for each.
+typedef enum {
+    CENSUS_OUTSIDE    = 0,
+    CENSUS_IN_QUOTES  = 1,
+    CENSUS_IN_COMMENT = 2,
+    CENSUS_LINE_START = 3,          // outside, and a comment could start here
+} census_state_t;
+
+typedef struct {
+    int    fd;
+    char   quote;
+    char   row_delimiter;
+    char   comment;
+    long   from;
+    long   to;
+    bool   starts_row;              // the first range starts at the first row
+
+    size_t rows[4];
+    long   first_row[4];            // -1 if no row starts in the range
+    census_state_t end_state[4];
+    bool   failed;
+} quote_census_t;
+
+static void *count_quotes(void *argument) {
+    quote_census_t *census = (quote_census_t *) argument;
+
+    // Without comments, only quotes matter.
+    unsigned int states = census->comment != '\0' ? 4 : 2;
+    census_state_t *state = census->end_state;
+    long row_start[4];
+    for (unsigned int start = 0; start < states; start++) {
+        state[start] = start == CENSUS_LINE_START ? CENSUS_OUTSIDE : (census_state_t) start;
+        census->rows[start] = census->starts_row ? 1 : 0;
+        census->first_row[start] = census->starts_row ? census->from : -1;
+        row_start[start] = census->starts_row || start == CENSUS_LINE_START ? census->from : -1;
+    }
+
+    char *buffer = (char *) malloc(CSV_SCAN_READ_BUFFER_SIZE);
+    if (buffer == NULL) {
+        census->failed = true;
+        return NULL;
+    }
+
+    char comment = census->comment != '\0' ? census->comment : census->quote;
+    for (long position = census->from; position < census->to;) {
+        size_t length = census->to - position < CSV_SCAN_READ_BUFFER_SIZE ? census->to - position : CSV_SCAN_READ_BUFFER_SIZE;
+        ssize_t read_bytes = pread(census->fd, buffer, length, position);
+        if (read_bytes <= 0) {
+            census->failed = true;
+            break;
+        }
+
+        for (size_t i = find_structural(buffer, read_bytes, census->quote, census->row_delimiter, comment);
+             i < (size_t) read_bytes;
+             i += 1 + find_structural(buffer + i + 1, read_bytes - i - 1, census->quote, census->row_delimiter, comment)) {
+            long offset = position + i;
+            for (unsigned int start = 0; start < states; start++) {
+                if (state[start] == CENSUS_IN_QUOTES) {
+                    if (buffer[i] == census->quote) {
+                        state[start] = CENSUS_OUTSIDE;
+                    }
+                } else if (state[start] == CENSUS_IN_COMMENT) {
+                    // The tokenizer skips comment lines as part of the row
+                    // after them, so the row has not started yet.
+                    if (buffer[i] == census->row_delimiter) {
+                        state[start] = CENSUS_OUTSIDE;
+                        row_start[start] = offset + 1;
+                    }
+                } else if (buffer[i] == census->row_delimiter) {
+                    census->rows[start]++;
+                    if (census->first_row[start] < 0) {
+                        census->first_row[start] = offset + 1;
+                    }
+                    row_start[start] = offset + 1;
+                } else if (buffer[i] == census->quote) {
+                    state[start] = CENSUS_IN_QUOTES;
+                } else if (offset == row_start[start]) {
+                    state[start] = CENSUS_IN_COMMENT;
+                }
+            }
+        }
+        position += read_bytes;
+    }
+    // The next range may start with a comment.
+    if (states > CENSUS_LINE_START) {
+        for (unsigned int start = 0; start < states; start++) {
+            if (state[start] == CENSUS_OUTSIDE && row_start[start] == census->to) {
+                state[start] = CENSUS_LINE_START;
+            }
+        }
+    }
+
+    free(buffer);
+    return NULL;
+}
+
+size_t ufo_csv_scan_thread_count() {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1) {
+        return 1;
+    }
+    return cores > CSV_SCAN_MAX_THREADS ? CSV_SCAN_MAX_THREADS : (size_t) cores;
+}
+
+// Runs each task on its own thread, and the last one (along with any that
+// could not be started) on this one. Returns false if any task failed.
+static bool run_in_parallel(void *(*function)(void *), void *tasks, size_t task_size, size_t count, bool *failed_flags[]) {
+    pthread_t *workers = (pthread_t *) calloc(count, sizeof(pthread_t));
+    bool *started = (bool *) calloc(count, sizeof(bool));
+    if (workers == NULL || started == NULL) {
+        free(workers);
+        free(started);
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        void *task = (char *) tasks + i * task_size;
+        started[i] = i + 1 < count && 0 == pthread_create(&workers[i], NULL, function, task);
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (!started[i]) {
+            function((char *) tasks + i * task_size);
+        }
+    }
+
+    bool failed = false;
+    for (size_t i = 0; i < count; i++) {
+        if (started[i]) {
+            pthread_join(workers[i], NULL);
+        }
+        failed = failed || *failed_flags[i];
+    }
+
+    free(workers);
+    free(started);
+    return !failed;
+}
+
+static bool scan_task_init(scan_task_t *task, tokenizer_t *tokenizer, const char *path, long size,
+                           long from, long to, size_t first_row) {
+    task->tokenizer = tokenizer;
+    task->path = path;
+    task->size = size;
+    task->from = from;
+    task->to = to;
+    task->first_row = first_row;
+    task->end = from;
+    task->rows = 0;
+    task->failed = false;
+    task->column_types = token_type_vector_new(32);
+    memset(&task->row_lengths, 0, sizeof(row_lengths_t));
+    memset(&task->column_offsets, 0, sizeof(column_offsets_t));
+    return task->column_types != NULL;
+}
+
+static void scan_task_free(scan_task_t *task) {
+    if (task->column_types != NULL) token_type_vector_free(task->column_types);
+    row_lengths_free(&task->row_lengths);
+    free(task->column_offsets.offsets);
+}
+
+// Rows between recorded offsets, so that an interval spans about
+// CSV_ROW_OFFSET_SPAN_BYTES of rows this long on average.
+static long row_offset_interval(long bytes, size_t rows, long max_interval) {
+    long average = rows == 0 ? 1 : bytes / (long) rows;
+    long interval = CSV_ROW_OFFSET_SPAN_BYTES / (average > 0 ? average : 1);
+    if (interval > max_interval) {
+        interval = max_interval;
+    }
+    return interval > 0 ? interval : 1;
+}
+
+// Scans the rows of the file that start at or after data_start. The bytes
+// are split into ranges, one per thread. First each thread counts the
+// quotes and row delimiters in its range, which tells every range where its
+// first row starts and how many rows come before it, assuming quotes come
+// in pairs. Then each thread tokenizes the rows starting in its range.
+//
+// The guess is checked when the results are merged: each range must start
+// where the tokenizer of the range before it found the next row, at the
+// expected row. Escaped quotes or quotes inside unquoted fields can break
+// the guess; the rest of the file is then tokenized again on this thread.
+//
+// Row offsets are recorded once the rows are counted, at an interval picked
+// from their average length.
+static bool scan_rows_in_parallel(tokenizer_t *tokenizer, const char *path, long data_start, long max_interval, size_t threads,
+                                  size_t *rows, token_type_vector_t *column_types, offset_record_t **row_offsets,
+                                  column_offsets_t *column_offsets) {
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat file;
+    if (0 != fstat(fd, &file)) {
+        close(fd);
+        return false;
+    }
+    long size = file.st_size;
+
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (data_start >= size || (size - data_start) / threads < CSV_SCAN_MIN_BYTES_PER_THREAD) {
+        threads = data_start >= size ? 1 : (size - data_start) / CSV_SCAN_MIN_BYTES_PER_THREAD + 1;
+    }
+
+    scan_task_t *tasks = (scan_task_t *) calloc(threads + 1, sizeof(scan_task_t));
+    quote_census_t *censuses = (quote_census_t *) calloc(threads, sizeof(quote_census_t));
+    bool **failed_flags = (bool **) calloc(threads, sizeof(bool *));
+    long *boundaries = (long *) calloc(threads + 1, sizeof(long));
+    if (tasks == NULL || censuses == NULL || failed_flags == NULL || boundaries == NULL) {
+        free(tasks);
+        free(censuses);
+        free(failed_flags);
+        free(boundaries);
+        close(fd);
+        return false;
+    }
+
+    bool ok = true;
+    long range = (size - data_start) / threads + 1;
+    for (size_t i = 0; i <= threads; i++) {
+        boundaries[i] = data_start + (long) i * range < size ? data_start + (long) i * range : size;
+    }
+
+    // A row delimiter at position p starts a row at p + 1, so each census
+    // range is shifted back a byte. The row at data_start is known to start
+    // outside quotes.
+    if (threads > 1) {
+        for (size_t i = 0; i < threads; i++) {
+            censuses[i].fd = fd;
+            censuses[i].quote = tokenizer->quote;
+            censuses[i].row_delimiter = tokenizer->row_delimiter;
+            censuses[i].comment = tokenizer->comment;
+            censuses[i].starts_row = i == 0;
+            censuses[i].from = i == 0 ? data_start : boundaries[i] - 1;
+            censuses[i].to = boundaries[i + 1] - 1;
+            failed_flags[i] = &censuses[i].failed;
+        }
+        ok = run_in_parallel(count_quotes, censuses, sizeof(quote_census_t), threads, failed_flags);
+    }
+
+    census_state_t state = CENSUS_OUTSIDE;
+    size_t first_row = 0;
+    for (size_t i = 0; ok && i < threads; i++) {
+        long from = data_start;
+        size_t range_rows = 1;
+        if (threads > 1) {
+            from = i == 0 ? data_start : censuses[i].first_row[state];
+            range_rows = censuses[i].rows[state];
+            state = censuses[i].end_state[state];
+        }
+        if (from < 0 || from >= boundaries[i + 1]) {
+            // No row starts in this range.
+            from = boundaries[i + 1];
+            range_rows = 0;
+        }
+
+        ok = scan_task_init(&tasks[i], tokenizer, path, size, from, boundaries[i + 1], first_row);
+        failed_flags[i] = &tasks[i].failed;
+        first_row += range_rows;
+    }
+    close(fd);
+
+    if (ok) {
+        ok = run_in_parallel(scan_rows, tasks, sizeof(scan_task_t), threads, failed_flags);
+    }
+
+    // Keep the ranges that start where the one before them ended, up to the
+    // first that does not.
+    long expected_start = data_start;
+    size_t expected_row = 0;
+    size_t valid = 0;
+    for (; ok && valid < threads; valid++) {
+        scan_task_t *task = &tasks[valid];
+        bool empty = task->from >= task->to;
+        if (empty ? expected_start < task->to : (task->from != expected_start || task->first_row != expected_row)) {
+            break;
+        }
+        if (!empty) {
+            expected_start = task->end;
+            expected_row += task->rows;
+        }
+    }
+
+    if (ok && valid < threads) {
+        scan_task_t *task = &tasks[threads];
+        ok = scan_task_init(task, tokenizer, path, size, expected_start, size, expected_row);
+        if (ok) {
+            scan_rows(task);
+            ok = !task->failed;
+        }
+        expected_row += task->rows;
+    }
+
+    long data_end = valid < threads ? size : expected_start;
+    long interval = row_offset_interval(data_end - data_start, expected_row, max_interval);
+    *row_offsets = ok ? offset_record_new(interval, expected_row / interval + 1) : NULL;
+    ok = ok && *row_offsets != NULL && (*row_offsets)->offsets != NULL;
+
+    for (size_t i = 0; ok && i <= threads; i++) {
+        if (i >= valid && i < threads) {
+            continue;
+        }
+        scan_task_t *task = &tasks[i];
+        if (task->column_types == NULL) {
+            continue;
+        }
+        for (size_t column = 0; ok && column < task->column_types->size; column++) {
+            ok = 0 == token_type_vector_add_type(column_types, column, task->column_types->types[column].value);
+        }
+        ok = ok && column_offsets_merge(column_offsets, &task->column_offsets);
+
+        long offset = task->from;
+        size_t long_rows = 0;
+        for (size_t j = 0; ok && j < task->row_lengths.size; j++) {
+            ok = 0 == offset_record_add_row(*row_offsets, offset);
+            uint16_t length = task->row_lengths.lengths[j];
+            offset += length == CSV_ROW_OFFSET_FAR ? task->row_lengths.long_lengths[long_rows++] : length;
+        }
+    }
+    *rows = expected_row;
+
+    for (size_t i = 0; i <= threads; i++) {
+        scan_task_free(&tasks[i]);
+    }
+    free(tasks);
+    free(censuses);
+    free(failed_flags);
+    free(boundaries);
+    return ok;
+}
+
+scan_results_t *ufo_csv_perform_initial_scan(tokenizer_t *tokenizer, const char* path, long record_row_offsets_at_interval, bool header, size_t skip, size_t initial_buffer_size, size_t threads) {
 
     tokenizer_state_t *state = tokenizer_state_init(path, 0, initial_buffer_size, initial_buffer_size);
-    tokenizer_start(tokenizer, state);
+    if (state == NULL) {
+        return NULL;
+    }
+    if (0 != tokenizer_start(tokenizer, state)) {
+        tokenizer_state_close(state);
+        return NULL;
+    }
 
-    offset_record_t *row_offsets = offset_record_new(record_row_offsets_at_interval, initial_buffer_size);
+    offset_record_t *row_offsets = NULL;
 
-    size_t row = 0;
     size_t column = 0;
 
     token_type_vector_t *column_types = token_type_vector_new(32);
     string_vector_t *column_names = string_vector_new(32);
 
+    if (0 != tokenizer_skip_lines(tokenizer, state, skip)) {
+        goto bad;
+    }
+
     if (header) {
         bool loop = true;
         while (loop) {
@@ -198,7 +843,11 @@ scan_results_t *ufo_csv_perform_initial_scan(tokenizer_t *tokenizer, const char*
                     break;
 
                 case TOKENIZER_END_OF_FILE: {
-                    scan_results_t *results = scan_results_new(0, column + 1, NULL);
+                    row_offsets = offset_record_new(record_row_offsets_at_interval > 0 ? record_row_offsets_at_interval : 1, 1);
+                    scan_results_t *results = row_offsets == NULL ? NULL : scan_results_new(0, column + 1, row_offsets);
+                    if (results == NULL) {
+                        goto bad;
+                    }
                     for (size_t i = 0; i < column + 1; i++) {
                         results->column_types[i] = TOKEN_EMPTY;
                         results->column_names[i] = column_names->strings[i];
@@ -206,7 +855,7 @@ scan_results_t *ufo_csv_perform_initial_scan(tokenizer_t *tokenizer, const char*
 
                     string_vector_free(column_names);
                     token_type_vector_free(column_types);
-                    tokenizer_close(tokenizer, state);
+                    tokenizer_state_close(state);
                     return results;
                 }
 
@@ -215,210 +864,369 @@ scan_results_t *ufo_csv_perform_initial_scan(tokenizer_t *tokenizer, const char*
         }
     }
 
-    while (true) {
-        bool column_type_is_string = token_type_vector_is_string(column_types, column);
+    long data_start = state->current_offset;
+    tokenizer_state_close(state);
+    state = NULL;
 
-        tokenizer_token_t *token = NULL;
-        tokenizer_result_t result = tokenizer_next(tokenizer, state, &token, column_type_is_string);
+    size_t rows = 0;
+    column_offsets_t column_offsets = {.offsets = NULL, .size = 0, .allocated = 0, .has_rows = false};
+    if (!scan_rows_in_parallel(tokenizer, path, data_start, record_row_offsets_at_interval, threads,
+                               &rows, column_types, &row_offsets, &column_offsets)) {
+        free(column_offsets.offsets);
+        goto bad;
+    }
 
-        switch (result) {
-            case TOKENIZER_PARSE_ERROR:
-            case TOKENIZER_ERROR:
-                goto bad;
-            default:;
+    scan_results_t *results = scan_results_new(rows, column_types->size, row_offsets);
+    if (results == NULL) {
+        free(column_offsets.offsets);
+        goto bad;
+    }
+    // The names move over to the results, columns without one get an empty
+    // name of their own.
+    bool named = true;
+    for (size_t i = 0; i < column_types->size; i++) {
+        results->column_types[i] = type_from_type_map(column_types->types[i]);
+        results->column_names[i] = (i < column_names->size) ? column_names->strings[i] : strdup("");
+        named = named && results->column_names[i] != NULL;
+        if (i < column_offsets.size) {
+            results->column_offsets[i] = column_offsets.offsets[i];
         }
+    }
+    free(column_offsets.offsets);
+    for (size_t i = column_types->size; i < column_names->size; i++) {
+        free(column_names->strings[i]);
+    }
 
-        if (!column_type_is_string) {
-            token_type_t token_type = deduce_token_type(token);
-            token_type_vector_add_type(column_types, column, token_type);
-        }
+    string_vector_free(column_names);
+    token_type_vector_free(column_types);
+    if (!named) {
+        scan_results_free(results);
+        return NULL;
+    }
+    return results;
 
-        if (column == 0 && offset_record_is_interesting(row_offsets, row)) {
-            offset_record_add(row_offsets, token->position_start);
+    bad:
+    for (size_t i = 0; i < column_names->size; i++) {
+        free(column_names->strings[i]);
+    }
+    string_vector_free(column_names);
+    token_type_vector_free(column_types);
+    if (row_offsets != NULL) {
+        offset_record_free(row_offsets);
+    }
+    if (state != NULL) {
+        tokenizer_state_close(state);
+    }
+    return NULL;
+}
+
+
+
+int ufo_csv_read_column_levels(tokenizer_t *tokenizer, const char *path, const csv_mapping_t *mapping, scan_results_t *scan_results, size_t max_levels, size_t initial_buffer_size) {
+
+    // Columns whose levels are still being collected.
+    size_t collecting = 0;
+    for (size_t column = 0; column < scan_results->columns; column++) {
+        if (scan_results->column_types[column] != TOKEN_STRING) {
+            continue;
         }
+        scan_results->column_levels[column] = string_set_new(max_levels < 16 ? max_levels + 1 : 16);
+        if (scan_results->column_levels[column] == NULL) {
+            goto bad;
+        }
+        collecting++;
+    }
 
-        switch (result) {
-            case TOKENIZER_OK:
-                column++;
-                break;
+    if (scan_results->rows == 0 || collecting == 0) {
+        return 0;
+    }
 
-            case TOKENIZER_END_OF_ROW:
-                column = 0;
-                row++;
-                break;
+    size_t row_at_offset;
+    tokenizer_state_t *state = ufo_csv_open_rows(path, mapping, scan_results, 0, scan_results->rows - 1, initial_buffer_size, &row_at_offset);
+    if (state == NULL) {
+        goto bad;
+    }
+    if (0 != tokenizer_start(tokenizer, state)) {
+        tokenizer_state_close(state);
+        goto bad;
+    }
 
-            case TOKENIZER_END_OF_FILE: {
-                scan_results_t *results = scan_results_new(row + (0 == column ? 0 : 1), column_types->size, row_offsets);
-                for (size_t i = 0; i < column_types->size; i++) {
-                    results->column_types[i] = type_from_type_map(column_types->types[i]);
-                    results->column_names[i] = (i < column_names->size) ? column_names->strings[i] : "";
-                }
+    size_t column = 0;
+    while (collecting > 0) {
+        string_set_t *levels = column < scan_results->columns ? scan_results->column_levels[column] : NULL;
+
+        // Columns without levels are skipped up to the next that has them.
+        size_t fields = 1;
+        if (levels == NULL) {
+            fields = 0;
+            while (column + fields < scan_results->columns && scan_results->column_levels[column + fields] == NULL) {
+                fields++;
+            }
+            fields = column + fields < scan_results->columns ? fields : SIZE_MAX;
+        }
+        tokenizer_result_t result = levels == NULL
+            ? tokenizer_skip_fields(tokenizer, state, fields, &fields)
+            : tokenizer_next_field(tokenizer, state, false);
+
+        if (TOKENIZER_ERROR == result || TOKENIZER_PARSE_ERROR == result) {
+            tokenizer_state_close(state);
+            goto bad;
+        }
 
-                string_vector_free(column_names);
-                token_type_vector_free(column_types);
-                tokenizer_close(tokenizer, state);
-                return results;
+        if (levels != NULL && !tokenizer_is_na(tokenizer, state->field, state->field_size)) {
+            if (!string_set_add_n(levels, state->field, state->field_size)) {
+                tokenizer_state_close(state);
+                goto bad;
+            }
+            if (string_set_size(levels) > max_levels) {
+                string_set_free(levels);
+                scan_results->column_levels[column] = NULL;
+                collecting--;
             }
+        }
 
-            default:;
+        if (result == TOKENIZER_OK) {
+            column += fields;
+        } else if (result == TOKENIZER_END_OF_ROW) {
+            column = 0;
+        } else {
+            break;
         }
     }
 
+    tokenizer_state_close(state);
+    return 0;
+
     bad:
-    perror("merde");
-    string_vector_free(column_names);
-    token_type_vector_free(column_types);
-    tokenizer_close(tokenizer, state);
-    return NULL;
+    perror("Error: cannot collect the levels of string columns");
+    for (size_t i = 0; i < scan_results->columns; i++) {
+        if (scan_results->column_levels[i] != NULL) {
+            string_set_free(scan_results->column_levels[i]);
+            scan_results->column_levels[i] = NULL;
+        }
+    }
+    return -1;
+}
+
+
+// How many fields to skip from the given column to reach the target column
+// of a row that is read, or the next row.
+static inline size_t skip_count(size_t column, size_t target_column, size_t row, size_t first_row) {
+    return row >= first_row && column < target_column ? target_column - column : SIZE_MAX;
 }
 
+read_results_t ufo_csv_read_column(tokenizer_t *tokenizer, const char *path, const csv_mapping_t *mapping, size_t target_column, scan_results_t *scan_results, size_t first_row, size_t last_row, size_t initial_buffer_size) {
 
+    assert(first_row <= last_row);
+    assert(last_row < scan_results->rows);
 
-string_set_t *ufo_csv_read_column_unique_values(tokenizer_t *tokenizer, const char *path, size_t target_column, scan_results_t *scan_results, size_t limit, size_t initial_buffer_size) {
-    string_set_t *unique_tokens = string_set_new(10);
+    read_results_t failure = {.tokens = NULL, .size = 0, .arena = NULL};
 
     if (scan_results->rows == 0) {
-        return unique_tokens;
+        return failure;
     }
 
-    long offset = 0;
-    size_t row_at_offset;
-    offset_record_get_value_closest_to_this_key(scan_results->row_offsets, 0, &offset, &row_at_offset);
+    size_t expected_tokens = last_row - first_row + 1;
 
-    tokenizer_state_t *state = tokenizer_state_init(path, offset, initial_buffer_size, initial_buffer_size);
-    tokenizer_start(tokenizer, state);
+    size_t row_at_offset;
+    tokenizer_token_t **tokens = (tokenizer_token_t **) malloc(expected_tokens * sizeof(tokenizer_token_t *));
+    arena_t *arena = arena_new(ARENA_DEFAULT_BLOCK_SIZE);
+    tokenizer_state_t *state = ufo_csv_open_rows(path, mapping, scan_results, first_row, last_row, initial_buffer_size, &row_at_offset);
+    if (tokens == NULL || arena == NULL || state == NULL) {
+        perror("Cannot allocate token array.");
+        free(tokens);
+        if (arena != NULL) arena_free(arena);
+        if (state != NULL) tokenizer_state_close(state);
+        return failure;
+    }
+    state->arena = arena;
+    if (0 != tokenizer_start(tokenizer, state)) {
+        tokenizer_state_close(state);
+        free(tokens);
+        arena_free(arena);
+        return failure;
+    }
 
     size_t row = row_at_offset;
     size_t column = 0;
+    bool found_column = false;
+
+    long column_offset = scan_results->column_offsets[target_column];
+
+    // Rows that lack the column all share one empty token.
+    tokenizer_token_t *empty_token = NULL;
 
     while (true) {
+        if (column == 0 && column_offset > 0 && row >= first_row && tokenizer_skip_bytes(state, column_offset)) {
+            column = target_column;
+        }
+
         tokenizer_token_t *token = NULL;
-        tokenizer_result_t result = tokenizer_next(tokenizer, state, &token, column != target_column);
+        bool skip = column != target_column || row < first_row;
+        size_t fields = 1;
+        tokenizer_result_t result = skip
+            ? tokenizer_skip_fields(tokenizer, state, skip_count(column, target_column, row, first_row), &fields)
+            : tokenizer_next(tokenizer, state, &token, false);
 
-        if (TOKENIZER_ERROR == result || TOKENIZER_PARSE_ERROR == result) {
-            goto bad;
+        switch (result) {
+            case TOKENIZER_PARSE_ERROR:
+            case TOKENIZER_ERROR:
+                tokenizer_state_close(state);
+                free(tokens);
+                arena_free(arena);
+                return failure;
+            default: ;
         }
 
-        if (column == target_column) {
+        if (!skip && row <= last_row) {
             assert(token != NULL);
-
-            if (string_set_size(unique_tokens) >= limit) {
-                goto good;
-            }
-
-            bool ok = string_set_add(unique_tokens, token_into_string(token));
-            if (!ok) { goto bad; }
+            tokens[row - first_row] = token;
+            found_column = true;
         }
 
         switch (result) {
             case TOKENIZER_OK:
-                column++;
+                column += fields;
                 break;
 
             case TOKENIZER_END_OF_ROW:
+            case TOKENIZER_END_OF_FILE: {
+
                 column = 0;
-                row++;
-                break;
+                if (!found_column && row >= first_row && row <= last_row) {
+                    if (empty_token == NULL) {
+                        empty_token = (tokenizer_token_t *) arena_allocate(arena, sizeof(tokenizer_token_t) + sizeof(char));
+                        if (empty_token == NULL) {
+                            tokenizer_state_close(state);
+                            free(tokens);
+                            arena_free(arena);
+                            return failure;
+                        }
+                        empty_token->string = (char *) (empty_token + 1);
+                        empty_token->string[0] = '\0';
+                        empty_token->size = 0;
+                        empty_token->position_start = 0;
+                        empty_token->position_end = 0;
+                    }
+                    assert(row - first_row < expected_tokens);
+                    tokens[row - first_row] = empty_token;
+                } else {
+                    found_column = false;
+                }
 
-            case TOKENIZER_END_OF_FILE:
-                goto good;
+                if (result == TOKENIZER_END_OF_FILE || row >= last_row) {
+                    tokenizer_state_close(state);
 
-            default:
-                goto bad;
-        }
-
-    }
+                    read_results_t result = {.tokens = tokens, .size = row >= first_row ? row - first_row + 1 : 0, .arena = arena};
+                    return result;
+                }
 
-    good:
-    tokenizer_close(tokenizer, state);
-    return unique_tokens;
+                row++;
+            }
 
-    bad:
-    perror("merde");
-    string_set_free(unique_tokens);
-    tokenizer_close(tokenizer, state);
-    return NULL;
+            default: ;
+        }
+    }
+}
 
+void read_results_free(read_results_t *results) {
+    free(results->tokens);
+    if (results->arena != NULL) {
+        arena_free(results->arena);
+    }
+    results->tokens = NULL;
+    results->arena = NULL;
+    results->size = 0;
 }
 
+// Writes the value of a field, or NA if the field is NULL, into the index-th
+// cell of a typed column.
+static inline void typed_column_set(token_type_t type, string_set_t *levels, void *target, size_t index, const char *field, size_t size) {
+    switch (type) {
+        case TOKEN_FACTOR: {
+            long level = field == NULL ? -1 : string_set_index_of(levels, field, size);
+            ((int *) target)[index] = level < 0 ? NA_INTEGER : (int) level + 1;
+            break;
+        }
+        case TOKEN_INTEGER:
+            ((int *) target)[index] = field == NULL ? NA_INTEGER : field_to_integer(field, size);
+            break;
+        case TOKEN_DOUBLE:
+            ((double *) target)[index] = field == NULL ? NA_REAL : field_to_numeric(field, size);
+            break;
+        case TOKEN_BOOLEAN:
+            ((trinary_t *) target)[index] = field == NULL ? NA_LOGICAL : field_to_logical(field, size);
+            break;
+        default:
+            assert(false);
+    }
+}
 
-read_results_t ufo_csv_read_column(tokenizer_t *tokenizer, const char *path, size_t target_column, scan_results_t *scan_results, size_t first_row, size_t last_row, size_t initial_buffer_size) {
+long ufo_csv_read_typed_column(tokenizer_t *tokenizer, const char *path, const csv_mapping_t *mapping, size_t target_column, scan_results_t *scan_results, size_t first_row, size_t last_row, void *target, size_t initial_buffer_size) {
 
     assert(first_row <= last_row);
     assert(last_row < scan_results->rows);
 
-    if (scan_results->rows == 0) {
-        read_results_t result = {.tokens = NULL, .size = 0};
-        return result;
-    }
+    token_type_t type = scan_results->column_types[target_column];
+    string_set_t *levels = scan_results->column_levels[target_column];
+    assert(type == TOKEN_INTEGER || type == TOKEN_DOUBLE || type == TOKEN_BOOLEAN || type == TOKEN_FACTOR);
 
-    long offset = 0;
     size_t row_at_offset;
-    offset_record_get_value_closest_to_this_key(scan_results->row_offsets, first_row, &offset, &row_at_offset);
-
-    tokenizer_state_t *state = tokenizer_state_init(path, offset, initial_buffer_size, initial_buffer_size);
-    tokenizer_start(tokenizer, state);
-
-    if (last_row == 0) {
-        last_row = scan_results->rows - 1;
+    tokenizer_state_t *state = ufo_csv_open_rows(path, mapping, scan_results, first_row, last_row, initial_buffer_size, &row_at_offset);
+    if (state == NULL) {
+        return -1;
+    }
+    if (0 != tokenizer_start(tokenizer, state)) {
+        tokenizer_state_close(state);
+        return -1;
     }
 
     size_t row = row_at_offset;
     size_t column = 0;
     bool found_column = false;
-
-    size_t expected_tokens = last_row - first_row + 1;
-
-    tokenizer_token_t **tokens = (tokenizer_token_t **) malloc(expected_tokens * sizeof(tokenizer_token_t *));
-    if (tokens == NULL) {
-        perror("Cannot allocate token array.");
-    }
+    long column_offset = scan_results->column_offsets[target_column];
 
     while (true) {
-        tokenizer_token_t *token = NULL;
-        tokenizer_result_t result = tokenizer_next(tokenizer, state, &token, column != target_column);
+        if (column == 0 && column_offset > 0 && row >= first_row && tokenizer_skip_bytes(state, column_offset)) {
+            column = target_column;
+        }
+
+        bool skip = column != target_column || row < first_row;
+        size_t fields = 1;
+        tokenizer_result_t result = skip
+            ? tokenizer_skip_fields(tokenizer, state, skip_count(column, target_column, row, first_row), &fields)
+            : tokenizer_next_field(tokenizer, state, false);
 
         switch (result) {
             case TOKENIZER_PARSE_ERROR:
             case TOKENIZER_ERROR:
-                tokenizer_close(tokenizer, state);
-
-                free(tokens);
-                read_results_t result = {.tokens = NULL, .size = row};
-                return result;
+                tokenizer_state_close(state);
+                return -1;
             default: ;
         }
 
-        if (column == target_column && row >= first_row && (last_row == 0 || row <= last_row)) {
-            assert(token != NULL);
-            assert(row - first_row >= 0);
-            tokens[row - first_row] = token;
+        if (!skip && row <= last_row) {
+            const char *field = tokenizer_is_na(tokenizer, state->field, state->field_size) ? NULL : state->field;
+            typed_column_set(type, levels, target, row - first_row, field, state->field_size);
             found_column = true;
         }
 
         switch (result) {
             case TOKENIZER_OK:
-                column++;
+                column += fields;
                 break;
 
             case TOKENIZER_END_OF_ROW:
             case TOKENIZER_END_OF_FILE: {
-
                 column = 0;
-                if (!found_column && row >= first_row && (last_row == 0 || row <= last_row)) {
-                        tokenizer_token_t *token = tokenizer_token_empty();
-                        assert(row - first_row >= 0);
-                        assert(row - first_row < expected_tokens);
-                        tokens[row - first_row] = token;
-                } else {
-                    found_column = false;
+                if (!found_column && row >= first_row && row <= last_row) {
+                    typed_column_set(type, levels, target, row - first_row, NULL, 0);
                 }
+                found_column = false;
 
-                if (result == TOKENIZER_END_OF_FILE || (last_row != 0 && row >= last_row)) {
-                    tokenizer_close(tokenizer, state);
-
-                    read_results_t result = {.tokens = tokens, .size = row - first_row + 1};
-                    return result;
+                if (result == TOKENIZER_END_OF_FILE || row >= last_row) {
+                    tokenizer_state_close(state);
+                    return row >= first_row ? row - first_row + 1 : 0;
                 }
 
                 row++;
@@ -427,4 +1235,4 @@ read_results_t ufo_csv_read_column(tokenizer_t *tokenizer, const char *path, siz
             default: ;
         }
     }
-}
\ No newline at end of file
+}
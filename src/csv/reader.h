@@ -1,33 +1,94 @@
 #pragma once
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include "string_set.h"
 #include "token.h"
 #include "tokenizer.h"
+#include "arena.h"
+#include "mapping.h"
+
+// Upper bound on the number of threads that scan a file, and the least
+// number of bytes worth a thread of its own.
+#define CSV_SCAN_MAX_THREADS 32
+#define CSV_SCAN_MIN_BYTES_PER_THREAD (4 * 1024 * 1024)
+
+// Scanning threads read the file in pieces of this size, and readers of a
+// column in pieces of this other size.
+#define CSV_SCAN_READ_BUFFER_SIZE (1024 * 1024)
+#define CSV_READ_BUFFER_SIZE (64 * 1024)
+
+// Where rows start, in two levels: the offset of every interval-th row, and
+// for every row how far past the offset of its interval it starts, in two
+// bytes. Rows starting further out than that are reached by tokenizing from
+// the last row of their interval that does not. The interval is picked after
+// the scan so that an interval spans about CSV_ROW_OFFSET_SPAN_BYTES, which
+// leaves room for rows of uneven width in the two bytes.
+#define CSV_ROW_OFFSET_SPAN_BYTES (16 * 1024)
+#define CSV_ROW_OFFSET_FAR UINT16_MAX
+
+// Columns of files laid out in fixed width start at the same byte of every
+// row. Readers jump there instead of skipping the columns before them.
+#define CSV_COLUMN_OFFSET_VARIES (-1L)
 
 typedef struct {
     long interval;
     long *offsets;
     size_t size;
     size_t allocated;
+    uint16_t *deltas;           // one per row, NULL if only intervals are recorded
+    size_t rows;
+    size_t allocated_rows;
 } offset_record_t;
 
 typedef struct {
     size_t rows;
     size_t columns;
     token_type_t *column_types;
-    char **column_names;
+    char **column_names;            // owned by the results
     offset_record_t *row_offsets;
+    string_set_t **column_levels;   // of TOKEN_FACTOR columns, NULL for others
+    long *column_offsets;           // where each column starts within every row, if that never changes
 } scan_results_t;
 
 typedef struct {
     size_t size;
     tokenizer_token_t **tokens;
+    arena_t *arena;             // holds the tokens
 } read_results_t; // FIXME rename
 
 
+offset_record_t    *offset_record_new(long interval, size_t initial_size);
+int                 offset_record_add(offset_record_t *, long offset);
+// Records where the next row starts, and where its interval starts if it is
+// the first row of one.
+int                 offset_record_add_row(offset_record_t *, long offset);
+void                offset_record_free(offset_record_t *);
 size_t              offset_record_human_readable_key(offset_record_t *, size_t i);
-scan_results_t     *ufo_csv_perform_initial_scan(tokenizer_t *, const char *path, long record_row_offsets_at_interval, bool header, size_t initial_buffer_size);
-string_set_t       *ufo_csv_read_column_unique_values(tokenizer_t *, const char *path, size_t target_column, scan_results_t *, size_t limit, size_t initial_buffer_size);
-read_results_t      ufo_csv_read_column(tokenizer_t *, const char *path, size_t target_column, scan_results_t *, size_t first_row, size_t last_row, size_t initial_buffer_size);
+// The offset of the target row if it is known, or else of the closest row
+// before it whose offset is, and that row in key_at_offset.
+void                offset_record_get_value_closest_to_this_key(offset_record_t *, size_t target, long *offset, size_t *key_at_offset);
+size_t              ufo_csv_scan_thread_count();
+// Scans the file, recording the offsets of rows at an interval of at most
+// record_row_offsets_at_interval rows. The first skip lines of the file are
+// ignored, the header included.
+scan_results_t     *ufo_csv_perform_initial_scan(tokenizer_t *, const char *path, long record_row_offsets_at_interval, bool header, size_t skip, size_t initial_buffer_size, size_t threads);
+// Collects the distinct values of every TOKEN_STRING column into its
+// column_levels, leaving out NA, in one pass over the file. Columns with
+// more than max_levels distinct values are left without levels.
+int                 ufo_csv_read_column_levels(tokenizer_t *, const char *path, const csv_mapping_t *, scan_results_t *, size_t max_levels, size_t initial_buffer_size);
+// Opens the file where the row offset closest before first_row was recorded
+// and sets row_at_offset to the row that starts there. The file is read from
+// the mapping if there is one, in which case the bytes up to last_row are
+// asked for ahead of time, and with stdio otherwise.
+tokenizer_state_t  *ufo_csv_open_rows(const char *path, const csv_mapping_t *, scan_results_t *, size_t first_row, size_t last_row, size_t initial_buffer_size, size_t *row_at_offset);
+// Reads the cells of a column in rows first_row to last_row, inclusive.
+read_results_t      ufo_csv_read_column(tokenizer_t *, const char *path, const csv_mapping_t *, size_t target_column, scan_results_t *, size_t first_row, size_t last_row, size_t initial_buffer_size);
+void                read_results_free(read_results_t *);
+// Parses the cells of a logical, integer, numeric or factor column in rows first_row
+// to last_row, inclusive, straight into target. Returns the number of rows
+// written or -1.
+long                ufo_csv_read_typed_column(tokenizer_t *, const char *path, const csv_mapping_t *, size_t target_column, scan_results_t *, size_t first_row, size_t last_row, void *target, size_t initial_buffer_size);
+// Takes over the offset record, unless it returns NULL for lack of memory.
+scan_results_t     *scan_results_new(size_t rows, size_t columns, offset_record_t *);
 void                scan_results_free(scan_results_t *);
@@ -0,0 +1,283 @@
+#include "row_cache.h"
+#include "field.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static size_t cell_size(token_type_t type) {
+    switch (type) {
+        case TOKEN_EMPTY:
+        case TOKEN_NA:              return 0;
+        case TOKEN_STRING:
+        case TOKEN_INTERNED_STRING:
+        case TOKEN_FREE_STRING:     return sizeof(char *);
+        default:                    return token_type_size(type);
+    }
+}
+
+row_cache_t *row_cache_new(tokenizer_t *tokenizer, const char *path, const csv_mapping_t *mapping, scan_results_t *scan_results, size_t max_bytes, size_t initial_buffer_size) {
+    if (scan_results->rows == 0) {
+        return NULL;
+    }
+
+    struct stat file_stats;
+    if (0 != stat(path, &file_stats)) {
+        return NULL;
+    }
+
+    row_cache_t *cache = (row_cache_t *) calloc(1, sizeof(row_cache_t));
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    cache->tokenizer = tokenizer;
+    cache->path = path;
+    cache->mapping = mapping;
+    cache->scan_results = scan_results;
+    cache->initial_buffer_size = initial_buffer_size;
+    cache->max_bytes = max_bytes;
+
+    // Blocks start where the scan recorded an offset.
+    size_t row_length = file_stats.st_size / scan_results->rows + 1;
+    size_t interval = scan_results->row_offsets->interval;
+    size_t intervals_per_block = ROW_CACHE_BLOCK_BYTES / (interval * row_length);
+    cache->block_rows = interval * (intervals_per_block > 0 ? intervals_per_block : 1);
+    cache->block_count = (scan_results->rows + cache->block_rows - 1) / cache->block_rows;
+
+    // Strings cannot take up more than the row they are in.
+    cache->row_bytes = row_length;
+    for (size_t column = 0; column < scan_results->columns; column++) {
+        cache->row_bytes += cell_size(scan_results->column_types[column]);
+    }
+
+    cache->blocks = (row_block_t *) calloc(cache->block_count, sizeof(row_block_t));
+    if (cache->blocks == NULL) {
+        free(cache);
+        return NULL;
+    }
+
+    pthread_mutex_init(&cache->lock, NULL);
+    pthread_cond_init(&cache->loaded, NULL);
+    return cache;
+}
+
+void row_cache_free(row_cache_t *cache) {
+    for (size_t i = 0; i < cache->block_count; i++) {
+        if (cache->blocks[i].arena != NULL) {
+            arena_free(cache->blocks[i].arena);
+        }
+    }
+    free(cache->blocks);
+    pthread_mutex_destroy(&cache->lock);
+    pthread_cond_destroy(&cache->loaded);
+    free(cache);
+}
+
+bool row_cache_fits(row_cache_t *cache, size_t first_row, size_t last_row) {
+    size_t blocks = last_row / cache->block_rows - first_row / cache->block_rows + 1;
+    return blocks * cache->block_rows * cache->row_bytes <= cache->max_bytes / 2;
+}
+
+static inline void set_cell(tokenizer_t *tokenizer, token_type_t type, string_set_t *levels, void *cells, size_t row, const char *field, size_t size, arena_t *arena) {
+    bool na = field != NULL && tokenizer_is_na(tokenizer, field, size);
+    if (na && type != TOKEN_STRING && type != TOKEN_INTERNED_STRING && type != TOKEN_FREE_STRING) {
+        field = NULL;
+    }
+
+    switch (type) {
+        case TOKEN_INTEGER:
+            ((int *) cells)[row] = field == NULL ? NA_INTEGER : field_to_integer(field, size);
+            break;
+        case TOKEN_DOUBLE:
+            ((double *) cells)[row] = field == NULL ? NA_REAL : field_to_numeric(field, size);
+            break;
+        case TOKEN_BOOLEAN:
+            ((trinary_t *) cells)[row] = field == NULL ? NA_LOGICAL : field_to_logical(field, size);
+            break;
+        case TOKEN_FACTOR: {
+            long level = field == NULL ? -1 : string_set_index_of(levels, field, size);
+            ((int *) cells)[row] = level < 0 ? NA_INTEGER : (int) level + 1;
+            break;
+        }
+        case TOKEN_STRING:
+        case TOKEN_INTERNED_STRING:
+        case TOKEN_FREE_STRING: {
+            char *string = NULL;
+            if (field == NULL) {
+                string = "";                            // the row is too short
+            } else if (!na) {
+                string = (char *) arena_allocate(arena, size + 1);
+                if (string != NULL) {
+                    memcpy(string, field, size + 1);
+                }
+            }
+            ((char **) cells)[row] = string;
+            break;
+        }
+        default: ;
+    }
+}
+
+// Tokenizes the rows of a block, storing the cells of every column.
+static bool parse_block(row_cache_t *cache, size_t block, row_block_t *entry) {
+    scan_results_t *scan_results = cache->scan_results;
+    size_t columns = scan_results->columns;
+    size_t first_row = block * cache->block_rows;
+    size_t rows = scan_results->rows - first_row < cache->block_rows ? scan_results->rows - first_row : cache->block_rows;
+
+    arena_t *arena = arena_new(ARENA_DEFAULT_BLOCK_SIZE);
+    if (arena == NULL) {
+        return false;
+    }
+
+    void **cells = (void **) arena_allocate(arena, columns * sizeof(void *));
+    if (cells == NULL) {
+        arena_free(arena);
+        return false;
+    }
+    for (size_t column = 0; column < columns; column++) {
+        size_t size = cell_size(scan_results->column_types[column]);
+        cells[column] = size == 0 ? NULL : arena_allocate(arena, rows * size);
+        if (size != 0 && cells[column] == NULL) {
+            arena_free(arena);
+            return false;
+        }
+    }
+
+    size_t row_at_offset;
+    tokenizer_state_t *state = ufo_csv_open_rows(cache->path, cache->mapping, scan_results, first_row, first_row + rows - 1,
+                                                 cache->initial_buffer_size, &row_at_offset);
+    if (state == NULL) {
+        arena_free(arena);
+        return false;
+    }
+    assert(row_at_offset == first_row);
+    if (0 != tokenizer_start(cache->tokenizer, state)) {
+        tokenizer_state_close(state);
+        arena_free(arena);
+        return false;
+    }
+
+    size_t row = 0;
+    size_t column = 0;
+    while (row < rows) {
+        bool skip = column >= columns || cells[column] == NULL;
+        tokenizer_result_t result = tokenizer_next_field(cache->tokenizer, state, skip);
+
+        if (TOKENIZER_ERROR == result || TOKENIZER_PARSE_ERROR == result) {
+            tokenizer_state_close(state);
+            arena_free(arena);
+            return false;
+        }
+
+        if (!skip) {
+            set_cell(cache->tokenizer, scan_results->column_types[column], scan_results->column_levels[column],
+                     cells[column], row, state->field, state->field_size, arena);
+        }
+
+        if (result == TOKENIZER_OK) {
+            column++;
+            continue;
+        }
+
+        // The row may be missing some columns, or the file some rows.
+        for (column++; column < columns; column++) {
+            if (cells[column] != NULL) {
+                set_cell(cache->tokenizer, scan_results->column_types[column], scan_results->column_levels[column],
+                         cells[column], row, NULL, 0, arena);
+            }
+        }
+        column = 0;
+        row++;
+
+        if (result == TOKENIZER_END_OF_FILE) {
+            for (; row < rows; row++) {
+                for (size_t missing = 0; missing < columns; missing++) {
+                    if (cells[missing] != NULL) {
+                        set_cell(cache->tokenizer, scan_results->column_types[missing], scan_results->column_levels[missing],
+                                 cells[missing], row, NULL, 0, arena);
+                    }
+                }
+            }
+        }
+    }
+    tokenizer_state_close(state);
+
+    entry->rows = rows;
+    entry->cells = cells;
+    entry->arena = arena;
+    return true;
+}
+
+// Drops the least recently used blocks nobody is reading until the rest
+// fit. Call with the lock held.
+static void evict(row_cache_t *cache) {
+    while (cache->bytes > cache->max_bytes) {
+        row_block_t *victim = NULL;
+        for (size_t i = 0; i < cache->block_count; i++) {
+            row_block_t *entry = &cache->blocks[i];
+            if (entry->state == ROW_BLOCK_READY && entry->pins == 0
+                && (victim == NULL || entry->last_used < victim->last_used)) {
+                victim = entry;
+            }
+        }
+        if (victim == NULL) {
+            return;
+        }
+
+        cache->bytes -= arena_size(victim->arena);
+        arena_free(victim->arena);
+        victim->arena = NULL;
+        victim->cells = NULL;
+        victim->rows = 0;
+        victim->state = ROW_BLOCK_EMPTY;
+    }
+}
+
+row_block_t *row_cache_pin(row_cache_t *cache, size_t block) {
+    assert(block < cache->block_count);
+    row_block_t *entry = &cache->blocks[block];
+
+    pthread_mutex_lock(&cache->lock);
+    while (entry->state == ROW_BLOCK_LOADING) {
+        pthread_cond_wait(&cache->loaded, &cache->lock);
+    }
+    if (entry->state == ROW_BLOCK_READY) {
+        cache->hits++;
+        entry->pins++;
+        entry->last_used = ++cache->clock;
+        pthread_mutex_unlock(&cache->lock);
+        return entry;
+    }
+    cache->misses++;
+    entry->state = ROW_BLOCK_LOADING;
+    pthread_mutex_unlock(&cache->lock);
+
+    bool parsed = parse_block(cache, block, entry);
+
+    pthread_mutex_lock(&cache->lock);
+    if (!parsed) {
+        entry->state = ROW_BLOCK_EMPTY;
+        pthread_cond_broadcast(&cache->loaded);
+        pthread_mutex_unlock(&cache->lock);
+        return NULL;
+    }
+    entry->state = ROW_BLOCK_READY;
+    entry->pins = 1;
+    entry->last_used = ++cache->clock;
+    cache->bytes += arena_size(entry->arena);
+    evict(cache);
+    pthread_cond_broadcast(&cache->loaded);
+    pthread_mutex_unlock(&cache->lock);
+    return entry;
+}
+
+void row_cache_unpin(row_cache_t *cache, row_block_t *entry) {
+    pthread_mutex_lock(&cache->lock);
+    assert(entry->pins > 0);
+    entry->pins--;
+    evict(cache);
+    pthread_mutex_unlock(&cache->lock);
+}
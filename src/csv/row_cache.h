@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "reader.h"
+#include "arena.h"
+
+// Default upper bound on the memory held by parsed rows of one file.
+#define ROW_CACHE_DEFAULT_BYTES (64 * 1024 * 1024)
+
+// Rows are parsed in blocks of about this many bytes of the file.
+#define ROW_CACHE_BLOCK_BYTES (1024 * 1024)
+
+typedef enum {
+    ROW_BLOCK_EMPTY,
+    ROW_BLOCK_LOADING,          // being parsed, wait for it
+    ROW_BLOCK_READY,
+} row_block_state_t;
+
+// The values of all columns in a block of rows. Cells are int, double or
+// trinary_t for typed columns, factor codes for TOKEN_FACTOR columns, and
+// NUL-terminated strings, or NULL for NA, for string columns. Columns of
+// TOKEN_EMPTY or TOKEN_NA have no cells.
+typedef struct {
+    row_block_state_t state;
+    size_t    rows;
+    void    **cells;            // one array per column
+    arena_t  *arena;            // holds the arrays and the strings
+    uint64_t  last_used;
+    size_t    pins;             // readers copying out of the cells
+} row_block_t;
+
+// Parsed rows of one CSV file, shared by the vectors of all of its columns.
+// When a column reads a block of rows, the block is tokenized once and the
+// cells of every column are kept, so that the other columns find them
+// parsed. Blocks are evicted least recently used first once they take up
+// more than max_bytes.
+typedef struct {
+    tokenizer_t     *tokenizer;
+    const char      *path;
+    const csv_mapping_t *mapping;           // may be NULL
+    scan_results_t  *scan_results;
+    size_t           initial_buffer_size;
+
+    size_t           block_rows;            // a multiple of the row offset interval
+    size_t           block_count;
+    size_t           row_bytes;             // estimated memory per parsed row
+    row_block_t     *blocks;
+
+    size_t           bytes;                 // sum of the arenas of all blocks
+    size_t           max_bytes;
+    uint64_t         clock;
+
+    uint64_t         hits;
+    uint64_t         misses;
+
+    pthread_mutex_t  lock;
+    pthread_cond_t   loaded;
+} row_cache_t;
+
+row_cache_t *row_cache_new(tokenizer_t *, const char *path, const csv_mapping_t *, scan_results_t *, size_t max_bytes, size_t initial_buffer_size);
+void         row_cache_free(row_cache_t *);
+
+// Whether rows first_row to last_row, inclusive, fit in the cache alongside
+// the blocks already there. Ranges that do not are better read column by
+// column.
+bool         row_cache_fits(row_cache_t *, size_t first_row, size_t last_row);
+
+// The block with the given index, parsed if need be and pinned so it is not
+// evicted until unpinned. Returns NULL if the rows cannot be parsed.
+row_block_t *row_cache_pin(row_cache_t *, size_t block);
+void         row_cache_unpin(row_cache_t *, row_block_t *);
@@ -4,59 +4,170 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-//FIXME a tree would be better
+
+// FNV-1a.
+static inline uint64_t string_hash(const char *string, size_t length) {
+    uint64_t hash = UINT64_C(14695981039346656037);
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char) string[i];
+        hash *= UINT64_C(1099511628211);
+    }
+    return hash;
+}
 
 string_set_t *string_set_new (size_t initial_size) {
+    if (initial_size < 2) {
+        initial_size = 2;
+    }
+
     string_set_t *set = (string_set_t *) malloc(sizeof(string_set_t));
+    if (set == NULL) {
+        return NULL;
+    }
+
     set->allocated = initial_size;
     set->size = 0;
     set->strings = (char **) calloc(initial_size, sizeof(char *));
+    set->lengths = (size_t *) calloc(initial_size, sizeof(size_t));
+    set->hashes = (uint64_t *) calloc(initial_size, sizeof(uint64_t));
+
+    // At most half of the slots are ever taken.
+    set->slot_count = 4;
+    while (set->slot_count < 2 * initial_size) {
+        set->slot_count <<= 1;
+    }
+    set->slots = (size_t *) calloc(set->slot_count, sizeof(size_t));
+
+    if (set->strings == NULL || set->lengths == NULL || set->hashes == NULL || set->slots == NULL) {
+        string_set_free(set);
+        return NULL;
+    }
     return set;
 }
 
-bool string_set_contains(string_set_t *set, char *string) {
-    for (size_t i = 0; i < set->size; i++) {
-        if (0 == strcmp(set->strings[i], string)) {
-            return true;
+// The slot holding the string, or the free slot where it would go.
+static size_t string_set_find_slot(string_set_t *set, const char *string, size_t length, uint64_t hash) {
+    size_t mask = set->slot_count - 1;
+    for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+        size_t index = set->slots[slot];
+        if (index == 0) {
+            return slot;
+        }
+        index--;
+        if (set->hashes[index] == hash && set->lengths[index] == length
+            && 0 == memcmp(set->strings[index], string, length)) {
+            return slot;
         }
     }
-    return false;
+}
+
+long string_set_index_of(string_set_t *set, const char *string, size_t length) {
+    uint64_t hash = string_hash(string, length);
+    size_t index = set->slots[string_set_find_slot(set, string, length, hash)];
+    return index == 0 ? -1 : (long) index - 1;
+}
+
+bool string_set_contains(string_set_t *set, char *string) {
+    return string_set_index_of(set, string, strlen(string)) >= 0;
 }
 
 size_t string_set_size(string_set_t *set) {
     return set->size;
 }
 
-bool string_set_add(string_set_t *set, char *string) {
-    if (string_set_contains(set, string)) {
+static bool string_set_grow(string_set_t *set) {
+    size_t new_allocated = set->allocated + (set->allocated >> 1);
+
+    char **strings = (char **) realloc(set->strings, new_allocated * sizeof(char *));
+    if (strings == NULL) {
+        return false;
+    }
+    set->strings = strings;
+
+    size_t *lengths = (size_t *) realloc(set->lengths, new_allocated * sizeof(size_t));
+    if (lengths == NULL) {
+        return false;
+    }
+    set->lengths = lengths;
+
+    uint64_t *hashes = (uint64_t *) realloc(set->hashes, new_allocated * sizeof(uint64_t));
+    if (hashes == NULL) {
+        return false;
+    }
+    set->hashes = hashes;
+
+    set->allocated = new_allocated;
+
+    if (set->slot_count >= 2 * new_allocated) {
         return true;
     }
 
-    if (set->size >= set->allocated) {
-        size_t new_allocated = set->allocated + (set->allocated >> 1);
-        set->strings = (char **) realloc(set->strings, new_allocated * sizeof(char *));
+    size_t slot_count = set->slot_count;
+    while (slot_count < 2 * new_allocated) {
+        slot_count <<= 1;
+    }
+    size_t *slots = (size_t *) calloc(slot_count, sizeof(size_t));
+    if (slots == NULL) {
+        return false;
+    }
 
-        if (NULL == set->strings) {
-            return false;
+    size_t mask = slot_count - 1;
+    for (size_t index = 0; index < set->size; index++) {
+        size_t slot = set->hashes[index] & mask;
+        while (slots[slot] != 0) {
+            slot = (slot + 1) & mask;
         }
-
-        set->allocated = new_allocated;
+        slots[slot] = index + 1;
     }
 
-    set->strings[set->size] = (char *) malloc(sizeof(char) * (strlen(string) + 1/*\0*/));
-    if (NULL != set->strings[set->size]) {
-        strcpy(set->strings[set->size], string);
-        set->size++;
+    free(set->slots);
+    set->slots = slots;
+    set->slot_count = slot_count;
+    return true;
+}
+
+bool string_set_add_n(string_set_t *set, const char *string, size_t length) {
+    uint64_t hash = string_hash(string, length);
+    size_t slot = string_set_find_slot(set, string, length, hash);
+    if (set->slots[slot] != 0) {
         return true;
-    } else {
+    }
+
+    if (set->size >= set->allocated) {
+        if (!string_set_grow(set)) {
+            return false;
+        }
+        slot = string_set_find_slot(set, string, length, hash);
+    }
+
+    char *copy = (char *) malloc(sizeof(char) * (length + 1/*\0*/));
+    if (NULL == copy) {
         return false;
     }
+    memcpy(copy, string, length);
+    copy[length] = '\0';
+
+    set->strings[set->size] = copy;
+    set->lengths[set->size] = length;
+    set->hashes[set->size] = hash;
+    set->size++;
+    set->slots[slot] = set->size;
+    return true;
+}
+
+bool string_set_add(string_set_t *set, char *string) {
+    return string_set_add_n(set, string, strlen(string));
 }
 
 void string_set_free(string_set_t *set) {
-    for (size_t i = 0; i < set->size; i++) {
-        free(set->strings[i]);
+    if (set->strings != NULL) {
+        for (size_t i = 0; i < set->size; i++) {
+            free(set->strings[i]);
+        }
     }
     free(set->strings);
+    free(set->lengths);
+    free(set->hashes);
+    free(set->slots);
     free(set);
-}
\ No newline at end of file
+}
@@ -1,19 +1,31 @@
 #pragma once
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stdint.h>
 
+// Strings in the order they were added, found by hash through an open
+// addressing table of indices into the strings.
 typedef struct {
     size_t allocated;
     size_t size;
     char **strings;
+    size_t *lengths;
+    uint64_t *hashes;
+
+    size_t slot_count;          // a power of two
+    size_t *slots;              // index + 1 of a string, 0 if the slot is free
 } string_set_t;
 
 string_set_t *string_set_new (size_t initial_size);
 
 bool string_set_contains(string_set_t *set, char *string);
 
+// Index of a string of length bytes, or -1 if it is not in the set.
+long string_set_index_of(string_set_t *set, const char *string, size_t length);
+
 //string must be null terminated
 //string is copied
 bool string_set_add(string_set_t *set, char *string);
+bool string_set_add_n(string_set_t *set, const char *string, size_t length);
 size_t string_set_size(string_set_t *set);
-void string_set_free(string_set_t *set);
\ No newline at end of file
+void string_set_free(string_set_t *set);
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Finding the characters that end a run of plain text inside a field: the
+// delimiters, quotes and escapes. Bytes are compared 64 at a time into a
+// bitmask, bit i set if byte i is one of the characters, with AVX2 or SSE2
+// when the compiler targets them and one byte at a time otherwise.
+
+#define STRUCTURAL_BLOCK_SIZE 64
+
+static inline uint64_t structural_mask(const char *block, char a, char b, char c) {
+#if defined(__AVX2__)
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+    const __m256i vc = _mm256_set1_epi8(c);
+    uint64_t mask = 0;
+    for (int i = 0; i < STRUCTURAL_BLOCK_SIZE; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *) (block + i));
+        __m256i hits = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, va),
+                                                        _mm256_cmpeq_epi8(bytes, vb)),
+                                       _mm256_cmpeq_epi8(bytes, vc));
+        mask |= ((uint64_t) (uint32_t) _mm256_movemask_epi8(hits)) << i;
+    }
+    return mask;
+#elif defined(__SSE2__)
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    const __m128i vc = _mm_set1_epi8(c);
+    uint64_t mask = 0;
+    for (int i = 0; i < STRUCTURAL_BLOCK_SIZE; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *) (block + i));
+        __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, va),
+                                                 _mm_cmpeq_epi8(bytes, vb)),
+                                    _mm_cmpeq_epi8(bytes, vc));
+        mask |= ((uint64_t) (uint16_t) _mm_movemask_epi8(hits)) << i;
+    }
+    return mask;
+#else
+    uint64_t mask = 0;
+    for (int i = 0; i < STRUCTURAL_BLOCK_SIZE; i++) {
+        char byte = block[i];
+        mask |= ((uint64_t) (byte == a || byte == b || byte == c)) << i;
+    }
+    return mask;
+#endif
+}
+
+// Index of the first of a, b or c in data[0, length), or length if none of
+// them is there.
+static inline size_t find_structural(const char *data, size_t length, char a, char b, char c) {
+    size_t i = 0;
+    for (; i + STRUCTURAL_BLOCK_SIZE <= length; i += STRUCTURAL_BLOCK_SIZE) {
+        uint64_t mask = structural_mask(data + i, a, b, c);
+        if (mask != 0) {
+            return i + __builtin_ctzll(mask);
+        }
+    }
+    for (; i < length; i++) {
+        if (data[i] == a || data[i] == b || data[i] == c) {
+            return i;
+        }
+    }
+    return length;
+}
@@ -29,6 +29,11 @@ char *token_into_string(tokenizer_token_t *token) {
     return string;
 }
 
+void token_free(tokenizer_token_t *token) {
+    free(token->string);
+    free(token);
+}
+
 const char *token_type_to_string(token_type_t type) {
     switch (type) {
         case TOKEN_EMPTY:                     { return "EMPTY";   }
@@ -39,6 +44,7 @@ const char *token_type_to_string(token_type_t type) {
         case TOKEN_FREE_STRING:
         case TOKEN_INTERNED_STRING:
         case TOKEN_STRING:                    { return "STRING";  }
+        case TOKEN_FACTOR:                    { return "FACTOR";  }
         case TOKEN_NOTHING:                   { return "NOTHING"; }
     }
     return "U.N. Owen";
@@ -211,7 +217,8 @@ token_type_t deduce_token_type(tokenizer_token_t *token) {
 size_t token_type_size(token_type_t type) {
     switch (type) {
         case TOKEN_BOOLEAN:                   { return sizeof(trinary_t); }
-        case TOKEN_INTEGER:                   { return sizeof(int);       }
+        case TOKEN_INTEGER:
+        case TOKEN_FACTOR:                    { return sizeof(int);       }
         case TOKEN_DOUBLE:                    { return sizeof(double);    }
         case TOKEN_INTERNED_STRING:
         case TOKEN_FREE_STRING:
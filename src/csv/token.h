@@ -34,11 +34,13 @@ typedef enum {
     TOKEN_STRING          = 32,
     TOKEN_INTERNED_STRING = 64,
     TOKEN_FREE_STRING     = 128,
+    TOKEN_FACTOR          = 256,
 } token_type_t;
 
 tokenizer_token_t  *tokenizer_token_empty();
 token_type_t        deduce_token_type(tokenizer_token_t *token);
 char               *token_into_string(tokenizer_token_t *token);
+void                token_free(tokenizer_token_t *token);
 const char         *token_type_to_string(token_type_t type);
 
 trinary_t token_to_logical(tokenizer_token_t *token);
@@ -7,6 +7,7 @@
 #include <string.h>
 
 #include "token.h"
+#include "structural.h"
 
 tokenizer_t csv_tokenizer() {
     tokenizer_t tokenizer;
@@ -15,8 +16,10 @@ tokenizer_t csv_tokenizer() {
     tokenizer.column_delimiter = ',';
     tokenizer.escape = '\\';
     tokenizer.quote = '"';
+    tokenizer.comment = '\0';
     tokenizer.use_double_quote_escape = true;
     tokenizer.use_escape_character = true;
+    tokenizer.na_strings = NULL;
 
     return tokenizer;
 }
@@ -28,6 +31,9 @@ tokenizer_t *new_csv_tokenizer() {
 }
 
 void tokenizer_free(tokenizer_t *tokenizer) {
+    if (tokenizer->na_strings != NULL) {
+        string_set_free(tokenizer->na_strings);
+    }
     free(tokenizer);
 }
 
@@ -38,12 +44,31 @@ tokenizer_read_buffer_t *read_buffer_init(size_t character_buffer_size) {
     read_buffer->max_size = character_buffer_size;
     read_buffer->size = character_buffer_size;                            // so that it triggers a full buffer...
     read_buffer->pointer = character_buffer_size;                         // ...check and initially populates it
+    read_buffer->mapped = false;
+
+    return read_buffer;
+}
+
+// The whole mapping is one read buffer that never needs refilling.
+tokenizer_read_buffer_t *read_buffer_init_mapped(const char *data, size_t size) {
+    tokenizer_read_buffer_t *read_buffer = (tokenizer_read_buffer_t *) malloc(sizeof(tokenizer_read_buffer_t));
+    if (read_buffer == NULL) {
+        return NULL;
+    }
+
+    read_buffer->buffer = (char *) data;
+    read_buffer->max_size = size;
+    read_buffer->size = size;
+    read_buffer->pointer = 0;
+    read_buffer->mapped = true;
 
     return read_buffer;
 }
 
 void read_buffer_free(tokenizer_read_buffer_t *read_buffer) {
-    free(read_buffer->buffer);
+    if (!read_buffer->mapped) {
+        free(read_buffer->buffer);
+    }
     free(read_buffer);
 }
 
@@ -86,26 +111,66 @@ tokenizer_state_t *tokenizer_state_init (const char *path, long initial_offset,
 
     state->read_buffer = read_buffer_init(character_buffer_size);
     state->token_buffer = tokenizer_token_buffer_init(token_buffer_size);
+    state->arena = NULL;
+    state->field = NULL;
+    state->field_size = 0;
+
+    return state;
+}
+
+tokenizer_state_t *tokenizer_state_init_mapped (const char *data, size_t size, long initial_offset, size_t token_buffer_size) {
+    tokenizer_state_t *state = (tokenizer_state_t *) malloc(sizeof(tokenizer_state_t));
+    if (state == NULL) {
+        perror("Error: cannot allocate memory for state");
+        return NULL;
+    }
+
+    state->file = NULL;
+    state->initial_offset = initial_offset;
+    state->read_characters = 0L;
+
+    state->read_buffer = read_buffer_init_mapped(data, size);
+    state->token_buffer = tokenizer_token_buffer_init(token_buffer_size);
+    state->arena = NULL;
+    state->field = NULL;
+    state->field_size = 0;
+
+    if (state->read_buffer == NULL || state->token_buffer == NULL) {
+        perror("Error: cannot allocate memory for state");
+        tokenizer_state_close(state);
+        return NULL;
+    }
 
     return state;
 }
 
 
-char next_character (tokenizer_state_t *state) {
+// Refills the read buffer once all of it was consumed. Returns false at the
+// end of the file.
+static inline bool fill_read_buffer (tokenizer_state_t *state) {
     assert(state->read_buffer->pointer <= state->read_buffer->size);
     if (state->read_buffer->pointer == state->read_buffer->size) {
-        int read_characters = fread(state->read_buffer->buffer, sizeof(char), state->read_buffer->max_size, state->file);
+        if (state->read_buffer->mapped) {
+            return false;
+        }
+        size_t read_characters = fread(state->read_buffer->buffer, sizeof(char), state->read_buffer->max_size, state->file);
         if (read_characters == 0) {
-            return EOF;
+            return false;
         }
         state->read_buffer->pointer = 0;
         state->read_buffer->size = read_characters;
     }
+    return true;
+}
 
+char next_character (tokenizer_state_t *state) {
+    if (!fill_read_buffer(state)) {
+        return EOF;
+    }
     return state->read_buffer->buffer[state->read_buffer->pointer++];
 }
 
-tokenizer_token_t *tokenizer_token_buffer_get_token (tokenizer_token_buffer_t *buffer, bool trim_trailing) {
+tokenizer_token_t *tokenizer_token_buffer_get_token (tokenizer_token_buffer_t *buffer, bool trim_trailing, arena_t *arena) {
     assert(buffer->size <= buffer->max_size);
 
     size_t trim_length = 0;
@@ -118,13 +183,25 @@ tokenizer_token_t *tokenizer_token_buffer_get_token (tokenizer_token_buffer_t *b
         }
     }
 
-    tokenizer_token_t *token = (tokenizer_token_t *) malloc(sizeof(tokenizer_token_t));
-    token->size = buffer->size - trim_length + 1;
-    token->string = (char *) malloc(sizeof(char) * (token->size));
-    if (token->string == NULL) {
-        perror("Error: cannot allocate memory for token");
-        return NULL;
+    size_t size = buffer->size - trim_length + 1;
+    tokenizer_token_t *token;
+    if (arena != NULL) {
+        // The string goes right after the token.
+        token = (tokenizer_token_t *) arena_allocate(arena, sizeof(tokenizer_token_t) + sizeof(char) * size);
+        if (token == NULL) {
+            perror("Error: cannot allocate memory for token");
+            return NULL;
+        }
+        token->string = (char *) (token + 1);
+    } else {
+        token = (tokenizer_token_t *) malloc(sizeof(tokenizer_token_t));
+        token->string = (char *) malloc(sizeof(char) * size);
+        if (token->string == NULL) {
+            perror("Error: cannot allocate memory for token");
+            return NULL;
+        }
     }
+    token->size = size;
 
     token->string = memcpy(token->string, buffer->buffer, token->size - 1);
     token->string[token->size - 1] = '\0';
@@ -149,6 +226,28 @@ int tokenizer_token_buffer_append (tokenizer_token_buffer_t *buffer, char c) {
     return 0;
 }
 
+int tokenizer_token_buffer_append_run (tokenizer_token_buffer_t *buffer, const char *run, size_t length) {
+    assert(buffer->size <= buffer->max_size);
+
+    if (buffer->size + length > buffer->max_size) {
+        size_t max_size = buffer->max_size;
+        while (buffer->size + length > max_size) {
+            max_size += (max_size >> 1) + 1;
+        }
+        char *expanded = (char *) realloc(buffer->buffer, sizeof(char) * max_size);
+        if (expanded == NULL) {
+            perror("Error: cannot allocate memory to expand token buffer's internal buffer");
+            return -1;
+        }
+        buffer->buffer = expanded;
+        buffer->max_size = max_size;
+    }
+
+    memcpy(buffer->buffer + buffer->size, run, length);
+    buffer->size += length;
+    return 0;
+}
+
 void tokenizer_token_buffer_clear (tokenizer_token_buffer_t *buffer) {
     buffer->size = 0;
 }
@@ -158,19 +257,55 @@ void tokenizer_token_buffer_free (tokenizer_token_buffer_t *buffer) {
 }
 
 void tokenizer_state_close (tokenizer_state_t *state) {
-    fclose(state->file);
-    tokenizer_token_buffer_free(state->token_buffer);
-    read_buffer_free(state->read_buffer);
+    if (state->file != NULL) {
+        fclose(state->file);
+    }
+    if (state->token_buffer != NULL) {
+        tokenizer_token_buffer_free(state->token_buffer);
+    }
+    if (state->read_buffer != NULL) {
+        read_buffer_free(state->read_buffer);
+    }
     free(state);
 }
 
+// Leaves the contents of the token buffer where they are, as state->field.
+// Clearing the buffer only resets its size, so the characters survive until
+// the next field is appended.
+static void pop_field (tokenizer_state_t *state, bool trim_trailing) {
+    tokenizer_token_buffer_t *buffer = state->token_buffer;
+
+    size_t size = buffer->size;
+    if (trim_trailing) {
+        while (size > 0 && isspace(buffer->buffer[size - 1])) {
+            size--;
+        }
+    }
+
+    buffer->size = size;
+    if (0 != tokenizer_token_buffer_append(buffer, '\0')) {
+        state->field = NULL;
+        state->field_size = 0;
+    } else {
+        state->field = buffer->buffer;
+        state->field_size = size;
+    }
+
+    state->end_of_last_token = state->current_offset;
+    tokenizer_token_buffer_clear(buffer);
+}
+
 void pop_token (tokenizer_state_t *state, tokenizer_token_t **token, bool trim_trailing, bool fake) {
 
     if (fake) {
-        *token = NULL;
+        if (token != NULL) {
+            *token = NULL;
+        }
         tokenizer_token_buffer_clear(state->token_buffer);
+    } else if (token == NULL) {
+        pop_field(state, trim_trailing);
     } else {
-        *token = tokenizer_token_buffer_get_token(state->token_buffer, trim_trailing);
+        *token = tokenizer_token_buffer_get_token(state->token_buffer, trim_trailing, state->arena);
         (*token)->position_start = state->end_of_last_token;
         (*token)->position_end = state->current_offset;
         state->end_of_last_token = (*token)->position_end;
@@ -179,6 +314,19 @@ void pop_token (tokenizer_state_t *state, tokenizer_token_t **token, bool trim_t
 }
 
 int tokenizer_start(tokenizer_t *tokenizer, tokenizer_state_t *state) {
+    if (state->read_buffer->mapped) {
+        if (state->initial_offset < 0 || (size_t) state->initial_offset > state->read_buffer->size) {
+            fprintf(stderr, "Error: cannot seek to initial position\n");
+            return 1;
+        }
+        state->read_buffer->pointer = state->initial_offset;
+        state->state = TOKENIZER_FIELD;
+        state->current_offset = state->initial_offset;
+        state->end_of_last_token = 0;
+        state->row_start = true;
+        return 0;
+    }
+
     int seek_status = fseek(state->file, state->initial_offset, SEEK_SET);
     if (seek_status < 0) {
         perror("Error: cannot seek to initial position");
@@ -188,15 +336,25 @@ int tokenizer_start(tokenizer_t *tokenizer, tokenizer_state_t *state) {
     state->state = TOKENIZER_FIELD;
     state->current_offset = state->initial_offset;
     state->end_of_last_token = 0;
+    state->row_start = true;
     return 0;
 }
 
 void tokenizer_close(tokenizer_t *tokenizer, tokenizer_state_t *state) { // TODO remove tokenizer
-    fclose(state->file);
+    if (state->file != NULL) {
+        fclose(state->file);
+    }
 }
 
+// Carriage returns count as whitespace, so that the CR of a CRLF line ending
+// is trimmed off the last field of the row. Delimiters never do, so that
+// tabs still separate the fields of a TSV file.
 static int is_whitespace(tokenizer_t* tokenizer, char c) {
-    return c == ' ' || c == '\t';
+    return (c == ' ' || c == '\t' || c == '\r') && c != tokenizer->column_delimiter && c != tokenizer->row_delimiter;
+}
+
+static int is_comment(tokenizer_t* tokenizer, tokenizer_state_t *state, char c) {
+    return state->row_start && c == tokenizer->comment && tokenizer->comment != '\0';
 }
 
 static int is_escape(tokenizer_t* tokenizer, char c) {
@@ -235,12 +393,37 @@ static inline int append(tokenizer_state_t *state, char c, tokenizer_state_value
     return 0;
 }
 
-tokenizer_result_t tokenizer_next (tokenizer_t *tokenizer, tokenizer_state_t *state, tokenizer_token_t **token, bool skip) {
+// Consumes characters up to the next a, b or c, which is left to the state
+// machine along with the end of the file. The characters are appended to
+// the token unless it is skipped. Returns -1 if the token cannot grow.
+static inline int consume_run(tokenizer_state_t *state, char a, char b, char c, bool skip) {
+    while (fill_read_buffer(state)) {
+        tokenizer_read_buffer_t *read_buffer = state->read_buffer;
+        const char *run = read_buffer->buffer + read_buffer->pointer;
+        size_t available = read_buffer->size - read_buffer->pointer;
+        size_t length = find_structural(run, available, a, b, c);
+
+        if (!skip && length > 0 && 0 != tokenizer_token_buffer_append_run(state->token_buffer, run, length)) {
+            return -1;
+        }
+        read_buffer->pointer += length;
+        state->current_offset += length;
+
+        if (length < available) {
+            break;
+        }
+    }
+    return 0;
+}
+
+static tokenizer_result_t tokenizer_step (tokenizer_t *tokenizer, tokenizer_state_t *state, tokenizer_token_t **token, bool skip) {
     while (true) {
         switch (state->state) {
             case TOKENIZER_FIELD: {
                 char c = next_character(state);
                 if (c == EOF)                         { return pop_and_yield(state, token, TOKENIZER_FINAL, TOKENIZER_END_OF_FILE, skip);         }
+                if (is_comment(tokenizer, state, c))  {        transition(state, TOKENIZER_COMMENT);                                    continue; }
+                state->row_start = false;
                 if (c == tokenizer->column_delimiter) { return pop_and_yield(state, token, TOKENIZER_FIELD, TOKENIZER_OK, skip);                  }
                 if (c == tokenizer->row_delimiter)    { return pop_and_yield(state, token, TOKENIZER_FIELD, TOKENIZER_END_OF_ROW, skip);          }
                 if (is_whitespace(tokenizer, c))      {        transition(state, TOKENIZER_FIELD);                                      continue; }
@@ -250,6 +433,9 @@ tokenizer_result_t tokenizer_next (tokenizer_t *tokenizer, tokenizer_state_t *st
             }
 
             case TOKENIZER_UNQUOTED_FIELD: {
+                if (0 != consume_run(state, tokenizer->column_delimiter, tokenizer->row_delimiter, tokenizer->row_delimiter, skip)) {
+                    transition(state, TOKENIZER_CRASHED); return TOKENIZER_ERROR;
+                }
                 char c = next_character(state);
                 if (c == EOF)                         { return trim_pop_and_yield(state, token, TOKENIZER_FINAL, TOKENIZER_END_OF_FILE, skip);    }
                 if (c == tokenizer->column_delimiter) { return trim_pop_and_yield(state, token, TOKENIZER_FIELD, TOKENIZER_OK, skip);             }
@@ -259,6 +445,9 @@ tokenizer_result_t tokenizer_next (tokenizer_t *tokenizer, tokenizer_state_t *st
             }
 
             case TOKENIZER_QUOTED_FIELD: {
+                if (0 != consume_run(state, tokenizer->quote, tokenizer->escape, tokenizer->quote, skip)) {
+                    transition(state, TOKENIZER_CRASHED); return TOKENIZER_ERROR;
+                }
                 char c = next_character(state);
                 if (is_quote_escape(tokenizer, c))    {        transition(state, TOKENIZER_QUOTE);                                      continue; }
                 if (is_escape(tokenizer, c))          {        transition(state, TOKENIZER_ESCAPE);                                     continue; }
@@ -291,11 +480,20 @@ tokenizer_result_t tokenizer_next (tokenizer_t *tokenizer, tokenizer_state_t *st
                 if (c == tokenizer->escape)           { if   (!append(state, c, TOKENIZER_QUOTED_FIELD))                                continue;
                                                         else { transition(state, TOKENIZER_CRASHED); return TOKENIZER_ERROR; }                    }
                 if (c == EOF)                         { return pop_and_yield(state, token, TOKENIZER_CRASHED, TOKENIZER_PARSE_ERROR, skip);       }
-                /* c is any other character */        { if   (!append(state, tokenizer->escape, TOKENIZER_QUOTED_FIELD)
+                /* c is any other character */        { if   (!tokenizer_token_buffer_append(state->token_buffer, tokenizer->escape)
                                                         &&    !append(state, c, TOKENIZER_QUOTED_FIELD))                                continue;
                                                         else { transition(state, TOKENIZER_CRASHED); return TOKENIZER_ERROR; }                    }
             }
 
+            case TOKENIZER_COMMENT: {
+                if (0 != consume_run(state, tokenizer->row_delimiter, tokenizer->row_delimiter, tokenizer->row_delimiter, true)) {
+                    transition(state, TOKENIZER_CRASHED); return TOKENIZER_ERROR;
+                }
+                char c = next_character(state);
+                if (c == EOF)                         { return pop_and_yield(state, token, TOKENIZER_FINAL, TOKENIZER_END_OF_FILE, skip);         }
+                /* c is the row delimiter */          {        transition(state, TOKENIZER_FIELD);                                      continue; }
+            }
+
             case TOKENIZER_INITIAL:                   { perror("Error: Tokenizer was now properly opened"); return TOKENIZER_ERROR;               }
             case TOKENIZER_FINAL:                     { perror("Error: Tokenizer completed reading this file"); return TOKENIZER_ERROR;           }
             case TOKENIZER_CRASHED:                   { perror("Error: Tokenizer crashed and cannot continue"); return TOKENIZER_ERROR;           }
@@ -304,6 +502,133 @@ tokenizer_result_t tokenizer_next (tokenizer_t *tokenizer, tokenizer_state_t *st
     }
 }
 
+tokenizer_result_t tokenizer_next (tokenizer_t *tokenizer, tokenizer_state_t *state, tokenizer_token_t **token, bool skip) {
+    tokenizer_result_t result = tokenizer_step(tokenizer, state, token, skip);
+    if (result == TOKENIZER_END_OF_ROW) {
+        state->row_start = true;
+    }
+    return result;
+}
+
+tokenizer_result_t tokenizer_next_field (tokenizer_t *tokenizer, tokenizer_state_t *state, bool skip) {
+    state->field = NULL;
+    state->field_size = 0;
+    tokenizer_result_t result = tokenizer_next(tokenizer, state, NULL, skip);
+    if (!skip && state->field == NULL && (result == TOKENIZER_OK || result == TOKENIZER_END_OF_ROW || result == TOKENIZER_END_OF_FILE)) {
+        return TOKENIZER_ERROR;
+    }
+    return result;
+}
+
+// Whether a field starting with this character has no quotes to mind, so
+// that it ends at the next delimiter.
+static inline bool is_plain_field_start(tokenizer_t *tokenizer, char c) {
+    return c != tokenizer->quote && c != tokenizer->comment && !is_whitespace(tokenizer, c);
+}
+
+static inline void skip_read_buffer(tokenizer_state_t *state, size_t length) {
+    state->read_buffer->pointer += length;
+    state->current_offset += length;
+}
+
+tokenizer_result_t tokenizer_skip_fields (tokenizer_t *tokenizer, tokenizer_state_t *state, size_t fields, size_t *skipped) {
+    state->field = NULL;
+    state->field_size = 0;
+    *skipped = 0;
+
+    while (*skipped < fields) {
+        tokenizer_read_buffer_t *read_buffer = state->read_buffer;
+
+        // Unquoted fields that end within the read buffer are jumped over.
+        // Fields that start with a quote or whitespace, or that go on past
+        // the buffer, are left to the state machine.
+        if (state->state == TOKENIZER_FIELD && fill_read_buffer(state)) {
+            const char *run = read_buffer->buffer + read_buffer->pointer;
+            size_t available = read_buffer->size - read_buffer->pointer;
+            if (!is_plain_field_start(tokenizer, run[0])) {
+                goto state_machine;
+            }
+
+            // Short fields are found together, in the bitmask of the
+            // delimiters in the next block of bytes.
+            if (available >= STRUCTURAL_BLOCK_SIZE) {
+                uint64_t mask = structural_mask(run, tokenizer->column_delimiter, tokenizer->row_delimiter, tokenizer->row_delimiter);
+                size_t next = 0;
+                while (mask != 0 && *skipped < fields) {
+                    size_t end = __builtin_ctzll(mask);
+                    mask &= mask - 1;
+                    next = end + 1;
+                    (*skipped)++;
+                    state->row_start = run[end] == tokenizer->row_delimiter;
+                    if (state->row_start) {
+                        skip_read_buffer(state, next);
+                        return TOKENIZER_END_OF_ROW;
+                    }
+                    if (next < STRUCTURAL_BLOCK_SIZE && !is_plain_field_start(tokenizer, run[next])) {
+                        break;
+                    }
+                }
+                if (next > 0) {
+                    skip_read_buffer(state, next);
+                    continue;
+                }
+            }
+
+            size_t length = find_structural(run, available, tokenizer->column_delimiter, tokenizer->row_delimiter, tokenizer->row_delimiter);
+            if (length < available) {
+                skip_read_buffer(state, length + 1);
+                (*skipped)++;
+                state->row_start = run[length] == tokenizer->row_delimiter;
+                if (state->row_start) {
+                    return TOKENIZER_END_OF_ROW;
+                }
+                continue;
+            }
+        }
+
+        state_machine: ;
+        tokenizer_result_t result = tokenizer_next(tokenizer, state, NULL, true);
+        if (result == TOKENIZER_OK || result == TOKENIZER_END_OF_ROW || result == TOKENIZER_END_OF_FILE) {
+            (*skipped)++;
+        }
+        if (result != TOKENIZER_OK) {
+            return result;
+        }
+    }
+    return TOKENIZER_OK;
+}
+
+bool tokenizer_skip_bytes (tokenizer_state_t *state, size_t bytes) {
+    if (state->state != TOKENIZER_FIELD || !fill_read_buffer(state)
+        || bytes >= state->read_buffer->size - state->read_buffer->pointer) {
+        return false;
+    }
+    skip_read_buffer(state, bytes);
+    state->row_start = state->row_start && bytes == 0;
+    return true;
+}
+
+int tokenizer_skip_lines (tokenizer_t *tokenizer, tokenizer_state_t *state, size_t lines) {
+    for (size_t line = 0; line < lines; line++) {
+        if (0 != consume_run(state, tokenizer->row_delimiter, tokenizer->row_delimiter, tokenizer->row_delimiter, true)) {
+            return -1;
+        }
+        if (!fill_read_buffer(state)) {
+            break;
+        }
+        skip_read_buffer(state, 1);
+    }
+    state->row_start = true;
+    return 0;
+}
+
+bool tokenizer_is_na (tokenizer_t *tokenizer, const char *field, size_t size) {
+    if (tokenizer->na_strings == NULL) {
+        return size == 2 && field[0] == 'N' && field[1] == 'A';
+    }
+    return string_set_index_of(tokenizer->na_strings, field, size) >= 0;
+}
+
 const char *tokenizer_result_to_string (tokenizer_result_t result) {
     switch (result) {
         case TOKENIZER_OK:              return "OK";
@@ -323,6 +648,7 @@ const char *tokenizer_state_to_string (tokenizer_state_value_t state) {
         case TOKENIZER_QUOTE:           return "quote";
         case TOKENIZER_TRAILING:        return "trailing";
         case TOKENIZER_ESCAPE:          return "escape";
+        case TOKENIZER_COMMENT:         return "comment";
         case TOKENIZER_FINAL:           return "final";
         case TOKENIZER_CRASHED:         return "crashed";
         default:                        return "?";
@@ -4,14 +4,18 @@
 #include <stdio.h>
 
 #include "token.h"
+#include "arena.h"
+#include "string_set.h"
 
 typedef struct {
     char row_delimiter;
     char column_delimiter;
     char escape;
     char quote;
+    char comment;                   // lines starting with it are skipped, '\0' for none
     bool use_double_quote_escape;
     bool use_escape_character;
+    string_set_t *na_strings;       // fields read as NA, just "NA" if NULL; freed with the tokenizer
     //bool strip_whitespace;
 } tokenizer_t;
 
@@ -31,6 +35,7 @@ typedef enum {
     TOKENIZER_QUOTE,
     TOKENIZER_TRAILING,
     TOKENIZER_ESCAPE,
+    TOKENIZER_COMMENT,
     TOKENIZER_FINAL,
     TOKENIZER_CRASHED,
 }  tokenizer_state_value_t;
@@ -46,17 +51,22 @@ typedef struct {
     size_t max_size;
     size_t size;
     size_t pointer;
+    bool   mapped;          // buffer is the whole mapped file, not ours to free
 } tokenizer_read_buffer_t;
 
 typedef struct {
-    FILE                     *file;
+    FILE                     *file;           // NULL when reading a mapping
     tokenizer_state_value_t   state;
     long                      initial_offset; // long because fseek offset uses long
     long                      read_characters;
     long                      current_offset;
     long                      end_of_last_token;
+    bool                      row_start;      // nothing of the current row was read yet
     tokenizer_read_buffer_t  *read_buffer;
     tokenizer_token_buffer_t *token_buffer;
+    arena_t                  *arena;          // tokens are allocated here if set, malloc'd otherwise
+    const char               *field;          // last field read by tokenizer_next_field, NUL-terminated
+    size_t                    field_size;
 } tokenizer_state_t;
 
 tokenizer_t               csv_tokenizer ();
@@ -64,10 +74,27 @@ tokenizer_t              *new_csv_tokenizer ();
 void                      tokenizer_free(tokenizer_t*);
 
 tokenizer_result_t        tokenizer_next (tokenizer_t *tokenizer, tokenizer_state_t *state, tokenizer_token_t **token, bool skip);
+// Like tokenizer_next, but the field is not copied into a token. It is left
+// in state->field, which stays valid until the next call.
+tokenizer_result_t        tokenizer_next_field (tokenizer_t *tokenizer, tokenizer_state_t *state, bool skip);
+// Skips up to the given number of fields, stopping early at the end of the
+// row. Sets skipped to the number of fields skipped, including the one that
+// ended the row, and returns how the last of them ended.
+tokenizer_result_t        tokenizer_skip_fields (tokenizer_t *tokenizer, tokenizer_state_t *state, size_t fields, size_t *skipped);
+// Moves ahead the given number of bytes from the start of a field, if they
+// are in the read buffer. Returns false, without moving, if they are not.
+bool                      tokenizer_skip_bytes (tokenizer_state_t *state, size_t bytes);
+// Skips the given number of lines, up to and including their row
+// delimiters, without minding quotes. Returns -1 if the file cannot be read.
+int                       tokenizer_skip_lines (tokenizer_t *tokenizer, tokenizer_state_t *state, size_t lines);
+// Whether a field of the given size is one of the strings read as NA.
+bool                      tokenizer_is_na (tokenizer_t *tokenizer, const char *field, size_t size);
 int                       tokenizer_start(tokenizer_t *tokenizer, tokenizer_state_t *state);
 void                      tokenizer_close(tokenizer_t *tokenizer, tokenizer_state_t *state);
 
 tokenizer_state_t        *tokenizer_state_init (const char *path, long initial_offset, size_t token_buffer_size, size_t character_buffer_size);
+// Reads size bytes at data, a file mapped into memory, without copying them.
+tokenizer_state_t        *tokenizer_state_init_mapped (const char *data, size_t size, long initial_offset, size_t token_buffer_size);
 void                      tokenizer_state_close (tokenizer_state_t *);
 const char               *tokenizer_state_to_string (tokenizer_state_value_t);
 
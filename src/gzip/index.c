@@ -0,0 +1,362 @@
+#include "index.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "../debug.h"
+
+#define GZIP_FTEXT    0x01
+#define GZIP_FHCRC    0x02
+#define GZIP_FEXTRA   0x04
+#define GZIP_FNAME    0x08
+#define GZIP_FCOMMENT 0x10
+
+// zlib counts input in unsigned ints, so large archives are fed in pieces.
+#define GZIP_MAX_INPUT (1U << 30)
+
+// Returns the offset of the deflate data of the member starting at offset,
+// or -1 if there is no gzip header there. If the header carries the BGZF
+// block size, it is stored in *block_size, otherwise that is set to 0.
+static int64_t Gzip_skip_header(const unsigned char *data, size_t size, size_t offset, size_t *block_size) {
+    *block_size = 0;
+    if (offset + 10 > size || data[offset] != 0x1f || data[offset + 1] != 0x8b || data[offset + 2] != 8) {
+        return -1;
+    }
+    unsigned char flags = data[offset + 3];
+    size_t cursor = offset + 10;
+
+    if (flags & GZIP_FEXTRA) {
+        if (cursor + 2 > size) return -1;
+        size_t extra_length = data[cursor] | (data[cursor + 1] << 8);
+        cursor += 2;
+        if (cursor + extra_length > size) return -1;
+
+        // Subfields: two identifier bytes, two length bytes, contents.
+        for (size_t field = cursor; field + 4 <= cursor + extra_length;) {
+            size_t field_length = data[field + 2] | (data[field + 3] << 8);
+            if (data[field] == 'B' && data[field + 1] == 'C' && field_length == 2 && field + 6 <= cursor + extra_length) {
+                *block_size = (size_t) (data[field + 4] | (data[field + 5] << 8)) + 1;
+            }
+            field += 4 + field_length;
+        }
+        cursor += extra_length;
+    }
+    if (flags & GZIP_FNAME) {
+        while (cursor < size && data[cursor] != 0) cursor++;
+        cursor++;
+    }
+    if (flags & GZIP_FCOMMENT) {
+        while (cursor < size && data[cursor] != 0) cursor++;
+        cursor++;
+    }
+    if (flags & GZIP_FHCRC) {
+        cursor += 2;
+    }
+    return cursor <= size ? (int64_t) cursor : -1;
+}
+
+static bool GzipIndex_add_point(GzipIndex *index, uint64_t compressed_offset, int bits,
+                                uint64_t decompressed_offset, unsigned char *window) {
+    if (index->points_count == index->points_capacity) {
+        size_t capacity = index->points_capacity ? 2 * index->points_capacity : 64;
+        GzipPoint *points = (GzipPoint *) realloc(index->points, capacity * sizeof(GzipPoint));
+        if (points == NULL) {
+            return false;
+        }
+        index->points = points;
+        index->points_capacity = capacity;
+    }
+    GzipPoint *point = &index->points[index->points_count++];
+    point->compressed_offset = compressed_offset;
+    point->bits = bits;
+    point->decompressed_offset = decompressed_offset;
+    point->window = window;
+    return true;
+}
+
+static void Gzip_feed(z_stream *stream, const unsigned char *data, size_t size) {
+    if (stream->avail_in == 0) {
+        size_t left = size - (stream->next_in - data);
+        stream->avail_in = left < GZIP_MAX_INPUT ? left : GZIP_MAX_INPUT;
+    }
+}
+
+// Members follow each other, each with its own header and an 8 byte trailer.
+// Returns the offset of the deflate data of the next member, or -1 if the
+// archive ends here.
+static int64_t Gzip_next_member(const unsigned char *data, size_t size, size_t end_of_deflate) {
+    size_t block_size;
+    return Gzip_skip_header(data, size, end_of_deflate + 8, &block_size);
+}
+
+// Gives up, clearing index->bgzf, if a member lacks the BGZF block size,
+// as when plain gzip data was appended to a BGZF file.
+static const char *GzipIndex_build_bgzf(GzipIndex *index) {
+    const unsigned char *data = index->archive;
+    size_t size = index->archive_size;
+    uint64_t decompressed = 0;
+
+    for (size_t offset = 0; offset < size;) {
+        size_t block_size;
+        int64_t deflate_offset = Gzip_skip_header(data, size, offset, &block_size);
+        if (deflate_offset >= 0 && block_size == 0) {
+            index->bgzf = false;
+            index->points_count = 0;
+            return NULL;
+        }
+        if (deflate_offset < 0 || offset + block_size > size || block_size < 18) {
+            return "BGZF member is corrupt";
+        }
+        const unsigned char *trailer = data + offset + block_size - 4;
+        uint32_t member_size = trailer[0] | trailer[1] << 8 | trailer[2] << 16 | (uint32_t) trailer[3] << 24;
+
+        // The empty member at the end of the file does not need a point.
+        if (member_size > 0 && !GzipIndex_add_point(index, deflate_offset, 0, decompressed, NULL)) {
+            return "cannot allocate the index";
+        }
+        decompressed += member_size;
+        offset += block_size;
+    }
+
+    index->decompressed_size = decompressed;
+    return NULL;
+}
+
+static const char *GzipIndex_build_by_decompressing(GzipIndex *index, size_t span) {
+    const unsigned char *data = index->archive;
+    size_t size = index->archive_size;
+
+    size_t block_size;
+    int64_t deflate_offset = Gzip_skip_header(data, size, 0, &block_size);
+    if (!GzipIndex_add_point(index, deflate_offset, 0, 0, NULL)) {
+        return "cannot allocate the index";
+    }
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, -15) != Z_OK) {
+        return "cannot initialize zlib";
+    }
+    unsigned char *window = (unsigned char *) calloc(GZIP_WINDOW_SIZE, 1);
+    if (window == NULL) {
+        inflateEnd(&stream);
+        return "cannot allocate a window";
+    }
+
+    stream.next_in = (unsigned char *) data + deflate_offset;
+    stream.avail_in = 0;
+    stream.avail_out = 0;
+    uint64_t decompressed = 0, last_point = 0;
+    const char *error = NULL;
+
+    while (true) {
+        Gzip_feed(&stream, data, size);
+        if (stream.avail_out == 0) {
+            stream.avail_out = GZIP_WINDOW_SIZE;
+            stream.next_out = window;
+        }
+
+        // Stop at the end of each deflate block to see if it is a good
+        // place for an access point.
+        uInt available = stream.avail_out;
+        int result = inflate(&stream, Z_BLOCK);
+        decompressed += available - stream.avail_out;
+
+        if (result == Z_NEED_DICT || result == Z_DATA_ERROR || result == Z_MEM_ERROR
+            || (result == Z_BUF_ERROR && stream.avail_in == 0)) {
+            error = "archive is truncated or corrupt";
+            break;
+        }
+
+        if (result == Z_STREAM_END) {
+            size_t end_of_deflate = stream.next_in - data;
+            int64_t next = Gzip_next_member(data, size, end_of_deflate);
+            if (next < 0) {
+                break;
+            }
+            // Back references do not cross members, so no window is needed.
+            inflateReset(&stream);
+            stream.next_in = (unsigned char *) data + next;
+            stream.avail_in = 0;
+            if (!GzipIndex_add_point(index, next, 0, decompressed, NULL)) {
+                error = "cannot allocate the index";
+                break;
+            }
+            last_point = decompressed;
+            continue;
+        }
+
+        // Bit 7 is set at the end of a block, bit 6 if it was the last one.
+        bool end_of_block = (stream.data_type & 128) && !(stream.data_type & 64);
+        if (end_of_block && decompressed - last_point >= span) {
+            unsigned char *copy = (unsigned char *) malloc(GZIP_WINDOW_SIZE);
+            if (copy == NULL || !GzipIndex_add_point(index, stream.next_in - data, stream.data_type & 7,
+                                                     decompressed, copy)) {
+                free(copy);
+                error = "cannot allocate the index";
+                break;
+            }
+            // The window is circular, the oldest output is just past the
+            // current position.
+            size_t left = stream.avail_out;
+            memcpy(copy, window + GZIP_WINDOW_SIZE - left, left);
+            memcpy(copy + left, window, GZIP_WINDOW_SIZE - left);
+            last_point = decompressed;
+        }
+    }
+
+    free(window);
+    inflateEnd(&stream);
+    index->decompressed_size = decompressed;
+    return error;
+}
+
+GzipIndex *GzipIndex_new(const char *path, size_t span, const char **error) {
+    GzipIndex *index = (GzipIndex *) calloc(1, sizeof(GzipIndex));
+    if (index == NULL) {
+        *error = "cannot allocate the index";
+        return NULL;
+    }
+    index->archive = MAP_FAILED;
+
+    index->path = strdup(path);
+    int fd = open(path, O_RDONLY);
+    struct stat file_info;
+    if (index->path == NULL || fd < 0 || fstat(fd, &file_info) < 0 || file_info.st_size == 0) {
+        if (fd >= 0) close(fd);
+        GzipIndex_free(index);
+        *error = "cannot open the file";
+        return NULL;
+    }
+    index->archive_size = file_info.st_size;
+    index->archive = (const unsigned char *) mmap(NULL, index->archive_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (index->archive == MAP_FAILED) {
+        GzipIndex_free(index);
+        *error = "cannot map the file";
+        return NULL;
+    }
+
+    size_t block_size;
+    if (Gzip_skip_header(index->archive, index->archive_size, 0, &block_size) < 0) {
+        GzipIndex_free(index);
+        *error = "file is not gzip compressed";
+        return NULL;
+    }
+    index->bgzf = block_size != 0;
+
+    *error = index->bgzf ? GzipIndex_build_bgzf(index) : NULL;
+    if (*error == NULL && !index->bgzf) {
+        *error = GzipIndex_build_by_decompressing(index, span);
+    }
+    if (*error != NULL) {
+        GzipIndex_free(index);
+        return NULL;
+    }
+
+    UFO_LOG("Gzip file %s%s has %li access points, %li bytes decompressed\n",
+            path, index->bgzf ? " (BGZF)" : "", index->points_count, index->decompressed_size);
+    return index;
+}
+
+void GzipIndex_free(GzipIndex *index) {
+    if (index->archive != MAP_FAILED) {
+        munmap((void *) index->archive, index->archive_size);
+    }
+    for (size_t i = 0; i < index->points_count; i++) {
+        free(index->points[i].window);
+    }
+    free(index->points);
+    free((void *) index->path);
+    free(index);
+}
+
+// The last access point at or before the offset.
+static const GzipPoint *GzipIndex_find(const GzipIndex *index, uint64_t offset) {
+    size_t low = 0, high = index->points_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (index->points[middle].decompressed_offset <= offset) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low == 0 ? NULL : &index->points[low - 1];
+}
+
+int32_t GzipIndex_read(GzipIndex *index, uintptr_t start, uintptr_t end, unsigned char *target) {
+    if (start > end || end > index->decompressed_size) {
+        return 1;
+    }
+    if (start == end) {
+        return 0;
+    }
+
+    const GzipPoint *point = GzipIndex_find(index, start);
+    if (point == NULL) {
+        return 1;
+    }
+
+    const unsigned char *data = index->archive;
+    size_t size = index->archive_size;
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, -15) != Z_OK) {
+        return -1;
+    }
+    if (point->bits > 0) {
+        inflatePrime(&stream, point->bits, data[point->compressed_offset - 1] >> (8 - point->bits));
+    }
+    if (point->window != NULL) {
+        inflateSetDictionary(&stream, point->window, GZIP_WINDOW_SIZE);
+    }
+    stream.next_in = (unsigned char *) data + point->compressed_offset;
+    stream.avail_in = 0;
+
+    // Output before start is thrown away.
+    unsigned char discard[GZIP_WINDOW_SIZE];
+    uint64_t position = point->decompressed_offset;
+    int32_t status = 0;
+
+    while (position < end) {
+        Gzip_feed(&stream, data, size);
+        if (position < start) {
+            uint64_t skip = start - position;
+            stream.next_out = discard;
+            stream.avail_out = skip < sizeof(discard) ? skip : sizeof(discard);
+        } else {
+            stream.next_out = target + (position - start);
+            stream.avail_out = end - position < UINT_MAX ? end - position : UINT_MAX;
+        }
+
+        uInt available = stream.avail_out;
+        int result = inflate(&stream, Z_NO_FLUSH);
+        position += available - stream.avail_out;
+
+        if (result == Z_STREAM_END && position < end) {
+            int64_t next = Gzip_next_member(data, size, stream.next_in - data);
+            if (next < 0) {
+                status = -1;
+                break;
+            }
+            inflateReset(&stream);
+            stream.next_in = (unsigned char *) data + next;
+            stream.avail_in = 0;
+            continue;
+        }
+        if (result != Z_OK && result != Z_STREAM_END) {
+            status = -1;
+            break;
+        }
+    }
+
+    inflateEnd(&stream);
+    return status;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Deflate streams cannot be entered in the middle, except at points where
+// the decompressor state is known: the start of each gzip member, and the
+// start of each deflate block provided the 32kB of output preceding it are
+// known as well (see zran.c in the zlib sources).
+//
+// BGZF files (as written by bgzip and samtools) consist of small members and
+// record the size of each member in its header, so every member is an access
+// point and the index is built without decompressing anything. Other gzip
+// files are decompressed once, and an access point with a copy of the
+// preceding window is recorded about every span bytes of output.
+#define GZIP_DEFAULT_SPAN  (1024 * 1024)
+#define GZIP_WINDOW_SIZE   32768
+
+typedef struct {
+    uint64_t       compressed_offset;    // first whole byte of deflate data
+    int            bits;                 // bits of the preceding byte to feed in first, 0-7
+    uint64_t       decompressed_offset;
+    unsigned char *window;               // the preceding output, NULL at member starts
+} GzipPoint;
+
+typedef struct {
+    const char          *path;
+    const unsigned char *archive;        // the whole file, mapped
+    size_t               archive_size;
+    bool                 bgzf;
+    GzipPoint           *points;         // sorted by both offsets
+    size_t               points_count;
+    size_t               points_capacity;
+    size_t               decompressed_size;
+} GzipIndex;
+
+// Builds the access point index of the file. Returns NULL and sets *error to
+// a static message if the file cannot be indexed.
+GzipIndex *GzipIndex_new(const char *path, size_t span, const char **error);
+void GzipIndex_free(GzipIndex *index);
+
+/**
+ * Copy the decompressed bytes [start, end) into target, decompressing from
+ * the closest access point before start. Does not call into R, and can be
+ * called from several threads at once.
+ *
+ * @return 0 on success.
+ */
+int32_t GzipIndex_read(GzipIndex *index, uintptr_t start, uintptr_t end, unsigned char *target);
@@ -184,7 +184,7 @@ const char* __extract_string_or_die(SEXP/*STRSXP*/ string) {
 
     // Copy string and return the copy.
     const char *tmp = CHAR(STRING_ELT(string, 0));
-    char *ret = (char *) malloc(sizeof(char) * strlen(tmp));  // FIXME reclaim
+    char *ret = (char *) malloc(sizeof(char) * (strlen(tmp) + 1));  // FIXME reclaim
     strcpy(ret, tmp);
     return ret;
 }
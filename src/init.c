@@ -7,6 +7,8 @@
 #include "ufo_sqlite.h"
 #include "ufo_sqlite.h"
 #include "ufo_bz2.h"
+#include "ufo_zstd.h"
+#include "ufo_gz.h"
 #include "ufo_write_protect.h"
 #include "ufo_bind.h"
 #include "ufo_mmap.h"
@@ -19,18 +21,18 @@ static const R_CallMethodDef CallEntries[] = {
 
     // Constructors for vectors that partially materialize on-demand from
     // binary files.
-    {"vectors_intsxp_bin",      (DL_FUNC) &ufo_vectors_intsxp_bin,          3},
-    {"vectors_realsxp_bin",     (DL_FUNC) &ufo_vectors_realsxp_bin,         3},
-    {"vectors_cplxsxp_bin",     (DL_FUNC) &ufo_vectors_cplxsxp_bin,         3},
-    {"vectors_lglsxp_bin",      (DL_FUNC) &ufo_vectors_lglsxp_bin,          3},
-    {"vectors_rawsxp_bin",      (DL_FUNC) &ufo_vectors_rawsxp_bin,          3},
+    {"vectors_intsxp_bin",      (DL_FUNC) &ufo_vectors_intsxp_bin,          7},
+    {"vectors_realsxp_bin",     (DL_FUNC) &ufo_vectors_realsxp_bin,         7},
+    {"vectors_cplxsxp_bin",     (DL_FUNC) &ufo_vectors_cplxsxp_bin,         7},
+    {"vectors_lglsxp_bin",      (DL_FUNC) &ufo_vectors_lglsxp_bin,          7},
+    {"vectors_rawsxp_bin",      (DL_FUNC) &ufo_vectors_rawsxp_bin,          7},
 
     // Constructors for matrices composed of the above-mentioned vectors.
-    {"matrix_intsxp_bin",       (DL_FUNC) &ufo_matrix_intsxp_bin,           5},
-    {"matrix_realsxp_bin",      (DL_FUNC) &ufo_matrix_realsxp_bin,          5},
-    {"matrix_cplxsxp_bin",      (DL_FUNC) &ufo_matrix_cplxsxp_bin,          5},
-    {"matrix_lglsxp_bin",       (DL_FUNC) &ufo_matrix_lglsxp_bin,           5},
-    {"matrix_rawsxp_bin",       (DL_FUNC) &ufo_matrix_rawsxp_bin,           5},
+    {"matrix_intsxp_bin",       (DL_FUNC) &ufo_matrix_intsxp_bin,           9},
+    {"matrix_realsxp_bin",      (DL_FUNC) &ufo_matrix_realsxp_bin,          9},
+    {"matrix_cplxsxp_bin",      (DL_FUNC) &ufo_matrix_cplxsxp_bin,          9},
+    {"matrix_lglsxp_bin",       (DL_FUNC) &ufo_matrix_lglsxp_bin,           9},
+    {"matrix_rawsxp_bin",       (DL_FUNC) &ufo_matrix_rawsxp_bin,           9},
 
     // Selective mmap based on offsets and lengths.
     {"strsxp_mmap",             (DL_FUNC) &ufo_strsxp_mmap,                 6},
@@ -49,13 +51,28 @@ static const R_CallMethodDef CallEntries[] = {
 	{"realsxp_seq",				(DL_FUNC) &ufo_realsxp_seq,					5},
 
     // BZip2
-    {"intsxp_bzip2",            (DL_FUNC) &ufo_intsxp_bzip2,                3},
-    {"realsxp_bzip2",           (DL_FUNC) &ufo_realsxp_bzip2,               3},
-    {"rawsxp_bzip2",            (DL_FUNC) &ufo_rawsxp_bzip2,                3},
-    {"cplxsxp_bzip2",           (DL_FUNC) &ufo_cplxsxp_bzip2,               3},
-    {"lglsxp_bzip2",            (DL_FUNC) &ufo_lglsxp_bzip2,                3},
-    {"vecsxp_bzip2",            (DL_FUNC) &ufo_vecsxp_bzip2,                3},
-    {"strsxp_bzip2",            (DL_FUNC) &ufo_strsxp_bzip2,                3},
+    {"intsxp_bzip2",            (DL_FUNC) &ufo_intsxp_bzip2,                5},
+    {"realsxp_bzip2",           (DL_FUNC) &ufo_realsxp_bzip2,               5},
+    {"rawsxp_bzip2",            (DL_FUNC) &ufo_rawsxp_bzip2,                5},
+    {"cplxsxp_bzip2",           (DL_FUNC) &ufo_cplxsxp_bzip2,               5},
+    {"lglsxp_bzip2",            (DL_FUNC) &ufo_lglsxp_bzip2,                5},
+    {"vecsxp_bzip2",            (DL_FUNC) &ufo_vecsxp_bzip2,                5},
+    {"strsxp_bzip2",            (DL_FUNC) &ufo_strsxp_bzip2,                5},
+    {"strsxp_bzip2_lines",      (DL_FUNC) &ufo_strsxp_bzip2_lines,          6},
+
+    // Seekable zstd
+    {"intsxp_zstd",             (DL_FUNC) &ufo_intsxp_zstd,                 3},
+    {"realsxp_zstd",            (DL_FUNC) &ufo_realsxp_zstd,                3},
+    {"rawsxp_zstd",             (DL_FUNC) &ufo_rawsxp_zstd,                 3},
+    {"cplxsxp_zstd",            (DL_FUNC) &ufo_cplxsxp_zstd,                3},
+    {"lglsxp_zstd",             (DL_FUNC) &ufo_lglsxp_zstd,                 3},
+
+    // Gzip
+    {"intsxp_gz",               (DL_FUNC) &ufo_intsxp_gz,                   4},
+    {"realsxp_gz",              (DL_FUNC) &ufo_realsxp_gz,                  4},
+    {"rawsxp_gz",               (DL_FUNC) &ufo_rawsxp_gz,                   4},
+    {"cplxsxp_gz",              (DL_FUNC) &ufo_cplxsxp_gz,                  4},
+    {"lglsxp_gz",               (DL_FUNC) &ufo_lglsxp_gz,                   4},
     
     // Write protect
     {"write_protect",           (DL_FUNC) &ufo_write_protect,               3},
@@ -64,7 +81,7 @@ static const R_CallMethodDef CallEntries[] = {
     {"bind",					(DL_FUNC) &ufo_bind,						3},
 
     // CSV support
-    {"csv",						(DL_FUNC) &ufo_csv,							6},
+    {"csv",						(DL_FUNC) &ufo_csv,							16},
 
     // PSQL column
     {"psql",        			(DL_FUNC) &ufo_psql,						5},
@@ -75,7 +92,11 @@ static const R_CallMethodDef CallEntries[] = {
     {"test",					(DL_FUNC) &test,  							0},
 
     // Storage.
-    {"store_bin",				(DL_FUNC) &ufo_store_bin,					2},
+    {"store_bin",				(DL_FUNC) &ufo_store_bin,					7},
+    {"bin",						(DL_FUNC) &ufo_bin,							6},
+    {"bin_header",				(DL_FUNC) &ufo_bin_header,					1},
+    {"store_tiled_bin",			(DL_FUNC) &ufo_store_tiled_bin,				5},
+    {"drain_writeback",			(DL_FUNC) &ufo_drain_writeback,				2},
 
     // Turn on debug mode.
     {"vectors_set_debug_mode",  (DL_FUNC) &ufo_vectors_set_debug_mode,      1},
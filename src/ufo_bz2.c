@@ -23,21 +23,25 @@
 #include "ufo_bz2.h"
 #include "bzip2/blocks.h"
 #include "bzip2/block.h"
-
-// TODO The buffer should probably be handled by R?
-#define DECOMPRESSED_BUFFER_SIZE 1024 * 1024 * 1024 // 900kB + some room just in case
+#include "bzip2/cache.h"
+#include "bzip2/lines.h"
 
 // #include <bzlib.h>
 typedef struct {
-    Blocks *blocks;
+    BlockCache *cache;
     size_t element_width;
-    size_t decompressed_buffer_size;
+    Lines *lines;           // only for vectors of lines
 } BZip2;
 
 
-BZip2 *BZip2_new(ufo_vector_type_t type, const char* path) {
-    // Pre-scan the file
-    Blocks *blocks = Blocks_new(path, DECOMPRESSED_BUFFER_SIZE);
+BZip2 *BZip2_new(size_t element_width, const char* path, size_t cache_bytes, size_t readahead) {
+    // Pre-scan the file. The cache decompresses each block into a buffer of
+    // its own, sized to the block.
+    Blocks *blocks = Blocks_new(path);
+    if (blocks == NULL) {
+        Rf_error("UFO could not read the blocks of %s.\n", path);
+        return NULL;
+    }
 
     // Check for bad blocks
     if (blocks->bad_blocks > 0) {
@@ -46,34 +50,69 @@ BZip2 *BZip2_new(ufo_vector_type_t type, const char* path) {
         return NULL;
     }
 
+    if (blocks->decompressed_size % element_width != 0) {
+        size_t decompressed_size = blocks->decompressed_size;
+        Blocks_free(blocks);
+        Rf_error("UFO decompressed size of %s (%li bytes) is not a multiple of the element size (%li bytes).\n",
+                 path, decompressed_size, element_width);
+        return NULL;
+    }
+
+    BlockCache *cache = BlockCache_new(blocks, cache_bytes, readahead);
+    if (cache == NULL) {
+        Blocks_free(blocks);
+        Rf_error("UFO could not map %s into memory.\n", path);
+        return NULL;
+    }
+
     BZip2 *bzip2 = (BZip2 *) malloc(sizeof(BZip2));
-    bzip2->element_width = __get_element_size(UFO_RAW);
-    bzip2->blocks = blocks;
+    if (bzip2 == NULL) {
+        BlockCache_free(cache);
+        Rf_error("UFO could not allocate the BZip2 source.\n");
+        return NULL;
+    }
+    bzip2->element_width = element_width;
+    bzip2->cache = cache;
+    bzip2->lines = NULL;
     return bzip2;
 }
 
 int32_t BZip2_populate(void* user_data, uintptr_t start, uintptr_t end, unsigned char* target) {
     BZip2 *bzip2 = (BZip2 *) user_data;
-    return Blocks_read(bzip2->blocks, start * bzip2->element_width, end * bzip2->element_width, target);
+    int32_t result = BlockCache_read(bzip2->cache, start * bzip2->element_width, end * bzip2->element_width, target);
+    if (result != 0) {
+        UFO_REPORT("UFO failed to read elements %li-%li from %s.\n", start, end, bzip2->cache->blocks->path);
+    }
+    return result;
 }
 
 void BZip2_free(void* data) {
     BZip2 *bzip2 = (BZip2 *) data;
-    Blocks_free(bzip2->blocks);
+    UFO_LOG("BZip2 block cache: %li hits, %li misses, %li blocks decompressed ahead\n",
+            bzip2->cache->hits, bzip2->cache->misses, bzip2->cache->prefetched);
+    if (bzip2->lines != NULL) {
+        Lines_free(bzip2->lines);
+    }
+    BlockCache_free(bzip2->cache);
     free(bzip2);
     // Everything else is handled by UFO-R.
 }
 
 /*ufo_vector_type_t result_type, */
-SEXP ufo_bzip2(ufo_vector_type_t type, SEXP/*STRSXPXP*/ filename, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count) {
+SEXP ufo_bzip2(ufo_vector_type_t type, SEXP/*STRSXPXP*/ filename, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count, SEXP/*REALSXP*/ cache_size, SEXP/*INTSXP*/ prefetch) {
 
     // Read the arguements into practical types (with checks).
     bool read_only_value = __extract_boolean_or_die(read_only);
     int min_load_count_value = __extract_int_or_die(min_load_count);
     const char *path = __extract_path_or_die(filename);    
+    R_xlen_t cache_bytes = __extract_R_xlen_t_or_die(cache_size);
+    int prefetch_value = __extract_int_or_die(prefetch);
+    if (cache_bytes < 0 || prefetch_value < 0) {
+        Rf_error("cache_size and prefetch cannot be negative.\n");
+    }
 
     size_t element_size = __get_element_size(type);
-    BZip2 *bzip2 = BZip2_new(element_size, path);
+    BZip2 *bzip2 = BZip2_new(element_size, path, cache_bytes, prefetch_value);
    
     // Create a source struct for UFOs.
     ufo_source_t* source = (ufo_source_t*) malloc(sizeof(ufo_source_t));
@@ -81,7 +120,7 @@ SEXP ufo_bzip2(ufo_vector_type_t type, SEXP/*STRSXPXP*/ filename, SEXP/*LGLSXP*/
     // Element size and count metadata
     source->vector_type = type;
     source->element_size = __get_element_size(type);
-    source->vector_size = bzip2->blocks->decompressed_size;
+    source->vector_size = bzip2->cache->blocks->decompressed_size / element_size;
 
     // Behavior specification
     source->data = (void*) bzip2;
@@ -101,35 +140,118 @@ SEXP ufo_bzip2(ufo_vector_type_t type, SEXP/*STRSXPXP*/ filename, SEXP/*LGLSXP*/
     return ufo_new(source);
 }
 
-SEXP ufo_intsxp_bzip2 (SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count) {
-    return ufo_bzip2(UFO_INT, path, read_only, min_load_count);
+SEXP ufo_intsxp_bzip2 (SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count, SEXP/*REALSXP*/ cache_size, SEXP/*INTSXP*/ prefetch) {
+    return ufo_bzip2(UFO_INT, path, read_only, min_load_count, cache_size, prefetch);
 }
-SEXP ufo_realsxp_bzip2(SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count) {
-    return ufo_bzip2(UFO_REAL, path, read_only, min_load_count);
+SEXP ufo_realsxp_bzip2(SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count, SEXP/*REALSXP*/ cache_size, SEXP/*INTSXP*/ prefetch) {
+    return ufo_bzip2(UFO_REAL, path, read_only, min_load_count, cache_size, prefetch);
 }
-SEXP ufo_rawsxp_bzip2 (SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count) {
-    return ufo_bzip2(UFO_RAW, path, read_only, min_load_count);
+SEXP ufo_rawsxp_bzip2 (SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count, SEXP/*REALSXP*/ cache_size, SEXP/*INTSXP*/ prefetch) {
+    return ufo_bzip2(UFO_RAW, path, read_only, min_load_count, cache_size, prefetch);
 }
-SEXP ufo_cplxsxp_bzip2(SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count) {
-    return ufo_bzip2(UFO_CPLX, path, read_only, min_load_count);
+SEXP ufo_cplxsxp_bzip2(SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count, SEXP/*REALSXP*/ cache_size, SEXP/*INTSXP*/ prefetch) {
+    return ufo_bzip2(UFO_CPLX, path, read_only, min_load_count, cache_size, prefetch);
 }
-SEXP ufo_lglsxp_bzip2 (SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count) {
-    return ufo_bzip2(UFO_LGL, path, read_only, min_load_count);
+SEXP ufo_lglsxp_bzip2 (SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count, SEXP/*REALSXP*/ cache_size, SEXP/*INTSXP*/ prefetch) {
+    return ufo_bzip2(UFO_LGL, path, read_only, min_load_count, cache_size, prefetch);
 }
-SEXP ufo_vecsxp_bzip2 (SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count) {
-    return ufo_bzip2(UFO_VEC, path, read_only, min_load_count);
+SEXP ufo_vecsxp_bzip2 (SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count, SEXP/*REALSXP*/ cache_size, SEXP/*INTSXP*/ prefetch) {
+    return ufo_bzip2(UFO_VEC, path, read_only, min_load_count, cache_size, prefetch);
 }
-SEXP ufo_charsxp_bzip2 (SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count) {
-    return ufo_bzip2(UFO_CHAR, path, read_only, min_load_count);
+SEXP ufo_charsxp_bzip2 (SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count, SEXP/*REALSXP*/ cache_size, SEXP/*INTSXP*/ prefetch) {
+    return ufo_bzip2(UFO_CHAR, path, read_only, min_load_count, cache_size, prefetch);
 }
 
 // TODO probably doable
-SEXP ufo_strsxp_bzip2 (SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count) {
+SEXP ufo_strsxp_bzip2 (SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count, SEXP/*REALSXP*/ cache_size, SEXP/*INTSXP*/ prefetch) {
     SEXP string_vector;
     SEXP character_vector;
     PROTECT(string_vector = allocVector(STRSXP, 1));
-    PROTECT(character_vector = ufo_charsxp_bzip2(path, read_only, min_load_count));
+    PROTECT(character_vector = ufo_charsxp_bzip2(path, read_only, min_load_count, cache_size, prefetch));
     SET_STRING_ELT(string_vector, 0, character_vector);
     UNPROTECT(2);
     return string_vector;
-}
\ No newline at end of file
+}
+
+// Decompresses the text from the closest sampled line before start and cuts
+// it into lines. A trailing \r is dropped, as readLines does.
+int32_t BZip2_populate_lines(void* user_data, uintptr_t start, uintptr_t end, unsigned char* target) {
+    BZip2 *bzip2 = (BZip2 *) user_data;
+    Lines *lines = bzip2->lines;
+
+    uint64_t text_start, text_end;
+    Lines_range(lines, start, end, &text_start, &text_end);
+    char *text = (char *) malloc(text_end - text_start);
+    if (text == NULL) {
+        UFO_REPORT("UFO cannot allocate %li bytes to read lines %li-%li from %s.\n",
+                   text_end - text_start, start, end, lines->path);
+        return -1;
+    }
+    if (BlockCache_read(bzip2->cache, text_start, text_end, (unsigned char *) text) != 0) {
+        UFO_REPORT("UFO failed to read lines %li-%li from %s.\n", start, end, lines->path);
+        free(text);
+        return -1;
+    }
+
+    const char *cursor = text;
+    const char *text_limit = text + (text_end - text_start);
+    for (size_t line = start - start % lines->sample; line < end; line++) {
+        const char *newline = (const char *) memchr(cursor, '\n', text_limit - cursor);
+        const char *line_end = newline != NULL ? newline : text_limit;
+        if (line >= start) {
+            size_t length = line_end - cursor;
+            if (length > 0 && cursor[length - 1] == '\r') {
+                length--;
+            }
+            // R strings end at the first NUL, as with readLines.
+            length = strnlen(cursor, length);
+            ((SEXP/*CHARSXP*/ *) target)[line - start] = mkCharLenCE(cursor, length, CE_NATIVE);
+        }
+        cursor = newline != NULL ? newline + 1 : text_limit;
+    }
+
+    free(text);
+    return 0;
+}
+
+SEXP ufo_strsxp_bzip2_lines(SEXP/*STRSXP*/ filename, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count, SEXP/*REALSXP*/ cache_size, SEXP/*INTSXP*/ prefetch, SEXP/*INTSXP*/ sample) {
+    bool read_only_value = __extract_boolean_or_die(read_only);
+    int min_load_count_value = __extract_int_or_die(min_load_count);
+    const char *path = __extract_path_or_die(filename);
+    R_xlen_t cache_bytes = __extract_R_xlen_t_or_die(cache_size);
+    int prefetch_value = __extract_int_or_die(prefetch);
+    int sample_value = __extract_int_or_die(sample);
+    if (cache_bytes < 0 || prefetch_value < 0) {
+        Rf_error("cache_size and prefetch cannot be negative.\n");
+    }
+    if (sample_value <= 0) {
+        Rf_error("sample must be positive.\n");
+    }
+
+    BZip2 *bzip2 = BZip2_new(1, path, cache_bytes, prefetch_value);
+    bzip2->lines = Lines_new(bzip2->cache, sample_value);
+    if (bzip2->lines == NULL) {
+        BZip2_free(bzip2);
+        Rf_error("UFO could not find the lines of %s.\n", path);
+    }
+
+    ufo_source_t* source = (ufo_source_t*) malloc(sizeof(ufo_source_t));
+
+    source->vector_type = UFO_STR;
+    source->element_size = __get_element_size(UFO_STR);
+    source->vector_size = bzip2->lines->lines;
+
+    source->data = (void*) bzip2;
+    source->destructor_function = BZip2_free;
+    source->population_function = BZip2_populate_lines;
+    source->writeback_function = NULL;
+
+    source->read_only = read_only_value;
+    source->min_load_count = __select_min_load_count(min_load_count_value, source->element_size);
+
+    source->dimensions = NULL;
+    source->dimensions_length = 0;
+
+    ufo_new_t ufo_new = (ufo_new_t) R_GetCCallable("ufos", "ufo_new");
+    return ufo_new(source);
+}
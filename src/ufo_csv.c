@@ -2,6 +2,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <stdbool.h>
 #include <stdint.h>
@@ -15,6 +16,8 @@
 #include "debug.h"
 
 #include "csv/reader.h"
+#include "csv/row_cache.h"
+#include "csv/index.h"
 #include "evil/bad_strings.h"
 
 typedef struct {
@@ -23,9 +26,75 @@ typedef struct {
     scan_results_t     *metadata;
     uint32_t           *references_to_metadata;
     tokenizer_t        *tokenizer;
+    csv_mapping_t      *mapping;        // shared by all columns, may be NULL
+    row_cache_t        *cache;          // shared by all columns, may be NULL
     size_t              initial_buffer_size;
 } ufo_csv_column_source_t;
 
+static inline SEXP/*CHARSXP*/ string_to_charsxp(token_type_t type, const char *string) {
+    if (string == NULL) {
+        return NA_STRING;
+    }
+    if (type == TOKEN_FREE_STRING) {
+        return mkBadChar(string);
+    }
+    // Strings that are still around are found in R's cache of CHARSXPs
+    // rather than allocated again when a chunk is populated again.
+    return mkChar(string);
+}
+
+// Copies rows first_row to last_row, inclusive, of a column out of the
+// parsed blocks of the file, parsing those that are not cached.
+static int32_t load_column_from_cache(ufo_csv_column_source_t *data, size_t first_row, size_t last_row, unsigned char *target) {
+    row_cache_t *cache = data->cache;
+    token_type_t type = data->metadata->column_types[data->column];
+    size_t cell_size = token_type_size(type);
+
+    for (size_t block = first_row / cache->block_rows; block <= last_row / cache->block_rows; block++) {
+        row_block_t *entry = row_cache_pin(cache, block);
+        if (entry == NULL) {
+            return -1;
+        }
+
+        size_t block_first_row = block * cache->block_rows;
+        size_t from = first_row > block_first_row ? first_row : block_first_row;
+        size_t to = last_row < block_first_row + entry->rows - 1 ? last_row : block_first_row + entry->rows - 1;
+        void *cells = entry->cells[data->column];
+
+        switch (type) {
+            case TOKEN_INTEGER:
+            case TOKEN_FACTOR:
+            case TOKEN_DOUBLE:
+            case TOKEN_BOOLEAN:
+                memcpy(target + (from - first_row) * cell_size,
+                       (char *) cells + (from - block_first_row) * cell_size,
+                       (to - from + 1) * cell_size);
+                break;
+
+            case TOKEN_STRING:
+            case TOKEN_INTERNED_STRING:
+            case TOKEN_FREE_STRING: {
+                SEXP/*CHARSXP*/ *strings = (SEXP *) target;
+                char **values = (char **) cells;
+                for (size_t row = from; row <= to; row++) {
+                    strings[row - first_row] = string_to_charsxp(type, values[row - block_first_row]);
+                }
+                break;
+            }
+
+            default: {
+                Rboolean *bools = (Rboolean *) target;
+                for (size_t row = from; row <= to; row++) {
+                    bools[row - first_row] = NA_LOGICAL;
+                }
+            }
+        }
+
+        row_cache_unpin(cache, entry);
+    }
+    return 0;
+}
+
 
 int32_t load_column_from_csv(void* user_data, uintptr_t start, uintptr_t end, unsigned char* target) {
 
@@ -46,23 +115,44 @@ int32_t load_column_from_csv(void* user_data, uintptr_t start, uintptr_t end, un
     }
 
     size_t first_row = start;
-    size_t last_row = end;
+    size_t last_row = end - 1;
 
-    read_results_t tokens = ufo_csv_read_column(data->tokenizer, data->path, data->column, data->metadata, first_row, last_row, data->initial_buffer_size);
+    if (data->cache != NULL && row_cache_fits(data->cache, first_row, last_row)) {
+        if (0 != load_column_from_cache(data, first_row, last_row, target)) {
+            UFO_REPORT("UFO failed to read rows %li-%li of column %li from %s.\n", start, end, data->column, data->path);
+            return -1;
+        }
+        return 0;
+    }
 
     switch (data->metadata->column_types[data->column]) {
-        case TOKEN_INTEGER: {
-            int *ints = (int *) target;
-            for (size_t i = 0; i < tokens.size; i++) {
-                ints[i] = token_to_integer(tokens.tokens[i]);
+        case TOKEN_INTEGER:
+        case TOKEN_DOUBLE:
+        case TOKEN_BOOLEAN:
+        case TOKEN_FACTOR: {
+            long rows = ufo_csv_read_typed_column(data->tokenizer, data->path, data->mapping, data->column, data->metadata, first_row, last_row, target, data->initial_buffer_size);
+            if (rows < 0) {
+                UFO_REPORT("UFO failed to read rows %li-%li of column %li from %s.\n", start, end, data->column, data->path);
+                return -1;
             }
-            break;
+            return 0;
         }
+        default: ;
+    }
+
+    read_results_t tokens = ufo_csv_read_column(data->tokenizer, data->path, data->mapping, data->column, data->metadata, first_row, last_row, data->initial_buffer_size);
+    if (tokens.tokens == NULL) {
+        UFO_REPORT("UFO failed to read rows %li-%li of column %li from %s.\n", start, end, data->column, data->path);
+        return -1;
+    }
 
+    switch (data->metadata->column_types[data->column]) {
         case TOKEN_INTERNED_STRING: {
             SEXP/*CHARSXP*/ *strings = (SEXP *) target;
             for (size_t i = 0; i < tokens.size; i++) {
-                strings[i] = mkChar(tokens.tokens[i]->string);
+                const char *string = tokens.tokens[i]->string;
+                bool na = tokenizer_is_na(data->tokenizer, string, strlen(string));
+                strings[i] = string_to_charsxp(TOKEN_INTERNED_STRING, na ? NULL : string);
             }
             break;
         }
@@ -91,22 +181,6 @@ int32_t load_column_from_csv(void* user_data, uintptr_t start, uintptr_t end, un
             break;
         }
 
-        case TOKEN_BOOLEAN: {
-            Rboolean *bools = (Rboolean *) target;
-            for (size_t i = 0; i < tokens.size; i++) {
-                bools[i] = token_to_logical(tokens.tokens[i]);
-            }
-            break;
-        }
-
-        case TOKEN_DOUBLE: {
-            double *doubles = (double *) target;
-            for (size_t i = 0; i < tokens.size; i++) {
-                doubles[i] = token_to_numeric(tokens.tokens[i]);
-            }
-            break;
-        }
-
         case TOKEN_EMPTY:
         case TOKEN_NA: {
             Rboolean *bools = (Rboolean *) target;
@@ -119,6 +193,7 @@ int32_t load_column_from_csv(void* user_data, uintptr_t start, uintptr_t end, un
         default: perror("Not implemented");
     }
 
+    read_results_free(&tokens);
     return 0;
 }
 
@@ -135,6 +210,15 @@ void destroy_column(void* user_data) {
     }
 
     if (*(data->references_to_metadata) == 1) {
+        if (data->cache != NULL) {
+            if (__get_debug_mode()) {
+                REprintf("      row cache: %li hits, %li misses\n", data->cache->hits, data->cache->misses);
+            }
+            row_cache_free(data->cache);
+        }
+        if (data->mapping != NULL) {
+            csv_mapping_close(data->mapping);
+        }
         scan_results_free(data->metadata);
         tokenizer_free(data->tokenizer);
         free(data->references_to_metadata);
@@ -150,7 +234,8 @@ SEXPTYPE token_type_to_sexp_type(token_type_t type) {
         case TOKEN_NA:
         case TOKEN_EMPTY:
         case TOKEN_BOOLEAN:         return LGLSXP;
-        case TOKEN_INTEGER:         return INTSXP;
+        case TOKEN_INTEGER:
+        case TOKEN_FACTOR:          return INTSXP;
         case TOKEN_DOUBLE:          return REALSXP;
         case TOKEN_FREE_STRING:
         case TOKEN_INTERNED_STRING:
@@ -164,7 +249,8 @@ ufo_vector_type_t token_type_to_ufo_type(token_type_t type) {
         case TOKEN_NA:
         case TOKEN_EMPTY:
         case TOKEN_BOOLEAN:         return UFO_LGL;
-        case TOKEN_INTEGER:         return UFO_INT;
+        case TOKEN_INTEGER:
+        case TOKEN_FACTOR:          return UFO_INT;
         case TOKEN_DOUBLE:          return UFO_REAL;
         case TOKEN_FREE_STRING:
         case TOKEN_INTERNED_STRING:
@@ -173,18 +259,118 @@ ufo_vector_type_t token_type_to_ufo_type(token_type_t type) {
     }
 }
 
-SEXP ufo_csv(SEXP/*STRSXP*/ path_sexp, SEXP/*LGLSXP*/ read_only_sexp, SEXP/*INTSXP*/ min_load_count_sexp, SEXP/*LGLSXP*/ headers_sexp, SEXP/*INTSXP*/ record_row_offsets_at_interval_sexp, SEXP/*INTSXP*/ initial_buffer_size_sexp, SEXP/*LGLSXP*/ add_class_to_columns_sexp) {
+// A single character, or '\0' if the string is empty.
+static char extract_optional_char_or_die(SEXP/*STRSXP*/ sexp) {
+    if (TYPEOF(sexp) == STRSXP && LENGTH(sexp) == 1 && LENGTH(STRING_ELT(sexp, 0)) == 0) {
+        return '\0';
+    }
+    return __extract_char_or_die(sexp);
+}
+
+static string_set_t *extract_string_set_or_die(SEXP/*STRSXP*/ sexp) {
+    if (TYPEOF(sexp) != STRSXP) {
+        Rf_error("Invalid type for string vector: %s\n", type2char(TYPEOF(sexp)));
+    }
+
+    string_set_t *set = string_set_new(LENGTH(sexp));
+    if (set == NULL) {
+        Rf_error("Cannot allocate a string set\n");
+    }
+    for (R_xlen_t i = 0; i < XLENGTH(sexp); i++) {
+        if (STRING_ELT(sexp, i) != NA_STRING && !string_set_add(set, (char *) CHAR(STRING_ELT(sexp, i)))) {
+            string_set_free(set);
+            Rf_error("Cannot allocate a string set\n");
+        }
+    }
+    return set;
+}
+
+SEXP ufo_csv(SEXP/*STRSXP*/ path_sexp, SEXP/*LGLSXP*/ read_only_sexp, SEXP/*INTSXP*/ min_load_count_sexp, SEXP/*LGLSXP*/ headers_sexp, SEXP/*INTSXP*/ record_row_offsets_at_interval_sexp, SEXP/*INTSXP*/ initial_buffer_size_sexp, SEXP/*LGLSXP*/ add_class_to_columns_sexp, SEXP/*INTSXP*/ max_factor_levels_sexp, SEXP/*REALSXP*/ cache_size_sexp,
+             SEXP/*STRSXP*/ delimiter_sexp, SEXP/*STRSXP*/ quote_sexp, SEXP/*STRSXP*/ escape_sexp, SEXP/*STRSXP*/ na_sexp, SEXP/*STRSXP*/ comment_sexp, SEXP/*INTSXP*/ skip_sexp, SEXP/*REALSXP*/ n_max_sexp) {
 
     bool headers = __extract_boolean_or_die(headers_sexp);
     bool read_only = __extract_boolean_or_die(read_only_sexp);
     bool add_class_to_columns = __extract_boolean_or_die(add_class_to_columns_sexp);
-    const char *path = __extract_path_or_die(path_sexp);
+    int32_t min_load_count = __extract_int_or_die(min_load_count_sexp);
     long record_row_offsets_at_interval = __extract_int_or_die(record_row_offsets_at_interval_sexp);
     size_t initial_buffer_size = __extract_int_or_die(initial_buffer_size_sexp);
+    int max_factor_levels = __extract_int_or_die(max_factor_levels_sexp);
+    R_xlen_t cache_bytes = __extract_R_xlen_t_or_die(cache_size_sexp);
+    if (max_factor_levels < 0 || cache_bytes < 0) {
+        Rf_error("max_factor_levels and cache_size cannot be negative.\n");
+    }
+
+    char delimiter = __extract_char_or_die(delimiter_sexp);
+    char quote = extract_optional_char_or_die(quote_sexp);
+    char escape = extract_optional_char_or_die(escape_sexp);
+    char comment = extract_optional_char_or_die(comment_sexp);
+    int skip = __extract_int_or_die(skip_sexp);
+    double n_max = Rf_asReal(n_max_sexp);                             // Inf for all rows
+    if (skip < 0 || ISNAN(n_max) || n_max < 0) {
+        Rf_error("skip and n_max cannot be negative.\n");
+    }
+    if (delimiter == '\n' || (quote != '\0' && quote == delimiter) || (comment != '\0' && (comment == delimiter || comment == quote))) {
+        Rf_error("The delimiter, quote and comment characters must differ, and the delimiter cannot be a newline.\n");
+    }
+    const char *path = __extract_path_or_die(path_sexp);
+    string_set_t *na_strings = extract_string_set_or_die(na_sexp);
 
     tokenizer_t *tokenizer = new_csv_tokenizer();
-    scan_results_t *csv_metadata = ufo_csv_perform_initial_scan(tokenizer, path, record_row_offsets_at_interval, headers, initial_buffer_size);
+    tokenizer->column_delimiter = delimiter;
+    tokenizer->quote = quote;
+    tokenizer->use_double_quote_escape = quote != '\0';
+    tokenizer->escape = escape;
+    tokenizer->use_escape_character = escape != '\0';
+    tokenizer->comment = comment;
+    tokenizer->na_strings = na_strings;
+
+    // Columns read the file from memory if it can be mapped.
+    csv_mapping_t *mapping = csv_mapping_open(path);
+
+    // The file is only scanned if it changed since it was last indexed.
+    scan_results_t *csv_metadata = csv_index_load(tokenizer, path, record_row_offsets_at_interval, headers, skip, max_factor_levels);
+    if (csv_metadata != NULL) {
+        if (__get_debug_mode()) {
+            REprintf("Reusing the index of %s\n", path);
+        }
+    } else {
+        csv_metadata = ufo_csv_perform_initial_scan(tokenizer, path, record_row_offsets_at_interval, headers, skip, initial_buffer_size, ufo_csv_scan_thread_count());
+        if (csv_metadata == NULL) {
+            if (mapping != NULL) {
+                csv_mapping_close(mapping);
+            }
+            tokenizer_free(tokenizer);
+            Rf_error("UFO could not scan %s.\n", path);
+        }
+
+        // String columns with few distinct values become factors, the rest
+        // character vectors.
+        if (max_factor_levels > 0 && 0 != ufo_csv_read_column_levels(tokenizer, path, mapping, csv_metadata, max_factor_levels, initial_buffer_size)) {
+            if (mapping != NULL) {
+                csv_mapping_close(mapping);
+            }
+            scan_results_free(csv_metadata);
+            tokenizer_free(tokenizer);
+            Rf_error("UFO could not read the values of string columns in %s.\n", path);
+        }
+
+        csv_index_store(tokenizer, path, record_row_offsets_at_interval, headers, skip, max_factor_levels, csv_metadata);
+    }
+
+    // Rows past n_max are left out of the columns, though the index and the
+    // column types cover all of them.
+    if (n_max < csv_metadata->rows) {
+        csv_metadata->rows = (size_t) n_max;
+    }
     uint32_t *references_to_metadata = (uint32_t *) malloc(sizeof(uint32_t));
+    if (references_to_metadata == NULL) {
+        if (mapping != NULL) {
+            csv_mapping_close(mapping);
+        }
+        scan_results_free(csv_metadata);
+        tokenizer_free(tokenizer);
+        Rf_error("UFO could not allocate the metadata of %s.\n", path);
+    }
     *references_to_metadata = csv_metadata->columns;
 
     if (__get_debug_mode()) {
@@ -217,48 +403,58 @@ SEXP ufo_csv(SEXP/*STRSXP*/ path_sexp, SEXP/*LGLSXP*/ read_only_sexp, SEXP/*INTS
         REprintf("\n");
     }
 
-    // Pre-intern strings
+    SEXP/*VECSXP*/ column_levels = PROTECT(allocVector(VECSXP, csv_metadata->columns));
     for (size_t column = 0; column < csv_metadata->columns; column++) {
-        if (csv_metadata->column_types[column] == TOKEN_STRING) {
-            size_t limit = 5; //FIXME as parameter also FIXME make work
-            string_set_t *unique_values = ufo_csv_read_column_unique_values(tokenizer, path, column, csv_metadata, limit, initial_buffer_size);
-            //REprintf("    ... [%li]: %li vs %li\n\n", column, unique_values->size, limit);
-            if (unique_values->size == limit) {
-                if (__get_debug_mode()) {
-                    REprintf("    cannot pre-intern strings for column [%li]: %li (or more) unique values\n\n",
-                             column, unique_values->size);
-                }
-
-                csv_metadata->column_types[column] = TOKEN_FREE_STRING;
-                continue;
-            }
-
-            csv_metadata->column_types[column] = TOKEN_INTERNED_STRING;
+        if (csv_metadata->column_types[column] != TOKEN_STRING) {
+            continue;
+        }
 
+        string_set_t *unique_values = csv_metadata->column_levels[column];
+        if (unique_values == NULL) {
             if (__get_debug_mode()) {
-                REprintf("    pre-interning %li strings for column [%li]:\n\n", unique_values->size, column);
+                REprintf("    column [%li] has more than %i unique values, reading as strings\n\n", column, max_factor_levels);
             }
+            csv_metadata->column_types[column] = TOKEN_INTERNED_STRING;
+            continue;
+        }
 
-            for (size_t i = 0; i < unique_values->size; i++) {
-                SEXP pointer = mkChar(unique_values->strings[i]); // FIXME PROTECT?
-
-//#ifdef SWITCH_TO_REFCNT
-//                SET_REFCNT(pointer, 1);
-//#else
-//                SET_NAMED(pointer, 1);
-//#endif
+        // Levels are sorted the way factor() sorts them, and the codes of
+        // the cells are their positions in the sorted set.
+        SEXP/*STRSXP*/ levels = allocVector(STRSXP, unique_values->size);
+        SET_VECTOR_ELT(column_levels, column, levels);
+        for (size_t i = 0; i < unique_values->size; i++) {
+            SET_STRING_ELT(levels, i, mkChar(unique_values->strings[i]));
+        }
+        sortVector(levels, FALSE);
 
-                if (__get_debug_mode()) {
-                    REprintf("        %-20s %p\n", unique_values->strings[i], pointer);
-                }
+        string_set_t *sorted_values = string_set_new(unique_values->size);
+        for (size_t i = 0; sorted_values != NULL && i < unique_values->size; i++) {
+            if (!string_set_add(sorted_values, (char *) CHAR(STRING_ELT(levels, i)))) {
+                string_set_free(sorted_values);
+                sorted_values = NULL;
             }
-
-            if (__get_debug_mode()) {
-                REprintf("\n");
+        }
+        string_set_free(unique_values);
+        csv_metadata->column_levels[column] = sorted_values;
+        if (sorted_values == NULL) {
+            if (mapping != NULL) {
+                csv_mapping_close(mapping);
             }
+            scan_results_free(csv_metadata);
+            tokenizer_free(tokenizer);
+            free(references_to_metadata);
+            Rf_error("UFO could not allocate the levels of column %li.\n", column);
+        }
+
+        csv_metadata->column_types[column] = TOKEN_FACTOR;
+
+        if (__get_debug_mode()) {
+            REprintf("    column [%li] is a factor with %li levels\n\n", column, sorted_values->size);
         }
     }
 
+    row_cache_t *cache = row_cache_new(tokenizer, path, mapping, csv_metadata, cache_bytes, initial_buffer_size);
+
     SEXP/*VECSXP*/ data_frame = PROTECT(allocVector(VECSXP, csv_metadata->columns));
     if (__get_debug_mode()) {
         REprintf("Creating UFOs to insert into data frame SEXP at %p\n\n", data_frame);
@@ -274,27 +470,36 @@ SEXP ufo_csv(SEXP/*STRSXP*/ path_sexp, SEXP/*LGLSXP*/ read_only_sexp, SEXP/*INTS
         source->destructor_function = destroy_column;
         source->data = (void*) data;
         source->vector_type = token_type_to_ufo_type(csv_metadata->column_types[column]);
-        source->element_size = token_type_size(source->vector_type);
+        source->element_size = __get_element_size(source->vector_type);
         source->vector_size = csv_metadata->rows;
         source->dimensions = 0;
         source->dimensions_length = 0;
         source->read_only = read_only;
-
-        int32_t min_load_count = __extract_int_or_die(min_load_count_sexp);
-        source->min_load_count = (min_load_count == 0) ? min_load_count : __1MB_of_elements(source->element_size);
+        source->min_load_count = __select_min_load_count(min_load_count, source->element_size);
 
         data->path = path;
         data->column = column;
         data->metadata = csv_metadata;
         data->references_to_metadata = references_to_metadata;
         data->tokenizer = tokenizer;
+        data->mapping = mapping;
+        data->cache = cache;
         data->initial_buffer_size = initial_buffer_size;
 
         ufo_new_t ufo_new = (ufo_new_t) R_GetCCallable("ufos", "ufo_new");
         SEXP/*UFO*/ vector = PROTECT(ufo_new(source));
         SET_VECTOR_ELT(data_frame, column, vector);
 
-        if(add_class_to_columns) {
+        if (csv_metadata->column_types[column] == TOKEN_FACTOR) {
+            setAttrib(vector, R_LevelsSymbol, VECTOR_ELT(column_levels, column));
+            SEXP/*STRSXP*/ class = PROTECT(allocVector(STRSXP, add_class_to_columns ? 2 : 1));
+            if (add_class_to_columns) {
+                SET_STRING_ELT(class, 0, mkChar("ufo"));
+            }
+            SET_STRING_ELT(class, add_class_to_columns ? 1 : 0, mkChar("factor"));
+            setAttrib(vector, R_ClassSymbol, class);
+            UNPROTECT(1);
+        } else if(add_class_to_columns) {
             setAttrib(vector, R_ClassSymbol, mkString("ufo"));
         }
 
@@ -326,6 +531,6 @@ SEXP ufo_csv(SEXP/*STRSXP*/ path_sexp, SEXP/*LGLSXP*/ read_only_sexp, SEXP/*INTS
         REprintf("          row.names %p\n", row_names);
     }
 
-    UNPROTECT(1 + csv_metadata->columns + 2);
+    UNPROTECT(1 + 1 + csv_metadata->columns + 2);
     return data_frame;
 }
@@ -8,4 +8,13 @@ SEXP ufo_csv(SEXP/*STRSXP*/ path,
              SEXP/*LGLSXP*/ headers,
              SEXP/*INTSXP*/ record_row_offsets_at_interval,
              SEXP/*INTSXP*/ initial_buffer_size,
-             SEXP/*LGLSXP*/ add_ufo_class_to_columns);
\ No newline at end of file
+             SEXP/*LGLSXP*/ add_ufo_class_to_columns,
+             SEXP/*INTSXP*/ max_factor_levels,
+             SEXP/*REALSXP*/ cache_size,
+             SEXP/*STRSXP*/ delimiter,
+             SEXP/*STRSXP*/ quote,
+             SEXP/*STRSXP*/ escape,
+             SEXP/*STRSXP*/ na,
+             SEXP/*STRSXP*/ comment,
+             SEXP/*INTSXP*/ skip,
+             SEXP/*REALSXP*/ n_max);
\ No newline at end of file
@@ -0,0 +1,109 @@
+#include "ufo_gz.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define USE_RINTERNALS
+#include <R.h>
+#include <Rinternals.h>
+
+#include "../include/ufos.h"
+#include "helpers.h"
+#include "debug.h"
+
+#include "gzip/index.h"
+
+typedef struct {
+    GzipIndex *index;
+    size_t element_width;
+} Gzip;
+
+int32_t Gzip_populate(void* user_data, uintptr_t start, uintptr_t end, unsigned char* target) {
+    Gzip *source = (Gzip *) user_data;
+    int32_t result = GzipIndex_read(source->index, start * source->element_width, end * source->element_width, target);
+    if (result != 0) {
+        UFO_REPORT("UFO failed to read elements %li-%li from %s.\n", start, end, source->index->path);
+    }
+    return result;
+}
+
+void Gzip_free(void* data) {
+    Gzip *source = (Gzip *) data;
+    GzipIndex_free(source->index);
+    free(source);
+}
+
+SEXP ufo_gz(ufo_vector_type_t type, SEXP/*STRSXP*/ filename, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count, SEXP/*REALSXP*/ span) {
+
+    bool read_only_value = __extract_boolean_or_die(read_only);
+    int min_load_count_value = __extract_int_or_die(min_load_count);
+    const char *path = __extract_path_or_die(filename);
+    size_t element_size = __get_element_size(type);
+
+    R_xlen_t span_value = __extract_R_xlen_t_or_die(span);
+    if (span_value <= 0) {
+        Rf_error("span must be positive.\n");
+    }
+
+    const char *reason;
+    GzipIndex *index = GzipIndex_new(path, span_value, &reason);
+    if (index == NULL) {
+        Rf_error("UFO could not read %s: %s.\n", path, reason);
+    }
+    if (index->decompressed_size % element_size != 0) {
+        size_t decompressed_size = index->decompressed_size;
+        GzipIndex_free(index);
+        Rf_error("UFO decompressed size of %s (%li bytes) is not a multiple of the element size (%li bytes).\n",
+                 path, decompressed_size, element_size);
+    }
+
+    Gzip *data = (Gzip *) malloc(sizeof(Gzip));
+    ufo_source_t* source = (ufo_source_t*) malloc(sizeof(ufo_source_t));
+    if (data == NULL || source == NULL) {
+        free(data);
+        free(source);
+        GzipIndex_free(index);
+        Rf_error("UFO could not allocate the gzip source.\n");
+    }
+    data->index = index;
+    data->element_width = element_size;
+
+    // Element size and count metadata
+    source->vector_type = type;
+    source->element_size = element_size;
+    source->vector_size = index->decompressed_size / element_size;
+
+    // Behavior specification
+    source->data = (void*) data;
+    source->destructor_function = Gzip_free;
+    source->population_function = Gzip_populate;
+    source->writeback_function = NULL;
+
+    // Chunk-related parameters
+    source->read_only = read_only_value;
+    source->min_load_count = __select_min_load_count(min_load_count_value, source->element_size);
+
+    // Unused.
+    source->dimensions = NULL;
+    source->dimensions_length = 0;
+
+    ufo_new_t ufo_new = (ufo_new_t) R_GetCCallable("ufos", "ufo_new");
+    return ufo_new(source);
+}
+
+SEXP ufo_intsxp_gz (SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count, SEXP/*REALSXP*/ span) {
+    return ufo_gz(UFO_INT, path, read_only, min_load_count, span);
+}
+SEXP ufo_realsxp_gz(SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count, SEXP/*REALSXP*/ span) {
+    return ufo_gz(UFO_REAL, path, read_only, min_load_count, span);
+}
+SEXP ufo_rawsxp_gz (SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count, SEXP/*REALSXP*/ span) {
+    return ufo_gz(UFO_RAW, path, read_only, min_load_count, span);
+}
+SEXP ufo_cplxsxp_gz(SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count, SEXP/*REALSXP*/ span) {
+    return ufo_gz(UFO_CPLX, path, read_only, min_load_count, span);
+}
+SEXP ufo_lglsxp_gz (SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count, SEXP/*REALSXP*/ span) {
+    return ufo_gz(UFO_LGL, path, read_only, min_load_count, span);
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "Rinternals.h"
+
+SEXP ufo_intsxp_gz (SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count, SEXP/*REALSXP*/ span);
+SEXP ufo_realsxp_gz(SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count, SEXP/*REALSXP*/ span);
+SEXP ufo_rawsxp_gz (SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count, SEXP/*REALSXP*/ span);
+SEXP ufo_cplxsxp_gz(SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count, SEXP/*REALSXP*/ span);
+SEXP ufo_lglsxp_gz (SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count, SEXP/*REALSXP*/ span);
@@ -1,16 +1,58 @@
 #pragma once
 
+#include <stdatomic.h>
+
 #include "../include/ufos.h"
+#include "bin/prefetch.h"
+#include "bin/writeback.h"
+#include "bin/tiles.h"
+
+// How the populate function gets data out of a binary file.
+typedef enum {
+    UFO_IO_READ, // read each requested range through the file handle
+    UFO_IO_MMAP, // copy each requested range out of a read-only mapping
+} ufo_io_mode_t;
 
 typedef struct {
     const char*         path;
     ufo_vector_type_t   vector_type;
     size_t              element_size; /* in bytes */
     size_t              vector_size;
-    FILE*               file_handle;
-    size_t              file_cursor;
+    uint32_t            storage;      /* ufo_bin_dtype_t of the elements in the file */
+    size_t              storage_size; /* in bytes, differs from element_size for narrow storage */
+    size_t              file_size;    /* in bytes, cached at construction */
+    size_t              data_offset;  /* in bytes, where the payload starts, 0 without header */
+    uint32_t            header_flags; /* ufo_bin_flags_t, 0 without header */
+    int                 file_descriptor;
+    int                 write_file_descriptor; /* -1 if read only */
+    ufo_io_mode_t       io_mode;
+    unsigned char*      mapping;      /* only with UFO_IO_MMAP */
+    size_t              mapping_size; /* in bytes */
+    size_t              prefetch_depth; /* ranges to read ahead, 0 disables */
+    prefetcher_t*       prefetcher;     /* only with UFO_IO_READ and prefetch_depth > 0 */
+    _Atomic uintptr_t   expected_start; /* next sequential populate, for mmap read-ahead */
+    writeback_queue_t*  writeback_queue; /* NULL if read only */
 } ufo_file_source_data_t;
 
+typedef struct {
+    const char*         path;
+    ufo_vector_type_t   vector_type;
+    size_t              element_size; /* in bytes */
+    size_t              vector_size;
+    uint32_t            storage;      /* ufo_bin_dtype_t of the elements in the file */
+    size_t              storage_size; /* in bytes */
+    uint32_t            header_flags; /* ufo_bin_flags_t */
+    size_t              data_offset;  /* in bytes, where the first tile starts */
+    size_t              rows;
+    size_t              cols;
+    size_t              tile_rows;
+    size_t              tile_cols;
+    size_t              tiles_down;   /* tiles in one column of tiles */
+    int                 file_descriptor;
+    int                 write_file_descriptor; /* -1 if read only */
+    tile_cache_t*       cache;
+} ufo_tiled_source_data_t;
+
 
 
 typedef struct {
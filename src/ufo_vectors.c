@@ -1,7 +1,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <limits.h>
 #include <assert.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <sys/stat.h>
 
 #define USE_RINTERNALS
 #include <R.h>
@@ -14,11 +22,98 @@
 #include "helpers.h"
 #include "debug.h"
 #include "bin/io.h"
+#include "bin/header.h"
+#include "bin/convert.h"
 
 #include "safety_first.h"
 
 int ufo_initialized = 0;
 
+// Live file-backed vectors by their data pointer, so that functions called
+// from R can find the source behind a vector. Tiled matrices have their own
+// kind of source, so an entry holds one or the other.
+typedef struct file_source_entry {
+    const void                  *address;
+    ufo_file_source_data_t      *data;      // NULL for tiled matrices
+    ufo_tiled_source_data_t     *tiles;     // NULL for everything else
+    struct file_source_entry    *next;
+} file_source_entry_t;
+
+static file_source_entry_t *__file_sources = NULL;
+static pthread_mutex_t __file_sources_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void __register_source(const void *address, ufo_file_source_data_t *data, ufo_tiled_source_data_t *tiles) {
+    file_source_entry_t *entry = (file_source_entry_t *) malloc(sizeof(file_source_entry_t));
+    if (entry == NULL) {
+        UFO_WARN("Cannot register file source %s, ufo_drain_writeback will not find it.\n",
+                 data != NULL ? data->path : tiles->path);
+        return;
+    }
+    entry->address = address;
+    entry->data = data;
+    entry->tiles = tiles;
+    pthread_mutex_lock(&__file_sources_lock);
+    entry->next = __file_sources;
+    __file_sources = entry;
+    pthread_mutex_unlock(&__file_sources_lock);
+}
+
+static void __unregister_source(const void *source_data) {
+    pthread_mutex_lock(&__file_sources_lock);
+    for (file_source_entry_t **link = &__file_sources; *link != NULL; link = &(*link)->next) {
+        if ((const void *) (*link)->data == source_data || (const void *) (*link)->tiles == source_data) {
+            file_source_entry_t *entry = *link;
+            *link = entry->next;
+            free(entry);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&__file_sources_lock);
+}
+
+void __register_file_source(const void *address, ufo_file_source_data_t *data) {
+    __register_source(address, data, NULL);
+}
+
+void __unregister_file_source(ufo_file_source_data_t *data) {
+    __unregister_source(data);
+}
+
+void __register_tiled_source(const void *address, ufo_tiled_source_data_t *tiles) {
+    __register_source(address, NULL, tiles);
+}
+
+void __unregister_tiled_source(ufo_tiled_source_data_t *tiles) {
+    __unregister_source(tiles);
+}
+
+// Returns a copy of the entry, with exactly one of data and tiles set.
+file_source_entry_t __find_file_source_or_die(SEXP vector) {
+    const void *address = DATAPTR_RO(vector);
+    file_source_entry_t found = { .address = NULL, .data = NULL, .tiles = NULL, .next = NULL };
+    pthread_mutex_lock(&__file_sources_lock);
+    for (file_source_entry_t *entry = __file_sources; entry != NULL; entry = entry->next) {
+        if (entry->address == address) {
+            found = *entry;
+            found.next = NULL;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&__file_sources_lock);
+    if (found.address == NULL) {
+        Rf_error("Not a file-backed UFO vector.\n");
+    }
+    return found;
+}
+
+SEXP __new_file_vector(ufo_source_t *source) {
+    ufo_file_source_data_t *data = (ufo_file_source_data_t *) source->data;
+    ufo_new_t ufo_new = (ufo_new_t) R_GetCCallable("ufos", source->dimensions != NULL ? "ufo_new_multidim" : "ufo_new");
+    SEXP result = ufo_new(source);
+    __register_file_source(DATAPTR_RO(result), data);
+    return result;
+}
+
 void __destroy(void* user_data) {
     ufo_file_source_data_t *data = (ufo_file_source_data_t*) user_data;
     if (__get_debug_mode()) {
@@ -28,31 +123,174 @@ void __destroy(void* user_data) {
         REprintf("    vector size: %li\n", data->vector_size);
         REprintf("   element size: %li\n", data->element_size);
     }
-    fclose(data->file_handle);
+    __unregister_file_source(data);
+    if (data->writeback_queue != NULL) {
+        int32_t failure = writeback_queue_free(data->writeback_queue);
+        if (failure != 0) {
+            UFO_REPORT("Error writing back to file %s: %s.\n", data->path, __write_error_message(failure));
+        }
+    }
+    if (data->prefetcher != NULL) {
+        prefetcher_free(data->prefetcher);
+    }
+    __unmap_file(data->mapping, data->mapping_size);
+    close(data->file_descriptor);
+    if (data->write_file_descriptor >= 0) {
+        close(data->write_file_descriptor);
+    }
     free((char *) data->path);
     free(data);
 }
 
 void __writeback(void* user_data, UfoWriteListenerEvent event) {
+    ufo_file_source_data_t *cfg = (ufo_file_source_data_t *) user_data;
+
+    if (event.tag == UfoWBDestroy && cfg->writeback_queue != NULL) {
+        writeback_queue_flush(cfg->writeback_queue);
+        return;
+    }
     if (event.tag != Writeback) { return; }
 
     uintptr_t start = event.writeback.start_idx;
     uintptr_t end = event.writeback.end_idx;
     const unsigned char *data = (const unsigned char *) event.writeback.data;
 
-    __write_to_file(user_data, start, end, data);
+    if (cfg->writeback_queue == NULL) {
+        __write_to_file(user_data, start, end, data);
+        return;
+    }
+
+    // The queue keeps its own copy, written out later on the background
+    // thread. Anything read ahead from the old contents is now outdated.
+    writeback_queue_push(cfg->writeback_queue, start, end, data);
+    if (cfg->prefetcher != NULL) {
+        prefetcher_invalidate(cfg->prefetcher, start, end);
+    }
+}
+
+void __destroy_tiles(void* user_data) {
+    ufo_tiled_source_data_t *data = (ufo_tiled_source_data_t*) user_data;
+    if (__get_debug_mode()) {
+        REprintf("__destroy_tiles\n");
+        REprintf("    source file: %s\n", data->path);
+        REprintf("    vector type: %d\n", data->vector_type);
+        REprintf("    vector size: %li\n", data->vector_size);
+        REprintf("   element size: %li\n", data->element_size);
+    }
+    __unregister_tiled_source(data);
+    tile_cache_free(data->cache);
+    close(data->file_descriptor);
+    if (data->write_file_descriptor >= 0) {
+        close(data->write_file_descriptor);
+    }
+    free((char *) data->path);
+    free(data);
 }
 
-ufo_source_t* __make_source_or_die(ufo_vector_type_t type, const char *path, int *dimensions, size_t dimensions_length, bool read_only, int32_t min_load_count) {
+void __writeback_tiles(void* user_data, UfoWriteListenerEvent event) {
+    if (event.tag != Writeback) { return; }
 
-    ufo_file_source_data_t *data = (ufo_file_source_data_t*) malloc(sizeof(ufo_file_source_data_t));
-    if(data == NULL) {
-    	Rf_error("Cannot allocate ufo_file_source_t");
+    uintptr_t start = event.writeback.start_idx;
+    uintptr_t end = event.writeback.end_idx;
+    const unsigned char *data = (const unsigned char *) event.writeback.data;
+
+    __write_to_tiles(user_data, start, end, data);
+}
+
+ufo_io_mode_t __extract_io_mode_or_die(SEXP/*STRSXP*/ io_sexp) {
+    const char *io = __extract_string_or_die(io_sexp);
+    ufo_io_mode_t io_mode;
+    if (0 == strcmp(io, "read")) {
+        io_mode = UFO_IO_READ;
+    } else if (0 == strcmp(io, "mmap")) {
+        io_mode = UFO_IO_MMAP;
+    } else {
+        free((char *) io);
+        Rf_error("Unknown io mode, expecting one of: read, mmap\n");
+    }
+    free((char *) io);
+    return io_mode;
+}
+
+int __extract_advice_or_die(SEXP/*STRSXP*/ advice_sexp) {
+    const char *advice = __extract_string_or_die(advice_sexp);
+    int advice_value;
+    if (0 == strcmp(advice, "normal")) {
+        advice_value = MADV_NORMAL;
+    } else if (0 == strcmp(advice, "sequential")) {
+        advice_value = MADV_SEQUENTIAL;
+    } else if (0 == strcmp(advice, "random")) {
+        advice_value = MADV_RANDOM;
+    } else if (0 == strcmp(advice, "willneed")) {
+        advice_value = MADV_WILLNEED;
+    } else {
+        free((char *) advice);
+        Rf_error("Unknown advice, expecting one of: normal, sequential, random, willneed\n");
+    }
+    free((char *) advice);
+    return advice_value;
+}
+
+int32_t __extract_prefetch_depth_or_die(SEXP/*INTSXP*/ prefetch_sexp) {
+    int32_t prefetch_depth = __extract_int_or_die(prefetch_sexp);
+    if (prefetch_depth < 0) {
+        Rf_error("Prefetch depth must not be negative.\n");
     }
+    return prefetch_depth;
+}
+
+// Returns 0 for "native", meaning the storage follows the vector type or
+// the file's header.
+uint32_t __extract_storage_or_die(SEXP/*STRSXP*/ storage_sexp) {
+    const char *name = __extract_string_or_die(storage_sexp);
+    if (0 == strcmp(name, "native")) {
+        free((char *) name);
+        return 0;
+    }
+    uint32_t storage = ufo_bin_dtype_from_name(name);
+    free((char *) name);
+    if (storage == 0) {
+        Rf_error("Unknown storage type, expecting one of: native, int8, uint8, int16, uint16, "
+                 "int32, uint32, float32, float64, complex128, logical32, raw8\n");
+    }
+    return storage;
+}
+
+// Releases a source that could not be set up, along with the path and the
+// dimensions it was going to own, and raises an error. The message is
+// formatted first, since it may mention the path.
+static void __discard_source_and_die(ufo_source_t *source, ufo_file_source_data_t *data, int *dimensions, const char *path, const char *format, ...) {
+    char message[1024];
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(message, sizeof(message), format, arguments);
+    va_end(arguments);
+
+    if (data != NULL) {
+        if (data->file_descriptor >= 0) {
+            close(data->file_descriptor);
+        }
+        if (data->write_file_descriptor >= 0) {
+            close(data->write_file_descriptor);
+        }
+    }
+    free(data);
+    free(source);
+    free(dimensions);
+    free((char *) path);
+    Rf_error("%s", message);
+}
+
+ufo_source_t* __make_source_or_die(ufo_vector_type_t type, const char *path, int *dimensions, size_t dimensions_length, bool read_only, int32_t min_load_count, ufo_io_mode_t io_mode, int advice, int32_t prefetch_depth, uint32_t storage) {
 
+    ufo_file_source_data_t *data = (ufo_file_source_data_t*) malloc(sizeof(ufo_file_source_data_t));
     ufo_source_t* source = (ufo_source_t*) malloc(sizeof(ufo_source_t));
-    if(source == NULL) {
-    	Rf_error("Cannot allocate ufo_source_t");
+    if (data == NULL || source == NULL) {
+        if (data != NULL) {
+            data->file_descriptor = -1;
+            data->write_file_descriptor = -1;
+        }
+        __discard_source_and_die(source, data, dimensions, path, "Cannot allocate ufo_source_t");
     }
 
     source->population_function = &__load_from_file;
@@ -61,7 +299,94 @@ ufo_source_t* __make_source_or_die(ufo_vector_type_t type, const char *path, int
     source->data = (void*) data;
     source->vector_type = type;
     source->element_size = __get_element_size(type);
-    source->vector_size = __get_vector_length_from_file_or_die(path, source->element_size);
+
+    // Open the file once and keep it open: all reads are positional, so the
+    // same descriptor can serve any number of concurrent populates.
+    data->file_descriptor = open(path, O_RDONLY);
+    data->write_file_descriptor = -1;
+    if (data->file_descriptor < 0) {
+        __discard_source_and_die(source, data, dimensions, path, "Could not open file.\n");
+    }
+    data->write_file_descriptor = read_only ? -1 : open(path, O_RDWR);
+    if (!read_only && data->write_file_descriptor < 0) {
+        UFO_WARN("File %s cannot be opened for writing, changes will not be written back.\n", path);
+    }
+    struct stat file_info;
+    if (fstat(data->file_descriptor, &file_info) < 0) {
+        __discard_source_and_die(source, data, dimensions, path, "Could not stat file.\n");
+    }
+    data->file_size = file_info.st_size;
+
+    ufo_bin_metadata_t metadata;
+    ufo_bin_status_t status = ufo_bin_read_metadata(data->file_descriptor, &metadata);
+    if (status == UFO_BIN_OK) {
+        // Self-describing file: the payload follows the header.
+        uint32_t stored = metadata.header.dtype;
+        size_t element_count = metadata.header.element_count;
+        data->data_offset = metadata.header.data_offset;
+        data->header_flags = metadata.header.flags;
+        ufo_bin_metadata_free(&metadata);
+
+        if (data->header_flags & UFO_BIN_TILED) {
+            __discard_source_and_die(source, data, dimensions, path,
+                                     "File %s holds a tiled matrix, open it with ufo_bin.\n", path);
+        }
+
+        if (storage != 0 && storage != stored) {
+            __discard_source_and_die(source, data, dimensions, path,
+                                     "File %s contains %s elements, but %s storage was requested.\n",
+                                     path, ufo_bin_dtype_name(stored) ? ufo_bin_dtype_name(stored) : "unknown",
+                                     ufo_bin_dtype_name(storage));
+        }
+        if (!__storage_compatible(stored, type)) {
+            __discard_source_and_die(source, data, dimensions, path,
+                                     "File %s contains %s elements, which cannot be read as %s.\n",
+                                     path, ufo_bin_dtype_name(stored) ? ufo_bin_dtype_name(stored) : "unknown",
+                                     type2char(type));
+        }
+        data->storage = stored;
+        data->storage_size = ufo_bin_dtype_size(stored);
+
+        if (data->data_offset > data->file_size
+            || (data->file_size - data->data_offset) / data->storage_size < element_count) {
+            __discard_source_and_die(source, data, dimensions, path,
+                                     "File %s is shorter than its header says.\n", path);
+        }
+        // Anything after the payload is not part of the vector.
+        data->file_size = data->data_offset + element_count * data->storage_size;
+        source->vector_size = element_count;
+
+        if (dimensions != NULL) {
+            size_t product = 1;
+            for (size_t i = 0; i < dimensions_length; i++) {
+                product *= dimensions[i];
+            }
+            if (product != element_count) {
+                __discard_source_and_die(source, data, dimensions, path,
+                                         "Dimensions do not match the %li elements in file %s.\n", element_count, path);
+            }
+        }
+    } else if (status == UFO_BIN_NO_HEADER) {
+        // Plain binary file: the length is inferred from the file size.
+        data->data_offset = 0;
+        data->header_flags = 0;
+        data->storage = storage != 0 ? storage : ufo_bin_dtype_from_sexptype(type);
+        if (!__storage_compatible(data->storage, type)) {
+            __discard_source_and_die(source, data, dimensions, path,
+                                     "Vectors of type %s cannot be stored as %s.\n",
+                                     type2char(type), ufo_bin_dtype_name(data->storage));
+        }
+        data->storage_size = ufo_bin_dtype_size(data->storage);
+        if (data->file_size % data->storage_size != 0) {
+            __discard_source_and_die(source, data, dimensions, path,
+                                     "File size not divisible by element size.\n");
+        }
+        source->vector_size = data->file_size / data->storage_size;
+    } else {
+        __discard_source_and_die(source, data, dimensions, path,
+                                 "Cannot read header of file %s: %s.\n", path, ufo_bin_status_message(status));
+    }
+
     source->dimensions = dimensions;
     source->dimensions_length = dimensions_length;
     source->read_only = read_only;
@@ -72,78 +397,466 @@ ufo_source_t* __make_source_or_die(ufo_vector_type_t type, const char *path, int
     data->vector_size = source->vector_size;
     data->element_size = source->element_size;
 
-    data->file_handle = __open_file_or_die(path);
-    data->file_cursor = 0;
+    data->io_mode = io_mode;
+
+    if (io_mode == UFO_IO_MMAP) {
+        // Map the file once, every populate is then just a memcpy.
+        data->mapping_size = data->file_size - data->data_offset;
+        data->mapping = __map_file(data->file_descriptor, data->data_offset, data->mapping_size, advice);
+        if (data->mapping == MAP_FAILED) {
+            __discard_source_and_die(source, data, dimensions, path, "Could not map file.\n");
+        }
+    } else {
+        data->mapping = NULL;
+        data->mapping_size = 0;
+    }
+
+    data->writeback_queue = NULL;
+    if (data->write_file_descriptor >= 0) {
+        data->writeback_queue = writeback_queue_new(&__write_range_to_file, data,
+                                                    data->element_size, WRITEBACK_DEFAULT_BUDGET);
+        if (data->writeback_queue == NULL) {
+            UFO_WARN("Cannot start writeback thread for %s, writing back synchronously.\n", path);
+        }
+    }
+
+    data->prefetch_depth = prefetch_depth;
+    data->expected_start = 0;
+    data->prefetcher = NULL;
+    if (io_mode == UFO_IO_READ && prefetch_depth > 0) {
+        data->prefetcher = prefetcher_new(&__read_range_through_queue, data,
+                                          data->element_size, data->vector_size,
+                                          prefetch_depth);
+        if (data->prefetcher == NULL) {
+            UFO_WARN("Cannot start prefetcher for %s, reading without prefetching.\n", path);
+        }
+    }
 
     return source;
 }
 
-SEXP __make_vector(ufo_vector_type_t type, SEXP sexp, SEXP/*LGLSXP*/ read_only_sexp, SEXP/*INTSXP*/ min_load_count_sexp) {
+SEXP __make_vector(ufo_vector_type_t type, SEXP sexp, SEXP/*LGLSXP*/ read_only_sexp, SEXP/*INTSXP*/ min_load_count_sexp, SEXP/*STRSXP*/ io_sexp, SEXP/*STRSXP*/ advice_sexp, SEXP/*INTSXP*/ prefetch_sexp, SEXP/*STRSXP*/ storage_sexp) {
     const char *path = __extract_path_or_die(sexp);
     int32_t min_load_count = __extract_int_or_die(min_load_count_sexp);
     bool read_only = __extract_boolean_or_die(read_only_sexp);
-    ufo_source_t *source = __make_source_or_die(type, path, NULL, 0, read_only, min_load_count);
-    ufo_new_t ufo_new = (ufo_new_t) R_GetCCallable("ufos", "ufo_new");
-    return ufo_new(source);
+    ufo_io_mode_t io_mode = __extract_io_mode_or_die(io_sexp);
+    int advice = __extract_advice_or_die(advice_sexp);
+    int32_t prefetch_depth = __extract_prefetch_depth_or_die(prefetch_sexp);
+    uint32_t storage = __extract_storage_or_die(storage_sexp);
+    ufo_source_t *source = __make_source_or_die(type, path, NULL, 0, read_only, min_load_count, io_mode, advice, prefetch_depth, storage);
+    return __new_file_vector(source);
+}
+
+SEXP ufo_vectors_intsxp_bin(SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only_sexp, SEXP/*INTSXP*/ min_load_count_sexp, SEXP/*STRSXP*/ io_sexp, SEXP/*STRSXP*/ advice_sexp, SEXP/*INTSXP*/ prefetch_sexp, SEXP/*STRSXP*/ storage_sexp) {
+    return __make_vector(UFO_INT, path, read_only_sexp, min_load_count_sexp, io_sexp, advice_sexp, prefetch_sexp, storage_sexp);
+}
+
+SEXP ufo_vectors_realsxp_bin(SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only_sexp, SEXP/*INTSXP*/ min_load_count_sexp, SEXP/*STRSXP*/ io_sexp, SEXP/*STRSXP*/ advice_sexp, SEXP/*INTSXP*/ prefetch_sexp, SEXP/*STRSXP*/ storage_sexp) {
+    return __make_vector(UFO_REAL, path, read_only_sexp, min_load_count_sexp, io_sexp, advice_sexp, prefetch_sexp, storage_sexp);
 }
 
-SEXP ufo_vectors_intsxp_bin(SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only_sexp, SEXP/*INTSXP*/ min_load_count_sexp) {
-    return __make_vector(UFO_INT, path, read_only_sexp, min_load_count_sexp);
+SEXP ufo_vectors_cplxsxp_bin(SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only_sexp, SEXP/*INTSXP*/ min_load_count_sexp, SEXP/*STRSXP*/ io_sexp, SEXP/*STRSXP*/ advice_sexp, SEXP/*INTSXP*/ prefetch_sexp, SEXP/*STRSXP*/ storage_sexp) {
+    return __make_vector(UFO_CPLX, path, read_only_sexp, min_load_count_sexp, io_sexp, advice_sexp, prefetch_sexp, storage_sexp);
 }
 
-SEXP ufo_vectors_realsxp_bin(SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only_sexp, SEXP/*INTSXP*/ min_load_count_sexp) {
-    return __make_vector(UFO_REAL, path, read_only_sexp, min_load_count_sexp);
+SEXP ufo_vectors_lglsxp_bin(SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only_sexp, SEXP/*INTSXP*/ min_load_count_sexp, SEXP/*STRSXP*/ io_sexp, SEXP/*STRSXP*/ advice_sexp, SEXP/*INTSXP*/ prefetch_sexp, SEXP/*STRSXP*/ storage_sexp) {
+    return __make_vector(UFO_LGL, path, read_only_sexp, min_load_count_sexp, io_sexp, advice_sexp, prefetch_sexp, storage_sexp);
 }
 
-SEXP ufo_vectors_cplxsxp_bin(SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only_sexp, SEXP/*INTSXP*/ min_load_count_sexp) {
-    return __make_vector(UFO_CPLX, path, read_only_sexp, min_load_count_sexp);
+SEXP ufo_vectors_rawsxp_bin(SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only_sexp, SEXP/*INTSXP*/ min_load_count_sexp, SEXP/*STRSXP*/ io_sexp, SEXP/*STRSXP*/ advice_sexp, SEXP/*INTSXP*/ prefetch_sexp, SEXP/*STRSXP*/ storage_sexp) {
+    return __make_vector(UFO_RAW, path, read_only_sexp, min_load_count_sexp, io_sexp, advice_sexp, prefetch_sexp, storage_sexp);
 }
 
-SEXP ufo_vectors_lglsxp_bin(SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only_sexp, SEXP/*INTSXP*/ min_load_count_sexp) {
-    return __make_vector(UFO_LGL, path, read_only_sexp, min_load_count_sexp);
+SEXP/*NILSXP*/ ufo_store_bin(SEXP/*STRSXP*/ _path, SEXP vector, SEXP/*LGLSXP*/ header_sexp, SEXP/*INTSXP*/ chunk_length_sexp, SEXP/*STRSXP*/ storage_sexp, SEXP/*INTSXP*/ min_load_count_sexp, SEXP/*LGLSXP*/ atomic_sexp) {
+    bool header = __extract_boolean_or_die(header_sexp);
+    uint32_t storage = __extract_storage_or_die(storage_sexp);
+    bool atomic = __extract_boolean_or_die(atomic_sexp);
+
+    int32_t chunk_length = __extract_int_or_die(chunk_length_sexp);
+    if (chunk_length < 0) {
+        Rf_error("Chunk length must not be negative.\n");
+    }
+
+    int32_t min_load_count = __extract_int_or_die(min_load_count_sexp);
+    if (min_load_count < 0) {
+        Rf_error("Window length must not be negative.\n");
+    }
+
+    int type = TYPEOF(vector);
+    if (storage == 0) {
+        storage = ufo_bin_dtype_from_sexptype(type);
+    }
+    if (storage == 0 || !__storage_compatible(storage, type)) {
+        Rf_error("Vectors of type %s cannot be stored as %s.\n",
+                 type2char(type), storage ? ufo_bin_dtype_name(storage) : "binary");
+    }
+
+    size_t element_count = XLENGTH(vector);
+    int64_t *dimensions = NULL;
+    uint32_t dimensions_length = 0;
+    if (header) {
+        SEXP/*INTSXP*/ dim = Rf_getAttrib(vector, R_DimSymbol);
+        dimensions_length = (dim == R_NilValue) ? 1 : LENGTH(dim);
+        dimensions = (int64_t *) R_alloc(dimensions_length, sizeof(int64_t));
+        if (dim == R_NilValue) {
+            dimensions[0] = element_count;
+        } else {
+            for (uint32_t i = 0; i < dimensions_length; i++) {
+                dimensions[i] = INTEGER_ELT(dim, i);
+            }
+        }
+    }
+
+    // For UFOs this does not load anything yet, the data is only touched
+    // window by window as it is written out.
+    const unsigned char *bytes = (const unsigned char *) DATAPTR_RO(vector);
+    const char *path = __extract_path_or_die(_path);
+    __store_bytes_or_die(path, storage, type, element_count, header, dimensions, dimensions_length,
+                         chunk_length, min_load_count, atomic, bytes);
+    return R_NilValue;
 }
 
-SEXP ufo_vectors_rawsxp_bin(SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only_sexp, SEXP/*INTSXP*/ min_load_count_sexp) {
-    return __make_vector(UFO_RAW, path, read_only_sexp, min_load_count_sexp);
+// Takes over the path. Everything that can go wrong with the file is checked
+// before anything is allocated, so that raising an error leaks nothing.
+SEXP __make_tiled_matrix_or_die(int type, const char *path, const ufo_bin_header_t *header,
+                                int64_t rows, int64_t cols, uint64_t payload_size,
+                                bool read_only, int32_t min_load_count) {
+    const char *problem = NULL;
+    struct stat file_info;
+    int file_descriptor = -1;
+    if (rows < 0 || cols < 0 || rows > INT_MAX || cols > INT_MAX
+        || (uint64_t) rows * (uint64_t) cols != header->element_count) {
+        problem = "has dimensions that do not match its length";
+    } else if ((file_descriptor = open(path, O_RDONLY)) < 0) {
+        problem = "cannot be opened";
+    } else if (fstat(file_descriptor, &file_info) != 0) {
+        problem = "cannot be read";
+    } else if ((uint64_t) file_info.st_size < header->data_offset + payload_size) {
+        problem = "is shorter than its header says";
+    }
+    if (problem != NULL) {
+        char message[1024];
+        snprintf(message, sizeof(message), "File %s %s.\n", path, problem);
+        if (file_descriptor >= 0) {
+            close(file_descriptor);
+        }
+        free((char *) path);
+        Rf_error("%s", message);
+    }
+
+    // Enough tiles for two columns of tiles, so that walking the matrix
+    // column by column reads every tile once, within the memory limit.
+    size_t element_size = __get_element_size(type);
+    size_t tiles_down = (rows + header->tile_rows - 1) / header->tile_rows;
+    size_t tile_bytes = header->tile_rows * header->tile_cols * element_size;
+    size_t slot_count = 2 * tiles_down;
+    if (slot_count * tile_bytes > UFO_TILE_CACHE_BYTES) {
+        slot_count = UFO_TILE_CACHE_BYTES / tile_bytes;
+    }
+
+    ufo_tiled_source_data_t *data = (ufo_tiled_source_data_t*) malloc(sizeof(ufo_tiled_source_data_t));
+    ufo_source_t* source = (ufo_source_t*) malloc(sizeof(ufo_source_t));
+    int *dimensions = (int *) malloc(sizeof(int) * 2);
+    tile_cache_t *cache = tile_cache_new(slot_count > 0 ? slot_count : 1, tile_bytes);
+    if (data == NULL || source == NULL || dimensions == NULL || cache == NULL) {
+        if (cache != NULL) {
+            tile_cache_free(cache);
+        }
+        free(dimensions);
+        free(source);
+        free(data);
+        free((char *) path);
+        close(file_descriptor);
+        Rf_error("Cannot allocate a tiled matrix source.\n");
+    }
+    dimensions[0] = (int) rows;
+    dimensions[1] = (int) cols;
+
+    data->path = path;
+    data->vector_type = type;
+    data->element_size = element_size;
+    data->vector_size = header->element_count;
+    data->storage = header->dtype;
+    data->storage_size = header->element_size;
+    data->header_flags = header->flags;
+    data->data_offset = header->data_offset;
+    data->rows = dimensions[0];
+    data->cols = dimensions[1];
+    data->tile_rows = header->tile_rows;
+    data->tile_cols = header->tile_cols;
+    data->tiles_down = tiles_down;
+    data->cache = cache;
+
+    data->file_descriptor = file_descriptor;
+    data->write_file_descriptor = read_only ? -1 : open(path, O_RDWR);
+    if (!read_only && data->write_file_descriptor < 0) {
+        UFO_WARN("File %s cannot be opened for writing, changes will not be written back.\n", path);
+    }
+
+    source->population_function = &__load_from_tiles;
+    source->writeback_function = &__writeback_tiles;
+    source->destructor_function = &__destroy_tiles;
+    source->data = (void*) data;
+    source->vector_type = type;
+    source->element_size = data->element_size;
+    source->vector_size = data->vector_size;
+    source->dimensions = dimensions;
+    source->dimensions_length = 2;
+    source->read_only = read_only;
+    source->min_load_count = __select_min_load_count(min_load_count, source->element_size);
+
+    ufo_new_t ufo_new = (ufo_new_t) R_GetCCallable("ufos", "ufo_new_multidim");
+    SEXP result = ufo_new(source);
+    __register_tiled_source(DATAPTR_RO(result), data);
+    return result;
 }
 
-SEXP/*NILSXP*/ ufo_store_bin(SEXP/*STRSXP*/ _path, SEXP vector) {
-    __write_bytes_to_disk(__extract_path_or_die(_path),
-                          Rf_length(vector) * __get_element_size(TYPEOF(vector)),
-                          (const char *) DATAPTR_RO(vector));
+SEXP/*NILSXP*/ ufo_store_tiled_bin(SEXP/*STRSXP*/ path_sexp, SEXP matrix, SEXP/*INTSXP*/ tile_rows_sexp, SEXP/*INTSXP*/ tile_cols_sexp, SEXP/*STRSXP*/ storage_sexp) {
+    int32_t tile_rows = __extract_int_or_die(tile_rows_sexp);
+    int32_t tile_cols = __extract_int_or_die(tile_cols_sexp);
+    uint32_t storage = __extract_storage_or_die(storage_sexp);
+
+    if (tile_rows <= 0 || tile_cols <= 0) {
+        Rf_error("Tile dimensions must be positive.\n");
+    }
+
+    SEXP/*INTSXP*/ dim = Rf_getAttrib(matrix, R_DimSymbol);
+    if (dim == R_NilValue || LENGTH(dim) != 2) {
+        Rf_error("Only matrices can be stored in tiles.\n");
+    }
+
+    int type = TYPEOF(matrix);
+    if (storage == 0) {
+        storage = ufo_bin_dtype_from_sexptype(type);
+    }
+    if (storage == 0 || !__storage_compatible(storage, type)) {
+        Rf_error("Vectors of type %s cannot be stored as %s.\n",
+                 type2char(type), storage ? ufo_bin_dtype_name(storage) : "binary");
+    }
+
+    // The path is extracted last, so the checks above have nothing to free.
+    const char *path = __extract_path_or_die(path_sexp);
+
+    // As in ufo_store_bin, a UFO is only populated as its tiles are written.
+    const unsigned char *bytes = (const unsigned char *) DATAPTR_RO(matrix);
+    __store_tiles_or_die(path, storage, type, INTEGER_ELT(dim, 0), INTEGER_ELT(dim, 1),
+                         tile_rows, tile_cols, bytes);
     return R_NilValue;
 }
 
-// TODO I think we should remove this and assign dimensions to a vector in R.
-SEXP __make_matrix(ufo_vector_type_t type, SEXP/*STRSXP*/ path_sexp, SEXP/*INTSXP*/ rows, SEXP/*INTSXP*/ cols, SEXP/*LGLSXP*/ read_only_sexp, SEXP/*INTSXP*/ min_load_count_sexp) {
+SEXP ufo_bin(SEXP/*STRSXP*/ path_sexp, SEXP/*LGLSXP*/ read_only_sexp, SEXP/*INTSXP*/ min_load_count_sexp, SEXP/*STRSXP*/ io_sexp, SEXP/*STRSXP*/ advice_sexp, SEXP/*INTSXP*/ prefetch_sexp) {
+    bool read_only = __extract_boolean_or_die(read_only_sexp);
+    int32_t min_load_count = __extract_int_or_die(min_load_count_sexp);
+    ufo_io_mode_t io_mode = __extract_io_mode_or_die(io_sexp);
+    int advice = __extract_advice_or_die(advice_sexp);
+    int32_t prefetch_depth = __extract_prefetch_depth_or_die(prefetch_sexp);
+    const char *path = __extract_path_or_die(path_sexp);
+
+    // Peek at the header to find out what kind of vector to make.
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        __discard_source_and_die(NULL, NULL, NULL, path, "Could not open file %s.\n", path);
+    }
+    ufo_bin_metadata_t metadata;
+    ufo_bin_status_t status = ufo_bin_read_metadata(fd, &metadata);
+    close(fd);
+    if (status != UFO_BIN_OK) {
+        ufo_bin_metadata_free(&metadata);
+        __discard_source_and_die(NULL, NULL, NULL, path, "Cannot read header of file %s: %s.\n",
+                                 path, ufo_bin_status_message(status));
+    }
+
+    int type = (metadata.header.flags & UFO_BIN_LOGICAL)
+             ? LGLSXP : ufo_bin_sexptype_from_dtype(metadata.header.dtype);
+    if (type == 0) {
+        uint32_t dtype = metadata.header.dtype;
+        ufo_bin_metadata_free(&metadata);
+        __discard_source_and_die(NULL, NULL, NULL, path, "File %s contains elements of unknown type %i.\n",
+                                 path, dtype);
+    }
+
+    // A plain vector can be a long vector, but R dimensions are ints.
+    for (uint32_t i = 0; metadata.header.dimensions_length > 1 && i < metadata.header.dimensions_length; i++) {
+        if (metadata.dimensions[i] < 0 || metadata.dimensions[i] > INT_MAX) {
+            int64_t dimension = metadata.dimensions[i];
+            ufo_bin_metadata_free(&metadata);
+            __discard_source_and_die(NULL, NULL, NULL, path,
+                                     "File %s has a dimension of %lld, R dimensions go up to %i.\n",
+                                     path, (long long) dimension, INT_MAX);
+        }
+    }
+
+    if (metadata.header.flags & UFO_BIN_TILED) {
+        // Tiles are read through the tile cache, not the file mapping or the
+        // prefetcher, so none of these would have any effect.
+        if (io_mode != UFO_IO_READ || advice != MADV_NORMAL || prefetch_depth != 0) {
+            ufo_bin_metadata_free(&metadata);
+            __discard_source_and_die(NULL, NULL, NULL, path,
+                                     "File %s holds a tiled matrix, io, advice and prefetch cannot be set for it.\n", path);
+        }
+        ufo_bin_header_t header = metadata.header;
+        int64_t rows = metadata.dimensions[0];
+        int64_t cols = metadata.dimensions[1];
+        uint64_t payload_size = ufo_bin_payload_size(&metadata);
+        ufo_bin_metadata_free(&metadata);
+        return __make_tiled_matrix_or_die(type, path, &header, rows, cols, payload_size,
+                                          read_only, min_load_count);
+    }
+
+    int *dimensions = NULL;
+    size_t dimensions_length = 0;
+    if (metadata.header.dimensions_length > 1) {
+        dimensions_length = metadata.header.dimensions_length;
+        dimensions = (int *) malloc(sizeof(int) * dimensions_length);
+        if (dimensions == NULL) {
+            ufo_bin_metadata_free(&metadata);
+            __discard_source_and_die(NULL, NULL, NULL, path, "Cannot allocate dimensions");
+        }
+        for (size_t i = 0; i < dimensions_length; i++) {
+            dimensions[i] = (int) metadata.dimensions[i];
+        }
+    }
+    ufo_bin_metadata_free(&metadata);
+
+    ufo_source_t *source = __make_source_or_die(type, path, dimensions, dimensions_length, read_only, min_load_count, io_mode, advice, prefetch_depth, 0);
+    return __new_file_vector(source);
+}
+
+SEXP/*VECSXP*/ ufo_bin_header(SEXP/*STRSXP*/ path_sexp) {
     const char *path = __extract_path_or_die(path_sexp);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        __discard_source_and_die(NULL, NULL, NULL, path, "Could not open file %s.\n", path);
+    }
+    ufo_bin_metadata_t metadata;
+    ufo_bin_status_t status = ufo_bin_read_metadata(fd, &metadata);
+    close(fd);
+    free((char *) path);
+    if (status == UFO_BIN_NO_HEADER) {
+        return R_NilValue;
+    }
+    if (status != UFO_BIN_OK) {
+        ufo_bin_metadata_free(&metadata);
+        Rf_error("Cannot read header: %s.\n", ufo_bin_status_message(status));
+    }
+
+    const ufo_bin_header_t *header = &metadata.header;
+    int type = (header->flags & UFO_BIN_LOGICAL) ? LGLSXP : ufo_bin_sexptype_from_dtype(header->dtype);
+    const char *storage = ufo_bin_dtype_name(header->dtype);
+
+    const char *names[] = { "version", "type", "element_size", "length", "dim",
+                            "data_offset", "has_na", "chunk_length", "chunk_min", "chunk_max",
+                            "storage", "tile_dim", "" };
+    SEXP/*VECSXP*/ result = PROTECT(Rf_mkNamed(VECSXP, names));
+
+    SET_VECTOR_ELT(result, 0, Rf_ScalarInteger(header->version));
+    SET_VECTOR_ELT(result, 1, Rf_mkString(type ? type2char(type) : "unknown"));
+    SET_VECTOR_ELT(result, 2, Rf_ScalarInteger(header->element_size));
+    SET_VECTOR_ELT(result, 3, Rf_ScalarReal((double) header->element_count));
+
+    SEXP/*REALSXP*/ dim = Rf_allocVector(REALSXP, header->dimensions_length);
+    SET_VECTOR_ELT(result, 4, dim);
+    for (uint32_t i = 0; i < header->dimensions_length; i++) {
+        SET_REAL_ELT(dim, i, (double) metadata.dimensions[i]);
+    }
+
+    SET_VECTOR_ELT(result, 5, Rf_ScalarReal((double) header->data_offset));
+    SET_VECTOR_ELT(result, 6, Rf_ScalarLogical((header->flags & UFO_BIN_HAS_NA) != 0));
+
+    if (header->flags & UFO_BIN_HAS_STATS) {
+        SET_VECTOR_ELT(result, 7, Rf_ScalarReal((double) header->chunk_length));
+        SEXP/*REALSXP*/ chunk_min = Rf_allocVector(REALSXP, header->chunk_count);
+        SET_VECTOR_ELT(result, 8, chunk_min);
+        SEXP/*REALSXP*/ chunk_max = Rf_allocVector(REALSXP, header->chunk_count);
+        SET_VECTOR_ELT(result, 9, chunk_max);
+        for (uint64_t i = 0; i < header->chunk_count; i++) {
+            // Chunks without any values are reported as NA.
+            SET_REAL_ELT(chunk_min, i, ISNAN(metadata.chunk_min[i]) ? NA_REAL : metadata.chunk_min[i]);
+            SET_REAL_ELT(chunk_max, i, ISNAN(metadata.chunk_max[i]) ? NA_REAL : metadata.chunk_max[i]);
+        }
+    }
+
+    SET_VECTOR_ELT(result, 10, Rf_mkString(storage ? storage : "unknown"));
+
+    if (header->flags & UFO_BIN_TILED) {
+        SEXP/*REALSXP*/ tile_dim = Rf_allocVector(REALSXP, 2);
+        SET_VECTOR_ELT(result, 11, tile_dim);
+        SET_REAL_ELT(tile_dim, 0, (double) header->tile_rows);
+        SET_REAL_ELT(tile_dim, 1, (double) header->tile_cols);
+    }
+
+    ufo_bin_metadata_free(&metadata);
+    UNPROTECT(1);
+    return result;
+}
+
+// TODO I think we should remove this and assign dimensions to a vector in R.
+SEXP __make_matrix(ufo_vector_type_t type, SEXP/*STRSXP*/ path_sexp, SEXP/*INTSXP*/ rows, SEXP/*INTSXP*/ cols, SEXP/*LGLSXP*/ read_only_sexp, SEXP/*INTSXP*/ min_load_count_sexp, SEXP/*STRSXP*/ io_sexp, SEXP/*STRSXP*/ advice_sexp, SEXP/*INTSXP*/ prefetch_sexp, SEXP/*STRSXP*/ storage_sexp) {
     bool read_only = __extract_boolean_or_die(read_only_sexp);
     int32_t min_load_count = __extract_int_or_die(min_load_count_sexp);
+    ufo_io_mode_t io_mode = __extract_io_mode_or_die(io_sexp);
+    int advice = __extract_advice_or_die(advice_sexp);
+    int32_t prefetch_depth = __extract_prefetch_depth_or_die(prefetch_sexp);
+    uint32_t storage = __extract_storage_or_die(storage_sexp);
+    int row_count = __extract_int_or_die(rows);
+    int col_count = __extract_int_or_die(cols);
+    if (row_count < 0 || col_count < 0) {
+        Rf_error("Matrix dimensions must not be negative.\n");
+    }
+    const char *path = __extract_path_or_die(path_sexp);
     int *dimensions = (int *) malloc(sizeof(int) * 2);
-    dimensions[0] = __extract_int_or_die(rows);
-    dimensions[1] = __extract_int_or_die(cols);
-    ufo_source_t *source = __make_source_or_die(type, path, dimensions, 2, read_only, min_load_count);
-    ufo_new_t ufo_new = (ufo_new_t) R_GetCCallable("ufos", "ufo_new_multidim");
+    if (dimensions == NULL) {
+        __discard_source_and_die(NULL, NULL, NULL, path, "Cannot allocate dimensions");
+    }
+    dimensions[0] = row_count;
+    dimensions[1] = col_count;
+    ufo_source_t *source = __make_source_or_die(type, path, dimensions, 2, read_only, min_load_count, io_mode, advice, prefetch_depth, storage);
+    return __new_file_vector(source);
+}
 
-    return ufo_new(source);
+SEXP ufo_matrix_intsxp_bin(SEXP/*STRSXP*/ path, SEXP/*INTSXP*/ rows, SEXP/*INTSXP*/ cols, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count, SEXP/*STRSXP*/ io, SEXP/*STRSXP*/ advice, SEXP/*INTSXP*/ prefetch, SEXP/*STRSXP*/ storage) {
+    return __make_matrix(UFO_INT, path, rows, cols, read_only, min_load_count, io, advice, prefetch, storage);
 }
 
-SEXP ufo_matrix_intsxp_bin(SEXP/*STRSXP*/ path, SEXP/*INTSXP*/ rows, SEXP/*INTSXP*/ cols, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count) {
-    return __make_matrix(UFO_INT, path, rows, cols, read_only, min_load_count);
+SEXP ufo_matrix_realsxp_bin(SEXP/*STRSXP*/ path, SEXP/*INTSXP*/ rows, SEXP/*INTSXP*/ cols, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count, SEXP/*STRSXP*/ io, SEXP/*STRSXP*/ advice, SEXP/*INTSXP*/ prefetch, SEXP/*STRSXP*/ storage) {
+    return __make_matrix(UFO_REAL, path, rows, cols, read_only, min_load_count, io, advice, prefetch, storage);
 }
 
-SEXP ufo_matrix_realsxp_bin(SEXP/*STRSXP*/ path, SEXP/*INTSXP*/ rows, SEXP/*INTSXP*/ cols, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count) {
-    return __make_matrix(UFO_REAL, path, rows, cols, read_only, min_load_count);
+SEXP ufo_matrix_cplxsxp_bin(SEXP/*STRSXP*/ path, SEXP/*INTSXP*/ rows, SEXP/*INTSXP*/ cols, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count, SEXP/*STRSXP*/ io, SEXP/*STRSXP*/ advice, SEXP/*INTSXP*/ prefetch, SEXP/*STRSXP*/ storage) {
+    return __make_matrix(UFO_CPLX, path, rows, cols, read_only, min_load_count, io, advice, prefetch, storage);
 }
 
-SEXP ufo_matrix_cplxsxp_bin(SEXP/*STRSXP*/ path, SEXP/*INTSXP*/ rows, SEXP/*INTSXP*/ cols, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count) {
-    return __make_matrix(UFO_CPLX, path, rows, cols, read_only, min_load_count);
+SEXP ufo_matrix_lglsxp_bin(SEXP/*STRSXP*/ path, SEXP/*INTSXP*/ rows, SEXP/*INTSXP*/ cols, SEXP/*LGLSXP*/ read_only, SEXP/*LGLSXP*/ min_load_count, SEXP/*STRSXP*/ io, SEXP/*STRSXP*/ advice, SEXP/*INTSXP*/ prefetch, SEXP/*STRSXP*/ storage) {
+    return __make_matrix(UFO_LGL, path, rows, cols, read_only, min_load_count, io, advice, prefetch, storage);
 }
 
-SEXP ufo_matrix_lglsxp_bin(SEXP/*STRSXP*/ path, SEXP/*INTSXP*/ rows, SEXP/*INTSXP*/ cols, SEXP/*LGLSXP*/ read_only, SEXP/*LGLSXP*/ min_load_count) {
-    return __make_matrix(UFO_LGL, path, rows, cols, read_only, min_load_count);
+SEXP ufo_matrix_rawsxp_bin(SEXP/*STRSXP*/ path, SEXP/*INTSXP*/ rows, SEXP/*INTSXP*/ cols, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count, SEXP/*STRSXP*/ io, SEXP/*STRSXP*/ advice, SEXP/*INTSXP*/ prefetch, SEXP/*STRSXP*/ storage) {
+    return __make_matrix(UFO_RAW, path, rows, cols, read_only, min_load_count, io, advice, prefetch, storage);
 }
 
-SEXP ufo_matrix_rawsxp_bin(SEXP/*STRSXP*/ path, SEXP/*INTSXP*/ rows, SEXP/*INTSXP*/ cols, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count) {
-    return __make_matrix(UFO_RAW, path, rows, cols, read_only, min_load_count);
+// The UFO core has no way to write back chunks that are still resident, so
+// this only waits for the ones it already handed over. Tiled matrices are
+// written back synchronously, tile by tile, so there is nothing to wait for.
+SEXP/*NILSXP*/ ufo_drain_writeback(SEXP vector, SEXP/*LGLSXP*/ sync_sexp) {
+    bool sync = __extract_boolean_or_die(sync_sexp);
+    file_source_entry_t entry = __find_file_source_or_die(vector);
+    ufo_file_source_data_t *data = entry.data;
+    if (data != NULL && data->writeback_queue != NULL) {
+        int32_t failure = writeback_queue_flush(data->writeback_queue);
+        if (failure != 0) {
+            Rf_error("Error writing back to file %s: %s.\n", data->path, __write_error_message(failure));
+        }
+    }
+    if (!sync) {
+        return R_NilValue;
+    }
+    const char *path = data != NULL ? data->path : entry.tiles->path;
+    int write_file_descriptor = data != NULL
+                              ? data->write_file_descriptor
+                              : entry.tiles->write_file_descriptor;
+    if (write_file_descriptor >= 0 && fdatasync(write_file_descriptor) != 0) {
+        Rf_error("Error syncing file %s.\n", path);
+    }
+    return R_NilValue;
 }
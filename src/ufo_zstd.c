@@ -0,0 +1,104 @@
+#include "ufo_zstd.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define USE_RINTERNALS
+#include <R.h>
+#include <Rinternals.h>
+
+#include "../include/ufos.h"
+#include "helpers.h"
+#include "debug.h"
+
+#include "zstd/seekable.h"
+
+typedef struct {
+    SeekableZstd *zstd;
+    size_t element_width;
+} Zstd;
+
+int32_t Zstd_populate(void* user_data, uintptr_t start, uintptr_t end, unsigned char* target) {
+    Zstd *source = (Zstd *) user_data;
+    int32_t result = SeekableZstd_read(source->zstd, start * source->element_width, end * source->element_width, target);
+    if (result != 0) {
+        UFO_REPORT("UFO failed to read elements %li-%li from %s.\n", start, end, source->zstd->path);
+    }
+    return result;
+}
+
+void Zstd_free(void* data) {
+    Zstd *source = (Zstd *) data;
+    SeekableZstd_free(source->zstd);
+    free(source);
+}
+
+SEXP ufo_zstd(ufo_vector_type_t type, SEXP/*STRSXP*/ filename, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count) {
+
+    bool read_only_value = __extract_boolean_or_die(read_only);
+    int min_load_count_value = __extract_int_or_die(min_load_count);
+    const char *path = __extract_path_or_die(filename);
+    size_t element_size = __get_element_size(type);
+
+    const char *reason;
+    SeekableZstd *zstd = SeekableZstd_open(path, &reason);
+    if (zstd == NULL) {
+        Rf_error("UFO could not read %s: %s.\n", path, reason);
+    }
+    if (zstd->decompressed_size % element_size != 0) {
+        size_t decompressed_size = zstd->decompressed_size;
+        SeekableZstd_free(zstd);
+        Rf_error("UFO decompressed size of %s (%li bytes) is not a multiple of the element size (%li bytes).\n",
+                 path, decompressed_size, element_size);
+    }
+
+    Zstd *data = (Zstd *) malloc(sizeof(Zstd));
+    ufo_source_t* source = (ufo_source_t*) malloc(sizeof(ufo_source_t));
+    if (data == NULL || source == NULL) {
+        free(data);
+        free(source);
+        SeekableZstd_free(zstd);
+        Rf_error("UFO could not allocate the zstd source.\n");
+    }
+    data->zstd = zstd;
+    data->element_width = element_size;
+
+    // Element size and count metadata
+    source->vector_type = type;
+    source->element_size = element_size;
+    source->vector_size = zstd->decompressed_size / element_size;
+
+    // Behavior specification
+    source->data = (void*) data;
+    source->destructor_function = Zstd_free;
+    source->population_function = Zstd_populate;
+    source->writeback_function = NULL;
+
+    // Chunk-related parameters
+    source->read_only = read_only_value;
+    source->min_load_count = __select_min_load_count(min_load_count_value, source->element_size);
+
+    // Unused.
+    source->dimensions = NULL;
+    source->dimensions_length = 0;
+
+    ufo_new_t ufo_new = (ufo_new_t) R_GetCCallable("ufos", "ufo_new");
+    return ufo_new(source);
+}
+
+SEXP ufo_intsxp_zstd (SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count) {
+    return ufo_zstd(UFO_INT, path, read_only, min_load_count);
+}
+SEXP ufo_realsxp_zstd(SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count) {
+    return ufo_zstd(UFO_REAL, path, read_only, min_load_count);
+}
+SEXP ufo_rawsxp_zstd (SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count) {
+    return ufo_zstd(UFO_RAW, path, read_only, min_load_count);
+}
+SEXP ufo_cplxsxp_zstd(SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count) {
+    return ufo_zstd(UFO_CPLX, path, read_only, min_load_count);
+}
+SEXP ufo_lglsxp_zstd (SEXP/*STRSXP*/ path, SEXP/*LGLSXP*/ read_only, SEXP/*INTSXP*/ min_load_count) {
+    return ufo_zstd(UFO_LGL, path, read_only, min_load_count);
+}
@@ -0,0 +1,207 @@
+#include "seekable.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../debug.h"
+
+static uint32_t read_le32(const unsigned char *bytes) {
+    return (uint32_t) bytes[0]
+         | (uint32_t) bytes[1] << 8
+         | (uint32_t) bytes[2] << 16
+         | (uint32_t) bytes[3] << 24;
+}
+
+// Fills in the frame offsets from the seek table at the end of the archive.
+static const char *SeekableZstd_parse(SeekableZstd *zstd) {
+    const unsigned char *archive = zstd->archive;
+    size_t size = zstd->archive_size;
+    if (size < SEEKABLE_FOOTER_SIZE + 8) {
+        return "file is too short to hold a seek table";
+    }
+
+    const unsigned char *footer = archive + size - SEEKABLE_FOOTER_SIZE;
+    if (read_le32(footer + 5) != SEEKABLE_FOOTER_MAGIC) {
+        return "file has no seek table, compress it with a seekable zstd writer";
+    }
+    uint64_t frames = read_le32(footer);
+    uint8_t descriptor = footer[4];
+    size_t entry_size = (descriptor & SEEKABLE_CHECKSUM_FLAG) ? 12 : 8;
+
+    uint64_t table_size = 8 + frames * entry_size + SEEKABLE_FOOTER_SIZE;
+    if (table_size > size) {
+        return "seek table is larger than the file";
+    }
+    const unsigned char *table = archive + size - table_size;
+    if (read_le32(table) != SEEKABLE_SKIPPABLE_MAGIC || read_le32(table + 4) != table_size - 8) {
+        return "seek table frame is corrupt";
+    }
+
+    zstd->compressed_offset = (uint64_t *) malloc((frames + 1) * sizeof(uint64_t));
+    zstd->decompressed_offset = (uint64_t *) malloc((frames + 1) * sizeof(uint64_t));
+    if (zstd->compressed_offset == NULL || zstd->decompressed_offset == NULL) {
+        return "cannot allocate the seek table";
+    }
+
+    uint64_t compressed = 0, decompressed = 0, largest = 0;
+    for (uint64_t frame = 0; frame < frames; frame++) {
+        const unsigned char *entry = table + 8 + frame * entry_size;
+        uint32_t compressed_size = read_le32(entry);
+        uint32_t decompressed_size = read_le32(entry + 4);
+        zstd->compressed_offset[frame] = compressed;
+        zstd->decompressed_offset[frame] = decompressed;
+        compressed += compressed_size;
+        decompressed += decompressed_size;
+        if (decompressed_size > largest) {
+            largest = decompressed_size;
+        }
+    }
+    zstd->compressed_offset[frames] = compressed;
+    zstd->decompressed_offset[frames] = decompressed;
+    zstd->frames = frames;
+    zstd->decompressed_size = decompressed;
+
+    if (compressed + table_size != size) {
+        return "frames in the seek table do not add up to the file size";
+    }
+
+    zstd->frame_buffer = (char *) malloc(largest ? largest : 1);
+    if (zstd->frame_buffer == NULL) {
+        return "cannot allocate a buffer for the largest frame";
+    }
+    return NULL;
+}
+
+SeekableZstd *SeekableZstd_open(const char *path, const char **error) {
+    SeekableZstd *zstd = (SeekableZstd *) calloc(1, sizeof(SeekableZstd));
+    if (zstd == NULL) {
+        *error = "cannot allocate the source";
+        return NULL;
+    }
+    zstd->archive = MAP_FAILED;
+    pthread_mutex_init(&zstd->lock, NULL);
+
+    zstd->path = strdup(path);
+    int fd = open(path, O_RDONLY);
+    struct stat file_info;
+    if (zstd->path == NULL || fd < 0 || fstat(fd, &file_info) < 0 || file_info.st_size == 0) {
+        if (fd >= 0) close(fd);
+        SeekableZstd_free(zstd);
+        *error = "cannot open the file";
+        return NULL;
+    }
+    zstd->archive_size = file_info.st_size;
+    zstd->archive = (const unsigned char *) mmap(NULL, zstd->archive_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (zstd->archive == MAP_FAILED) {
+        SeekableZstd_free(zstd);
+        *error = "cannot map the file";
+        return NULL;
+    }
+
+    *error = SeekableZstd_parse(zstd);
+    if (*error != NULL) {
+        SeekableZstd_free(zstd);
+        return NULL;
+    }
+
+    zstd->context = ZSTD_createDCtx();
+    if (zstd->context == NULL) {
+        SeekableZstd_free(zstd);
+        *error = "cannot create a decompression context";
+        return NULL;
+    }
+    zstd->cached_frame = zstd->frames;
+
+    UFO_LOG("Seekable zstd file %s has %li frames, %li bytes decompressed\n",
+            path, zstd->frames, zstd->decompressed_size);
+    return zstd;
+}
+
+void SeekableZstd_free(SeekableZstd *zstd) {
+    if (zstd->archive != MAP_FAILED) {
+        munmap((void *) zstd->archive, zstd->archive_size);
+    }
+    ZSTD_freeDCtx(zstd->context);
+    pthread_mutex_destroy(&zstd->lock);
+    free(zstd->frame_buffer);
+    free(zstd->compressed_offset);
+    free(zstd->decompressed_offset);
+    free((void *) zstd->path);
+    free(zstd);
+}
+
+size_t SeekableZstd_find(const SeekableZstd *zstd, uint64_t offset) {
+    // Find the last frame that starts at or before the offset. Empty frames
+    // are skipped over, because the next frame starts at the same offset.
+    size_t low = 0, high = zstd->frames;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (zstd->decompressed_offset[middle] <= offset) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low == 0 || offset >= zstd->decompressed_offset[low]) {
+        return zstd->frames;
+    }
+    return low - 1;
+}
+
+// Decompresses the frame into the target, which must fit it exactly.
+static bool SeekableZstd_decompress(SeekableZstd *zstd, size_t frame, char *target) {
+    size_t compressed_size = zstd->compressed_offset[frame + 1] - zstd->compressed_offset[frame];
+    size_t decompressed_size = zstd->decompressed_offset[frame + 1] - zstd->decompressed_offset[frame];
+    size_t result = ZSTD_decompressDCtx(zstd->context, target, decompressed_size,
+                                        zstd->archive + zstd->compressed_offset[frame], compressed_size);
+    return !ZSTD_isError(result) && result == decompressed_size;
+}
+
+int32_t SeekableZstd_read(SeekableZstd *zstd, uintptr_t start, uintptr_t end, unsigned char *target) {
+    if (start > end || end > zstd->decompressed_size) {
+        return 1;
+    }
+
+    int32_t result = 0;
+    pthread_mutex_lock(&zstd->lock);
+    for (uintptr_t position = start; position < end;) {
+        size_t frame = SeekableZstd_find(zstd, position);
+        if (frame >= zstd->frames) {
+            result = 1;
+            break;
+        }
+
+        uint64_t frame_start = zstd->decompressed_offset[frame];
+        uint64_t frame_end = zstd->decompressed_offset[frame + 1];
+
+        // Frames that are needed whole go straight into the target.
+        if (frame_start == position && frame_end <= end && frame != zstd->cached_frame) {
+            if (!SeekableZstd_decompress(zstd, frame, (char *) target + (position - start))) {
+                result = -1;
+                break;
+            }
+            position = frame_end;
+            continue;
+        }
+
+        if (frame != zstd->cached_frame) {
+            zstd->cached_frame = zstd->frames;
+            if (!SeekableZstd_decompress(zstd, frame, zstd->frame_buffer)) {
+                result = -1;
+                break;
+            }
+            zstd->cached_frame = frame;
+        }
+
+        size_t length = (frame_end < end ? frame_end : end) - position;
+        memcpy(target + (position - start), zstd->frame_buffer + (position - frame_start), length);
+        position += length;
+    }
+    pthread_mutex_unlock(&zstd->lock);
+    return result;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include <zstd.h>
+
+// Zstandard seekable format: the data is cut into independent frames, and a
+// skippable frame at the end of the file lists the compressed and
+// decompressed size of each frame.
+//
+//   [frame 0][frame 1]...[frame n-1][seek table]
+//
+// The seek table is a skippable frame:
+//
+//   [magic 0x184D2A5E][u32 frame size]
+//   n x [u32 compressed size][u32 decompressed size][u32 checksum, optional]
+//   [u32 n][u8 descriptor, bit 7 = checksums present][u32 magic 0x8F92EAB1]
+//
+// All integers are little endian.
+#define SEEKABLE_SKIPPABLE_MAGIC 0x184D2A5EU
+#define SEEKABLE_FOOTER_MAGIC    0x8F92EAB1U
+#define SEEKABLE_FOOTER_SIZE     9
+#define SEEKABLE_CHECKSUM_FLAG   0x80
+
+typedef struct {
+    const char          *path;
+    const unsigned char *archive;              // the whole file, mapped
+    size_t               archive_size;
+    size_t               frames;
+    uint64_t            *compressed_offset;    // frames + 1 entries
+    uint64_t            *decompressed_offset;  // frames + 1 entries
+    size_t               decompressed_size;
+
+    // The most recently decompressed frame, since consecutive chunks tend
+    // to fall into the same frame.
+    pthread_mutex_t      lock;
+    ZSTD_DCtx           *context;
+    size_t               cached_frame;         // frames if none
+    char                *frame_buffer;         // fits the largest frame
+} SeekableZstd;
+
+// Reads the seek table of the file. Returns NULL and sets *error to a static
+// message if the file is not in the seekable format.
+SeekableZstd *SeekableZstd_open(const char *path, const char **error);
+void SeekableZstd_free(SeekableZstd *zstd);
+
+// Index of the frame holding the given decompressed byte, or the number of
+// frames if there is none.
+size_t SeekableZstd_find(const SeekableZstd *zstd, uint64_t offset);
+
+/**
+ * Copy the decompressed bytes [start, end) into target. Only the frames
+ * overlapping the range are read and decompressed. Does not call into R.
+ *
+ * @return 0 on success.
+ */
+int32_t SeekableZstd_read(SeekableZstd *zstd, uintptr_t start, uintptr_t end, unsigned char *target);